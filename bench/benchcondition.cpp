@@ -0,0 +1,101 @@
+#include "cpu.h"
+#include "fmt/format.h"
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace aavm;
+
+// the condition check as a switch, for comparison with the table
+static bool switch_passed(unsigned cond, std::uint32_t apsr) {
+  const auto n = (apsr & vm::FlagN) != 0;
+  const auto z = (apsr & vm::FlagZ) != 0;
+  const auto c = (apsr & vm::FlagC) != 0;
+  const auto v = (apsr & vm::FlagV) != 0;
+
+  switch (cond) {
+  case ir::Condition::EQ:
+    return z;
+  case ir::Condition::NE:
+    return !z;
+  case ir::Condition::CS:
+    return c;
+  case ir::Condition::CC:
+    return !c;
+  case ir::Condition::MI:
+    return n;
+  case ir::Condition::PL:
+    return !n;
+  case ir::Condition::VS:
+    return v;
+  case ir::Condition::VC:
+    return !v;
+  case ir::Condition::HI:
+    return c && !z;
+  case ir::Condition::LS:
+    return !c || z;
+  case ir::Condition::GE:
+    return n == v;
+  case ir::Condition::LT:
+    return n != v;
+  case ir::Condition::GT:
+    return !z && n == v;
+  case ir::Condition::LE:
+    return z || n != v;
+  default:
+    return true;
+  }
+}
+
+struct Check {
+  std::uint8_t cond;
+  std::uint32_t apsr;
+};
+
+template <typename Passed>
+static void measure(const char *name, const std::vector<Check> &checks,
+                    int rounds, Passed passed) {
+  auto taken = std::uint32_t{0};
+  const auto start = std::chrono::steady_clock::now();
+  for (auto round = 0; round < rounds; ++round) {
+    for (const auto &check : checks) {
+      // branch on the outcome, as an engine skipping the instruction would
+      if (passed(check.cond, check.apsr)) {
+        ++taken;
+      }
+    }
+  }
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  const auto count = static_cast<double>(checks.size()) * rounds;
+  fmt::print("{}: {} checks in {:.3f}s: {:.2f}ns/check ({} passed)\n", name,
+             count, elapsed.count(), elapsed.count() / count * 1e9, taken);
+}
+
+int main() {
+  constexpr auto check_count = std::size_t{1} << 16;
+  constexpr auto rounds = 1000;
+
+  // mostly AL, as in compiled code, with the rest spread over the conditions
+  // and flags at random
+  auto checks = std::vector<Check>(check_count);
+  auto rng = std::mt19937{42};
+  auto percent = std::uniform_int_distribution<int>{0, 99};
+  auto cond = std::uniform_int_distribution<unsigned>{ir::Condition::EQ,
+                                                      ir::Condition::LE};
+  auto nzcv = std::uniform_int_distribution<std::uint32_t>{0, 15};
+  for (auto &check : checks) {
+    check.cond = static_cast<std::uint8_t>(
+        percent(rng) < 80 ? unsigned{ir::Condition::AL} : cond(rng));
+    check.apsr = nzcv(rng) << 28;
+  }
+
+  measure("switch", checks, rounds, [](unsigned cond, std::uint32_t apsr) {
+    return switch_passed(cond, apsr);
+  });
+  measure("table", checks, rounds, [](unsigned cond, std::uint32_t apsr) {
+    return vm::condition_passed(cond, apsr);
+  });
+}
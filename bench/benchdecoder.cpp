@@ -0,0 +1,51 @@
+#include "decoder.h"
+#include "fmt/format.h"
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace aavm;
+
+// a mix of data processing, memory and branch encodings
+static constexpr std::uint32_t corpus[] = {
+    0xE2810001, 0xE0932183, 0xE0410352, 0x12610000, 0xE21008FF, 0xE0200461,
+    0xE1A00061, 0xE3C10003, 0xE3A004FF, 0xE1F00001, 0xE1A00021, 0xE1A00251,
+    0xE3010234, 0xE34A0BCD, 0xE3500001, 0xE1700001, 0xE3100102, 0xE1300211,
+    0xE0000291, 0xE0303291, 0xE0603291, 0xE0810392, 0xE0E10392, 0xE710F211,
+    0xE7CB021F, 0xE7CB0211, 0xE7A70251, 0xE6BF0F31, 0xE12FFF1E, 0xE5910004,
+    0xE4810004, 0xE7F10102, 0xE1D100B2, 0xE19100D2, 0xE92D4010, 0xE8BD8070,
+    0xEAFFFFFE, 0x0B000001, 0xE59F0000, 0x1AFFFFF0};
+
+int main() {
+  constexpr auto word_count = std::size_t{1} << 20;
+  constexpr auto rounds = 100;
+
+  auto words = std::vector<std::uint32_t>(word_count);
+  auto rng = std::mt19937{42};
+  auto pick = std::uniform_int_distribution<std::size_t>{
+      0, sizeof(corpus) / sizeof(corpus[0]) - 1};
+  for (auto &word : words) {
+    word = corpus[pick(rng)];
+  }
+
+  // decode into a buffer the size of a page of instructions, as a cache would
+  constexpr auto page_size = std::size_t{1024};
+  auto decoded = std::vector<vm::DecodedInstruction>(page_size);
+  auto checksum = std::uint32_t{0};
+  const auto start = std::chrono::steady_clock::now();
+  for (auto round = 0; round < rounds; ++round) {
+    for (auto i = std::size_t{0}; i < word_count; ++i) {
+      vm::decode(words[i], decoded[i % page_size]);
+    }
+    checksum += decoded[round % page_size].imm;
+  }
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  const auto count = static_cast<double>(word_count) * rounds;
+  fmt::print("decoded {} instructions in {:.3f}s: {:.1f}M instructions/s "
+             "(checksum {:08x})\n",
+             count, elapsed.count(), count / elapsed.count() / 1e6,
+             checksum);
+}
@@ -0,0 +1,69 @@
+#include "assembler.h"
+#include "farm.h"
+#include "fmt/format.h"
+#include "lexer.h"
+#include "textbuffer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <thread>
+
+using namespace aavm;
+
+// a short job: hashes its number a few hundred times
+static constexpr auto program = std::string_view{"push {r4, lr}\n"
+                                                 "mov r4, #200\n"
+                                                 "loop:\n"
+                                                 "eor r0, r0, r0, ror #7\n"
+                                                 "add r0, r0, r4\n"
+                                                 "subs r4, r4, #1\n"
+                                                 "bne loop\n"
+                                                 "pop {r4, pc}\n"};
+
+static constexpr auto memory_base = std::uint32_t{0x10000};
+static constexpr auto jobs = std::uint64_t{200000};
+
+int main() {
+  const auto buffer = Charbuffer{program};
+  auto lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{lexer};
+  if (!assembler.assemble()) {
+    return 1;
+  }
+  const auto &code = assembler.code();
+
+  const auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (auto workers = 1u; workers <= threads; workers *= 2) {
+    auto options = FarmOptions{};
+    options.memory_base = memory_base;
+    options.workers = workers;
+    auto farm = Farm{code.data(),
+                     static_cast<std::uint32_t>(code.size() * sizeof(code[0])),
+                     options};
+    auto failed = std::atomic<std::uint64_t>{};
+    const auto start = std::chrono::steady_clock::now();
+    farm.run(
+        jobs, memory_base,
+        [](Machine &machine, std::uint64_t job) {
+          machine.cpu().reg(ir::Register::R0) =
+              static_cast<std::uint32_t>(job);
+        },
+        [&](const Machine &, std::uint64_t, vm::Status status) {
+          if (status != vm::Status::Halted) {
+            ++failed;
+          }
+        });
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+    if (failed != 0) {
+      fmt::print("{} workers: {} jobs failed\n", workers, failed.load());
+      return 1;
+    }
+    fmt::print("{} workers: ran {} jobs in {:.3f}s: {:.0f}K jobs/s\n",
+               workers, jobs, elapsed.count(),
+               static_cast<double>(jobs) / elapsed.count() / 1e3);
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "assembler.h"
+#include "fmt/format.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "machine.h"
+#include "parser.h"
+#include "textbuffer.h"
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+using namespace aavm;
+
+// a loop mixing data processing, memory accesses and a call
+static constexpr auto program = std::string_view{"push {lr}\n"
+                                                 "ldr r1, =1000000\n"
+                                                 "mov r0, #0\n"
+                                                 "movw r2, #0\n"
+                                                 "movt r2, #0x10\n"
+                                                 "loop:\n"
+                                                 "and r3, r1, #0xFF\n"
+                                                 "ldr r4, [r2, r3, lsl #2]\n"
+                                                 "add r4, r4, r1\n"
+                                                 "str r4, [r2, r3, lsl #2]\n"
+                                                 "bl mix\n"
+                                                 "subs r1, r1, #1\n"
+                                                 "bne loop\n"
+                                                 "pop {pc}\n"
+                                                 "mix:\n"
+                                                 "eor r0, r0, r4, ror #3\n"
+                                                 "add r0, r0, #1\n"
+                                                 "bx lr\n"};
+
+// guest memory holds the code at its base and the data at 0x100000
+static constexpr auto memory_base = std::uint32_t{0x10000};
+static constexpr auto memory_size = std::uint32_t{0x100000};
+
+template <typename Engine, typename Run>
+static auto measure(const char *name, const Engine &engine, Run run) {
+  const auto start = std::chrono::steady_clock::now();
+  const auto status = run();
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+  if (status != vm::Status::Halted) {
+    fmt::print("{}: program stopped with status {}\n", name,
+               static_cast<int>(status));
+    return false;
+  }
+
+  const auto count = static_cast<double>(engine.retired());
+  fmt::print("{}: executed {} instructions in {:.3f}s: "
+             "{:.1f}M instructions/s (r0 {:08x})\n",
+             name, count, elapsed.count(), count / elapsed.count() / 1e6,
+             engine.cpu().reg(ir::Register::R0));
+  return true;
+}
+
+int main() {
+  const auto buffer = Charbuffer{program};
+  auto lexer = parser::Lexer{buffer};
+  auto parser = Parser{lexer};
+  const auto module = parser.parse_module();
+  if (!module) {
+    return 1;
+  }
+
+  auto memory = vm::Memory{memory_base, memory_size};
+  auto interpreter = Interpreter{*module, memory};
+  if (!measure("switch", interpreter, [&] { return interpreter.run(); })) {
+    return 1;
+  }
+  memory = vm::Memory{memory_base, memory_size};
+  interpreter.reset();
+  if (!measure("threaded", interpreter,
+               [&] { return interpreter.run_threaded(); })) {
+    return 1;
+  }
+
+  auto assembler_lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{assembler_lexer};
+  if (!assembler.assemble()) {
+    return 1;
+  }
+  memory = vm::Memory{memory_base, memory_size};
+  auto machine = Machine{memory};
+  const auto &code = assembler.code();
+  machine.write(memory_base, code.data(),
+                static_cast<std::uint32_t>(code.size() * sizeof(code[0])));
+  machine.reset(memory_base);
+  if (!measure("predecoded", machine, [&] { return machine.run(); })) {
+    return 1;
+  }
+  if (!machine.set_jit(true)) {
+    fmt::print("jit: not available on this host\n");
+    return 0;
+  }
+  memory = vm::Memory{memory_base, memory_size};
+  machine.write(memory_base, code.data(),
+                static_cast<std::uint32_t>(code.size() * sizeof(code[0])));
+  machine.reset(memory_base);
+  if (!measure("jit", machine, [&] { return machine.run(); })) {
+    return 1;
+  }
+
+  // the same, with accesses bounded by guard pages rather than checks
+  auto reserved =
+      vm::Memory{memory_base, memory_size, vm::Memory::Reserved};
+  auto flat = Machine{reserved};
+  flat.set_jit(true);
+  flat.write(memory_base, code.data(),
+             static_cast<std::uint32_t>(code.size() * sizeof(code[0])));
+  flat.reset(memory_base);
+  return measure("jit reserved", flat, [&] { return flat.run(); }) ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#ifndef AAVM_VM_ALU_H_
+#define AAVM_VM_ALU_H_
+
+#include "cpu.h"
+#include "instruction.h"
+#include "stl_bit.h"
+#include <cstdint>
+#include <utility>
+
+namespace aavm::vm {
+
+// the arithmetic shared by the execution engines, following the pseudocode
+// in the ARM ARM
+
+constexpr auto carry_shift = 29;
+
+constexpr auto nz(std::uint32_t result) {
+  return (result & FlagN) |
+         (result == 0 ? std::uint32_t{FlagZ} : std::uint32_t{0});
+}
+
+// x + y + carry and the flags it sets, as AddWithCarry
+constexpr auto add_with_carry(std::uint32_t x, std::uint32_t y,
+                              std::uint32_t carry) {
+  const auto wide = std::uint64_t{x} + y + carry;
+  const auto result = static_cast<std::uint32_t>(wide);
+  const auto c = (wide >> 32) != 0 ? std::uint32_t{FlagC} : std::uint32_t{0};
+  const auto v = ((~(x ^ y) & (x ^ result)) >> 31) != 0 ? std::uint32_t{FlagV}
+                                                        : std::uint32_t{0};
+  return std::pair{result, nz(result) | c | v};
+}
+
+// the flags set by a logical operation, which keeps V
+constexpr auto logical_flags(std::uint32_t result, std::uint32_t carry,
+                             std::uint32_t apsr) {
+  return nz(result) | carry << carry_shift | (apsr & FlagV);
+}
+
+// NZCV kept as the operation that last set them and computed when read.
+// Additions keep their operands; logical operations keep their result and
+// carry out and take V from the flags before them.
+class LazyFlags {
+public:
+  constexpr LazyFlags() = default;
+  explicit constexpr LazyFlags(std::uint32_t apsr) : apsr_{apsr} {}
+
+  // the flags of x + y + carry
+  constexpr void add(std::uint32_t x, std::uint32_t y, std::uint32_t carry) {
+    kind_ = Add;
+    x_ = x;
+    y_ = y;
+    carry_ = carry;
+  }
+  // the flags of a logical operation with result and carry out
+  constexpr void logical(std::uint32_t result, std::uint32_t carry) {
+    if (kind_ == Add) {
+      apsr_ = this->apsr();
+    }
+    kind_ = Logical;
+    x_ = result;
+    carry_ = carry;
+  }
+
+  // NZCV in bits 31-28
+  constexpr std::uint32_t apsr() const {
+    switch (kind_) {
+    case Add:
+      return add_with_carry(x_, y_, carry_).second;
+    case Logical:
+      return logical_flags(x_, carry_, apsr_);
+    default:
+      return apsr_;
+    }
+  }
+  // the C flag in bit 0
+  constexpr std::uint32_t carry() const {
+    switch (kind_) {
+    case Add:
+      return static_cast<std::uint32_t>(
+          (std::uint64_t{x_} + y_ + carry_) >> 32);
+    case Logical:
+      return carry_;
+    default:
+      return (apsr_ >> carry_shift) & 1u;
+    }
+  }
+
+private:
+  enum Kind : std::uint8_t { Computed, Add, Logical };
+
+  Kind kind_{Computed};
+  // the flags when computed, or those a logical operation leaves alone
+  std::uint32_t apsr_{};
+  // the operands of an addition, or x_ the result of a logical operation
+  std::uint32_t x_{};
+  std::uint32_t y_{};
+  std::uint32_t carry_{};
+};
+
+// value shifted by amount and the carry out, as Shift_C
+constexpr auto shift_c(std::uint32_t value, unsigned sh, std::uint32_t amount,
+                       std::uint32_t carry)
+    -> std::pair<std::uint32_t, std::uint32_t> {
+  if (sh == ir::Instruction::Rrx) {
+    return {carry << 31 | value >> 1, value & 1u};
+  }
+  if (amount == 0) {
+    return {value, carry};
+  }
+
+  switch (sh) {
+  case ir::Instruction::Lsl:
+    if (amount < 32) {
+      return {value << amount, (value >> (32 - amount)) & 1u};
+    }
+    return {0, amount == 32 ? value & 1u : 0};
+  case ir::Instruction::Lsr:
+    if (amount < 32) {
+      return {value >> amount, (value >> (amount - 1)) & 1u};
+    }
+    return {0, amount == 32 ? value >> 31 : 0};
+  case ir::Instruction::Asr:
+    if (amount < 32) {
+      return {static_cast<std::uint32_t>(static_cast<std::int32_t>(value) >>
+                                         amount),
+              (value >> (amount - 1)) & 1u};
+    }
+    return {static_cast<std::uint32_t>(static_cast<std::int32_t>(value) >> 31),
+            value >> 31};
+  case ir::Instruction::Ror: {
+    const auto result = stl::rotr(value, static_cast<int>(amount));
+    return {result, result >> 31};
+  }
+  default:
+    return {value, carry};
+  }
+}
+
+constexpr auto low_bits(unsigned width) {
+  return width >= 32 ? ~std::uint32_t{0} : (std::uint32_t{1} << width) - 1;
+}
+
+} // namespace aavm::vm
+
+#endif
@@ -0,0 +1,233 @@
+#include "assembler.h"
+#include "fmt/format.h"
+#include "instructions.h"
+#include <variant>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::ir;
+using namespace std::string_view_literals;
+
+static constexpr auto word_size =
+    static_cast<std::uint32_t>(sizeof(std::uint32_t));
+
+static auto referenced_label(const Instruction &instr) -> const Label * {
+  if (const auto arithmetic = cast<ArithmeticInstruction>(&instr)) {
+    return arithmetic->label();
+  }
+  if (const auto branch = cast<BranchInstruction>(&instr)) {
+    return branch->label();
+  }
+  if (const auto memory = cast<SingleMemoryInstruction>(&instr)) {
+    const auto source = memory->source();
+    if (const auto label = std::get_if<const Label *>(&source)) {
+      return *label;
+    }
+  }
+  return nullptr;
+}
+
+bool Assembler::assemble() {
+  auto ok = parser_.parse_statements(
+      [this](const Label &label, std::size_t line) {
+        return define_label(label, line);
+      },
+      [this](std::unique_ptr<Instruction> instr, std::size_t line) {
+        return emit(*instr, line);
+      });
+  ok = flush_literal_pool() && ok;
+  if (!ok || !relax()) {
+    return false;
+  }
+  encode_unresolved_addends();
+  return true;
+}
+
+std::optional<std::uint32_t>
+Assembler::label_address(const Label &label) const {
+  if (label.id() < addresses_.size() && addresses_[label.id()] != undefined_) {
+    return addresses_[label.id()];
+  }
+  return std::nullopt;
+}
+
+std::vector<Fixup> Assembler::unresolved_fixups() const {
+  auto unresolved = std::vector<Fixup>{};
+  for (auto id = LabelID{0}; id < pending_.size(); ++id) {
+    for (auto i = pending_[id]; i != end_of_chain_; i = fixups_[i].next) {
+      const auto &reference = references_[fixups_[i].reference];
+      unresolved.push_back(Fixup{reference.offset, reference.kind, id});
+    }
+  }
+  return unresolved;
+}
+
+bool Assembler::emit(const Instruction &instr, std::size_t line) {
+  // any A32 sequence for these would also set the flags
+  if (instr.operation() == Instruction::Cbz ||
+      instr.operation() == Instruction::Cbnz) {
+    Parser::report_error(line, "cbz and cbnz only exist in T32"sv);
+    return false;
+  }
+  if (!legalizer_.needs_legalization(instr)) {
+    return emit_encoded(instr, line);
+  }
+
+  legalized_.clear();
+  if (!legalizer_.legalize(instr, legalized_)) {
+    Parser::report_error(line, "immediate value cannot be encoded"sv);
+    return false;
+  }
+  auto ok = true;
+  for (const auto &rewritten : legalized_) {
+    ok = emit_encoded(*rewritten, line) && ok;
+  }
+  return ok;
+}
+
+bool Assembler::emit_encoded(const Instruction &instr, std::size_t line) {
+  const auto word = encode(instr);
+  if (!word) {
+    Parser::report_error(line, "instruction cannot be encoded"sv);
+    return false;
+  }
+
+  const auto offset = current_offset();
+  code_.push_back(*word);
+
+  const auto kind = fixup_kind(instr);
+  if (!kind) {
+    return true;
+  }
+  const auto reference = static_cast<std::uint32_t>(references_.size());
+  references_.push_back(Reference{offset, *kind, unresolved_target});
+  if (const auto label = referenced_label(instr)) {
+    reference_sources_.emplace_back(line, label->name());
+    return reference_label(*label, reference, line);
+  }
+  reference_sources_.emplace_back(line, std::string_view{});
+  const auto memory = cast<SingleMemoryInstruction>(&instr);
+  reference_literal(std::get<unsigned>(memory->source()), reference);
+  return true;
+}
+
+bool Assembler::define_label(const Label &label, std::size_t line) {
+  reserve_label(label.id());
+  if (addresses_[label.id()] != undefined_) {
+    Parser::report_error(
+        line, fmt::format("redefinition of label '{}'", label.name()));
+    return false;
+  }
+
+  const auto address = current_offset();
+  addresses_[label.id()] = address;
+
+  auto ok = true;
+  for (auto i = pending_[label.id()]; i != end_of_chain_; i = fixups_[i].next) {
+    ok = resolve(fixups_[i].reference, address, line) && ok;
+  }
+  pending_[label.id()] = end_of_chain_;
+  return ok;
+}
+
+bool Assembler::reference_label(const Label &label, std::uint32_t reference,
+                                std::size_t line) {
+  reserve_label(label.id());
+  if (addresses_[label.id()] != undefined_) {
+    return resolve(reference, addresses_[label.id()], line);
+  }
+
+  fixups_.push_back(PendingFixup{reference, pending_[label.id()]});
+  pending_[label.id()] = static_cast<std::uint32_t>(fixups_.size() - 1);
+  return true;
+}
+
+void Assembler::reference_literal(std::uint32_t value,
+                                  std::uint32_t reference) {
+  const auto [it, inserted] = literal_lookup_.try_emplace(
+      value, static_cast<std::uint32_t>(literals_.size()));
+  if (inserted) {
+    literals_.push_back(value);
+  }
+  literal_fixups_.emplace_back(reference, it->second);
+}
+
+bool Assembler::resolve(std::uint32_t reference, std::uint32_t target,
+                        std::size_t line) {
+  auto &resolved = references_[reference];
+  resolved.target = target;
+  auto &word = code_[resolved.offset / word_size];
+  const auto distance = static_cast<std::int32_t>(target - resolved.offset);
+  if (const auto patched = apply_fixup(
+          word, resolved.kind,
+          distance - static_cast<std::int32_t>(pc_offset))) {
+    word = *patched;
+    return true;
+  }
+  if (!relaxed_size(word, resolved.kind, distance)) {
+    Parser::report_error(line, "label is out of range"sv);
+    return false;
+  }
+  needs_relaxation_ = true;
+  return true;
+}
+
+bool Assembler::flush_literal_pool() {
+  pool_offset_ = current_offset();
+  code_.insert(code_.end(), literals_.begin(), literals_.end());
+
+  auto ok = true;
+  for (const auto &[reference, index] : literal_fixups_) {
+    const auto target = pool_offset_ + index * word_size;
+    ok = resolve(reference, target, lexer_.source_location().line() + 1) && ok;
+  }
+  return ok;
+}
+
+bool Assembler::relax() {
+  // the common case, everything was in range at its shortest form
+  if (!needs_relaxation_) {
+    return true;
+  }
+
+  auto relaxer = Relaxer{code_, references_};
+  if (!relaxer.relax()) {
+    const auto &[line, label] = reference_sources_[relaxer.unreachable()];
+    if (label.empty()) {
+      Parser::report_error(line,
+                           "literal pool is out of range after relaxation"sv);
+    } else {
+      Parser::report_error(
+          line,
+          fmt::format("label '{}' is out of range after relaxation", label));
+    }
+    return false;
+  }
+  for (auto &address : addresses_) {
+    if (address != undefined_) {
+      address = relaxer.relocate(address);
+    }
+  }
+  pool_offset_ = relaxer.relocate(pool_offset_);
+  needs_relaxation_ = false;
+  return true;
+}
+
+void Assembler::encode_unresolved_addends() {
+  // pc reads 8 bytes ahead, so a displacement of -8 refers to the symbol itself
+  for (const auto head : pending_) {
+    for (auto i = head; i != end_of_chain_; i = fixups_[i].next) {
+      const auto &reference = references_[fixups_[i].reference];
+      auto &word = code_[reference.offset / word_size];
+      word = *apply_fixup(word, reference.kind,
+                          -static_cast<std::int32_t>(pc_offset));
+    }
+  }
+}
+
+void Assembler::reserve_label(LabelID id) {
+  if (id >= addresses_.size()) {
+    addresses_.resize(id + 1, undefined_);
+    pending_.resize(id + 1, end_of_chain_);
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef AAVM_ASSEMBLER_ASSEMBLER_H_
+#define AAVM_ASSEMBLER_ASSEMBLER_H_
+
+#include "encoder.h"
+#include "instruction.h"
+#include "label.h"
+#include "legalizer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "relaxer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace aavm::assembler {
+
+struct Fixup {
+  // byte offset of the instruction word to patch
+  std::uint32_t offset;
+  FixupKind kind;
+  ir::LabelID label;
+};
+
+// Assembles source text in a single pass. Instructions are encoded as soon as
+// they are parsed and references to labels that are not yet defined are
+// chained per label, each chain is patched once when its label is defined.
+// References that end up out of range are relaxed into longer sequences once
+// the whole layout is known.
+class Assembler {
+public:
+  Assembler() = delete;
+  Assembler(parser::Lexer &lexer, Legalizer legalizer = Legalizer{})
+      : lexer_{lexer}, parser_{lexer}, legalizer_{legalizer} {}
+
+  bool assemble();
+
+  // instruction words followed by the literal pool
+  constexpr auto &code() const { return code_; }
+  constexpr auto literal_pool_offset() const { return pool_offset_; }
+  constexpr auto &labels() const { return parser_.labels(); }
+
+  std::optional<std::uint32_t> label_address(const ir::Label &label) const;
+  // references to labels that were never defined, their words hold the
+  // implicit addend that places the target at the referenced label
+  std::vector<Fixup> unresolved_fixups() const;
+
+private:
+  static constexpr auto undefined_ = ~std::uint32_t{0};
+  static constexpr auto end_of_chain_ = ~std::uint32_t{0};
+
+  struct PendingFixup {
+    // index into references_
+    std::uint32_t reference;
+    std::uint32_t next;
+  };
+
+  bool emit(const ir::Instruction &instr, std::size_t line);
+  bool emit_encoded(const ir::Instruction &instr, std::size_t line);
+  bool define_label(const ir::Label &label, std::size_t line);
+  bool reference_label(const ir::Label &label, std::uint32_t reference,
+                       std::size_t line);
+  void reference_literal(std::uint32_t value, std::uint32_t reference);
+  bool resolve(std::uint32_t reference, std::uint32_t target, std::size_t line);
+  bool flush_literal_pool();
+  bool relax();
+  void encode_unresolved_addends();
+  void reserve_label(ir::LabelID id);
+
+  auto current_offset() const {
+    return static_cast<std::uint32_t>(code_.size() * sizeof(std::uint32_t));
+  }
+
+  parser::Lexer &lexer_;
+  parser::Parser parser_;
+  Legalizer legalizer_;
+
+  std::vector<std::uint32_t> code_{};
+  std::uint32_t pool_offset_{};
+
+  // indexed by LabelID
+  std::vector<std::uint32_t> addresses_{};
+  std::vector<std::uint32_t> pending_{};
+  std::vector<PendingFixup> fixups_{};
+
+  // every label and literal reference in order of offset
+  std::vector<Reference> references_{};
+  // where each reference was made and the label it names, empty for a
+  // literal, to report it with if it ends up out of range
+  std::vector<std::pair<std::size_t, std::string_view>> reference_sources_{};
+  bool needs_relaxation_{false};
+
+  std::vector<std::uint32_t> literals_{};
+  std::unordered_map<std::uint32_t, std::uint32_t> literal_lookup_{};
+  // reference of each literal load and the index of its pool entry
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> literal_fixups_{};
+
+  std::vector<std::unique_ptr<ir::Instruction>> legalized_{};
+};
+
+} // namespace aavm::assembler
+
+namespace aavm {
+using Assembler = assembler::Assembler;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "blockcache.h"
+#include <algorithm>
+
+using namespace aavm;
+using namespace aavm::vm;
+
+Block *BlockCache::lookup(std::uint32_t address, std::uint32_t threshold) {
+  ++lookups_;
+  if (auto *const block = find(address)) {
+    return block;
+  }
+  if (threshold > 1) {
+    const auto entries = ++entries_[address];
+    if (entries < threshold) {
+      return nullptr;
+    }
+    entries_.erase(address);
+  }
+  return form(address);
+}
+
+Block *BlockCache::form(std::uint32_t address) {
+  auto &block = blocks_[address];
+  block = std::make_unique<Block>();
+  block->address = address;
+  const auto *const page = code_.page(address);
+  const auto first = (address - code_.page_address(address)) / 4;
+  for (auto i = first; i < CodeCache::page_ops; ++i) {
+    block->ops.push_back(page[i]);
+    if ((page[i].flags & MicroOp::WritesPc) != 0) {
+      break;
+    }
+  }
+  return block.get();
+}
+
+void BlockCache::retranslate(std::uint32_t address) {
+  for (auto &[start, block] : blocks_) {
+    if (address - start >= block->ops.size() * 4) {
+      continue;
+    }
+    const auto *const page = code_.page(start);
+    const auto first = (start - code_.page_address(start)) / 4;
+    std::copy(page + first, page + first + block->ops.size(),
+              block->ops.begin());
+    block->compiled = nullptr;
+    block->executions = 0;
+  }
+}
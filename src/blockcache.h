@@ -0,0 +1,96 @@
+#ifndef AAVM_VM_BLOCKCACHE_H_
+#define AAVM_VM_BLOCKCACHE_H_
+
+#include "codecache.h"
+#include "cpu.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace aavm::vm {
+
+struct BlockProfile;
+
+// Host code compiled from a block. It returns twice the number of
+// instructions it retired, plus one if it stopped at an instruction in pc that
+// must be interpreted.
+using CompiledBlock = std::uint32_t (*)(Cpu *cpu);
+
+// A run of micro-ops ending at the first instruction that writes pc or at
+// the end of its page, linked to the blocks that followed it so far.
+struct Block {
+  std::uint32_t address{};
+  std::vector<MicroOp> ops{};
+  // the successor when the block ends without branching
+  Block *fallthrough{};
+  // the successor when its last instruction is a direct branch and taken
+  Block *taken{};
+  // the last successor of an indirect branch, which only holds while the
+  // branch goes to indirect_address
+  Block *indirect{};
+  std::uint32_t indirect_address{};
+
+  // how many times run() entered the block, and its code once it got hot
+  std::uint32_t executions{};
+  CompiledBlock compiled{};
+  // where a profiling run counts the block
+  BlockProfile *profile{};
+
+  auto end_address() const {
+    return address + static_cast<std::uint32_t>(ops.size() * 4);
+  }
+};
+
+// Basic blocks of predecoded code, keyed by the guest address they start at.
+class BlockCache {
+public:
+  BlockCache() = delete;
+  explicit BlockCache(CodeCache &code) : code_{code} {}
+
+  // the block starting at address, formed once address has been looked up
+  // threshold times, or nullptr while it is colder than that. address must
+  // be word aligned and in memory.
+  Block *lookup(std::uint32_t address, std::uint32_t threshold = 1);
+  // forms the block starting at address, which must not be formed yet
+  Block *form(std::uint32_t address);
+  // the block starting at address, or nullptr if it has not been formed
+  Block *find(std::uint32_t address) const {
+    const auto block = blocks_.find(address);
+    return block != blocks_.end() ? block->second.get() : nullptr;
+  }
+  // drops every block, along with the links between them, and forgets how
+  // often cold addresses were looked up
+  void flush() {
+    blocks_.clear();
+    entries_.clear();
+  }
+
+  // takes the ops of every block holding address from the code cache
+  // again, dropping their compiled code. The blocks keep their place and
+  // their links, as an op that ends a block still does when it changes.
+  void retranslate(std::uint32_t address);
+
+  // calls function with each block
+  template <typename Function> void for_each(Function function) const {
+    for (const auto &[address, block] : blocks_) {
+      function(static_cast<const Block &>(*block));
+    }
+  }
+
+  auto size() const { return blocks_.size(); }
+  // how many times a block was looked up rather than reached through a link
+  constexpr auto lookups() const { return lookups_; }
+
+private:
+  CodeCache &code_;
+  std::unordered_map<std::uint32_t, std::unique_ptr<Block>> blocks_{};
+  // lookups of addresses whose block is not formed yet
+  std::unordered_map<std::uint32_t, std::uint32_t> entries_{};
+  std::uint64_t lookups_{};
+};
+
+} // namespace aavm::vm
+
+#endif
@@ -0,0 +1,201 @@
+#include "codecache.h"
+#include "decoder.h"
+#include "instruction.h"
+#include "stl_bit.h"
+#include <algorithm>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto pc = std::uint8_t{15};
+
+// whether instr leaves its result in pc, which makes it a branch
+static constexpr auto writes_pc(const DecodedInstruction &instr) {
+  const auto op = instr.operation;
+  if (op == Instruction::B || op == Instruction::Bl || op == Instruction::Bx) {
+    return true;
+  }
+  const auto load = Instruction::is_single_memory_operation(op) &&
+                    op <= Instruction::Ldrsh;
+  if (Instruction::is_arithmetic_operation(op) ||
+      Instruction::is_move_operation(op) || load) {
+    return instr.rd == pc;
+  }
+  if (op >= Instruction::Ldm && op <= Instruction::Ldmdb) {
+    return (instr.imm >> pc & 1u) != 0;
+  }
+  return false;
+}
+
+MicroOp aavm::vm::predecode(std::uint32_t word, std::uint32_t address) {
+  auto instr = DecodedInstruction{};
+  decode(word, instr);
+
+  auto op = MicroOp{};
+  op.operation = instr.operation;
+  op.condition = instr.condition;
+  op.flags = instr.flags;
+  op.rd = instr.rd;
+  op.rn = instr.rn;
+  op.rm = instr.rm;
+  op.rs = instr.rs;
+  op.shift = instr.shift;
+  op.amount = instr.shift_amount;
+  op.lsb = instr.lsb;
+  op.width = instr.width;
+  op.imm = instr.imm;
+  if (!instr.valid()) {
+    return op;
+  }
+
+  switch (instr.operand) {
+  case DecodedInstruction::None:
+    op.operand = MicroOp::None;
+    break;
+  case DecodedInstruction::Immediate:
+    // data processing immediates record their rotation in the shift amount
+    op.operand = instr.shift_amount != 0 ? MicroOp::RotatedImmediate
+                                         : MicroOp::Immediate;
+    break;
+  case DecodedInstruction::ShiftImmediate:
+    op.operand = instr.shift == Instruction::Lsl && instr.shift_amount == 0
+                     ? MicroOp::Register
+                     : MicroOp::ShiftImmediate;
+    break;
+  case DecodedInstruction::ShiftRegister:
+    op.operand = MicroOp::ShiftRegister;
+    break;
+  }
+
+  if (instr.operation == Instruction::B || instr.operation == Instruction::Bl) {
+    op.imm = address + 8 + instr.imm;
+  }
+  if (Instruction::is_block_memory_operation(instr.operation)) {
+    op.lsb = static_cast<std::uint8_t>(stl::popcount(instr.imm));
+  }
+  if (writes_pc(instr)) {
+    op.flags |= MicroOp::WritesPc;
+  }
+  return op;
+}
+
+CodeCache::CodeCache(const Memory &memory)
+    : memory_{memory},
+      pages_((memory.size() + page_size - 1) / page_size),
+      states_(pages_.size()) {}
+
+const MicroOp *CodeCache::page(std::uint32_t address) {
+  const auto index = (address - memory_.base()) / page_size;
+  auto &page = pages_[index];
+  if (page == nullptr) {
+    page = std::make_unique<Page>();
+  }
+  if ((states_[index] & Decoded) == 0) {
+    const auto start = memory_.base() + index * page_size;
+    // the last page can be cut short by the end of memory
+    const auto count = std::min<std::size_t>(
+        page_ops, (memory_.size() - index * page_size) / sizeof(Word));
+    for (auto i = std::size_t{0}; i < page_ops; ++i) {
+      const auto at = start + static_cast<Word>(i * sizeof(Word));
+      page->ops[i] =
+          i < count ? predecode(memory_.load<Word>(at), at) : MicroOp{};
+    }
+    trap(index, page->ops.data());
+    states_[index] |= Decoded;
+    ++decoded_pages_;
+  }
+  return page->ops.data();
+}
+
+void CodeCache::install(std::size_t index, const MicroOp *ops) {
+  auto &page = pages_[index];
+  if (page == nullptr) {
+    page = std::make_unique<Page>();
+  }
+  std::copy(ops, ops + page_ops, page->ops.begin());
+  // the traps of the machine that saved the page are not ours
+  const auto start = memory_.base() + static_cast<Word>(index * page_size);
+  for (auto i = std::size_t{0}; i < page_ops; ++i) {
+    if (page->ops[i].operation == MicroOp::breakpoint) {
+      const auto at = start + static_cast<Word>(i * sizeof(Word));
+      page->ops[i] = predecode(memory_.load<Word>(at), at);
+    }
+  }
+  trap(index, page->ops.data());
+  states_[index] |= Decoded;
+}
+
+void CodeCache::set_breakpoint(std::uint32_t address) {
+  const auto at =
+      std::lower_bound(breakpoints_.begin(), breakpoints_.end(), address);
+  if (at == breakpoints_.end() || *at != address) {
+    breakpoints_.insert(at, address);
+  }
+  states_[(address - memory_.base()) / page_size] &= ~Decoded;
+}
+
+void CodeCache::clear_breakpoint(std::uint32_t address) {
+  const auto at =
+      std::lower_bound(breakpoints_.begin(), breakpoints_.end(), address);
+  if (at != breakpoints_.end() && *at == address) {
+    breakpoints_.erase(at);
+  }
+  states_[(address - memory_.base()) / page_size] &= ~Decoded;
+}
+
+void CodeCache::trap(std::size_t index, MicroOp *ops) const {
+  const auto start = memory_.base() + static_cast<Word>(index * page_size);
+  for (auto at = std::lower_bound(breakpoints_.begin(), breakpoints_.end(),
+                                  start);
+       at != breakpoints_.end() && *at - start < page_size; ++at) {
+    auto &op = ops[(*at - start) / sizeof(Word)];
+    // it stops whether or not the condition passes, and keeps the shape of
+    // the blocks formed from it
+    const auto writes_pc = op.flags & MicroOp::WritesPc;
+    op = MicroOp{};
+    op.operation = MicroOp::breakpoint;
+    op.condition = Condition::AL;
+    op.flags = writes_pc;
+  }
+}
+
+void CodeCache::clear() {
+  for (auto &state : states_) {
+    state &= ~Decoded;
+  }
+}
+
+void CodeCache::watch_stores() {
+  for (auto &state : states_) {
+    state |= Watched;
+  }
+  dirty_.clear();
+}
+
+void CodeCache::guard(std::uint32_t address, std::uint32_t size,
+                      std::uint8_t accesses) {
+  const auto end = std::uint64_t{address} + size;
+  // the part past the top of the address space wraps around to zero
+  if (end > std::uint64_t{1} << 32) {
+    guard(0, static_cast<std::uint32_t>(end), accesses);
+  }
+  const auto base = std::uint64_t{memory_.base()};
+  const auto first = std::max<std::uint64_t>(address, base);
+  const auto last = std::min(end, base + memory_.size());
+  if (first >= last) {
+    return;
+  }
+  for (auto i = (first - base) / page_size; i <= (last - 1 - base) / page_size;
+       ++i) {
+    states_[i] |= accesses;
+  }
+}
+
+void CodeCache::unguard() {
+  for (auto &state : states_) {
+    state &= ~Guarded;
+  }
+}
@@ -0,0 +1,194 @@
+#ifndef AAVM_VM_CODECACHE_H_
+#define AAVM_VM_CODECACHE_H_
+
+#include "memory.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace aavm::vm {
+
+// A guest instruction predecoded for execution. Registers are hardware numbers
+// (0-15), immediates are rotated, shifts that do nothing are dropped and
+// branch targets are absolute, so executing it never looks at the word again.
+struct MicroOp {
+  enum Operand : std::uint8_t {
+    None,
+    // imm, leaving the carry alone
+    Immediate,
+    // imm, which came from a rotation and sets the carry to its top bit
+    RotatedImmediate,
+    // rm as it is
+    Register,
+    // rm shifted by amount
+    ShiftImmediate,
+    // rm shifted by the bottom byte of rs
+    ShiftRegister
+  };
+
+  // the first four match DecodedInstruction::Flags
+  enum Flags : std::uint8_t {
+    UpdatesFlags = 1 << 0,
+    Writeback = 1 << 1,
+    Subtract = 1 << 2,
+    PreIndex = 1 << 3,
+    // the instruction branches to the address it leaves in r15
+    WritesPc = 1 << 4
+  };
+
+  // the operation of the trap a breakpoint puts in place of an instruction
+  static constexpr auto breakpoint = std::uint8_t{0xFF};
+
+  // an ir::Instruction operation, 0 if the word is not supported
+  std::uint8_t operation;
+  // an ir::Condition::Kind
+  std::uint8_t condition;
+  Operand operand;
+  std::uint8_t flags;
+
+  std::uint8_t rd;
+  std::uint8_t rn;
+  std::uint8_t rm;
+  std::uint8_t rs;
+
+  std::uint8_t shift;
+  std::uint8_t amount;
+  // bitfield position, or the number of registers a block transfer moves
+  std::uint8_t lsb;
+  std::uint8_t width;
+
+  // immediate operand, memory offset, imm16, register list, branch target or
+  // svc number
+  std::uint32_t imm;
+};
+
+static_assert(sizeof(MicroOp) == 16);
+
+// predecodes the word at address
+MicroOp predecode(std::uint32_t word, std::uint32_t address);
+
+// Predecoded guest code, one page at a time. A page is decoded in full the
+// first time anything in it runs and stays valid until guest code writes to
+// it. Pages are counted from the base of memory.
+//
+// Every store goes through invalidate(), so the cache also tracks which
+// pages are written after watch_stores(), for snapshots to copy back only
+// those.
+//
+// Pages are decoded with a breakpoint trap in place of the instruction at
+// each address set_breakpoint() was given, so breakpoints cost nothing
+// until they are reached.
+class CodeCache {
+public:
+  static constexpr auto page_size = std::uint32_t{0x1000};
+  static constexpr auto page_ops = page_size / sizeof(std::uint32_t);
+
+  enum State : std::uint8_t {
+    Decoded = 1,
+    Watched = 2,
+    // the page holds memory a watchpoint watches, which compiled code
+    // leaves the accesses to
+    GuardedLoads = 4,
+    GuardedStores = 8,
+    Guarded = GuardedLoads | GuardedStores
+  };
+
+  CodeCache() = delete;
+  explicit CodeCache(const Memory &memory);
+
+  // the first op of the page holding address, which must be in memory
+  const MicroOp *page(std::uint32_t address);
+  // the guest address of the first op of the page holding address
+  std::uint32_t page_address(std::uint32_t address) const {
+    return address - (address - memory_.base()) % page_size;
+  }
+
+  // drops the pages [address, address + size) overlaps and notes the
+  // watched ones as dirty, returns true if any of them had been decoded
+  bool invalidate(std::uint32_t address, std::uint32_t size) {
+    const auto first = (address - memory_.base()) / page_size;
+    const auto last = (address + size - 1 - memory_.base()) / page_size;
+    auto dropped = false;
+    for (auto i = first; i <= last && i < states_.size(); ++i) {
+      const auto state = states_[i];
+      if (state == 0) {
+        continue;
+      }
+      if ((state & Watched) != 0) {
+        dirty_.push_back(static_cast<std::uint32_t>(i));
+      }
+      dropped |= (state & Decoded) != 0;
+      states_[i] = state & Guarded;
+    }
+    return dropped;
+  }
+  // drops every decoded page
+  void clear();
+
+  // watches every page for its first store from here on, and forgets the
+  // pages dirtied so far
+  void watch_stores();
+  // calls visit with the index of every page stored to since it was last
+  // watched, then watches it again
+  template <typename Visit> void rewatch_dirty(Visit &&visit) {
+    for (const auto index : dirty_) {
+      visit(index);
+      states_[index] |= Watched;
+    }
+    dirty_.clear();
+  }
+
+  // how many pages memory spans, the last one possibly cut short
+  auto page_count() const { return states_.size(); }
+  // the ops of page index, or nullptr if it is not decoded
+  const MicroOp *decoded_page(std::size_t index) const {
+    return (states_[index] & Decoded) != 0 ? pages_[index]->ops.data()
+                                           : nullptr;
+  }
+  // takes ops as the decoded page index, which they must have come from
+  void install(std::size_t index, const MicroOp *ops);
+
+  // guards the pages [address, address + size) overlaps against accesses,
+  // any of GuardedLoads and GuardedStores, addresses outside memory aside
+  void guard(std::uint32_t address, std::uint32_t size, std::uint8_t accesses);
+  // takes every guard off
+  void unguard();
+
+  // one byte per page of State, for compiled code to test and leave its
+  // access to the interpreter: a store before it is made if the byte is
+  // nonzero, which invalidate() then sees, a load once made if GuardedLoads
+  // is set
+  const std::uint8_t *watched_pages() const { return states_.data(); }
+
+  // how many times a page has been decoded
+  constexpr auto decoded_pages() const { return decoded_pages_; }
+
+  // sets or clears a breakpoint on the word aligned address, which takes
+  // effect the next time its page is decoded, and drops the page for that
+  void set_breakpoint(std::uint32_t address);
+  void clear_breakpoint(std::uint32_t address);
+  // the breakpoints set, in ascending order
+  const auto &breakpoints() const { return breakpoints_; }
+
+private:
+  struct Page {
+    std::array<MicroOp, page_ops> ops;
+  };
+  // puts the traps of the breakpoints in page index into ops
+  void trap(std::size_t index, MicroOp *ops) const;
+
+  const Memory &memory_;
+  // kept when invalidated, so ops being executed stay readable
+  std::vector<std::unique_ptr<Page>> pages_;
+  std::vector<std::uint8_t> states_;
+  // pages stored to since they were last watched
+  std::vector<std::uint32_t> dirty_{};
+  std::vector<std::uint32_t> breakpoints_{};
+  std::uint64_t decoded_pages_{};
+};
+
+} // namespace aavm::vm
+
+#endif
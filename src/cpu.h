@@ -0,0 +1,86 @@
+#ifndef AAVM_VM_CPU_H_
+#define AAVM_VM_CPU_H_
+
+#include "condition.h"
+#include "register.h"
+#include <array>
+#include <cstdint>
+
+namespace aavm::vm {
+
+// why an execution engine stopped
+enum class Status {
+  Running,
+  // the program branched to the address lr held on entry
+  Halted,
+  // a load or store outside guest memory
+  MemoryFault,
+  // pc left the code or is not word aligned
+  BadBranch,
+  // a branch or address of a label that is never defined
+  UndefinedLabel,
+  // an instruction the engine cannot execute
+  Unsupported,
+  // the instruction budget ran out, running again carries on from pc
+  Preempted,
+  // pc reached a breakpoint, or the instruction at pc was about to access a
+  // watched address. Running again carries on from that instruction.
+  Breakpoint,
+  Watchpoint,
+  // the program made the exit host call, see HostCalls
+  Exited
+};
+
+// the condition flags as laid out in the APSR
+enum ConditionFlag : std::uint32_t {
+  FlagV = 1u << 28,
+  FlagC = 1u << 29,
+  FlagZ = 1u << 30,
+  FlagN = 1u << 31
+};
+
+// The architectural state of the guest. registers[15] holds the address of
+// the instruction being executed, not the pc + 8 that instructions read.
+struct Cpu {
+  std::array<std::uint32_t, 16> registers{};
+  // NZCV in bits 31-28, the remaining bits are zero
+  std::uint32_t apsr{};
+
+  constexpr auto &reg(ir::Register::Kind reg) { return registers[reg - 1]; }
+  constexpr auto reg(ir::Register::Kind reg) const {
+    return registers[reg - 1];
+  }
+
+  constexpr auto flag(ConditionFlag flag) const { return (apsr & flag) != 0; }
+};
+
+// Bit nzcv of condition_table[cond] is set when cond holds for the flags
+// nzcv, with N in bit 3 and V in bit 0. Row 0 is not a condition and always
+// passes, as does the unconditional space a decoded 0b1111 field masks to.
+inline constexpr auto condition_table = std::array<std::uint16_t, 16>{
+    0xFFFF, // -
+    0xF0F0, // EQ: Z
+    0x0F0F, // NE: !Z
+    0xCCCC, // CS: C
+    0x3333, // CC: !C
+    0xFF00, // MI: N
+    0x00FF, // PL: !N
+    0xAAAA, // VS: V
+    0x5555, // VC: !V
+    0x0C0C, // HI: C && !Z
+    0xF3F3, // LS: !C || Z
+    0xAA55, // GE: N == V
+    0x55AA, // LT: N != V
+    0x0A05, // GT: !Z && N == V
+    0xF5FA, // LE: Z || N != V
+    0xFFFF  // AL
+};
+
+// whether an instruction with condition cond executes under the flags in apsr
+constexpr bool condition_passed(unsigned cond, std::uint32_t apsr) {
+  return ((condition_table[cond & 0xF] >> (apsr >> 28)) & 1) != 0;
+}
+
+} // namespace aavm::vm
+
+#endif
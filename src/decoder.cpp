@@ -0,0 +1,755 @@
+#include "decoder.h"
+#include "compiler.h"
+#include "fmt/format.h"
+#include "stl_bit.h"
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+namespace {
+
+// how the fields of an instruction are laid out
+enum Format : std::uint8_t {
+  Undefined,
+  DataProcessingImmediate,
+  DataProcessingRegister,
+  DataProcessingRegisterShift,
+  MoveWide,
+  Multiply,
+  MultiplyLong,
+  Divide,
+  ExtraLoadStoreImmediate,
+  ExtraLoadStoreRegister,
+  LoadStoreImmediate,
+  LoadStoreRegister,
+  BitfieldExtract,
+  BitfieldInsert,
+  Reverse,
+  BranchExchange,
+  Branch,
+  BlockTransfer,
+  SupervisorCall
+};
+
+struct Entry {
+  Format format;
+  std::uint8_t operation;
+};
+
+constexpr auto row_size = std::size_t{16};
+constexpr auto row_count = std::size_t{256};
+
+constexpr std::uint8_t data_processing_operations[] = {
+    Instruction::And, Instruction::Eor, Instruction::Sub, Instruction::Rsb,
+    Instruction::Add, Instruction::Adc, Instruction::Sbc, Instruction::Rsc,
+    Instruction::Tst, Instruction::Teq, Instruction::Cmp, Instruction::Cmn,
+    Instruction::Orr, Instruction::Mov, Instruction::Bic, Instruction::Mvn};
+
+constexpr std::uint8_t multiply_operations[] = {
+    Instruction::Mul,   Instruction::Mla,   0,
+    Instruction::Mls,   Instruction::Umull, Instruction::Umlal,
+    Instruction::Smull, Instruction::Smlal};
+
+// the entry for bits 27-20 (high) and bits 7-4 (low) of a word
+constexpr auto classify(unsigned high, unsigned low) -> Entry {
+  const auto bit = [&](unsigned n) { return (high >> (n - 20)) & 1u; };
+  const auto p = bit(24);
+  const auto u = bit(23);
+  const auto w = bit(21);
+  const auto l = bit(20);
+  const auto data_processing = data_processing_operations[(high >> 1) & 0xFu];
+  // opcodes 10xx without S encode miscellaneous instructions instead
+  const auto miscellaneous = (high & 0b11001u) == 0b10000u;
+
+  switch (high >> 5) {
+  case 0b000:
+    if (low == 0b1001) {
+      if ((high >> 4) != 0) {
+        return {Undefined, 0};
+      }
+      const auto op = multiply_operations[(high >> 1) & 0b111u];
+      if (op == 0 || (op == Instruction::Mls && l != 0)) {
+        return {Undefined, 0};
+      }
+      return {op >= Instruction::Umull ? MultiplyLong : Multiply, op};
+    }
+    if ((low & 0b1001) == 0b1001) {
+      // unprivileged (p = 0, w = 1) and doubleword forms are not supported
+      const auto sh = (low >> 1) & 0b11u;
+      if ((p == 0 && w != 0) || (l == 0 && sh != 0b01)) {
+        return {Undefined, 0};
+      }
+      const auto op = l == 0        ? Instruction::Strh
+                      : sh == 0b01 ? Instruction::Ldrh
+                      : sh == 0b10 ? Instruction::Ldrsb
+                                   : Instruction::Ldrsh;
+      return {bit(22) != 0 ? ExtraLoadStoreImmediate : ExtraLoadStoreRegister,
+              static_cast<std::uint8_t>(op)};
+    }
+    if (miscellaneous) {
+      if (high == 0b00010010 && low == 0b0001) {
+        return {BranchExchange, Instruction::Bx};
+      }
+      return {Undefined, 0};
+    }
+    return {(low & 1u) == 0 ? DataProcessingRegister
+                            : DataProcessingRegisterShift,
+            data_processing};
+  case 0b001:
+    if (high == 0b00110000) {
+      return {MoveWide, Instruction::Movw};
+    }
+    if (high == 0b00110100) {
+      return {MoveWide, Instruction::Movt};
+    }
+    if (miscellaneous) {
+      return {Undefined, 0};
+    }
+    return {DataProcessingImmediate, data_processing};
+  case 0b010:
+  case 0b011: {
+    const auto registers = (high >> 5) == 0b011;
+    if (registers && (low & 1u) != 0) {
+      // media instructions
+      if ((high == 0b01110001 || high == 0b01110011) && low == 0b0001) {
+        return {Divide, static_cast<std::uint8_t>(
+                            high == 0b01110001 ? Instruction::Sdiv
+                                               : Instruction::Udiv)};
+      }
+      if (high == 0b01101011 || high == 0b01101111) {
+        const auto rbit_or_revsh = high == 0b01101111;
+        if (low == 0b0011) {
+          return {Reverse,
+                  static_cast<std::uint8_t>(rbit_or_revsh ? Instruction::Rbit
+                                                          : Instruction::Rev)};
+        }
+        if (low == 0b1011) {
+          return {Reverse, static_cast<std::uint8_t>(
+                               rbit_or_revsh ? Instruction::Revsh
+                                             : Instruction::Rev16)};
+        }
+        return {Undefined, 0};
+      }
+      if ((low & 0b111) == 0b101 && (high >> 1) == 0b0111101) {
+        return {BitfieldExtract, Instruction::Sbfx};
+      }
+      if ((low & 0b111) == 0b101 && (high >> 1) == 0b0111111) {
+        return {BitfieldExtract, Instruction::Ubfx};
+      }
+      if ((low & 0b111) == 0b001 && (high >> 1) == 0b0111110) {
+        return {BitfieldInsert, Instruction::Bfi};
+      }
+      return {Undefined, 0};
+    }
+    if (p == 0 && w != 0) {
+      return {Undefined, 0};
+    }
+    const auto byte = bit(22) != 0;
+    const auto op = l != 0 ? (byte ? Instruction::Ldrb : Instruction::Ldr)
+                           : (byte ? Instruction::Strb : Instruction::Str);
+    return {registers ? LoadStoreRegister : LoadStoreImmediate,
+            static_cast<std::uint8_t>(op)};
+  }
+  case 0b100: {
+    // the user register forms are not supported
+    if (bit(22) != 0) {
+      return {Undefined, 0};
+    }
+    constexpr std::uint8_t loads[] = {Instruction::Ldmda, Instruction::Ldmia,
+                                      Instruction::Ldmdb, Instruction::Ldmib};
+    constexpr std::uint8_t stores[] = {Instruction::Stmda, Instruction::Stmia,
+                                       Instruction::Stmdb, Instruction::Stmib};
+    const auto mode = p << 1 | u;
+    return {BlockTransfer, l != 0 ? loads[mode] : stores[mode]};
+  }
+  case 0b101:
+    return {Branch, static_cast<std::uint8_t>(p != 0 ? Instruction::Bl
+                                                     : Instruction::B)};
+  case 0b111:
+    // coprocessor instructions are not supported
+    if (p == 0) {
+      return {Undefined, 0};
+    }
+    return {SupervisorCall, Instruction::Svc};
+  default:
+    return {Undefined, 0};
+  }
+}
+
+} // namespace
+
+namespace {
+
+enum ImmediateKind : std::uint8_t {
+  NoImmediate,
+  // imm8 rotated right by twice bits 11-8
+  RotatedImmediate,
+  // bits 11-0
+  Immediate12,
+  // bits 19-16 and 11-0
+  Immediate16,
+  // bits 11-8 and 3-0
+  SplitImmediate8,
+  // bits 23-0 sign extended and scaled to bytes
+  BranchOffset,
+  // bits 15-0
+  RegisterList,
+  // bits 23-0
+  Immediate24
+};
+
+enum ShiftKind : std::uint8_t {
+  NoShift,
+  // the rotation of a rotated immediate
+  Rotation,
+  // type in bits 6-5 and amount in bits 11-7
+  ImmediateShift,
+  // type in bits 6-5, amount in rs
+  RegisterShift
+};
+
+enum FlagsKind : std::uint8_t {
+  NoFlags,
+  // S in bit 20
+  SetFlags,
+  // P, U and W in bits 24, 23 and 21
+  IndexFlags,
+  // W in bit 21
+  WritebackFlag,
+  flags_kind_count
+};
+
+enum BitfieldKind : std::uint8_t {
+  NoBitfield,
+  // lsb in bits 11-7, width - 1 in bits 20-16
+  ExtractBitfield,
+  // lsb in bits 11-7, msb in bits 20-16
+  InsertBitfield
+};
+
+// bit positions of the register fields, absent ones are masked off
+struct Layout {
+  std::uint8_t rd, rn, rm, rs;
+  std::uint8_t registers;
+  DecodedInstruction::Operand operand;
+  ImmediateKind immediate;
+  ShiftKind shift;
+  FlagsKind flags;
+  BitfieldKind bitfield;
+};
+
+constexpr auto rd_ = std::uint8_t{1};
+constexpr auto rn_ = std::uint8_t{2};
+constexpr auto rm_ = std::uint8_t{4};
+constexpr auto rs_ = std::uint8_t{8};
+
+using Operand = DecodedInstruction::Operand;
+
+// indexed by Format
+constexpr Layout layouts[] = {
+    // Undefined
+    {0, 0, 0, 0, 0, Operand::None, NoImmediate, NoShift, NoFlags, NoBitfield},
+    // DataProcessingImmediate
+    {12, 16, 0, 0, rd_ | rn_, Operand::Immediate, RotatedImmediate, Rotation,
+     SetFlags, NoBitfield},
+    // DataProcessingRegister
+    {12, 16, 0, 0, rd_ | rn_ | rm_, Operand::ShiftImmediate, NoImmediate,
+     ImmediateShift, SetFlags, NoBitfield},
+    // DataProcessingRegisterShift
+    {12, 16, 0, 8, rd_ | rn_ | rm_ | rs_, Operand::ShiftRegister, NoImmediate,
+     RegisterShift, SetFlags, NoBitfield},
+    // MoveWide
+    {12, 0, 0, 0, rd_, Operand::Immediate, Immediate16, NoShift, NoFlags,
+     NoBitfield},
+    // Multiply
+    {16, 12, 0, 8, rd_ | rn_ | rm_ | rs_, Operand::None, NoImmediate, NoShift,
+     SetFlags, NoBitfield},
+    // MultiplyLong
+    {12, 16, 0, 8, rd_ | rn_ | rm_ | rs_, Operand::None, NoImmediate, NoShift,
+     SetFlags, NoBitfield},
+    // Divide
+    {16, 0, 8, 0, rd_ | rn_ | rm_, Operand::None, NoImmediate, NoShift,
+     NoFlags, NoBitfield},
+    // ExtraLoadStoreImmediate
+    {12, 16, 0, 0, rd_ | rn_, Operand::Immediate, SplitImmediate8, NoShift,
+     IndexFlags, NoBitfield},
+    // ExtraLoadStoreRegister, always lsl #0
+    {12, 16, 0, 0, rd_ | rn_ | rm_, Operand::ShiftImmediate, NoImmediate,
+     NoShift, IndexFlags, NoBitfield},
+    // LoadStoreImmediate
+    {12, 16, 0, 0, rd_ | rn_, Operand::Immediate, Immediate12, NoShift,
+     IndexFlags, NoBitfield},
+    // LoadStoreRegister
+    {12, 16, 0, 0, rd_ | rn_ | rm_, Operand::ShiftImmediate, NoImmediate,
+     ImmediateShift, IndexFlags, NoBitfield},
+    // BitfieldExtract
+    {12, 0, 0, 0, rd_ | rn_, Operand::None, NoImmediate, NoShift, NoFlags,
+     ExtractBitfield},
+    // BitfieldInsert
+    {12, 0, 0, 0, rd_ | rn_, Operand::None, NoImmediate, NoShift, NoFlags,
+     InsertBitfield},
+    // Reverse
+    {12, 0, 0, 0, rd_ | rm_, Operand::None, NoImmediate, NoShift, NoFlags,
+     NoBitfield},
+    // BranchExchange
+    {0, 0, 0, 0, rm_, Operand::None, NoImmediate, NoShift, NoFlags,
+     NoBitfield},
+    // Branch
+    {0, 0, 0, 0, 0, Operand::None, BranchOffset, NoShift, NoFlags, NoBitfield},
+    // BlockTransfer
+    {0, 16, 0, 0, rn_, Operand::None, RegisterList, NoShift, WritebackFlag,
+     NoBitfield},
+    // SupervisorCall
+    {0, 0, 0, 0, 0, Operand::None, Immediate24, NoShift, NoFlags, NoBitfield}};
+
+static_assert(sizeof(layouts) / sizeof(layouts[0]) == SupervisorCall + 1);
+
+// The register fields are gathered into lanes, bytes 0 to 3 holding rd, rn,
+// rm and rs. Rotating the word left by one of these amounts moves a field
+// into its lane: rd from bits 15-12 or 19-16, rn from bits 19-16, 15-12 or
+// 3-0, rm from bits 3-0 or 11-8 and rs from bits 11-8.
+constexpr std::uint8_t lane_rotations[] = {20, 24, 16, 28, 8};
+constexpr auto lane_rotation_count = std::size(lane_rotations);
+
+// the rotation that moves a field at position into lane, or
+// lane_rotation_count if there is none
+constexpr auto lane_rotation(unsigned position, unsigned lane) {
+  auto i = std::size_t{0};
+  while (i < lane_rotation_count &&
+         (position + lane_rotations[i]) % 32 != lane * 8) {
+    ++i;
+  }
+  return i;
+}
+
+// A layout and operation turned into masks, so that decode selects the fields
+// that apply with plain arithmetic instead of tests the compiler would turn
+// into branches. decode builds a DecodedInstruction as four words, the masks
+// are laid out to match. Each takes a cache line of its own.
+struct alignas(64) Extractor {
+  // the operation, 1 for the condition and the operand in their bytes of the
+  // first word
+  Word header;
+  // xored into the operation when rn is pc, turning bfi into bfc
+  Word bfc;
+  // the lanes each of lane_rotations fills
+  std::array<Word, lane_rotation_count> lanes;
+  // the immediate is rotr((word & low) | (word >> 4 & high), rotation), or
+  // the branch offset
+  Word low;
+  Word high;
+  Word branch;
+  Word rotation;
+  // the bytes of the third word that take bits 11-7, as the shift amount
+  // or the lsb
+  Word amount;
+  // the width is (bits 20-16 + 1 - lsb * insert) & width
+  Word width;
+  // 1 for bitfield inserts, whose msb must not be below the lsb, and for
+  // extracts, whose field must end by bit 31
+  Word insert;
+  Word extraction;
+  // 1 for block transfers, which must transfer some register
+  Word block;
+};
+
+constexpr std::uint8_t register_bits[] = {rd_, rn_, rm_, rs_};
+
+constexpr auto positions(const Layout &layout) {
+  return std::array<std::uint8_t, 4>{layout.rd, layout.rn, layout.rm,
+                                     layout.rs};
+}
+
+// whether every register of layout can be rotated into its lane
+constexpr auto in_lanes(const Layout &layout) {
+  for (auto i = 0u; i < 4; ++i) {
+    if ((layout.registers & register_bits[i]) != 0 &&
+        lane_rotation(positions(layout)[i], i) == lane_rotation_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr auto extractor(const Layout &layout, std::uint8_t operation) {
+  auto result = Extractor{};
+  result.header = operation | Word{1} << 8 | Word{layout.operand} << 16;
+  if (layout.bitfield == InsertBitfield) {
+    result.bfc = Instruction::Bfi ^ Instruction::Bfc;
+  }
+  for (auto i = 0u; i < 4; ++i) {
+    if ((layout.registers & register_bits[i]) != 0) {
+      result.lanes[lane_rotation(positions(layout)[i], i)] |= Word{0xF}
+                                                              << (i * 8);
+    }
+  }
+
+  switch (layout.immediate) {
+  case NoImmediate:
+    break;
+  case RotatedImmediate:
+    result.low = 0xFF;
+    break;
+  case Immediate12:
+    result.low = 0xFFF;
+    break;
+  case Immediate16:
+    result.low = 0xFFF;
+    result.high = 0xF000;
+    break;
+  case SplitImmediate8:
+    result.low = 0xF;
+    result.high = 0xF0;
+    break;
+  case BranchOffset:
+    result.branch = ~Word{0};
+    break;
+  case RegisterList:
+    result.low = 0xFFFF;
+    break;
+  case Immediate24:
+    result.low = 0xFFFFFF;
+    break;
+  }
+
+  const auto bitfield = layout.bitfield != NoBitfield;
+  result.rotation = layout.shift == Rotation ? 0x1E : 0;
+  result.amount = (layout.shift == ImmediateShift ? 0xFF00 : 0) |
+                  (bitfield ? 0xFF0000 : 0);
+  result.width = bitfield ? 0xFF : 0;
+  result.insert = layout.bitfield == InsertBitfield ? 1 : 0;
+  result.extraction = layout.bitfield == ExtractBitfield ? 1 : 0;
+  result.block = layout.immediate == RegisterList ? 1 : 0;
+  return result;
+}
+
+constexpr auto lanes_cover_layouts = [] {
+  for (const auto &layout : layouts) {
+    if (!in_lanes(layout)) {
+      return false;
+    }
+  }
+  return true;
+}();
+
+static_assert(lanes_cover_layouts);
+
+// indexed by the shift type in bits 6-5, plus 4 when the amount is 0:
+// lsr #0 and asr #0 mean #32 and ror #0 means rrx
+constexpr std::uint8_t shifts[] = {
+    Instruction::Lsl, Instruction::Lsr, Instruction::Asr, Instruction::Ror,
+    Instruction::Lsl, Instruction::Lsr, Instruction::Asr, Instruction::Rrx};
+constexpr std::uint8_t special_amounts[] = {0, 0, 0, 0, 0, 32, 32, 0};
+
+// the flags of each FlagsKind, indexed by bits 24-20 (P, U, B, W and S)
+constexpr auto flag_tables = [] {
+  using Flags = DecodedInstruction::Flags;
+  auto result = std::array<std::array<std::uint8_t, 32>, flags_kind_count>{};
+  for (auto bits = 0u; bits < 32; ++bits) {
+    const auto p = (bits >> 4) & 1u;
+    const auto u = (bits >> 3) & 1u;
+    const auto w = (bits >> 1) & 1u;
+    const auto s = bits & 1u;
+    result[SetFlags][bits] =
+        static_cast<std::uint8_t>(s * Flags::UpdatesFlags);
+    // post-indexed accesses always write back
+    result[IndexFlags][bits] = static_cast<std::uint8_t>(
+        p * Flags::PreIndex | ((p ^ 1u) | w) * Flags::Writeback |
+        (u ^ 1u) * Flags::Subtract);
+    result[WritebackFlag][bits] =
+        static_cast<std::uint8_t>(w * Flags::Writeback);
+  }
+  return result;
+}();
+
+constexpr auto table_size = row_count * row_size;
+
+// the entry for a word, indexed by bits 27-20 and 7-4
+constexpr auto entry_at(std::size_t index) {
+  return classify(static_cast<unsigned>(index / row_size),
+                  static_cast<unsigned>(index % row_size));
+}
+
+constexpr auto same_entry(const Entry &lhs, const Entry &rhs) {
+  return lhs.format == rhs.format && lhs.operation == rhs.operation;
+}
+
+// the distinct entries, each of which gets an extractor of its own
+constexpr auto extractor_count = [] {
+  auto count = std::size_t{0};
+  auto seen = std::array<Entry, table_size>{};
+  for (auto index = std::size_t{0}; index < table_size; ++index) {
+    const auto entry = entry_at(index);
+    auto found = false;
+    for (auto i = std::size_t{0}; i < count && !found; ++i) {
+      found = same_entry(seen[i], entry);
+    }
+    if (!found) {
+      seen[count++] = entry;
+    }
+  }
+  return count;
+}();
+
+static_assert(extractor_count <= 256);
+
+// what bits 27-20 and 7-4 of a word fix besides its extractor
+struct Slot {
+  std::uint8_t extractor;
+  std::uint8_t flags;
+  std::uint8_t shift;
+  // xored into the shift and its amount when bits 11-7 are 0, lsr #0 and
+  // asr #0 mean #32 and ror #0 means rrx
+  std::uint16_t zero;
+};
+
+constexpr auto slot(std::size_t index, std::uint8_t extractor) {
+  const auto &layout = layouts[entry_at(index).format];
+  const auto high = index / row_size;
+  // bits 6-5
+  const auto type = (index >> 1) & 3u;
+  auto result = Slot{};
+  result.extractor = extractor;
+  result.flags = flag_tables[layout.flags][high & 0x1Fu];
+  switch (layout.shift) {
+  case NoShift:
+    result.shift = Instruction::Lsl;
+    break;
+  case Rotation:
+    result.shift = Instruction::Ror;
+    break;
+  case ImmediateShift:
+  case RegisterShift:
+    result.shift = shifts[type];
+    break;
+  }
+  if (layout.shift == ImmediateShift) {
+    result.zero = static_cast<std::uint16_t>(
+        (result.shift ^ shifts[type + 4]) | special_amounts[type + 4] << 8);
+  }
+  return result;
+}
+
+// A single lookup of bits 27-20 and 7-4 gives the slot for a word, the
+// flags, shift and extractor with the operation and every mask it needs are
+// all in place.
+struct Tables {
+  std::array<Slot, table_size> slots;
+  std::array<Extractor, extractor_count> extractors;
+};
+
+constexpr auto tables = [] {
+  auto result = Tables{};
+  auto entries = std::array<Entry, extractor_count>{};
+  auto count = std::size_t{0};
+  for (auto index = std::size_t{0}; index < table_size; ++index) {
+    const auto entry = entry_at(index);
+    auto found = std::size_t{0};
+    while (found < count && !same_entry(entries[found], entry)) {
+      ++found;
+    }
+    if (found == count) {
+      entries[count] = entry;
+      result.extractors[count] =
+          extractor(layouts[entry.format], entry.operation);
+      ++count;
+    }
+    result.slots[index] = slot(index, static_cast<std::uint8_t>(found));
+  }
+  return result;
+}();
+
+} // namespace
+
+static constexpr auto field(Word word, unsigned lsb, unsigned width) {
+  return static_cast<std::uint8_t>((word >> lsb) & ((1u << width) - 1));
+}
+
+// the host is little-endian, so decode writes the byte fields four at a time
+// rather than leave the compiler to gather them with a chain of shifts
+#if AAVM_GCC || AAVM_CLANG
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+#endif
+static_assert(offsetof(DecodedInstruction, condition) == 1 &&
+              offsetof(DecodedInstruction, operand) == 2 &&
+              offsetof(DecodedInstruction, flags) == 3 &&
+              offsetof(DecodedInstruction, rd) == 4 &&
+              offsetof(DecodedInstruction, shift) == 8 &&
+              offsetof(DecodedInstruction, shift_amount) == 9 &&
+              offsetof(DecodedInstruction, lsb) == 10 &&
+              offsetof(DecodedInstruction, width) == 11 &&
+              offsetof(DecodedInstruction, imm) == 12);
+
+void aavm::vm::decode(std::uint32_t word, DecodedInstruction &instr) {
+  const auto &slot = tables.slots[(word >> 16 & 0xFF0u) | field(word, 4, 4)];
+  const auto &extract = tables.extractors[slot.extractor];
+
+  // rd, rn, rm and rs, rotating by constants only
+  const auto lane = [&](std::size_t i) {
+    return stl::rotl(word, lane_rotations[i]) & extract.lanes[i];
+  };
+  const auto registers = lane(0) | lane(1) | lane(2) | lane(3) | lane(4);
+
+  const auto rotation = word >> 7 & extract.rotation;
+  const auto branch =
+      static_cast<Word>(static_cast<std::int32_t>(word << 8) >> 6);
+  const auto imm =
+      stl::rotr((word & extract.low) | (word >> 4 & extract.high),
+                static_cast<int>(rotation)) |
+      (branch & extract.branch);
+
+  // the shift amount or the lsb
+  const auto bits = word >> 7 & 0x1Fu;
+  // all ones if bits is 0, without a test the compiler could branch on
+  const auto zero = 0u - ((bits - 1u) >> 31);
+  const auto high = word >> 16 & 0x1Fu;
+  const auto width = (high + 1 - bits * extract.insert) & extract.width;
+  const auto shift = (slot.shift ^ (slot.zero & zero)) |
+                     (bits * 0x10100u & extract.amount) | rotation << 8 |
+                     width << 24;
+
+  // a few encodings are only told apart (or ruled out) by their operands
+  const auto bfc = 0u - ((registers & 0xF00u) == 0xF00u);
+  const auto invalid = (word >> 28 == 0xF) | (extract.insert & (high < bits)) |
+                       (extract.extraction & (bits + high > 31)) |
+                       (extract.block & (imm == 0));
+  const auto header = ((extract.header ^ (extract.bfc & bfc)) &
+                       ~(0xFFu & (0u - invalid))) +
+                      (word >> 20 & 0xF00u) + (Word{slot.flags} << 24);
+
+  const Word fields[] = {header, registers, shift, imm};
+  static_assert(sizeof(fields) == sizeof(instr));
+  std::memcpy(&instr, fields, sizeof(fields));
+}
+
+const Label *LabelTable::label_at(std::uint32_t address) {
+  const auto [it, inserted] = lookup_.try_emplace(address, nullptr);
+  if (inserted) {
+    const auto &name = names_.emplace_back(fmt::format("L{:08x}", address));
+    it->second = &labels_.emplace_back(
+        Label{static_cast<LabelID>(labels_.size() + 1), name});
+  }
+  return it->second;
+}
+
+static constexpr auto to_register(std::uint8_t reg) {
+  return static_cast<Register::Kind>(reg + 1);
+}
+
+static auto to_operand2(const DecodedInstruction &instr) {
+  switch (instr.operand) {
+  case DecodedInstruction::ShiftImmediate:
+    return Operand2{ShiftedRegister{
+        to_register(instr.rm),
+        static_cast<Instruction::ShiftOperation>(instr.shift),
+        static_cast<unsigned>(instr.shift_amount)}};
+  case DecodedInstruction::ShiftRegister:
+    return Operand2{ShiftedRegister{
+        to_register(instr.rm),
+        static_cast<Instruction::ShiftOperation>(instr.shift),
+        to_register(instr.rs)}};
+  default:
+    return Operand2{instr.imm};
+  }
+}
+
+std::unique_ptr<Instruction>
+aavm::vm::to_instruction(const DecodedInstruction &instr, std::uint32_t address,
+                         LabelTable &labels) {
+  const auto op = instr.operation;
+  const auto cond = static_cast<Condition::Kind>(instr.condition);
+  const auto s = instr.updatesflags();
+  const auto rd = to_register(instr.rd);
+  const auto rn = to_register(instr.rn);
+  const auto rm = to_register(instr.rm);
+  const auto rs = to_register(instr.rs);
+
+  if (Instruction::is_arithmetic_operation(op)) {
+    return std::make_unique<ArithmeticInstruction>(
+        static_cast<Instruction::ArithmeticOperation>(op), cond, s, rd, rn,
+        to_operand2(instr));
+  }
+  if (Instruction::is_move_operation(op)) {
+    const auto move = static_cast<Instruction::MoveOperation>(op);
+    if (op == Instruction::Movw || op == Instruction::Movt) {
+      return std::make_unique<MoveInstruction>(move, cond, rd, instr.imm);
+    }
+    return std::make_unique<MoveInstruction>(move, cond, s, rd,
+                                             to_operand2(instr));
+  }
+  if (Instruction::is_comparison_operation(op)) {
+    return std::make_unique<ComparisonInstruction>(
+        static_cast<Instruction::ComparisonOperation>(op), cond, rn,
+        to_operand2(instr));
+  }
+  if (Instruction::is_multiply_operation(op)) {
+    const auto multiply = static_cast<Instruction::MultiplyOperation>(op);
+    if (op >= Instruction::Umull) {
+      return std::make_unique<MultiplyInstruction>(multiply, cond, s,
+                                                   std::pair{rd, rn}, rm, rs);
+    }
+    return std::make_unique<MultiplyInstruction>(multiply, cond, s, rd, rm, rs,
+                                                 rn);
+  }
+  if (Instruction::is_divide_operation(op)) {
+    return std::make_unique<DivideInstruction>(
+        static_cast<Instruction::DivideOperation>(op), cond, rd, rn, rm);
+  }
+  if (Instruction::is_bitfield_operation(op)) {
+    const auto bitfield = static_cast<Instruction::BitfieldOperation>(op);
+    if (op == Instruction::Bfc) {
+      return std::make_unique<BitfieldInstruction>(bitfield, cond, rd,
+                                                   instr.lsb, instr.width);
+    }
+    return std::make_unique<BitfieldInstruction>(bitfield, cond, rd, rn,
+                                                 instr.lsb, instr.width);
+  }
+  if (Instruction::is_reverse_operation(op)) {
+    return std::make_unique<ReverseInstruction>(
+        static_cast<Instruction::ReverseOperation>(op), cond, rd, rm);
+  }
+  if (op == Instruction::B || op == Instruction::Bl) {
+    const auto target = address + 8 + instr.imm;
+    return std::make_unique<BranchInstruction>(
+        static_cast<Instruction::BranchOperation>(op), cond,
+        labels.label_at(target));
+  }
+  if (op == Instruction::Bx) {
+    return std::make_unique<BranchInstruction>(Instruction::Bx, cond, rm);
+  }
+  if (Instruction::is_single_memory_operation(op)) {
+    using IndexMode = SingleMemoryInstruction::IndexMode;
+    const auto preindex = (instr.flags & DecodedInstruction::PreIndex) != 0;
+    const auto writeback = (instr.flags & DecodedInstruction::Writeback) != 0;
+    const auto mode = !preindex   ? IndexMode::PostIndex
+                      : writeback ? IndexMode::PreIndex
+                                  : IndexMode::Offset;
+    return std::make_unique<SingleMemoryInstruction>(
+        static_cast<Instruction::SingleMemoryOperation>(op), cond, rd, rn,
+        to_operand2(instr), mode,
+        (instr.flags & DecodedInstruction::Subtract) != 0);
+  }
+  if (Instruction::is_block_memory_operation(op)) {
+    auto registers = std::vector<Register::Kind>{};
+    for (auto reg = std::uint8_t{0}; reg < 16; ++reg) {
+      if ((instr.imm >> reg) & 1u) {
+        registers.push_back(to_register(reg));
+      }
+    }
+    return std::make_unique<BlockMemoryInstruction>(
+        static_cast<Instruction::BlockMemoryOperation>(op), cond, rn,
+        (instr.flags & DecodedInstruction::Writeback) != 0, registers);
+  }
+  if (op == Instruction::Svc) {
+    return std::make_unique<SystemInstruction>(Instruction::Svc, cond,
+                                               instr.imm);
+  }
+  return nullptr;
+}
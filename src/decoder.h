@@ -0,0 +1,99 @@
+#ifndef AAVM_VM_DECODER_H_
+#define AAVM_VM_DECODER_H_
+
+#include "instruction.h"
+#include "instructions.h"
+#include "label.h"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace aavm::vm {
+
+// A decoded A32 instruction in a flat, fixed-size form the execution engines
+// can consume without chasing pointers. Registers are hardware numbers (0-15),
+// not ir::Register kinds.
+struct DecodedInstruction {
+  enum Operand : std::uint8_t {
+    None,
+    // imm holds the value, shift and shift_amount the rotation it came from
+    Immediate,
+    // rm shifted by shift_amount
+    ShiftImmediate,
+    // rm shifted by the bottom byte of rs
+    ShiftRegister
+  };
+
+  enum Flags : std::uint8_t {
+    UpdatesFlags = 1 << 0,
+    Writeback = 1 << 1,
+    // the offset is subtracted from the base
+    Subtract = 1 << 2,
+    // the offset is applied before the access
+    PreIndex = 1 << 3
+  };
+
+  // an ir::Instruction operation, 0 if the word is not supported
+  std::uint8_t operation;
+  // an ir::Condition::Kind
+  std::uint8_t condition;
+  Operand operand;
+  std::uint8_t flags;
+
+  // multiplies use rn for the accumulator, long multiplies use rd for the low
+  // and rn for the high word
+  std::uint8_t rd;
+  std::uint8_t rn;
+  std::uint8_t rm;
+  std::uint8_t rs;
+
+  // an ir::Instruction::ShiftOperation, lsr #32 and asr #32 keep their amount
+  std::uint8_t shift;
+  std::uint8_t shift_amount;
+  std::uint8_t lsb;
+  std::uint8_t width;
+
+  // immediate operand, memory offset, imm16, register list, svc number or
+  // the signed branch displacement from pc (the instruction address plus 8)
+  std::uint32_t imm;
+
+  constexpr auto valid() const { return operation != 0; }
+  constexpr auto updatesflags() const { return (flags & UpdatesFlags) != 0; }
+};
+
+static_assert(sizeof(DecodedInstruction) == 16);
+
+// Decodes word with a single table lookup. Bits 27-20 and 7-4 select an entry,
+// which fixes the operation and the operand layout, the remaining fields are
+// extracted without further tests. Every field of instr
+// is written, filling it in place avoids packing the result into registers.
+void decode(std::uint32_t word, DecodedInstruction &instr);
+
+inline DecodedInstruction decode(std::uint32_t word) {
+  auto instr = DecodedInstruction{};
+  decode(word, instr);
+  return instr;
+}
+
+// Labels for branch targets, named after the address they mark.
+class LabelTable {
+public:
+  const ir::Label *label_at(std::uint32_t address);
+
+private:
+  std::deque<std::string> names_{};
+  std::deque<ir::Label> labels_{};
+  std::unordered_map<std::uint32_t, const ir::Label *> lookup_{};
+};
+
+// Builds the IR for a decoded instruction at address, branch targets refer to
+// labels from labels. Returns nullptr for unsupported instructions.
+std::unique_ptr<ir::Instruction> to_instruction(const DecodedInstruction &instr,
+                                                std::uint32_t address,
+                                                LabelTable &labels);
+
+} // namespace aavm::vm
+
+#endif
@@ -0,0 +1,221 @@
+#include "elfwriter.h"
+#include "fileio.h"
+#include <algorithm>
+#include <string_view>
+#include <utility>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::assembler::elf;
+using namespace aavm::ir;
+using namespace std::string_view_literals;
+
+// the tables are written straight from memory, which assumes a little-endian
+// host like the ARM targets we emit for
+#if AAVM_GCC || AAVM_CLANG
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+#endif
+
+// ".text" is the tail of ".rel.text"
+static constexpr auto section_names =
+    "\0.rel.text\0.symtab\0.strtab\0.shstrtab\0"sv;
+static constexpr auto text_name = std::uint32_t{5};
+static constexpr auto rel_text_name = std::uint32_t{1};
+static constexpr auto symtab_name = std::uint32_t{11};
+static constexpr auto strtab_name = std::uint32_t{19};
+static constexpr auto shstrtab_name = std::uint32_t{27};
+
+static constexpr auto padding = std::array<char, 4>{};
+
+static constexpr auto align4(std::size_t size) {
+  return (size + 3) & ~std::size_t{3};
+}
+
+static constexpr auto symbol_info(unsigned binding, unsigned type) {
+  return static_cast<std::uint8_t>(binding << 4 | type);
+}
+
+// symbol bindings and types
+static constexpr auto stb_local = 0u;
+static constexpr auto stb_global = 1u;
+static constexpr auto stt_notype = 0u;
+static constexpr auto stt_section = 3u;
+
+static constexpr auto relocation_type(std::uint32_t word, FixupKind kind) {
+  switch (kind) {
+  case FixupKind::Branch:
+    // only an unconditional bl may be turned into blx by the linker
+    return (word >> 24 & 1u) != 0 && word >> 28 == 0xEu ? R_ARM_CALL
+                                                        : R_ARM_JUMP24;
+  case FixupKind::Adr:
+    return R_ARM_ALU_PC_G0;
+  case FixupKind::Load12:
+    return R_ARM_LDR_PC_G0;
+  case FixupKind::Load8:
+    return R_ARM_LDRS_PC_G0;
+  }
+  return R_ARM_JUMP24;
+}
+
+ElfWriter::ElfWriter(const Assembler &assembler,
+                     std::vector<std::string> exports)
+    : assembler_{assembler}, exports_{std::move(exports)} {
+  build_symbols();
+  build_relocations();
+  build_headers();
+}
+
+void ElfWriter::build_symbols() {
+  strings_.push_back('\0');
+  const auto add_string = [&](std::string_view name) {
+    const auto offset = static_cast<std::uint32_t>(strings_.size());
+    strings_.append(name);
+    strings_.push_back('\0');
+    return offset;
+  };
+
+  symbols_.push_back(Symbol{});
+  symbols_.push_back(
+      Symbol{0, 0, 0, symbol_info(stb_local, stt_section), 0, Text});
+  // mapping symbols mark where arm code and literal data start
+  symbols_.push_back(Symbol{add_string("$a"sv), 0, 0,
+                            symbol_info(stb_local, stt_notype), 0, Text});
+  const auto pool_offset = assembler_.literal_pool_offset();
+  if (pool_offset < assembler_.code().size() * sizeof(std::uint32_t)) {
+    symbols_.push_back(Symbol{add_string("$d"sv), pool_offset, 0,
+                              symbol_info(stb_local, stt_notype), 0, Text});
+  }
+
+  // defined labels stay local to the object, so that objects that each
+  // have a loop of their own link together, and must come before the
+  // globals
+  const auto &labels = assembler_.labels();
+  label_symbols_.resize(labels.size() + 1);
+  const auto add_labels = [&](bool global) {
+    for (const auto &label : labels) {
+      const auto address = assembler_.label_address(label);
+      const auto exported =
+          !address || std::find(exports_.begin(), exports_.end(),
+                                label.name()) != exports_.end();
+      if (exported != global) {
+        continue;
+      }
+      label_symbols_[label.id()] = static_cast<std::uint32_t>(symbols_.size());
+      symbols_.push_back(
+          Symbol{add_string(label.name()), address.value_or(0), 0,
+                 symbol_info(global ? stb_global : stb_local, stt_notype), 0,
+                 static_cast<std::uint16_t>(address ? Text : 0)});
+    }
+  };
+  add_labels(false);
+  first_global_ = static_cast<std::uint32_t>(symbols_.size());
+  add_labels(true);
+}
+
+void ElfWriter::build_relocations() {
+  const auto &code = assembler_.code();
+  for (const auto &fixup : assembler_.unresolved_fixups()) {
+    const auto word = code[fixup.offset / sizeof(std::uint32_t)];
+    relocations_.push_back(
+        Relocation{fixup.offset, label_symbols_[fixup.label] << 8 |
+                                     relocation_type(word, fixup.kind)});
+  }
+  // unresolved fixups are gathered per label, linkers expect them in order
+  std::sort(relocations_.begin(), relocations_.end(),
+            [](const auto &lhs, const auto &rhs) {
+              return lhs.offset < rhs.offset;
+            });
+}
+
+void ElfWriter::build_headers() {
+  const auto text_size = static_cast<std::uint32_t>(
+      assembler_.code().size() * sizeof(std::uint32_t));
+  const auto rel_size =
+      static_cast<std::uint32_t>(relocations_.size() * sizeof(Relocation));
+  const auto symtab_size =
+      static_cast<std::uint32_t>(symbols_.size() * sizeof(Symbol));
+  const auto strtab_size = static_cast<std::uint32_t>(strings_.size());
+  const auto shstrtab_size = static_cast<std::uint32_t>(section_names.size());
+
+  auto offset = static_cast<std::uint32_t>(sizeof(FileHeader));
+  const auto place = [&](std::uint32_t size) {
+    const auto placed = offset;
+    offset += size;
+    return placed;
+  };
+  const auto text_offset = place(text_size);
+  const auto rel_offset = place(rel_size);
+  const auto symtab_offset = place(symtab_size);
+  const auto strtab_offset = place(strtab_size);
+  const auto shstrtab_offset = place(shstrtab_size);
+  const auto section_header_offset = static_cast<std::uint32_t>(align4(offset));
+
+  const auto section = [](std::uint32_t name, std::uint32_t type,
+                           std::uint32_t flags, std::uint32_t offset,
+                           std::uint32_t size, std::uint32_t alignment) {
+    return SectionHeader{name, type, flags, 0, offset, size, 0, 0, alignment,
+                         0};
+  };
+  // SHT_PROGBITS with SHF_ALLOC | SHF_EXECINSTR
+  section_headers_[Text] =
+      section(text_name, 1, 0x6, text_offset, text_size, 4);
+  // SHT_REL with SHF_INFO_LINK, relocates Text against Symtab
+  section_headers_[RelText] =
+      section(rel_text_name, 9, 0x40, rel_offset, rel_size, 4);
+  section_headers_[RelText].link = Symtab;
+  section_headers_[RelText].info = Text;
+  section_headers_[RelText].entry_size = sizeof(Relocation);
+  // SHT_SYMTAB, info is the index of the first global symbol
+  section_headers_[Symtab] =
+      section(symtab_name, 2, 0, symtab_offset, symtab_size, 4);
+  section_headers_[Symtab].link = Strtab;
+  section_headers_[Symtab].info = first_global_;
+  section_headers_[Symtab].entry_size = sizeof(Symbol);
+  // SHT_STRTAB
+  section_headers_[Strtab] =
+      section(strtab_name, 3, 0, strtab_offset, strtab_size, 1);
+  section_headers_[Shstrtab] =
+      section(shstrtab_name, 3, 0, shstrtab_offset, shstrtab_size, 1);
+
+  header_.ident = {0x7F, 'E', 'L', 'F', 1 /* ELFCLASS32 */,
+                   1 /* ELFDATA2LSB */, 1 /* EV_CURRENT */};
+  header_.type = 1;     // ET_REL
+  header_.machine = 40; // EM_ARM
+  header_.version = 1;
+  header_.section_header_offset = section_header_offset;
+  header_.flags = 0x05000000; // EABI version 5
+  header_.header_size = sizeof(FileHeader);
+  header_.section_header_size = sizeof(SectionHeader);
+  header_.section_header_count = SectionCount;
+  header_.section_names_index = Shstrtab;
+}
+
+bool ElfWriter::write(const char *path) const {
+  const auto fd = fileio::open_for_writing(path);
+  if (fd < 0) {
+    return false;
+  }
+  const auto ok = write_to(fd);
+  fileio::close_file(fd);
+  return ok;
+}
+
+bool ElfWriter::write_to(int fd) const {
+  using fileio::Buffer;
+  const auto &code = assembler_.code();
+  const auto strings_end = section_headers_[Shstrtab].offset +
+                           section_headers_[Shstrtab].size;
+  const auto padding_size = header_.section_header_offset - strings_end;
+
+  const auto buffers = std::array<Buffer, 8>{
+      Buffer{&header_, sizeof(header_)},
+      Buffer{code.data(), code.size() * sizeof(std::uint32_t)},
+      Buffer{relocations_.data(), relocations_.size() * sizeof(Relocation)},
+      Buffer{symbols_.data(), symbols_.size() * sizeof(Symbol)},
+      Buffer{strings_.data(), strings_.size()},
+      Buffer{section_names.data(), section_names.size()},
+      Buffer{padding.data(), padding_size},
+      Buffer{section_headers_.data(),
+             section_headers_.size() * sizeof(SectionHeader)}};
+  return fileio::write_buffers(fd, buffers.data(), buffers.size());
+}
@@ -0,0 +1,131 @@
+#ifndef AAVM_ASSEMBLER_ELFWRITER_H_
+#define AAVM_ASSEMBLER_ELFWRITER_H_
+
+#include "assembler.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace aavm::assembler {
+
+namespace elf {
+
+struct FileHeader {
+  std::array<std::uint8_t, 16> ident;
+  std::uint16_t type;
+  std::uint16_t machine;
+  std::uint32_t version;
+  std::uint32_t entry;
+  std::uint32_t program_header_offset;
+  std::uint32_t section_header_offset;
+  std::uint32_t flags;
+  std::uint16_t header_size;
+  std::uint16_t program_header_size;
+  std::uint16_t program_header_count;
+  std::uint16_t section_header_size;
+  std::uint16_t section_header_count;
+  std::uint16_t section_names_index;
+};
+
+struct SectionHeader {
+  std::uint32_t name;
+  std::uint32_t type;
+  std::uint32_t flags;
+  std::uint32_t address;
+  std::uint32_t offset;
+  std::uint32_t size;
+  std::uint32_t link;
+  std::uint32_t info;
+  std::uint32_t alignment;
+  std::uint32_t entry_size;
+};
+
+struct Symbol {
+  std::uint32_t name;
+  std::uint32_t value;
+  std::uint32_t size;
+  std::uint8_t info;
+  std::uint8_t other;
+  std::uint16_t section;
+};
+
+struct Relocation {
+  std::uint32_t offset;
+  std::uint32_t info;
+};
+
+static_assert(sizeof(FileHeader) == 52);
+static_assert(sizeof(SectionHeader) == 40);
+static_assert(sizeof(Symbol) == 16);
+static_assert(sizeof(Relocation) == 8);
+
+// section header indices
+enum Section : std::uint16_t {
+  Null,
+  Text,
+  RelText,
+  Symtab,
+  Strtab,
+  Shstrtab,
+  SectionCount
+};
+
+// relocation types from the ARM ELF ABI
+enum RelocationType : std::uint32_t {
+  R_ARM_LDR_PC_G0 = 4,
+  R_ARM_CALL = 28,
+  R_ARM_JUMP24 = 29,
+  R_ARM_ALU_PC_G0 = 58,
+  R_ARM_LDRS_PC_G0 = 64
+};
+
+} // namespace elf
+
+// Writes the output of an Assembler as an ELF32 ARM relocatable object. Labels
+// the code defines become local symbols, except the exported ones, which
+// become global along with the labels it only refers to, and every
+// unresolved fixup becomes a REL relocation.
+// Headers and tables are built in place and written together with the code
+// in a single writev, the code is never copied.
+class ElfWriter {
+public:
+  ElfWriter() = delete;
+  // exports names the defined labels other objects can refer to
+  explicit ElfWriter(const Assembler &assembler,
+                     std::vector<std::string> exports = {"_start"});
+
+  bool write(const char *path) const;
+  bool write_to(int fd) const;
+
+  constexpr auto &header() const { return header_; }
+  constexpr auto &section_headers() const { return section_headers_; }
+  constexpr auto &symbols() const { return symbols_; }
+  constexpr auto &relocations() const { return relocations_; }
+
+private:
+  void build_symbols();
+  void build_relocations();
+  void build_headers();
+
+  const Assembler &assembler_;
+  std::vector<std::string> exports_;
+
+  elf::FileHeader header_{};
+  std::array<elf::SectionHeader, elf::SectionCount> section_headers_{};
+  std::vector<elf::Symbol> symbols_{};
+  std::vector<elf::Relocation> relocations_{};
+  std::string strings_{};
+  // symbol table index of each label, indexed by LabelID
+  std::vector<std::uint32_t> label_symbols_{};
+  std::uint32_t first_global_{};
+};
+
+} // namespace aavm::assembler
+
+namespace aavm {
+using ElfWriter = assembler::ElfWriter;
+}
+
+#endif
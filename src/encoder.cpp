@@ -0,0 +1,537 @@
+#include "encoder.h"
+#include "instructions.h"
+#include "operand2.h"
+#include <variant>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto data_processing_opcode(unsigned op) -> Word {
+  switch (op) {
+  case Instruction::And:
+    return 0b0000;
+  case Instruction::Eor:
+    return 0b0001;
+  case Instruction::Sub:
+    return 0b0010;
+  case Instruction::Rsb:
+    return 0b0011;
+  case Instruction::Add:
+  case Instruction::Adr:
+    return 0b0100;
+  case Instruction::Adc:
+    return 0b0101;
+  case Instruction::Sbc:
+    return 0b0110;
+  case Instruction::Rsc:
+    return 0b0111;
+  case Instruction::Tst:
+    return 0b1000;
+  case Instruction::Teq:
+    return 0b1001;
+  case Instruction::Cmp:
+    return 0b1010;
+  case Instruction::Cmn:
+    return 0b1011;
+  case Instruction::Orr:
+    return 0b1100;
+  case Instruction::Mov:
+    return 0b1101;
+  case Instruction::Bic:
+    return 0b1110;
+  case Instruction::Mvn:
+    return 0b1111;
+  default:
+    return 0;
+  }
+}
+
+static constexpr auto shift_type(Instruction::ShiftOperation sh) -> Word {
+  switch (sh) {
+  case Instruction::Lsl:
+    return 0b00;
+  case Instruction::Lsr:
+    return 0b01;
+  case Instruction::Asr:
+    return 0b10;
+  case Instruction::Ror:
+  case Instruction::Rrx:
+    return 0b11;
+  }
+  return 0;
+}
+
+// the imm5 field for an immediate shift, lsr #32 and asr #32 are encoded as 0
+// and rrx is ror #0
+static constexpr auto encode_shift_amount(Instruction::ShiftOperation sh,
+                                          unsigned shamt)
+    -> std::optional<Word> {
+  switch (sh) {
+  case Instruction::Lsl:
+    return shamt < 32 ? std::optional{Word{shamt}} : std::nullopt;
+  case Instruction::Lsr:
+  case Instruction::Asr:
+    return shamt >= 1 && shamt <= 32 ? std::optional{Word{shamt & 31u}}
+                                     : std::nullopt;
+  case Instruction::Ror:
+    return shamt >= 1 && shamt < 32 ? std::optional{Word{shamt}}
+                                    : std::nullopt;
+  case Instruction::Rrx:
+    return Word{0};
+  }
+  return std::nullopt;
+}
+
+// the shifter operand bits for a register operand: rm with an immediate shift
+// (bit 4 clear) or a register shift (bit 4 set)
+static constexpr auto encode_shifted_register(const ShiftedRegister &rm)
+    -> std::optional<Word> {
+  const auto type = shift_type(rm.sh());
+  if (rm.immediate()) {
+    const auto shamt = encode_shift_amount(rm.sh(), rm.shamt5());
+    if (!shamt) {
+      return std::nullopt;
+    }
+    return *shamt << 7 | type << 5 | encode_register(rm.rm());
+  }
+
+  if (rm.sh() == Instruction::Rrx) {
+    return std::nullopt;
+  }
+  return encode_register(rm.rs()) << 8 | type << 5 | Word{1} << 4 |
+         encode_register(rm.rm());
+}
+
+// the shifter operand bits including the immediate flag (bit 25)
+static constexpr auto encode_operand2(const Operand2 &src2)
+    -> std::optional<Word> {
+  if (src2.immediate()) {
+    const auto imm12 = encode_modified_immediate(src2.imm12());
+    return imm12 ? std::optional{Word{1} << 25 | *imm12} : std::nullopt;
+  }
+  return encode_shifted_register(src2.rm());
+}
+
+static constexpr auto data_processing(const Instruction &instr, Word rd,
+                                      Word rn, const Operand2 &src2)
+    -> std::optional<Word> {
+  const auto operand = encode_operand2(src2);
+  if (!operand) {
+    return std::nullopt;
+  }
+  return encode_condition(instr.condition()) << 28 |
+         data_processing_opcode(instr.operation()) << 21 |
+         Word{instr.updatesflags()} << 20 | rn << 16 | rd << 12 | *operand;
+}
+
+static auto encode_arithmetic(const ArithmeticInstruction &instr)
+    -> std::optional<Word> {
+  if (instr.operation() == Instruction::Adr) {
+    // add rd, pc, #0 until the fixup is applied
+    return encode_condition(instr.condition()) << 28 | Word{1} << 25 |
+           data_processing_opcode(Instruction::Add) << 21 |
+           encode_register(Register::PC) << 16 |
+           encode_register(instr.rd()) << 12;
+  }
+  return data_processing(instr, encode_register(instr.rd()),
+                         encode_register(instr.rn()), instr.src2());
+}
+
+static auto encode_multiply(const MultiplyInstruction &instr)
+    -> std::optional<Word> {
+  const auto cond = encode_condition(instr.condition()) << 28;
+  const auto s = Word{instr.updatesflags()} << 20;
+  const auto rm = encode_register(instr.rm());
+  const auto rs = encode_register(instr.rs()) << 8;
+  const auto multiply = Word{0b1001} << 4;
+
+  switch (instr.operation()) {
+  case Instruction::Mul:
+    return cond | s | encode_register(instr.rd()) << 16 | rs | multiply | rm;
+  case Instruction::Mla:
+    return cond | Word{0b001} << 21 | s | encode_register(instr.rd()) << 16 |
+           encode_register(instr.rn()) << 12 | rs | multiply | rm;
+  case Instruction::Mls:
+    if (instr.updatesflags()) {
+      return std::nullopt;
+    }
+    return cond | Word{0b011} << 21 | encode_register(instr.rd()) << 16 |
+           encode_register(instr.rn()) << 12 | rs | multiply | rm;
+  case Instruction::Umull:
+  case Instruction::Umlal:
+  case Instruction::Smull:
+  case Instruction::Smlal: {
+    const auto opcode = Word{0b100} + (instr.operation() - Instruction::Umull);
+    return cond | opcode << 21 | s | encode_register(instr.rdhi()) << 16 |
+           encode_register(instr.rdlo()) << 12 | rs | multiply | rm;
+  }
+  default:
+    return std::nullopt;
+  }
+}
+
+static auto encode_divide(const DivideInstruction &instr)
+    -> std::optional<Word> {
+  const auto opcode =
+      instr.operation() == Instruction::Sdiv ? Word{0b0001} : Word{0b0011};
+  return encode_condition(instr.condition()) << 28 | Word{0b0111} << 24 |
+         opcode << 20 | encode_register(instr.rd()) << 16 | Word{0b1111} << 12 |
+         encode_register(instr.rm()) << 8 | Word{0b0001} << 4 |
+         encode_register(instr.rn());
+}
+
+static auto encode_move(const MoveInstruction &instr) -> std::optional<Word> {
+  switch (instr.operation()) {
+  case Instruction::Mov:
+  case Instruction::Mvn:
+    return data_processing(instr, encode_register(instr.rd()), 0,
+                           instr.src2());
+  case Instruction::Movw:
+  case Instruction::Movt: {
+    if (instr.imm16() > 0xFFFFu) {
+      return std::nullopt;
+    }
+    const auto opcode =
+        instr.operation() == Instruction::Movw ? Word{0b0000} : Word{0b0100};
+    return encode_condition(instr.condition()) << 28 | Word{0b0011} << 24 |
+           opcode << 20 | (instr.imm16() >> 12) << 16 |
+           encode_register(instr.rd()) << 12 | (instr.imm16() & 0xFFFu);
+  }
+  default:
+    return std::nullopt;
+  }
+}
+
+static auto encode_comparison(const ComparisonInstruction &instr)
+    -> std::optional<Word> {
+  return data_processing(instr, 0, encode_register(instr.rn()), instr.src2());
+}
+
+static auto encode_bitfield(const BitfieldInstruction &instr)
+    -> std::optional<Word> {
+  const auto lsb = Word{instr.lsb()};
+  const auto width = Word{instr.width()};
+  if (lsb > 31 || width < 1 || width > 32 - lsb) {
+    return std::nullopt;
+  }
+
+  const auto cond = encode_condition(instr.condition()) << 28;
+  const auto rd = encode_register(instr.rd()) << 12;
+  switch (instr.operation()) {
+  case Instruction::Bfc:
+  case Instruction::Bfi: {
+    const auto rn = instr.operation() == Instruction::Bfc
+                        ? Word{0b1111}
+                        : encode_register(instr.rn());
+    return cond | Word{0b0111110} << 21 | (lsb + width - 1) << 16 | rd |
+           lsb << 7 | Word{0b001} << 4 | rn;
+  }
+  case Instruction::Sbfx:
+  case Instruction::Ubfx: {
+    const auto opcode =
+        instr.operation() == Instruction::Sbfx ? Word{0b0111101}
+                                               : Word{0b0111111};
+    return cond | opcode << 21 | (width - 1) << 16 | rd | lsb << 7 |
+           Word{0b101} << 4 | encode_register(instr.rn());
+  }
+  default:
+    return std::nullopt;
+  }
+}
+
+static auto encode_reverse(const ReverseInstruction &instr)
+    -> std::optional<Word> {
+  auto opcode = Word{};
+  auto type = Word{};
+  switch (instr.operation()) {
+  case Instruction::Rbit:
+    opcode = 0b01101111;
+    type = 0b0011;
+    break;
+  case Instruction::Rev:
+    opcode = 0b01101011;
+    type = 0b0011;
+    break;
+  case Instruction::Rev16:
+    opcode = 0b01101011;
+    type = 0b1011;
+    break;
+  case Instruction::Revsh:
+    opcode = 0b01101111;
+    type = 0b1011;
+    break;
+  default:
+    return std::nullopt;
+  }
+  return encode_condition(instr.condition()) << 28 | opcode << 20 |
+         Word{0b1111} << 16 | encode_register(instr.rd()) << 12 |
+         Word{0b1111} << 8 | type << 4 | encode_register(instr.rm());
+}
+
+static auto encode_branch(const BranchInstruction &instr)
+    -> std::optional<Word> {
+  const auto cond = encode_condition(instr.condition()) << 28;
+  switch (instr.operation()) {
+  case Instruction::B:
+    return cond | Word{0b1010} << 24;
+  case Instruction::Bl:
+    return cond | Word{0b1011} << 24;
+  case Instruction::Bx:
+    return cond | Word{0x012FFF1} << 4 | encode_register(instr.rm());
+  default:
+    // cbz and cbnz only exist in T32
+    return std::nullopt;
+  }
+}
+
+static constexpr auto is_extra_load_store(unsigned op) {
+  return op == Instruction::Ldrh || op == Instruction::Ldrsb ||
+         op == Instruction::Ldrsh || op == Instruction::Strh;
+}
+
+static constexpr auto is_load(unsigned op) {
+  return op >= Instruction::Ldr && op <= Instruction::Ldrsh;
+}
+
+// the fixed bits of a load or store with a positive immediate offset of 0
+static auto single_memory_base(const SingleMemoryInstruction &instr, Word rn,
+                               bool preindex, bool writeback) -> Word {
+  const auto op = instr.operation();
+  const auto common = encode_condition(instr.condition()) << 28 |
+                      Word{preindex} << 24 | Word{1} << 23 |
+                      Word{writeback} << 21 | Word{is_load(op)} << 20 |
+                      rn << 16 | encode_register(instr.rd()) << 12;
+  if (is_extra_load_store(op)) {
+    // S and H bits select between the halfword and signed byte forms
+    const auto sh = op == Instruction::Ldrsb   ? Word{0b10}
+                    : op == Instruction::Ldrsh ? Word{0b11}
+                                               : Word{0b01};
+    return common | Word{1} << 22 | Word{1} << 7 | sh << 5 | Word{1} << 4;
+  }
+  const auto byte = op == Instruction::Ldrb || op == Instruction::Strb;
+  return common | Word{0b01} << 26 | Word{byte} << 22;
+}
+
+static auto encode_single_memory(const SingleMemoryInstruction &instr)
+    -> std::optional<Word> {
+  const auto source = instr.source();
+  const auto pc = encode_register(Register::PC);
+  if (!std::holds_alternative<Operand2>(source)) {
+    // labels and literals are addressed relative to pc
+    if (std::holds_alternative<unsigned>(source) &&
+        instr.operation() != Instruction::Ldr) {
+      return std::nullopt;
+    }
+    return single_memory_base(instr, pc, true, false);
+  }
+
+  const auto &src2 = std::get<Operand2>(source);
+  const auto mode = instr.indexmode();
+  // [rn] is parsed as a post-indexed access with no offset
+  const auto no_offset = src2.immediate() && src2.imm12() == 0;
+  const auto preindex =
+      mode != SingleMemoryInstruction::IndexMode::PostIndex || no_offset;
+  const auto writeback = mode == SingleMemoryInstruction::IndexMode::PreIndex;
+  auto word = single_memory_base(instr, encode_register(instr.rn()), preindex,
+                                 writeback);
+
+  if (src2.immediate()) {
+    auto offset = src2.imm12();
+    auto subtract = instr.subtract();
+    // #-4 is parsed as the two's complement of 4
+    if (offset > 0xFFFu) {
+      offset = 0u - offset;
+      subtract = !subtract;
+    }
+    if (subtract) {
+      word &= ~(Word{1} << 23);
+    }
+    if (is_extra_load_store(instr.operation())) {
+      if (offset > 0xFFu) {
+        return std::nullopt;
+      }
+      return word | (offset & 0xF0u) << 4 | (offset & 0xFu);
+    }
+    return offset <= 0xFFFu ? std::optional{word | offset} : std::nullopt;
+  }
+
+  if (instr.subtract()) {
+    word &= ~(Word{1} << 23);
+  }
+  const auto &rm = src2.rm();
+  if (!rm.immediate()) {
+    return std::nullopt;
+  }
+  if (is_extra_load_store(instr.operation())) {
+    if (rm.sh() != Instruction::Lsl || rm.shamt5() != 0) {
+      return std::nullopt;
+    }
+    // the register form clears the immediate flag (bit 22)
+    return (word & ~(Word{1} << 22)) | encode_register(rm.rm());
+  }
+  const auto shifted = encode_shifted_register(rm);
+  return shifted ? std::optional{word | Word{1} << 25 | *shifted}
+                 : std::nullopt;
+}
+
+static auto encode_block_memory(const BlockMemoryInstruction &instr)
+    -> std::optional<Word> {
+  auto preindex = false;
+  auto increment = true;
+  auto load = true;
+  switch (instr.operation()) {
+  case Instruction::Ldm:
+  case Instruction::Ldmia:
+  case Instruction::Pop:
+    break;
+  case Instruction::Ldmib:
+    preindex = true;
+    break;
+  case Instruction::Ldmda:
+    increment = false;
+    break;
+  case Instruction::Ldmdb:
+    preindex = true;
+    increment = false;
+    break;
+  case Instruction::Stm:
+  case Instruction::Stmia:
+    load = false;
+    break;
+  case Instruction::Stmib:
+    preindex = true;
+    load = false;
+    break;
+  case Instruction::Stmda:
+    increment = false;
+    load = false;
+    break;
+  case Instruction::Stmdb:
+  case Instruction::Push:
+    preindex = true;
+    increment = false;
+    load = false;
+    break;
+  default:
+    return std::nullopt;
+  }
+
+  const auto registers = Word{instr.register_mask()};
+  if (registers == 0) {
+    return std::nullopt;
+  }
+
+  return encode_condition(instr.condition()) << 28 | Word{0b100} << 25 |
+         Word{preindex} << 24 | Word{increment} << 23 |
+         Word{instr.writeback()} << 21 | Word{load} << 20 |
+         encode_register(instr.rn()) << 16 | registers;
+}
+
+static auto encode_system(const SystemInstruction &instr)
+    -> std::optional<Word> {
+  if (instr.imm24() > 0xFFFFFFu) {
+    return std::nullopt;
+  }
+  return encode_condition(instr.condition()) << 28 | Word{0b1111} << 24 |
+         instr.imm24();
+}
+
+std::optional<std::uint32_t> aavm::assembler::encode(const Instruction &instr) {
+  if (const auto arithmetic = cast<ArithmeticInstruction>(&instr)) {
+    return encode_arithmetic(*arithmetic);
+  }
+  if (const auto multiply = cast<MultiplyInstruction>(&instr)) {
+    return encode_multiply(*multiply);
+  }
+  if (const auto divide = cast<DivideInstruction>(&instr)) {
+    return encode_divide(*divide);
+  }
+  if (const auto move = cast<MoveInstruction>(&instr)) {
+    return encode_move(*move);
+  }
+  if (const auto comparison = cast<ComparisonInstruction>(&instr)) {
+    return encode_comparison(*comparison);
+  }
+  if (const auto bitfield = cast<BitfieldInstruction>(&instr)) {
+    return encode_bitfield(*bitfield);
+  }
+  if (const auto reverse = cast<ReverseInstruction>(&instr)) {
+    return encode_reverse(*reverse);
+  }
+  if (const auto branch = cast<BranchInstruction>(&instr)) {
+    return encode_branch(*branch);
+  }
+  if (const auto memory = cast<SingleMemoryInstruction>(&instr)) {
+    return encode_single_memory(*memory);
+  }
+  if (const auto memory = cast<BlockMemoryInstruction>(&instr)) {
+    return encode_block_memory(*memory);
+  }
+  if (const auto system = cast<SystemInstruction>(&instr)) {
+    return encode_system(*system);
+  }
+  return std::nullopt;
+}
+
+std::optional<FixupKind>
+aavm::assembler::fixup_kind(const Instruction &instr) {
+  if (instr.operation() == Instruction::Adr) {
+    return FixupKind::Adr;
+  }
+  if (instr.operation() == Instruction::B ||
+      instr.operation() == Instruction::Bl) {
+    return FixupKind::Branch;
+  }
+  if (const auto memory = cast<SingleMemoryInstruction>(&instr)) {
+    if (std::holds_alternative<Operand2>(memory->source())) {
+      return std::nullopt;
+    }
+    return is_extra_load_store(memory->operation()) ? FixupKind::Load8
+                                                    : FixupKind::Load12;
+  }
+  return std::nullopt;
+}
+
+std::optional<std::uint32_t>
+aavm::assembler::apply_fixup(std::uint32_t word, FixupKind kind,
+                             std::int32_t displacement) {
+  const auto negative = displacement < 0;
+  const auto magnitude = negative ? Word{0} - static_cast<Word>(displacement)
+                                  : static_cast<Word>(displacement);
+  switch (kind) {
+  case FixupKind::Branch: {
+    if ((displacement & 3) != 0 || displacement < -(1 << 25) ||
+        displacement >= (1 << 25)) {
+      return std::nullopt;
+    }
+    const auto imm24 = static_cast<Word>(displacement >> 2) & 0xFFFFFFu;
+    return (word & ~Word{0xFFFFFF}) | imm24;
+  }
+  case FixupKind::Adr: {
+    const auto imm12 = encode_modified_immediate(magnitude);
+    if (!imm12) {
+      return std::nullopt;
+    }
+    const auto opcode = data_processing_opcode(
+        negative ? Instruction::Sub : Instruction::Add);
+    return (word & ~(Word{0b1111} << 21 | Word{0xFFF})) | opcode << 21 |
+           *imm12;
+  }
+  case FixupKind::Load12:
+    if (magnitude > 0xFFFu) {
+      return std::nullopt;
+    }
+    return (word & ~(Word{1} << 23 | Word{0xFFF})) | Word{!negative} << 23 |
+           magnitude;
+  case FixupKind::Load8:
+    if (magnitude > 0xFFu) {
+      return std::nullopt;
+    }
+    return (word & ~(Word{1} << 23 | Word{0xF0F})) | Word{!negative} << 23 |
+           (magnitude & 0xF0u) << 4 | (magnitude & 0xFu);
+  }
+  return std::nullopt;
+}
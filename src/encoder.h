@@ -0,0 +1,49 @@
+#ifndef AAVM_ASSEMBLER_ENCODER_H_
+#define AAVM_ASSEMBLER_ENCODER_H_
+
+#include "condition.h"
+#include "instruction.h"
+#include "register.h"
+#include <cstdint>
+#include <optional>
+
+namespace aavm::assembler {
+
+// how a label (or literal) displacement is folded into an instruction word
+enum class FixupKind {
+  // b and bl: signed 24-bit word offset
+  Branch,
+  // adr: add or sub from pc with a modified immediate
+  Adr,
+  // ldr, ldrb, str and strb: 12-bit byte offset and direction bit
+  Load12,
+  // ldrh, ldrsb, ldrsh and strh: split 8-bit byte offset and direction bit
+  Load8
+};
+
+constexpr auto encode_register(ir::Register::Kind reg) {
+  return static_cast<std::uint32_t>(reg) - 1;
+}
+
+constexpr auto encode_condition(ir::Condition::Kind cond) {
+  return static_cast<std::uint32_t>(cond) - 1;
+}
+
+// reading pc in A32 state yields the address of the instruction plus 8
+constexpr auto pc_offset = std::uint32_t{8};
+
+// Encodes instr as a single A32 instruction word. Label and literal operands
+// are encoded with a zero displacement that apply_fixup() fills in later.
+std::optional<std::uint32_t> encode(const ir::Instruction &instr);
+
+// the fixup needed by instr, if it refers to a label or a literal
+std::optional<FixupKind> fixup_kind(const ir::Instruction &instr);
+
+// patches displacement (target - (address + pc_offset)) into word, returns
+// std::nullopt if the displacement is out of range
+std::optional<std::uint32_t> apply_fixup(std::uint32_t word, FixupKind kind,
+                                         std::int32_t displacement);
+
+} // namespace aavm::assembler
+
+#endif
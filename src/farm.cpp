@@ -0,0 +1,85 @@
+#include "farm.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+using namespace aavm;
+using namespace aavm::vm;
+
+struct Farm::Worker {
+  explicit Worker(const FarmOptions &options)
+      : memory{options.memory_base, options.memory_size, options.layout},
+        machine{memory} {}
+
+  Memory memory;
+  Machine machine;
+
+  std::uint64_t jobs_run{};
+};
+
+Farm::Farm(const void *image, std::uint32_t size, const FarmOptions &options) {
+  auto baseline = std::vector<std::uint8_t>(options.memory_size);
+  std::memcpy(baseline.data(), image, std::min(size, options.memory_size));
+
+  auto count = options.workers;
+  if (count == 0) {
+    count = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (auto i = 0u; i < count; ++i) {
+    auto &worker = *workers_.emplace_back(std::make_unique<Worker>(options));
+    auto &machine = worker.machine;
+    machine.set_tiering(options.tiering);
+    machine.set_jit(options.jit);
+    machine.set_budget(options.budget);
+    machine.write(options.memory_base, baseline.data(), options.memory_size);
+    if (options.translations != nullptr) {
+      machine.load_translations(options.translations,
+                                options.translations_key);
+    }
+    machine.snapshot();
+  }
+}
+
+Farm::~Farm() = default;
+
+void Farm::run(std::uint64_t jobs, std::uint32_t entry, const Setup &setup,
+               const Finish &finish) {
+  const auto count = workers_.size();
+  next_.store(0, std::memory_order_relaxed);
+  jobs_ = jobs;
+
+  // the calling thread is the first worker
+  auto threads = std::vector<std::thread>{};
+  for (auto i = std::size_t{1}; i < count; ++i) {
+    threads.emplace_back(
+        [this, i, entry, &setup, &finish] { work(i, entry, setup, finish); });
+  }
+  work(0, entry, setup, finish);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+std::uint64_t Farm::jobs_run(std::size_t worker) const {
+  return workers_[worker]->jobs_run;
+}
+
+void Farm::work(std::size_t index, std::uint32_t entry, const Setup &setup,
+                const Finish &finish) {
+  auto &worker = *workers_[index];
+  // the threads were started after next_ and jobs_ were set, and only the
+  // job number is taken from next_, so a relaxed increment is enough
+  for (auto job = next_.fetch_add(1, std::memory_order_relaxed); job < jobs_;
+       job = next_.fetch_add(1, std::memory_order_relaxed)) {
+    worker.machine.restore();
+    worker.machine.reset(entry);
+    if (setup) {
+      setup(worker.machine, job);
+    }
+    const auto status = worker.machine.run();
+    if (finish) {
+      finish(worker.machine, job, status);
+    }
+    ++worker.jobs_run;
+  }
+}
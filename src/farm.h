@@ -0,0 +1,93 @@
+#ifndef AAVM_VM_FARM_H_
+#define AAVM_VM_FARM_H_
+
+#include "machine.h"
+#include "memory.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace aavm::vm {
+
+// How a Farm sets up its workers.
+struct FarmOptions {
+  std::uint32_t memory_base = 0x10000;
+  std::uint32_t memory_size = 0x10000;
+  Memory::Layout layout = Memory::Buffer;
+  // the number of workers, zero for one per host thread
+  unsigned workers = 0;
+  bool jit = true;
+  // the instructions a job may run before it is given up on and finishes
+  // with Status::Preempted, zero for no limit, see Machine::set_budget()
+  std::uint64_t budget = 0;
+  // every worker is a thread of its own already, so by default they compile
+  // their blocks in place rather than each starting a compiler thread
+  Tiering tiering{2, 16, false};
+  // translations saved by Machine::save_translations() for the image, which
+  // every worker starts from, or nullptr
+  const char *translations = nullptr;
+  std::uint64_t translations_key = 0;
+};
+
+// Runs many short, independent guest programs across host threads.
+//
+// Every worker owns a Memory and a Machine and keeps them from one job to
+// the next, restoring the machine to a snapshot of the image between jobs,
+// which copies back only the pages the last job stored to. As long as the
+// jobs do not write code, their decoded pages, blocks and compiled code stay
+// warm across jobs.
+//
+// Workers share nothing but the job counter: each decodes, translates and
+// compiles the image on its own, into its own memory and code buffer.
+// FarmOptions::translations lets them all start from one set of saved
+// translations instead. Sharing read-only pages and compiled code between
+// workers is left to follow-up work.
+//
+// run() hands out jobs one at a time, in order, to whichever worker asks
+// next, so that workers whose jobs run quickly pick up more of them.
+class Farm {
+public:
+  // called on a worker before job runs, with the image in memory and the
+  // machine reset to the entry point. Writes the job's inputs.
+  using Setup = std::function<void(Machine &machine, std::uint64_t job)>;
+  // called on a worker once job has run, with the status it stopped with.
+  // Reads the job's results.
+  using Finish = std::function<void(const Machine &machine, std::uint64_t job,
+                                    Status status)>;
+
+  // every job starts from image at the base of memory, and zeroes above it
+  Farm(const void *image, std::uint32_t size, const FarmOptions &options);
+  ~Farm();
+  Farm(const Farm &) = delete;
+  Farm &operator=(const Farm &) = delete;
+
+  // runs jobs [0, jobs) from entry and returns once all of them have
+  // finished. setup and finish are called from all workers at once.
+  void run(std::uint64_t jobs, std::uint32_t entry, const Setup &setup,
+           const Finish &finish);
+
+  auto workers() const { return workers_.size(); }
+  // the jobs worker ran, over all runs
+  std::uint64_t jobs_run(std::size_t worker) const;
+
+private:
+  struct Worker;
+
+  void work(std::size_t index, std::uint32_t entry, const Setup &setup,
+            const Finish &finish);
+  std::vector<std::unique_ptr<Worker>> workers_{};
+  // the next job to hand out, and one past the last
+  alignas(64) std::atomic<std::uint64_t> next_{};
+  std::uint64_t jobs_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using Farm = vm::Farm;
+using FarmOptions = vm::FarmOptions;
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "fileio.h"
+#include "fmt/format.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#if AAVM_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace aavm;
+using namespace aavm::fileio;
+
+int aavm::fileio::open_for_writing(const char *path) {
+#if AAVM_WINDOWS
+  const auto fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                        _S_IREAD | _S_IWRITE);
+#else
+  const auto fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+  if (fd < 0) {
+    fmt::print("cannot open '{}': {}\n", path, std::strerror(errno));
+  }
+  return fd;
+}
+
+int aavm::fileio::open_file(const char *path, OpenMode mode) {
+#if AAVM_WINDOWS
+  const int flags[] = {_O_RDONLY, _O_WRONLY | _O_CREAT | _O_TRUNC,
+                       _O_WRONLY | _O_CREAT | _O_APPEND};
+  return _open(path, flags[static_cast<int>(mode)] | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+#else
+  const int flags[] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC,
+                       O_WRONLY | O_CREAT | O_APPEND};
+  return ::open(path, flags[static_cast<int>(mode)], 0644);
+#endif
+}
+
+std::ptrdiff_t aavm::fileio::read_file(int fd, void *data, std::size_t size) {
+#if AAVM_WINDOWS
+  return _read(fd, data,
+               static_cast<unsigned>(std::min<std::size_t>(size, INT_MAX)));
+#else
+  for (;;) {
+    const auto read = ::read(fd, data, size);
+    if (read >= 0 || errno != EINTR) {
+      return read;
+    }
+  }
+#endif
+}
+
+void aavm::fileio::close_file(int fd) {
+#if AAVM_WINDOWS
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+bool aavm::fileio::write_buffers(int fd, const Buffer *buffers,
+                                 std::size_t count) {
+#if AAVM_WINDOWS
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    auto data = static_cast<const char *>(buffers[i].data);
+    auto remaining = buffers[i].size;
+    while (remaining > 0) {
+      const auto written = _write(fd, data, static_cast<unsigned>(remaining));
+      if (written < 0) {
+        fmt::print("cannot write file: {}\n", std::strerror(errno));
+        return false;
+      }
+      data += written;
+      remaining -= static_cast<std::size_t>(written);
+    }
+  }
+  return true;
+#else
+  // a handful of buffers fit on the stack, larger lists spill to the heap
+  auto inline_iov = std::array<iovec, 16>{};
+  auto spilled_iov = std::vector<iovec>{};
+  auto iov = inline_iov.data();
+  if (count > inline_iov.size()) {
+    spilled_iov.resize(count);
+    iov = spilled_iov.data();
+  }
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    iov[i].iov_base = const_cast<void *>(buffers[i].data);
+    iov[i].iov_len = buffers[i].size;
+  }
+
+  const auto max_iov = static_cast<std::size_t>(IOV_MAX);
+  auto first = std::size_t{0};
+  while (first < count) {
+    const auto batch = std::min(count - first, max_iov);
+    const auto written = ::writev(fd, iov + first, static_cast<int>(batch));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fmt::print("cannot write file: {}\n", std::strerror(errno));
+      return false;
+    }
+    auto remaining = static_cast<std::size_t>(written);
+    while (first < count && remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < count) {
+      iov[first].iov_base =
+          static_cast<char *>(iov[first].iov_base) + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+  return true;
+#endif
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  std::swap(fd_, other.fd_);
+#if AAVM_WINDOWS
+  std::swap(mapping_, other.mapping_);
+#endif
+  return *this;
+}
+
+MappedFile::~MappedFile() {
+#if AAVM_WINDOWS
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+#else
+  if (data_ != nullptr) {
+    ::munmap(const_cast<std::uint8_t *>(data_), size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+#endif
+}
+
+std::optional<MappedFile> MappedFile::open(const char *path) {
+  auto file = MappedFile{};
+#if AAVM_WINDOWS
+  const auto handle =
+      CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                  FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    fmt::print("cannot open '{}'\n", path);
+    return std::nullopt;
+  }
+  auto size = LARGE_INTEGER{};
+  if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+    CloseHandle(handle);
+    fmt::print("cannot map '{}'\n", path);
+    return std::nullopt;
+  }
+  file.size_ = static_cast<std::size_t>(size.QuadPart);
+  file.mapping_ =
+      CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(handle);
+  if (file.mapping_ == nullptr) {
+    fmt::print("cannot map '{}'\n", path);
+    return std::nullopt;
+  }
+  file.data_ = static_cast<const std::uint8_t *>(
+      MapViewOfFile(file.mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (file.data_ == nullptr) {
+    fmt::print("cannot map '{}'\n", path);
+    return std::nullopt;
+  }
+#else
+  const auto fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    fmt::print("cannot open '{}': {}\n", path, std::strerror(errno));
+    return std::nullopt;
+  }
+  struct stat status {};
+  if (::fstat(fd, &status) != 0 || status.st_size == 0) {
+    ::close(fd);
+    fmt::print("cannot map '{}'\n", path);
+    return std::nullopt;
+  }
+  const auto size = static_cast<std::size_t>(status.st_size);
+  const auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    ::close(fd);
+    fmt::print("cannot map '{}': {}\n", path, std::strerror(errno));
+    return std::nullopt;
+  }
+  file.data_ = static_cast<const std::uint8_t *>(data);
+  file.size_ = size;
+  file.fd_ = fd;
+#endif
+  return file;
+}
@@ -0,0 +1,63 @@
+#ifndef AAVM_FILEIO_H_
+#define AAVM_FILEIO_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace aavm::fileio {
+
+struct Buffer {
+  const void *data;
+  std::size_t size;
+};
+
+// opens path for writing, truncating it, returns -1 on failure
+int open_for_writing(const char *path);
+void close_file(int fd);
+
+enum class OpenMode { Read, Write, Append };
+
+// opens path to read, to write truncating it or to append to it, creating it
+// for the last two. Returns -1 on failure without reporting it, which is up
+// to the caller.
+int open_file(const char *path, OpenMode mode);
+// reads up to size bytes into data, returns how many, 0 at the end of the
+// file or -1 on failure
+std::ptrdiff_t read_file(int fd, void *data, std::size_t size);
+
+// writes buffers back to back with a single writev, resuming if it stops short
+bool write_buffers(int fd, const Buffer *buffers, std::size_t count);
+
+// A read-only, copy-on-write private mapping of a whole file. Clean pages are
+// backed by the page cache, so every process mapping the same file shares them.
+// The file stays open, for parts of it to be mapped elsewhere as well.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+  MappedFile &operator=(MappedFile &&other) noexcept;
+  ~MappedFile();
+
+  static std::optional<MappedFile> open(const char *path);
+
+  constexpr auto data() const { return data_; }
+  constexpr auto size() const { return size_; }
+  // the open file, -1 on hosts that cannot map it again
+  constexpr auto fd() const { return fd_; }
+
+private:
+  const std::uint8_t *data_{};
+  std::size_t size_{};
+  int fd_{-1};
+#if AAVM_WINDOWS
+  void *mapping_{};
+#endif
+};
+
+} // namespace aavm::fileio
+
+#endif
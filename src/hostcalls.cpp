@@ -0,0 +1,134 @@
+#include "hostcalls.h"
+#include "fileio.h"
+#include <algorithm>
+#include <array>
+
+using namespace aavm;
+using namespace aavm::vm;
+
+static constexpr auto standard_files = std::size_t{3};
+
+HostCalls::HostCalls(int input, int output, int error)
+    : start_{std::chrono::steady_clock::now()} {
+  for (const auto fd : {input, output, error}) {
+    files_.push_back(File{fd, false, false, {}});
+  }
+}
+
+HostCalls::~HostCalls() {
+  flush();
+  for (auto &file : files_) {
+    if (file.owned && file.fd >= 0) {
+      fileio::close_file(file.fd);
+    }
+  }
+}
+
+HostCalls::File *HostCalls::find(std::uint32_t file) {
+  if (file >= files_.size() || files_[file].fd < 0) {
+    return nullptr;
+  }
+  return &files_[file];
+}
+
+bool HostCalls::write_out(File &file, const std::uint8_t *data,
+                          std::size_t size) {
+  const auto buffers = std::array<fileio::Buffer, 2>{
+      {{file.buffer.data(), file.buffer.size()}, {data, size}}};
+  // skips whichever is empty
+  const auto first = file.buffer.empty() ? 1 : 0;
+  const auto count = (size == 0 ? 1 : 2) - first;
+  auto ok = true;
+  if (count > 0) {
+    ++host_writes_;
+    ok = fileio::write_buffers(file.fd, buffers.data() + first,
+                               static_cast<std::size_t>(count));
+  }
+  file.buffer.clear();
+  file.failed = file.failed || !ok;
+  return ok;
+}
+
+std::int32_t HostCalls::write(std::uint32_t file, const std::uint8_t *data,
+                              std::uint32_t size) {
+  auto *const open = find(file);
+  if (open == nullptr || open->failed || size > INT32_MAX) {
+    return -1;
+  }
+  if (size <= buffer_size - open->buffer.size()) {
+    if (open->buffer.capacity() == 0) {
+      open->buffer.reserve(buffer_size);
+    }
+    open->buffer.insert(open->buffer.end(), data, data + size);
+    return static_cast<std::int32_t>(size);
+  }
+  return write_out(*open, data, size) ? static_cast<std::int32_t>(size) : -1;
+}
+
+std::int32_t HostCalls::read(std::uint32_t file, std::uint8_t *data,
+                             std::uint32_t size) {
+  auto *const open = find(file);
+  if (open == nullptr) {
+    return -1;
+  }
+  flush();
+  const auto read = fileio::read_file(
+      open->fd, data, std::min<std::uint32_t>(size, INT32_MAX));
+  return static_cast<std::int32_t>(read);
+}
+
+std::int32_t HostCalls::open(const char *path, std::uint32_t mode) {
+  if (mode > OpenAppend) {
+    return -1;
+  }
+  const auto fd =
+      fileio::open_file(path, static_cast<fileio::OpenMode>(mode));
+  if (fd < 0) {
+    return -1;
+  }
+  // the lowest number free, as on the host
+  auto file = standard_files;
+  while (file < files_.size() && files_[file].fd >= 0) {
+    ++file;
+  }
+  if (file == files_.size()) {
+    files_.emplace_back();
+  }
+  files_[file] = File{fd, true, false, {}};
+  return static_cast<std::int32_t>(file);
+}
+
+std::int32_t HostCalls::close(std::uint32_t file) {
+  auto *const open = find(file);
+  if (open == nullptr) {
+    return -1;
+  }
+  const auto ok = write_out(*open, nullptr, 0);
+  if (open->owned) {
+    fileio::close_file(open->fd);
+  }
+  *open = File{-1, false, false, {}};
+  return ok ? 0 : -1;
+}
+
+std::uint32_t HostCalls::clock() const {
+  const auto elapsed = std::chrono::steady_clock::now() - start_;
+  return static_cast<std::uint32_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+void HostCalls::exit(std::uint32_t code) {
+  flush();
+  exited_ = true;
+  exit_code_ = code;
+}
+
+bool HostCalls::flush() {
+  auto ok = true;
+  for (auto &file : files_) {
+    if (file.fd >= 0 && !file.buffer.empty()) {
+      ok = write_out(file, nullptr, 0) && ok;
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,105 @@
+#ifndef AAVM_VM_HOSTCALLS_H_
+#define AAVM_VM_HOSTCALLS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace aavm::vm {
+
+// The host side of the calls guest code makes with svc #n, n being one of
+// Call. A Machine given the calls passes them r0 to r2 as the arguments and
+// leaves the result in r0, -1 for a call that failed. Guest files 0, 1 and 2
+// are the host's standard input, output and error unless given others, the
+// files the guest opens are numbered from 3.
+//
+// Guest buffers are never copied on the way in or out of a call: the machine
+// hands over host pointers into guest memory, so reads land in it directly.
+// Writes are gathered per file into a buffer of buffer_size bytes, which goes
+// to the file together with the first write that no longer fits in it in a
+// single writev, straight from guest memory. A guest printing a character at
+// a time so costs a copy per call and a system call per buffer. The buffers
+// are written out before any read, so that a prompt shows before the guest
+// waits on its answer, as well as when their file is closed, on exit and by
+// flush(). Calls are made from the thread running the machine, give every
+// machine running on its own thread calls of its own.
+class HostCalls {
+public:
+  enum Call : std::uint32_t {
+    // exit(code) stops the machine with Status::Exited
+    Exit,
+    // write(file, buffer, size) returns size
+    Write,
+    // read(file, buffer, size) returns the bytes read, 0 at the end of the
+    // file
+    Read,
+    // open(path, mode) opens the nul terminated path in one of OpenMode and
+    // returns the file
+    Open,
+    // close(file) returns 0
+    Close,
+    // clock() returns the milliseconds since the calls were made
+    Clock
+  };
+
+  enum OpenMode : std::uint32_t { OpenRead, OpenWrite, OpenAppend };
+
+  static constexpr auto buffer_size = std::size_t{1} << 16;
+
+  // input, output and error are the host files behind guest files 0 to 2,
+  // which are left open
+  explicit HostCalls(int input = 0, int output = 1, int error = 2);
+  HostCalls(const HostCalls &) = delete;
+  HostCalls &operator=(const HostCalls &) = delete;
+  // writes out the buffers and closes the files the guest left open
+  ~HostCalls();
+
+  // The calls, with data and path pointing into guest memory. A file
+  // stays failed once a write to it fails.
+  std::int32_t write(std::uint32_t file, const std::uint8_t *data,
+                     std::uint32_t size);
+  std::int32_t read(std::uint32_t file, std::uint8_t *data,
+                    std::uint32_t size);
+  std::int32_t open(const char *path, std::uint32_t mode);
+  std::int32_t close(std::uint32_t file);
+  std::uint32_t clock() const;
+  void exit(std::uint32_t code);
+
+  // writes out every buffer, returns false if a write failed
+  bool flush();
+
+  constexpr auto exited() const { return exited_; }
+  constexpr auto exit_code() const { return exit_code_; }
+  // the writes that reached the host so far, each a single writev
+  constexpr auto host_writes() const { return host_writes_; }
+
+private:
+  struct File {
+    // -1 once closed
+    int fd;
+    // whether the guest opened it, and closing it closes fd
+    bool owned;
+    bool failed;
+    std::vector<std::uint8_t> buffer;
+  };
+
+  // the open file numbered file, or nullptr
+  File *find(std::uint32_t file);
+  // writes out the buffer of file along with size bytes from data
+  bool write_out(File &file, const std::uint8_t *data, std::size_t size);
+
+  std::vector<File> files_{};
+  std::chrono::steady_clock::time_point start_;
+  std::uint64_t host_writes_{};
+  bool exited_{};
+  std::uint32_t exit_code_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using HostCalls = vm::HostCalls;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "image.h"
+#include "fmt/format.h"
+#include <cstring>
+
+using namespace aavm;
+using namespace aavm::image;
+
+static bool validate(const std::uint8_t *data, std::size_t size) {
+  if (size < sizeof(Header)) {
+    return false;
+  }
+  auto header = Header{};
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != magic || header.version != version ||
+      header.alignment != alignment) {
+    return false;
+  }
+
+  const auto table_end =
+      sizeof(Header) + std::size_t{header.segment_count} * sizeof(Segment);
+  if (table_end > size) {
+    return false;
+  }
+  for (auto i = std::size_t{0}; i < header.segment_count; ++i) {
+    auto segment = Segment{};
+    std::memcpy(&segment, data + sizeof(Header) + i * sizeof(Segment),
+                sizeof(segment));
+    const auto file_end =
+        std::uint64_t{segment.file_offset} + segment.file_size;
+    const auto memory_end =
+        std::uint64_t{segment.address} + segment.memory_size;
+    if (segment.address % alignment != 0 ||
+        segment.file_offset % alignment != 0 || file_end > size ||
+        segment.file_size > segment.memory_size ||
+        memory_end > std::uint64_t{1} << 32) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::optional<Image> Image::open(const char *path) {
+  auto file = fileio::MappedFile::open(path);
+  if (!file) {
+    return std::nullopt;
+  }
+  if (!validate(file->data(), file->size())) {
+    fmt::print("'{}' is not a valid image\n", path);
+    return std::nullopt;
+  }
+  return Image{std::move(*file)};
+}
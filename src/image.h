@@ -0,0 +1,96 @@
+#ifndef AAVM_IMAGE_H_
+#define AAVM_IMAGE_H_
+
+#include "fileio.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace aavm::image {
+
+// "AAVM" read as a little-endian word
+constexpr auto magic = std::uint32_t{0x4D564141};
+constexpr auto version = std::uint16_t{2};
+
+// Segments start on this boundary both in the file and in guest memory, so a
+// segment can be mapped straight from the file. 64 KiB covers every host
+// page size we run on and the Windows allocation granularity.
+constexpr auto alignment = std::uint32_t{0x10000};
+
+constexpr auto align(std::uint32_t value) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a of size bytes from data, carrying on from hash
+constexpr auto fnv1a_basis = std::uint64_t{0xCBF29CE484222325};
+inline std::uint64_t fnv1a(const void *data, std::size_t size,
+                           std::uint64_t hash = fnv1a_basis) {
+  const auto *const bytes = static_cast<const std::uint8_t *>(data);
+  for (auto i = std::size_t{0}; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+enum SegmentFlags : std::uint32_t { Read = 1, Write = 2, Execute = 4 };
+
+struct Header {
+  std::uint32_t magic;
+  std::uint16_t version;
+  std::uint16_t segment_count;
+  // guest address of the first instruction
+  std::uint32_t entry;
+  std::uint32_t alignment;
+  // fnv1a() of the segment table and then the contents of each segment,
+  // worked out as the image is written
+  std::uint64_t hash;
+};
+
+// followed by segment_count segments
+struct Segment {
+  // guest address of the first byte, aligned to alignment
+  std::uint32_t address;
+  // bytes past file_size are zero filled
+  std::uint32_t memory_size;
+  // aligned to alignment
+  std::uint32_t file_offset;
+  std::uint32_t file_size;
+  std::uint32_t flags;
+};
+
+static_assert(sizeof(Header) == 24);
+static_assert(sizeof(Segment) == 20);
+
+// A program image mapped read-only into memory. Loading validates the header
+// and segment table and nothing else, segment contents are never copied.
+// Machine::load() maps the segments into reserved guest memory from fd().
+class Image {
+public:
+  Image() = delete;
+
+  static std::optional<Image> open(const char *path);
+
+  const Header &header() const {
+    return *reinterpret_cast<const Header *>(file_.data());
+  }
+  const Segment *segments() const {
+    return reinterpret_cast<const Segment *>(file_.data() + sizeof(Header));
+  }
+  std::size_t segment_count() const { return header().segment_count; }
+  const std::uint8_t *contents(const Segment &segment) const {
+    return file_.data() + segment.file_offset;
+  }
+  int fd() const { return file_.fd(); }
+  // tells programs apart for the caches kept of them, without reading more
+  // than the header. It is not checked against the contents.
+  std::uint64_t hash() const { return header().hash; }
+
+private:
+  explicit Image(fileio::MappedFile file) : file_{std::move(file)} {}
+
+  fileio::MappedFile file_;
+};
+
+} // namespace aavm::image
+
+#endif
@@ -0,0 +1,85 @@
+#include "imagewriter.h"
+#include "fileio.h"
+#include "fmt/format.h"
+#include <array>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::image;
+using namespace std::string_view_literals;
+
+static const auto zeroes = std::array<char, alignment>{};
+
+ImageWriter::ImageWriter(const Assembler &assembler, std::uint32_t base)
+    : assembler_{assembler} {
+  header_.magic = magic;
+  header_.version = version;
+  header_.entry = base;
+  header_.alignment = alignment;
+  for (const auto &label : assembler_.labels()) {
+    if (label.name() == "_start"sv) {
+      header_.entry = base + assembler_.label_address(label).value_or(0);
+    }
+  }
+
+  const auto &code = assembler_.code();
+  const auto size =
+      static_cast<std::uint32_t>(code.size() * sizeof(std::uint32_t));
+  add_segment(base, code.data(), size, size, Read | Execute);
+}
+
+void ImageWriter::add_segment(std::uint32_t address, const void *data,
+                              std::uint32_t size, std::uint32_t memory_size,
+                              std::uint32_t flags) {
+  segments_.push_back(Segment{address, memory_size, 0, size, flags});
+  contents_.push_back(data);
+}
+
+bool ImageWriter::write(const char *path) const {
+  const auto fd = fileio::open_for_writing(path);
+  if (fd < 0) {
+    return false;
+  }
+  const auto ok = write_to(fd);
+  fileio::close_file(fd);
+  return ok;
+}
+
+bool ImageWriter::write_to(int fd) const {
+  using fileio::Buffer;
+  if (const auto unresolved = assembler_.unresolved_fixups();
+      !unresolved.empty()) {
+    fmt::print("image has {} unresolved references\n", unresolved.size());
+    return false;
+  }
+
+  auto header = header_;
+  header.segment_count = static_cast<std::uint16_t>(segments_.size());
+  auto segments = segments_;
+  const auto table_size = static_cast<std::uint32_t>(
+      sizeof(Header) + segments.size() * sizeof(Segment));
+
+  // the header and segment table share the first page, then each segment
+  // starts on its own
+  auto buffers = std::vector<Buffer>{};
+  buffers.reserve(2 + 2 * segments.size() + 1);
+  buffers.push_back(Buffer{&header, sizeof(header)});
+  buffers.push_back(Buffer{segments.data(), segments.size() * sizeof(Segment)});
+  auto offset = table_size;
+  for (auto i = std::size_t{0}; i < segments.size(); ++i) {
+    auto &segment = segments[i];
+    if (segment.file_size == 0) {
+      continue;
+    }
+    buffers.push_back(Buffer{zeroes.data(), align(offset) - offset});
+    segment.file_offset = align(offset);
+    buffers.push_back(Buffer{contents_[i], segment.file_size});
+    offset = segment.file_offset + segment.file_size;
+  }
+  header.hash = fnv1a(segments.data(), segments.size() * sizeof(Segment));
+  for (auto i = std::size_t{0}; i < segments.size(); ++i) {
+    header.hash = fnv1a(contents_[i], segments[i].file_size, header.hash);
+  }
+  return fileio::write_buffers(fd, buffers.data(), buffers.size());
+}
@@ -0,0 +1,42 @@
+#ifndef AAVM_ASSEMBLER_IMAGEWRITER_H_
+#define AAVM_ASSEMBLER_IMAGEWRITER_H_
+
+#include "assembler.h"
+#include "image.h"
+#include <cstdint>
+#include <vector>
+
+namespace aavm::assembler {
+
+// Writes the output of an Assembler as a flat program image. The code is an
+// executable segment at base, further segments (data, stack) can be added.
+// The entry point is the label _start, or base if there is none.
+class ImageWriter {
+public:
+  static constexpr auto default_base = std::uint32_t{0x10000};
+
+  ImageWriter() = delete;
+  explicit ImageWriter(const Assembler &assembler,
+                       std::uint32_t base = default_base);
+
+  // data must outlive the writer, memory past size is zero filled
+  void add_segment(std::uint32_t address, const void *data, std::uint32_t size,
+                   std::uint32_t memory_size, std::uint32_t flags);
+
+  bool write(const char *path) const;
+  bool write_to(int fd) const;
+
+private:
+  const Assembler &assembler_;
+  image::Header header_{};
+  std::vector<image::Segment> segments_{};
+  std::vector<const void *> contents_{};
+};
+
+} // namespace aavm::assembler
+
+namespace aavm {
+using ImageWriter = assembler::ImageWriter;
+}
+
+#endif
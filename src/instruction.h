@@ -136,6 +136,12 @@ public:
     block_memory_operations_end_ = 66
   };
 
+  enum SystemOperation {
+    system_operations_start_ = 67,
+    Svc = 67,
+    system_operations_end_ = 67
+  };
+
   static constexpr auto is_arithmetic_operation(unsigned op) {
     return op >= arithmetic_operations_start_ &&
            op <= arithmetic_operations_end_;
@@ -183,6 +189,10 @@ public:
            op <= block_memory_operations_end_;
   }
 
+  static constexpr auto is_system_operation(unsigned op) {
+    return op >= system_operations_start_ && op <= system_operations_end_;
+  }
+
 private:
   unsigned op_;
   Condition::Kind condition_;
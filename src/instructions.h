@@ -7,6 +7,7 @@
 #include "label.h"
 #include "operand2.h"
 #include "register.h"
+#include <cstdint>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -227,22 +228,46 @@ public:
       BlockMemoryOperation op, Condition::Kind cond, Register::Kind rn,
       bool writeback, const std::vector<Register::Kind> &registers)
       : Instruction{op, cond, false}, rn_{rn}, writeback_{writeback},
-        register_list_{registers} {}
+        register_list_{registers}, register_mask_{mask(registers)} {}
 
   /* constexpr */ BlockMemoryInstruction(
       BlockMemoryOperation op, Condition::Kind cond,
       const std::vector<Register::Kind> &registers)
       : Instruction{op, cond, false}, rn_{Register::SP}, writeback_{true},
-        register_list_{registers} {}
+        register_list_{registers}, register_mask_{mask(registers)} {}
 
   constexpr auto rn() const { return rn_; }
   constexpr auto writeback() const { return writeback_; }
   constexpr auto &register_list() const { return register_list_; }
+  // the register list with bit 0 for r0 up to bit 15 for pc, as encoded
+  constexpr auto register_mask() const { return register_mask_; }
 
 private:
+  static std::uint16_t mask(const std::vector<Register::Kind> &registers) {
+    auto mask = 0u;
+    for (const auto reg : registers) {
+      mask |= 1u << (reg - 1);
+    }
+    return static_cast<std::uint16_t>(mask);
+  }
+
   Register::Kind rn_{};
   bool writeback_{};
   std::vector<Register::Kind> register_list_{};
+  std::uint16_t register_mask_{};
+};
+
+class SystemInstruction : public Instruction {
+public:
+  constexpr SystemInstruction(SystemOperation op, Condition::Kind cond,
+                              unsigned imm24)
+      : Instruction{op, cond, false}, imm24_{imm24} {}
+
+  // the comment field of svc, which the host reads as the call number
+  constexpr auto imm24() const { return imm24_; }
+
+private:
+  unsigned imm24_{};
 };
 
 template <typename T> constexpr auto cast(const Instruction * /*instr*/) {
@@ -313,6 +338,12 @@ constexpr auto cast<BlockMemoryInstruction>(const Instruction *instr) {
              : nullptr;
 }
 
+template <> constexpr auto cast<SystemInstruction>(const Instruction *instr) {
+  return Instruction::is_system_operation(instr->operation())
+             ? static_cast<const SystemInstruction *>(instr)
+             : nullptr;
+}
+
 } // namespace aavm::ir
 
 #endif
@@ -0,0 +1,601 @@
+#include "interpreter.h"
+#include "alu.h"
+#include "stl_bit.h"
+#include <optional>
+#include <variant>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto word_size = Word{4};
+static constexpr auto pc_offset = Word{8};
+
+Interpreter::Interpreter(const Module &module, Memory &memory,
+                         std::uint32_t code_base)
+    : module_{module}, memory_{memory}, code_base_{code_base} {
+  reset();
+}
+
+void Interpreter::reset() {
+  cpu_ = Cpu{};
+  cpu_.reg(Register::SP) = memory_.end();
+  cpu_.reg(Register::LR) = end_address();
+  cpu_.reg(Register::PC) = code_base_;
+  retired_ = 0;
+  fault_address_ = 0;
+}
+
+std::uint32_t Interpreter::end_address() const {
+  return code_base_ + static_cast<Word>(module_.size()) * word_size;
+}
+
+std::optional<std::uint32_t>
+Interpreter::label_address(const Label &label) const {
+  if (const auto index = module_.label_index(label)) {
+    return code_base_ + static_cast<Word>(*index) * word_size;
+  }
+  return std::nullopt;
+}
+
+Status Interpreter::run() {
+  auto status = Status::Running;
+  while (status == Status::Running) {
+    status = step();
+  }
+  return status;
+}
+
+Status Interpreter::step() {
+  auto &pc = cpu_.reg(Register::PC);
+  const auto offset = pc - code_base_;
+  const auto index = offset / word_size;
+  if (offset % word_size != 0 || index > module_.size()) {
+    return Status::BadBranch;
+  }
+  if (index == module_.size()) {
+    return Status::Halted;
+  }
+
+  const auto &instr = *module_.instructions()[index];
+  next_pc_ = pc + word_size;
+  if (condition_passed(instr.condition(), cpu_.apsr)) {
+    const auto status = execute(instr);
+    if (status != Status::Running) {
+      return status;
+    }
+  }
+  pc = next_pc_;
+  ++retired_;
+  return Status::Running;
+}
+
+Status Interpreter::execute(const Instruction &instr) {
+  switch (instr.operation()) {
+  case Instruction::Add:
+  case Instruction::Adc:
+  case Instruction::Sub:
+  case Instruction::Sbc:
+  case Instruction::Rsb:
+  case Instruction::Rsc:
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic:
+  case Instruction::Adr:
+    return execute_arithmetic(
+        static_cast<const ArithmeticInstruction &>(instr));
+  case Instruction::Mul:
+  case Instruction::Mla:
+  case Instruction::Mls:
+  case Instruction::Umull:
+  case Instruction::Umlal:
+  case Instruction::Smull:
+  case Instruction::Smlal:
+    return execute_multiply(static_cast<const MultiplyInstruction &>(instr));
+  case Instruction::Sdiv:
+  case Instruction::Udiv:
+    return execute_divide(static_cast<const DivideInstruction &>(instr));
+  case Instruction::Mov:
+  case Instruction::Mvn:
+  case Instruction::Movt:
+  case Instruction::Movw:
+    return execute_move(static_cast<const MoveInstruction &>(instr));
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+  case Instruction::Tst:
+  case Instruction::Teq:
+    return execute_comparison(
+        static_cast<const ComparisonInstruction &>(instr));
+  case Instruction::Bfc:
+  case Instruction::Bfi:
+  case Instruction::Sbfx:
+  case Instruction::Ubfx:
+    return execute_bitfield(static_cast<const BitfieldInstruction &>(instr));
+  case Instruction::Rbit:
+  case Instruction::Rev:
+  case Instruction::Rev16:
+  case Instruction::Revsh:
+    return execute_reverse(static_cast<const ReverseInstruction &>(instr));
+  case Instruction::B:
+  case Instruction::Bl:
+  case Instruction::Bx:
+  case Instruction::Cbz:
+  case Instruction::Cbnz:
+    return execute_branch(static_cast<const BranchInstruction &>(instr));
+  case Instruction::Ldr:
+  case Instruction::Ldrb:
+  case Instruction::Ldrsb:
+  case Instruction::Ldrh:
+  case Instruction::Ldrsh:
+  case Instruction::Str:
+  case Instruction::Strb:
+  case Instruction::Strh:
+    return execute_single_memory(
+        static_cast<const SingleMemoryInstruction &>(instr));
+  case Instruction::Ldm:
+  case Instruction::Ldmia:
+  case Instruction::Ldmib:
+  case Instruction::Ldmda:
+  case Instruction::Ldmdb:
+  case Instruction::Stm:
+  case Instruction::Stmia:
+  case Instruction::Stmib:
+  case Instruction::Stmda:
+  case Instruction::Stmdb:
+  case Instruction::Push:
+  case Instruction::Pop:
+    return execute_block_memory(
+        static_cast<const BlockMemoryInstruction &>(instr));
+  default:
+    // shifts are parsed as moves with a shifted register
+    return Status::Unsupported;
+  }
+}
+
+std::uint32_t Interpreter::read(Register::Kind reg) const {
+  return reg == Register::PC ? cpu_.reg(reg) + pc_offset : cpu_.reg(reg);
+}
+
+void Interpreter::write(Register::Kind reg, std::uint32_t value) {
+  if (reg == Register::PC) {
+    // bit 0 selects thumb state on interworking branches, which we ignore
+    next_pc_ = value & ~Word{1};
+  } else {
+    cpu_.reg(reg) = value;
+  }
+}
+
+std::pair<std::uint32_t, std::uint32_t>
+Interpreter::operand2(const Operand2 &src2) const {
+  const auto carry = (cpu_.apsr >> carry_shift) & 1u;
+  if (src2.immediate()) {
+    // only immediates that need a rotation set the carry to their top bit
+    const auto value = src2.imm12();
+    return {value, value > 0xFFu ? value >> 31 : carry};
+  }
+
+  const auto &rm = src2.rm();
+  const auto amount = rm.immediate() ? rm.shamt5() : read(rm.rs()) & 0xFFu;
+  return shift_c(read(rm.rm()), rm.sh(), amount, carry);
+}
+
+Status Interpreter::execute_arithmetic(const ArithmeticInstruction &instr) {
+  if (instr.operation() == Instruction::Adr) {
+    const auto address = label_address(*instr.label());
+    if (!address) {
+      return Status::UndefinedLabel;
+    }
+    write(instr.rd(), *address);
+    return Status::Running;
+  }
+
+  const auto [value, shift_carry] = operand2(instr.src2());
+  const auto rn = read(instr.rn());
+  const auto carry = (cpu_.apsr >> carry_shift) & 1u;
+  auto result = std::pair<Word, Word>{};
+  switch (instr.operation()) {
+  case Instruction::Add:
+    result = add_with_carry(rn, value, 0);
+    break;
+  case Instruction::Adc:
+    result = add_with_carry(rn, value, carry);
+    break;
+  case Instruction::Sub:
+    result = add_with_carry(rn, ~value, 1);
+    break;
+  case Instruction::Sbc:
+    result = add_with_carry(rn, ~value, carry);
+    break;
+  case Instruction::Rsb:
+    result = add_with_carry(value, ~rn, 1);
+    break;
+  case Instruction::Rsc:
+    result = add_with_carry(value, ~rn, carry);
+    break;
+  case Instruction::And:
+    result.first = rn & value;
+    result.second = logical_flags(result.first, shift_carry, cpu_.apsr);
+    break;
+  case Instruction::Eor:
+    result.first = rn ^ value;
+    result.second = logical_flags(result.first, shift_carry, cpu_.apsr);
+    break;
+  case Instruction::Orr:
+    result.first = rn | value;
+    result.second = logical_flags(result.first, shift_carry, cpu_.apsr);
+    break;
+  case Instruction::Bic:
+    result.first = rn & ~value;
+    result.second = logical_flags(result.first, shift_carry, cpu_.apsr);
+    break;
+  default:
+    return Status::Unsupported;
+  }
+
+  write(instr.rd(), result.first);
+  // flag setting writes to pc return from exceptions, which we do not model
+  if (instr.updatesflags() && instr.rd() != Register::PC) {
+    cpu_.apsr = result.second;
+  }
+  return Status::Running;
+}
+
+Status Interpreter::execute_multiply(const MultiplyInstruction &instr) {
+  const auto rm = read(instr.rm());
+  const auto rs = read(instr.rs());
+  switch (instr.operation()) {
+  case Instruction::Mul:
+  case Instruction::Mla:
+  case Instruction::Mls: {
+    const auto product = rm * rs;
+    const auto result = instr.operation() == Instruction::Mul ? product
+                        : instr.operation() == Instruction::Mla
+                            ? product + read(instr.rn())
+                            : read(instr.rn()) - product;
+    write(instr.rd(), result);
+    if (instr.updatesflags()) {
+      cpu_.apsr = nz(result) | (cpu_.apsr & (FlagC | FlagV));
+    }
+    return Status::Running;
+  }
+  case Instruction::Umull:
+  case Instruction::Umlal:
+  case Instruction::Smull:
+  case Instruction::Smlal: {
+    const auto is_signed = instr.operation() == Instruction::Smull ||
+                           instr.operation() == Instruction::Smlal;
+    auto result =
+        is_signed ? static_cast<std::uint64_t>(
+                        std::int64_t{static_cast<std::int32_t>(rm)} *
+                        static_cast<std::int32_t>(rs))
+                  : std::uint64_t{rm} * rs;
+    if (instr.operation() == Instruction::Umlal ||
+        instr.operation() == Instruction::Smlal) {
+      result += std::uint64_t{read(instr.rdhi())} << 32 | read(instr.rdlo());
+    }
+    write(instr.rdlo(), static_cast<Word>(result));
+    write(instr.rdhi(), static_cast<Word>(result >> 32));
+    if (instr.updatesflags()) {
+      const auto n = (result >> 63) != 0 ? Word{FlagN} : Word{0};
+      const auto z = result == 0 ? Word{FlagZ} : Word{0};
+      cpu_.apsr = n | z | (cpu_.apsr & (FlagC | FlagV));
+    }
+    return Status::Running;
+  }
+  default:
+    return Status::Unsupported;
+  }
+}
+
+Status Interpreter::execute_divide(const DivideInstruction &instr) {
+  const auto rn = read(instr.rn());
+  const auto rm = read(instr.rm());
+  // division by zero yields zero unless the divide trap is enabled
+  auto result = Word{0};
+  if (rm != 0) {
+    if (instr.operation() == Instruction::Udiv) {
+      result = rn / rm;
+    } else if (rn == 0x80000000u && rm == ~Word{0}) {
+      // the only overflow, which wraps around
+      result = rn;
+    } else {
+      result = static_cast<Word>(static_cast<std::int32_t>(rn) /
+                                 static_cast<std::int32_t>(rm));
+    }
+  }
+  write(instr.rd(), result);
+  return Status::Running;
+}
+
+Status Interpreter::execute_move(const MoveInstruction &instr) {
+  switch (instr.operation()) {
+  case Instruction::Mov:
+  case Instruction::Mvn: {
+    const auto [value, carry] = operand2(instr.src2());
+    const auto result = instr.operation() == Instruction::Mov ? value : ~value;
+    write(instr.rd(), result);
+    if (instr.updatesflags() && instr.rd() != Register::PC) {
+      cpu_.apsr = logical_flags(result, carry, cpu_.apsr);
+    }
+    return Status::Running;
+  }
+  case Instruction::Movw:
+    write(instr.rd(), instr.imm16() & 0xFFFFu);
+    return Status::Running;
+  case Instruction::Movt:
+    write(instr.rd(), (read(instr.rd()) & 0xFFFFu) | instr.imm16() << 16);
+    return Status::Running;
+  default:
+    return Status::Unsupported;
+  }
+}
+
+Status Interpreter::execute_comparison(const ComparisonInstruction &instr) {
+  const auto [value, carry] = operand2(instr.src2());
+  const auto rn = read(instr.rn());
+  switch (instr.operation()) {
+  case Instruction::Cmp:
+    cpu_.apsr = add_with_carry(rn, ~value, 1).second;
+    return Status::Running;
+  case Instruction::Cmn:
+    cpu_.apsr = add_with_carry(rn, value, 0).second;
+    return Status::Running;
+  case Instruction::Tst:
+    cpu_.apsr = logical_flags(rn & value, carry, cpu_.apsr);
+    return Status::Running;
+  case Instruction::Teq:
+    cpu_.apsr = logical_flags(rn ^ value, carry, cpu_.apsr);
+    return Status::Running;
+  default:
+    return Status::Unsupported;
+  }
+}
+
+Status Interpreter::execute_bitfield(const BitfieldInstruction &instr) {
+  const auto lsb = instr.lsb();
+  const auto width = instr.width();
+  if (width == 0 || lsb + width > 32) {
+    return Status::Unsupported;
+  }
+
+  const auto field = low_bits(width);
+  switch (instr.operation()) {
+  case Instruction::Bfc:
+    write(instr.rd(), read(instr.rd()) & ~(field << lsb));
+    return Status::Running;
+  case Instruction::Bfi:
+    write(instr.rd(), (read(instr.rd()) & ~(field << lsb)) |
+                          (read(instr.rn()) & field) << lsb);
+    return Status::Running;
+  case Instruction::Sbfx: {
+    // move the field to the top, then shift it back down sign extending
+    const auto top = read(instr.rn()) << (32 - lsb - width);
+    write(instr.rd(), static_cast<Word>(static_cast<std::int32_t>(top) >>
+                                        (32 - width)));
+    return Status::Running;
+  }
+  case Instruction::Ubfx:
+    write(instr.rd(), (read(instr.rn()) >> lsb) & field);
+    return Status::Running;
+  default:
+    return Status::Unsupported;
+  }
+}
+
+Status Interpreter::execute_reverse(const ReverseInstruction &instr) {
+  const auto rm = read(instr.rm());
+  const auto swap_bytes = [](Word value) {
+    return value >> 24 | (value >> 8 & 0xFF00u) | (value << 8 & 0xFF0000u) |
+           value << 24;
+  };
+  switch (instr.operation()) {
+  case Instruction::Rbit: {
+    auto result = Word{0};
+    for (auto i = 0; i < 32; ++i) {
+      result |= ((rm >> i) & 1u) << (31 - i);
+    }
+    write(instr.rd(), result);
+    return Status::Running;
+  }
+  case Instruction::Rev:
+    write(instr.rd(), swap_bytes(rm));
+    return Status::Running;
+  case Instruction::Rev16:
+    write(instr.rd(), (rm >> 8 & 0x00FF00FFu) | (rm << 8 & 0xFF00FF00u));
+    return Status::Running;
+  case Instruction::Revsh: {
+    const auto swapped = static_cast<std::int16_t>((rm >> 8 & 0xFFu) |
+                                                   (rm << 8 & 0xFF00u));
+    write(instr.rd(), static_cast<Word>(std::int32_t{swapped}));
+    return Status::Running;
+  }
+  default:
+    return Status::Unsupported;
+  }
+}
+
+Status Interpreter::execute_branch(const BranchInstruction &instr) {
+  if (instr.operation() == Instruction::Bx) {
+    write(Register::PC, read(instr.rm()));
+    return Status::Running;
+  }
+
+  if (instr.operation() == Instruction::Cbz ||
+      instr.operation() == Instruction::Cbnz) {
+    const auto zero = read(instr.rn()) == 0;
+    if (zero != (instr.operation() == Instruction::Cbz)) {
+      return Status::Running;
+    }
+  }
+
+  const auto target = label_address(*instr.label());
+  if (!target) {
+    return Status::UndefinedLabel;
+  }
+  if (instr.operation() == Instruction::Bl) {
+    write(Register::LR, cpu_.reg(Register::PC) + word_size);
+  }
+  write(Register::PC, *target);
+  return Status::Running;
+}
+
+Status
+Interpreter::execute_single_memory(const SingleMemoryInstruction &instr) {
+  using IndexMode = SingleMemoryInstruction::IndexMode;
+  const auto op = instr.operation();
+  const auto load = op <= Instruction::Ldrsh;
+  const auto source = instr.source();
+
+  // ldr rd, =imm32 loads a constant the assembler places in a literal pool
+  if (const auto literal = std::get_if<unsigned>(&source)) {
+    if (op != Instruction::Ldr) {
+      return Status::Unsupported;
+    }
+    write(instr.rd(), *literal);
+    return Status::Running;
+  }
+
+  auto address = Word{0};
+  // the base register is only written back once the access is done, so that
+  // a fault leaves it alone
+  auto writeback = std::optional<Word>{};
+  if (const auto label = std::get_if<const Label *>(&source)) {
+    const auto target = label_address(**label);
+    if (!target) {
+      return Status::UndefinedLabel;
+    }
+    address = *target;
+  } else {
+    const auto offset = operand2(std::get<Operand2>(source)).first;
+    const auto base = read(instr.rn());
+    const auto offset_address =
+        instr.subtract() ? base - offset : base + offset;
+    address =
+        instr.indexmode() == IndexMode::PostIndex ? base : offset_address;
+    if (instr.indexmode() != IndexMode::Offset) {
+      writeback = offset_address;
+    }
+  }
+
+  const auto size = op == Instruction::Ldr || op == Instruction::Str ? Word{4}
+                    : op == Instruction::Ldrb || op == Instruction::Ldrsb ||
+                            op == Instruction::Strb
+                        ? Word{1}
+                        : Word{2};
+  if (!memory_.contains(address, size)) {
+    fault_address_ = address;
+    return Status::MemoryFault;
+  }
+
+  if (!load) {
+    const auto value = read(instr.rd());
+    if (size == 4) {
+      memory_.store<std::uint32_t>(address, value);
+    } else if (size == 2) {
+      memory_.store<std::uint16_t>(address, static_cast<std::uint16_t>(value));
+    } else {
+      memory_.store<std::uint8_t>(address, static_cast<std::uint8_t>(value));
+    }
+    if (writeback) {
+      write(instr.rn(), *writeback);
+    }
+    return Status::Running;
+  }
+
+  auto value = Word{0};
+  switch (op) {
+  case Instruction::Ldr:
+    value = memory_.load<std::uint32_t>(address);
+    break;
+  case Instruction::Ldrb:
+    value = memory_.load<std::uint8_t>(address);
+    break;
+  case Instruction::Ldrsb:
+    value = static_cast<Word>(std::int32_t{memory_.load<std::int8_t>(address)});
+    break;
+  case Instruction::Ldrh:
+    value = memory_.load<std::uint16_t>(address);
+    break;
+  case Instruction::Ldrsh:
+    value =
+        static_cast<Word>(std::int32_t{memory_.load<std::int16_t>(address)});
+    break;
+  default:
+    return Status::Unsupported;
+  }
+  // a load into the base register wins over the writeback
+  if (writeback) {
+    write(instr.rn(), *writeback);
+  }
+  write(instr.rd(), value);
+  return Status::Running;
+}
+
+Status Interpreter::execute_block_memory(const BlockMemoryInstruction &instr) {
+  const auto registers = std::uint32_t{instr.register_mask()};
+  if (registers == 0) {
+    return Status::Unsupported;
+  }
+
+  const auto op = instr.operation();
+  const auto load = op <= Instruction::Ldmdb || op == Instruction::Pop;
+  const auto count = static_cast<Word>(stl::popcount(registers));
+  const auto base = read(instr.rn());
+  const auto size = count * word_size;
+
+  // registers are transferred in ascending order from the lowest address
+  auto start = base;
+  auto final_base = base + size;
+  switch (op) {
+  case Instruction::Ldmib:
+  case Instruction::Stmib:
+    start = base + word_size;
+    break;
+  case Instruction::Ldmda:
+  case Instruction::Stmda:
+    start = base - size + word_size;
+    final_base = base - size;
+    break;
+  case Instruction::Ldmdb:
+  case Instruction::Stmdb:
+  case Instruction::Push:
+    start = base - size;
+    final_base = start;
+    break;
+  default:
+    break;
+  }
+
+  if (!memory_.contains(start, size)) {
+    fault_address_ = start;
+    return Status::MemoryFault;
+  }
+
+  // pc is read and written through read() and write(), the rest go straight
+  // between memory and the register file
+  static constexpr auto pc_bit = 1u << (Register::PC - 1);
+  if (!load) {
+    if ((registers & pc_bit) != 0) {
+      auto values = cpu_.registers;
+      values[Register::PC - 1] = read(Register::PC);
+      memory_.store_registers(start, registers, values.data());
+    } else {
+      memory_.store_registers(start, registers, cpu_.registers.data());
+    }
+  }
+  // a loaded base register wins over the writeback
+  if (instr.writeback()) {
+    write(instr.rn(), final_base);
+  }
+  if (load) {
+    memory_.load_registers(start, registers & ~pc_bit, cpu_.registers.data());
+    if ((registers & pc_bit) != 0) {
+      write(Register::PC,
+            memory_.load<std::uint32_t>(start + size - word_size));
+    }
+  }
+  return Status::Running;
+}
@@ -0,0 +1,118 @@
+#ifndef AAVM_VM_INTERPRETER_H_
+#define AAVM_VM_INTERPRETER_H_
+
+#include "cpu.h"
+#include "instructions.h"
+#include "label.h"
+#include "memory.h"
+#include "module.h"
+#include "operand2.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace aavm::vm {
+
+// An instruction translated for threaded dispatch: the handler that executes
+// it and its operands as indices into the register file.
+struct ThreadedOp {
+  // the address of the handler when dispatching with computed goto
+  const void *handler{};
+  // the instruction, which instructions without a handler of their own run
+  // through the switch interpreter
+  const ir::Instruction *instr{};
+  // the immediate operand, shift amount or branch target index
+  std::uint32_t imm{};
+  std::uint8_t kind{};
+  std::uint8_t cond{};
+  std::uint8_t rd{};
+  std::uint8_t rn{};
+  std::uint8_t rm{};
+  std::uint8_t rs{};
+  std::uint8_t shift{};
+  // how the operand2 fields are laid out
+  std::uint8_t form{};
+  std::uint8_t mode{};
+  bool flags{};
+  bool subtract{};
+};
+
+// Executes a parsed module directly by switching over the operation of each
+// instruction. The instruction at index i lives at code_base + 4 * i, which is
+// what pc reads and branches see; code is not part of guest memory.
+class Interpreter {
+public:
+  static constexpr auto default_code_base = std::uint32_t{0x10000};
+
+  Interpreter() = delete;
+  Interpreter(const ir::Module &module, Memory &memory,
+              std::uint32_t code_base = default_code_base);
+
+  // points pc at the first instruction, sp at the top of memory and lr at the
+  // end of the module, clears the other registers and the flags
+  void reset();
+
+  // executes instructions until the program halts or faults
+  Status run();
+  // executes a single instruction
+  Status step();
+  // executes instructions like run(), but from code translated into handlers
+  // that dispatch straight to the next one, which the host predicts far
+  // better than a single switch
+  Status run_threaded();
+
+  constexpr auto &cpu() { return cpu_; }
+  constexpr auto &cpu() const { return cpu_; }
+  constexpr auto &memory() const { return memory_; }
+  // instructions stepped over so far, including those whose condition failed
+  constexpr auto retired() const { return retired_; }
+  // the address of the access that caused a MemoryFault
+  constexpr auto fault_address() const { return fault_address_; }
+
+  std::uint32_t end_address() const;
+  std::optional<std::uint32_t> label_address(const ir::Label &label) const;
+
+private:
+  void translate();
+
+  Status execute(const ir::Instruction &instr);
+  Status execute_arithmetic(const ir::ArithmeticInstruction &instr);
+  Status execute_multiply(const ir::MultiplyInstruction &instr);
+  Status execute_divide(const ir::DivideInstruction &instr);
+  Status execute_move(const ir::MoveInstruction &instr);
+  Status execute_comparison(const ir::ComparisonInstruction &instr);
+  Status execute_bitfield(const ir::BitfieldInstruction &instr);
+  Status execute_reverse(const ir::ReverseInstruction &instr);
+  Status execute_branch(const ir::BranchInstruction &instr);
+  Status execute_single_memory(const ir::SingleMemoryInstruction &instr);
+  Status execute_block_memory(const ir::BlockMemoryInstruction &instr);
+
+  // reads pc as the address of the instruction plus 8
+  std::uint32_t read(ir::Register::Kind reg) const;
+  // writing pc branches once the instruction completes
+  void write(ir::Register::Kind reg, std::uint32_t value);
+  // the value of src2 and the carry out of its shift
+  std::pair<std::uint32_t, std::uint32_t>
+  operand2(const ir::Operand2 &src2) const;
+
+  const ir::Module &module_;
+  Memory &memory_;
+  std::uint32_t code_base_;
+
+  Cpu cpu_{};
+  std::uint32_t next_pc_{};
+  std::uint64_t retired_{};
+  std::uint32_t fault_address_{};
+  // one op per instruction and one that halts, translated on first use
+  std::vector<ThreadedOp> threaded_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using Interpreter = vm::Interpreter;
+}
+
+#endif
@@ -0,0 +1,1236 @@
+#include "jit.h"
+#include "instruction.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+
+#if AAVM_JIT
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+#if AAVM_JIT
+
+namespace {
+
+// x86-64 register numbers
+enum Host : std::uint8_t {
+  Rax,
+  Rcx,
+  Rdx,
+  Rbx,
+  Rsp,
+  Rbp,
+  Rsi,
+  Rdi,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15
+};
+
+// condition codes, as in jcc, setcc and cmovcc
+enum class Cc : std::uint8_t {
+  O = 0x0,
+  No = 0x1,
+  B = 0x2,
+  Ae = 0x3,
+  E = 0x4,
+  Ne = 0x5,
+  Be = 0x6,
+  A = 0x7,
+  S = 0x8,
+  Ns = 0x9,
+  L = 0xC,
+  Ge = 0xD,
+  Le = 0xE,
+  G = 0xF
+};
+
+constexpr auto invert(Cc cc) {
+  return static_cast<Cc>(static_cast<int>(cc) ^ 1);
+}
+
+// the host registers compiled code uses
+constexpr auto cpu_register = Rdi;
+constexpr auto memory_register = R8;
+constexpr auto apsr_register = R9;
+constexpr auto pages_register = R10;
+// compiled code starts by loading the host addresses of memory and of the
+// watched page bytes, which differ from one process to the next
+constexpr auto memory_pointer_offset = std::size_t{2};
+constexpr auto pages_pointer_offset = std::size_t{12};
+constexpr auto pointers_size = std::size_t{20};
+
+// what compiled code adds guest addresses to, or offsets into a buffer
+const std::uint8_t *host_memory(const Memory &memory) {
+  return memory.layout() == Memory::Reserved ? memory.flat_base()
+                                             : memory.data();
+}
+// callee saved, so they hold guest registers
+constexpr Host guest_hosts[] = {Rbx, Rbp, R12, R13, R14, R15};
+
+constexpr auto apsr_offset = static_cast<int>(offsetof(Cpu, apsr));
+
+// Encodes the handful of x86-64 instructions compiled code is made of.
+// Operands are 32 bits unless noted.
+class Emitter {
+public:
+  auto size() const { return code_.size(); }
+  auto &code() const { return code_; }
+
+  void byte(unsigned value) {
+    code_.push_back(static_cast<std::uint8_t>(value));
+  }
+  void dword(Word value) {
+    for (auto i = 0; i < 4; ++i) {
+      byte(value >> (i * 8));
+    }
+  }
+
+  // op reg, rm with both in registers
+  void rr(std::initializer_list<unsigned> opcode, unsigned reg, unsigned rm) {
+    rex(false, reg, 0, rm);
+    bytes(opcode);
+    byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+  }
+  // op reg, [rdi + disp]
+  void rcpu(std::initializer_list<unsigned> opcode, unsigned reg, int disp) {
+    rex(false, reg, 0, cpu_register);
+    bytes(opcode);
+    byte(0x40 | (reg & 7) << 3 | (cpu_register & 7));
+    byte(static_cast<unsigned>(disp));
+  }
+  // op reg, [base + index]
+  void rindex(std::initializer_list<unsigned> opcode, unsigned reg,
+              unsigned base, unsigned index) {
+    rex(false, reg, index, base);
+    bytes(opcode);
+    byte((reg & 7) << 3 | 4);
+    byte((index & 7) << 3 | (base & 7));
+  }
+
+  void mov(unsigned dst, unsigned src) { rr({0x89}, src, dst); }
+  void mov_imm(unsigned dst, Word imm) {
+    rex(false, 0, 0, dst);
+    byte(0xB8 + (dst & 7));
+    dword(imm);
+  }
+  void mov_imm64(unsigned dst, const void *pointer) {
+    rex(true, 0, 0, dst);
+    byte(0xB8 + (dst & 7));
+    const auto imm = reinterpret_cast<std::uintptr_t>(pointer);
+    dword(static_cast<Word>(imm));
+    dword(static_cast<Word>(imm >> 32));
+  }
+  void load_cpu(unsigned dst, int disp) { rcpu({0x8B}, dst, disp); }
+  void store_cpu(int disp, unsigned src) { rcpu({0x89}, src, disp); }
+  void store_cpu_imm(int disp, Word imm) {
+    rcpu({0xC7}, 0, disp);
+    dword(imm);
+  }
+
+  // add 0, or 1, adc 2, and 4, sub 5, xor 6, cmp 7
+  void alu(unsigned ext, unsigned dst, unsigned src) {
+    rr({ext << 3 | 1}, src, dst);
+  }
+  void alu_imm(unsigned ext, unsigned dst, Word imm) {
+    rr({0x81}, ext, dst);
+    dword(imm);
+  }
+  void test(unsigned a, unsigned b) { rr({0x85}, b, a); }
+  void not_(unsigned dst) { rr({0xF7}, 2, dst); }
+  void imul(unsigned dst, unsigned src) { rr({0x0F, 0xAF}, dst, src); }
+  // rol 0, ror 1, shl 4, shr 5, sar 7
+  void shift(unsigned ext, unsigned dst, unsigned amount) {
+    rr({0xC1}, ext, dst);
+    byte(amount);
+  }
+  // CF = bit of value
+  void bt_imm(unsigned value, unsigned bit) {
+    rr({0x0F, 0xBA}, 4, value);
+    byte(bit);
+  }
+  void bt(unsigned value, unsigned bit) { rr({0x0F, 0xA3}, bit, value); }
+  void setcc(Cc cc, unsigned dst) {
+    rr({0x0F, 0x90u + static_cast<unsigned>(cc)}, 0, dst);
+  }
+  void movzx8(unsigned dst, unsigned src) { rr({0x0F, 0xB6}, dst, src); }
+  void cmov(Cc cc, unsigned dst, unsigned src) {
+    rr({0x0F, 0x40u + static_cast<unsigned>(cc)}, dst, src);
+  }
+  void lahf() { byte(0x9F); }
+  void push(unsigned reg) {
+    rex(false, 0, 0, reg);
+    byte(0x50 + (reg & 7));
+  }
+  void pop(unsigned reg) {
+    rex(false, 0, 0, reg);
+    byte(0x58 + (reg & 7));
+  }
+  void ret() { byte(0xC3); }
+
+  // jumps to a label bound later, returns the place to patch
+  std::size_t jcc(Cc cc) {
+    bytes({0x0F, 0x80u + static_cast<unsigned>(cc)});
+    dword(0);
+    return size() - 4;
+  }
+  std::size_t jmp() {
+    byte(0xE9);
+    dword(0);
+    return size() - 4;
+  }
+  // points the jump at patch here
+  void bind(std::size_t patch) {
+    const auto rel = static_cast<Word>(size() - (patch + 4));
+    std::memcpy(code_.data() + patch, &rel, sizeof(rel));
+  }
+
+private:
+  void bytes(std::initializer_list<unsigned> values) {
+    for (const auto value : values) {
+      byte(value);
+    }
+  }
+  void rex(bool wide, unsigned reg, unsigned index, unsigned base) {
+    const auto prefix = 0x40u | (wide ? 8u : 0u) | (reg >> 3 & 1) << 2 |
+                        (index >> 3 & 1) << 1 | (base >> 3 & 1);
+    if (prefix != 0x40) {
+      byte(prefix);
+    }
+  }
+
+  std::vector<std::uint8_t> code_{};
+};
+
+// what the host flags hold that NZCV in apsr_register does not yet
+enum class Pending {
+  None,
+  // an add or adc, with C in CF
+  Add,
+  // a sub or cmp, with C the inverse of CF
+  Sub,
+  // a logical operation tested its result, C is kept, set or cleared
+  Keep,
+  Set,
+  Clear
+};
+
+class BlockCompiler {
+public:
+  BlockCompiler(const Block &block, const Memory &memory,
+                const std::uint8_t *watched_pages)
+      : block_{block}, memory_{memory}, watched_pages_{watched_pages} {}
+
+  // compiles as much of the block as it can, returns false if that is
+  // nothing
+  bool compile();
+  auto &code() const { return out_.code(); }
+  auto &faults() const { return faults_; }
+
+private:
+  static bool supported(const MicroOp &op);
+  static bool supported_operand(const MicroOp &op);
+
+  void map_registers(std::size_t count);
+  void read(unsigned dst, unsigned guest);
+  void write(unsigned guest, unsigned src);
+
+  void flags(Pending pending);
+  void settle() {
+    flags(pending_);
+    pending_ = Pending::None;
+  }
+  std::optional<Cc> live(unsigned cond) const;
+  Cc test(unsigned cond);
+
+  void operand(const MicroOp &op, unsigned dst);
+  void instruction(const MicroOp &op);
+  void conditional(const MicroOp &op);
+  void memory(const MicroOp &op);
+  void branch(const MicroOp &op);
+
+  void exit(Word pc, std::size_t retired);
+  void bail(std::size_t patch);
+  // makes the access emitted next leave the instruction to the interpreter
+  // if it faults
+  void guard();
+
+  const Block &block_;
+  const Memory &memory_;
+  const std::uint8_t *watched_pages_;
+  Emitter out_{};
+
+  // the guest instruction being compiled
+  std::size_t index_{};
+  Word address_{};
+  Pending pending_{};
+
+  std::array<std::optional<Host>, 16> hosts_{};
+  std::uint16_t written_{};
+  std::vector<std::size_t> exits_{};
+  // jumps to the stub that leaves an instruction to the interpreter
+  struct Bail {
+    // the jump, or the fault site for accesses that fault instead
+    std::size_t patch;
+    Word address;
+    std::size_t retired;
+    bool fault;
+  };
+  std::vector<Bail> bails_{};
+  std::vector<FaultSite> faults_{};
+};
+
+bool BlockCompiler::supported_operand(const MicroOp &op) {
+  switch (op.operand) {
+  case MicroOp::Immediate:
+  case MicroOp::RotatedImmediate:
+  case MicroOp::Register:
+    return true;
+  case MicroOp::ShiftImmediate:
+    return op.shift != Instruction::Rrx;
+  default:
+    return false;
+  }
+}
+
+bool BlockCompiler::supported(const MicroOp &op) {
+  const auto setflags = (op.flags & MicroOp::UpdatesFlags) != 0;
+  switch (op.operation) {
+  case Instruction::Add:
+  case Instruction::Adc:
+  case Instruction::Sub:
+  case Instruction::Sbc:
+  case Instruction::Rsb:
+  case Instruction::Rsc:
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+    return op.rd != 15 && supported_operand(op);
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic:
+  case Instruction::Mov:
+  case Instruction::Mvn:
+  case Instruction::Tst:
+  case Instruction::Teq:
+    // the carry out of a shift is left to the interpreter
+    return op.rd != 15 && supported_operand(op) &&
+           !(setflags && op.operand == MicroOp::ShiftImmediate);
+  case Instruction::Movw:
+  case Instruction::Movt:
+    return op.rd != 15;
+  case Instruction::Mul:
+  case Instruction::Mla:
+  case Instruction::Mls:
+    return op.rd != 15 && !setflags;
+  case Instruction::Ldr:
+  case Instruction::Ldrb:
+  case Instruction::Str:
+  case Instruction::Strb:
+    return op.rd != 15 && !(op.rn == 15 && (op.flags & MicroOp::Writeback)) &&
+           (op.operand == MicroOp::Immediate || supported_operand(op));
+  case Instruction::B:
+  case Instruction::Bl:
+    return true;
+  case Instruction::Bx:
+    return op.rm != 15;
+  default:
+    return false;
+  }
+}
+
+void BlockCompiler::map_registers(std::size_t count) {
+  auto uses = std::array<unsigned, 16>{};
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    const auto &op = block_.ops[i];
+    ++uses[op.rd];
+    ++uses[op.rn];
+    if (op.operand == MicroOp::Register ||
+        op.operand == MicroOp::ShiftImmediate ||
+        op.operation == Instruction::Bx) {
+      ++uses[op.rm];
+    }
+    if (op.operation == Instruction::Mul || op.operation == Instruction::Mla ||
+        op.operation == Instruction::Mls) {
+      ++uses[op.rm];
+      ++uses[op.rs];
+    }
+  }
+  // pc reads are constants
+  uses[15] = 0;
+
+  auto order = std::array<unsigned, 15>{};
+  for (auto i = 0u; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](auto a, auto b) { return uses[a] > uses[b]; });
+  auto next = std::size_t{0};
+  for (const auto guest : order) {
+    // loading and storing a register only pays off if it is used again
+    if (next == std::size(guest_hosts) || uses[guest] < 2) {
+      break;
+    }
+    hosts_[guest] = guest_hosts[next++];
+  }
+}
+
+void BlockCompiler::read(unsigned dst, unsigned guest) {
+  if (guest == 15) {
+    out_.mov_imm(dst, address_ + 8);
+  } else if (hosts_[guest]) {
+    out_.mov(dst, *hosts_[guest]);
+  } else {
+    out_.load_cpu(dst, static_cast<int>(guest * 4));
+  }
+}
+
+void BlockCompiler::write(unsigned guest, unsigned src) {
+  if (hosts_[guest]) {
+    out_.mov(*hosts_[guest], src);
+    written_ |= static_cast<std::uint16_t>(1u << guest);
+  } else {
+    out_.store_cpu(static_cast<int>(guest * 4), src);
+  }
+}
+
+// converts what the host flags say into NZCV in apsr_register
+void BlockCompiler::flags(Pending pending) {
+  if (pending == Pending::None) {
+    return;
+  }
+  // SF and ZF land in bits 15 and 14 of eax, CF in bit 8
+  out_.lahf();
+  if (pending == Pending::Add || pending == Pending::Sub) {
+    out_.setcc(Cc::O, Rcx);
+    out_.movzx8(Rcx, Rcx);
+    out_.shift(4, Rcx, 28);
+    out_.mov(Rdx, Rax);
+    out_.alu_imm(4, Rdx, 0x100);
+    if (pending == Pending::Sub) {
+      out_.alu_imm(6, Rdx, 0x100);
+    }
+    out_.shift(4, Rdx, 21);
+    out_.alu_imm(4, Rax, 0xC000);
+    out_.shift(4, Rax, 16);
+    out_.alu(1, Rax, Rdx);
+    out_.alu(1, Rax, Rcx);
+    out_.mov(apsr_register, Rax);
+    return;
+  }
+  out_.alu_imm(4, Rax, 0xC000);
+  out_.shift(4, Rax, 16);
+  out_.alu_imm(4, apsr_register,
+               pending == Pending::Keep ? FlagC | FlagV : FlagV);
+  if (pending == Pending::Set) {
+    out_.alu_imm(1, apsr_register, FlagC);
+  }
+  out_.alu(1, apsr_register, Rax);
+}
+
+// the host condition cond maps to while the flags are pending, if any
+std::optional<Cc> BlockCompiler::live(unsigned cond) const {
+  switch (cond) {
+  case Condition::EQ:
+    return Cc::E;
+  case Condition::NE:
+    return Cc::Ne;
+  case Condition::MI:
+    return Cc::S;
+  case Condition::PL:
+    return Cc::Ns;
+  default:
+    break;
+  }
+  if (pending_ != Pending::Add && pending_ != Pending::Sub) {
+    return std::nullopt;
+  }
+  const auto sub = pending_ == Pending::Sub;
+  switch (cond) {
+  case Condition::CS:
+    return sub ? Cc::Ae : Cc::B;
+  case Condition::CC:
+    return sub ? Cc::B : Cc::Ae;
+  case Condition::VS:
+    return Cc::O;
+  case Condition::VC:
+    return Cc::No;
+  case Condition::HI:
+    return sub ? std::optional{Cc::A} : std::nullopt;
+  case Condition::LS:
+    return sub ? std::optional{Cc::Be} : std::nullopt;
+  case Condition::GE:
+    return Cc::Ge;
+  case Condition::LT:
+    return Cc::L;
+  case Condition::GT:
+    return Cc::G;
+  case Condition::LE:
+    return Cc::Le;
+  default:
+    return std::nullopt;
+  }
+}
+
+// emits a test of cond and returns the host condition under which it passes,
+// flags that are pending and map to one are left where they are
+Cc BlockCompiler::test(unsigned cond) {
+  if (pending_ != Pending::None) {
+    if (const auto cc = live(cond)) {
+      return *cc;
+    }
+    settle();
+  }
+
+  // the single flag conditions test their bit, the others the table row
+  static constexpr unsigned bits[] = {0,  30, 30, 29, 29, 31, 31, 28, 28};
+  if (cond >= Condition::EQ && cond <= Condition::VC) {
+    out_.bt_imm(apsr_register, bits[cond]);
+    return (cond - Condition::EQ) % 2 == 0 ? Cc::B : Cc::Ae;
+  }
+  out_.mov(Rax, apsr_register);
+  out_.shift(5, Rax, 28);
+  out_.mov_imm(Rcx, condition_table[cond & 0xF]);
+  out_.bt(Rcx, Rax);
+  return Cc::B;
+}
+
+void BlockCompiler::operand(const MicroOp &op, unsigned dst) {
+  switch (op.operand) {
+  case MicroOp::Immediate:
+  case MicroOp::RotatedImmediate:
+    out_.mov_imm(dst, op.imm);
+    return;
+  case MicroOp::Register:
+    read(dst, op.rm);
+    return;
+  default:
+    break;
+  }
+
+  read(dst, op.rm);
+  switch (op.shift) {
+  case Instruction::Lsl:
+    out_.shift(4, dst, op.amount);
+    break;
+  case Instruction::Lsr:
+    if (op.amount == 32) {
+      out_.mov_imm(dst, 0);
+    } else {
+      out_.shift(5, dst, op.amount);
+    }
+    break;
+  case Instruction::Asr:
+    out_.shift(7, dst, std::min<unsigned>(op.amount, 31));
+    break;
+  default:
+    out_.shift(1, dst, op.amount);
+    break;
+  }
+}
+
+void BlockCompiler::instruction(const MicroOp &op) {
+  const auto setflags = (op.flags & MicroOp::UpdatesFlags) != 0;
+  switch (op.operation) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Rsb:
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+    read(Rax, op.rn);
+    operand(op, Rcx);
+    if (op.operation == Instruction::Add || op.operation == Instruction::Cmn) {
+      out_.alu(0, Rax, Rcx);
+    } else if (op.operation == Instruction::Rsb) {
+      out_.alu(5, Rcx, Rax);
+      out_.mov(Rax, Rcx);
+    } else {
+      out_.alu(5, Rax, Rcx);
+    }
+    if (op.operation != Instruction::Cmp && op.operation != Instruction::Cmn) {
+      write(op.rd, Rax);
+    }
+    if (setflags) {
+      pending_ = op.operation == Instruction::Add ||
+                         op.operation == Instruction::Cmn
+                     ? Pending::Add
+                     : Pending::Sub;
+    }
+    return;
+  case Instruction::Adc:
+  case Instruction::Sbc:
+  case Instruction::Rsc:
+    // x + y + C, with y inverted for the subtractions
+    read(Rax, op.rn);
+    operand(op, Rcx);
+    if (op.operation == Instruction::Rsc) {
+      out_.not_(Rax);
+      out_.bt_imm(apsr_register, 29);
+      out_.alu(2, Rcx, Rax);
+      out_.mov(Rax, Rcx);
+    } else {
+      if (op.operation == Instruction::Sbc) {
+        out_.not_(Rcx);
+      }
+      out_.bt_imm(apsr_register, 29);
+      out_.alu(2, Rax, Rcx);
+    }
+    write(op.rd, Rax);
+    if (setflags) {
+      pending_ = Pending::Add;
+    }
+    return;
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic:
+  case Instruction::Mov:
+  case Instruction::Mvn:
+  case Instruction::Tst:
+  case Instruction::Teq:
+    operand(op, Rcx);
+    switch (op.operation) {
+    case Instruction::Mov:
+      out_.mov(Rax, Rcx);
+      break;
+    case Instruction::Mvn:
+      out_.mov(Rax, Rcx);
+      out_.not_(Rax);
+      break;
+    default:
+      read(Rax, op.rn);
+      if (op.operation == Instruction::Bic) {
+        out_.not_(Rcx);
+      }
+      out_.alu(op.operation == Instruction::Orr ? 1
+               : op.operation == Instruction::Eor ||
+                       op.operation == Instruction::Teq
+                   ? 6
+                   : 4,
+               Rax, Rcx);
+      break;
+    }
+    if (op.operation != Instruction::Tst && op.operation != Instruction::Teq) {
+      write(op.rd, Rax);
+    }
+    if (setflags) {
+      out_.test(Rax, Rax);
+      pending_ = op.operand != MicroOp::RotatedImmediate ? Pending::Keep
+                 : (op.imm >> 31) != 0                   ? Pending::Set
+                                                         : Pending::Clear;
+    }
+    return;
+  case Instruction::Movw:
+    out_.mov_imm(Rax, op.imm & 0xFFFFu);
+    write(op.rd, Rax);
+    return;
+  case Instruction::Movt:
+    read(Rax, op.rd);
+    out_.alu_imm(4, Rax, 0xFFFFu);
+    out_.alu_imm(1, Rax, op.imm << 16);
+    write(op.rd, Rax);
+    return;
+  case Instruction::Mul:
+  case Instruction::Mla:
+  case Instruction::Mls:
+    read(Rax, op.rm);
+    read(Rcx, op.rs);
+    out_.imul(Rax, Rcx);
+    if (op.operation == Instruction::Mla) {
+      read(Rcx, op.rn);
+      out_.alu(0, Rax, Rcx);
+    } else if (op.operation == Instruction::Mls) {
+      read(Rcx, op.rn);
+      out_.alu(5, Rcx, Rax);
+      out_.mov(Rax, Rcx);
+    }
+    write(op.rd, Rax);
+    return;
+  default:
+    memory(op);
+    return;
+  }
+}
+
+// moves that do not touch the host flags, which a cmov can make conditional
+static bool is_plain_move(const MicroOp &op) {
+  return (op.operation == Instruction::Mov ||
+          op.operation == Instruction::Mvn) &&
+         (op.flags & MicroOp::UpdatesFlags) == 0 &&
+         op.operand != MicroOp::ShiftImmediate;
+}
+
+void BlockCompiler::conditional(const MicroOp &op) {
+  if (is_plain_move(op)) {
+    // the value only takes moves, which keep the host flags of the test
+    const auto pass = test(op.condition);
+    operand(op, Rdx);
+    if (op.operation == Instruction::Mvn) {
+      out_.not_(Rdx);
+    }
+    if (hosts_[op.rd]) {
+      out_.cmov(pass, *hosts_[op.rd], Rdx);
+      written_ |= static_cast<std::uint16_t>(1u << op.rd);
+    } else {
+      read(Rax, op.rd);
+      out_.cmov(pass, Rax, Rdx);
+      write(op.rd, Rax);
+    }
+    return;
+  }
+
+  // otherwise branch around it, settling pending flags on both paths
+  const auto pass = test(op.condition);
+  const auto before = pending_;
+  const auto skip = out_.jcc(invert(pass));
+  settle();
+  instruction(op);
+  settle();
+  if (before == Pending::None) {
+    out_.bind(skip);
+    return;
+  }
+  const auto done = out_.jmp();
+  out_.bind(skip);
+  flags(before);
+  out_.bind(done);
+}
+
+void BlockCompiler::memory(const MicroOp &op) {
+  const auto word = op.operation == Instruction::Ldr ||
+                    op.operation == Instruction::Str;
+  const auto store = op.operation == Instruction::Str ||
+                     op.operation == Instruction::Strb;
+  const auto size = word ? Word{4} : Word{1};
+  const auto reserved = memory_.layout() == Memory::Reserved;
+
+  read(Rax, op.rn);
+  out_.mov(Rdx, Rax);
+  operand(op, Rcx);
+  out_.alu((op.flags & MicroOp::Subtract) != 0 ? 5 : 0, Rdx, Rcx);
+  out_.mov(Rcx, (op.flags & MicroOp::PreIndex) != 0 ? Rdx : Rax);
+  if (!reserved) {
+    // the offset into memory, which must leave room for the access
+    out_.alu_imm(5, Rcx, memory_.base());
+    out_.alu_imm(7, Rcx, memory_.size() - size);
+    bail(out_.jcc(Cc::A));
+  }
+
+  // Stores into decoded code drop it, stores into watched pages mark them
+  // dirty and stores into guarded pages may hit a watchpoint, all of which
+  // the interpreter sees to when it makes the store instead. Loads from
+  // guarded pages are only tested once made, having written just rax, as
+  // they cannot have left memory by then.
+  const auto test_pages = [&] {
+    for (const auto last : {Word{0}, size - 1}) {
+      out_.mov(Rsi, Rcx);
+      if (reserved) {
+        out_.alu_imm(5, Rsi, memory_.base());
+      }
+      if (last != 0) {
+        out_.alu_imm(0, Rsi, last);
+      }
+      out_.shift(5, Rsi, 12);
+      if (store) {
+        if (reserved) {
+          // past the pages, where the store faults in the interpreter
+          out_.alu_imm(7, Rsi, (memory_.size() - 1) / CodeCache::page_size);
+          bail(out_.jcc(Cc::A));
+        }
+        out_.rindex({0x80}, 7, pages_register, Rsi);
+        out_.byte(0);
+      } else {
+        out_.rindex({0xF6}, 0, pages_register, Rsi);
+        out_.byte(CodeCache::GuardedLoads);
+      }
+      bail(out_.jcc(Cc::Ne));
+      if (!word) {
+        break;
+      }
+    }
+  };
+
+  if (store) {
+    read(Rax, op.rd);
+    test_pages();
+    if (reserved) {
+      guard();
+    }
+    out_.rindex({word ? 0x89u : 0x88u}, Rax, memory_register, Rcx);
+  } else {
+    if (reserved) {
+      guard();
+    }
+    if (word) {
+      out_.rindex({0x8B}, Rax, memory_register, Rcx);
+    } else {
+      out_.rindex({0x0F, 0xB6}, Rax, memory_register, Rcx);
+    }
+    test_pages();
+  }
+
+  // a load into the base register wins over the writeback
+  if ((op.flags & MicroOp::Writeback) != 0) {
+    write(op.rn, Rdx);
+  }
+  if (!store) {
+    write(op.rd, Rax);
+  }
+}
+
+void BlockCompiler::branch(const MicroOp &op) {
+  const auto retired = index_ + 1;
+  const auto next = address_ + 4;
+  auto taken = std::optional<std::size_t>{};
+  auto before = Pending::None;
+  if (op.condition != Condition::AL) {
+    const auto pass = test(op.condition);
+    before = pending_;
+    taken = out_.jcc(pass);
+    exit(next, retired);
+    out_.bind(*taken);
+    pending_ = before;
+  }
+
+  settle();
+  if (op.operation == Instruction::Bx) {
+    // bit 0 selects thumb state on interworking branches, which we ignore
+    read(Rax, op.rm);
+    out_.alu_imm(4, Rax, ~Word{1});
+    out_.store_cpu(15 * 4, Rax);
+  } else {
+    if (op.operation == Instruction::Bl) {
+      out_.mov_imm(Rax, next);
+      write(14, Rax);
+    }
+    out_.store_cpu_imm(15 * 4, op.imm);
+  }
+  out_.mov_imm(Rax, static_cast<Word>(retired * 2));
+  exits_.push_back(out_.jmp());
+}
+
+// leaves with pc at the next instruction
+void BlockCompiler::exit(Word pc, std::size_t retired) {
+  const auto before = pending_;
+  settle();
+  out_.store_cpu_imm(15 * 4, pc);
+  out_.mov_imm(Rax, static_cast<Word>(retired * 2));
+  exits_.push_back(out_.jmp());
+  pending_ = before;
+}
+
+// the instruction being compiled goes to the interpreter if patch jumps
+void BlockCompiler::bail(std::size_t patch) {
+  bails_.push_back({patch, address_, index_, false});
+}
+
+void BlockCompiler::guard() {
+  bails_.push_back({faults_.size(), address_, index_, true});
+  faults_.push_back({static_cast<std::uint32_t>(out_.size()), 0});
+}
+
+bool BlockCompiler::compile() {
+  auto count = std::size_t{0};
+  while (count < block_.ops.size() && supported(block_.ops[count])) {
+    const auto operation = block_.ops[count++].operation;
+    if (operation == Instruction::B || operation == Instruction::Bl ||
+        operation == Instruction::Bx) {
+      break;
+    }
+  }
+  if (count == 0) {
+    return false;
+  }
+  map_registers(count);
+
+  out_.mov_imm64(memory_register, host_memory(memory_));
+  out_.mov_imm64(pages_register, watched_pages_);
+  auto saved = std::vector<Host>{};
+  for (const auto host : guest_hosts) {
+    if (std::find(hosts_.begin(), hosts_.end(), host) != hosts_.end()) {
+      out_.push(host);
+      saved.push_back(host);
+    }
+  }
+  out_.load_cpu(apsr_register, apsr_offset);
+  for (auto guest = 0u; guest < hosts_.size(); ++guest) {
+    if (hosts_[guest]) {
+      out_.load_cpu(*hosts_[guest], static_cast<int>(guest * 4));
+    }
+  }
+
+  auto ended = false;
+  for (index_ = 0; index_ < count; ++index_) {
+    const auto &op = block_.ops[index_];
+    address_ = block_.address + static_cast<Word>(index_ * 4);
+    const auto operation = op.operation;
+    if (operation == Instruction::B || operation == Instruction::Bl ||
+        operation == Instruction::Bx) {
+      branch(op);
+      ended = true;
+    } else if (op.condition == Condition::AL) {
+      settle();
+      instruction(op);
+    } else {
+      conditional(op);
+    }
+  }
+  if (!ended) {
+    // the block went on past what could be compiled, or off its page
+    address_ = block_.address + static_cast<Word>(count * 4);
+    index_ = count;
+    if (count < block_.ops.size()) {
+      settle();
+      bail(out_.jmp());
+    } else {
+      exit(address_, count);
+    }
+  }
+
+  for (const auto &stub : bails_) {
+    if (stub.fault) {
+      faults_[stub.patch].stub = static_cast<std::uint32_t>(out_.size());
+    } else {
+      out_.bind(stub.patch);
+    }
+    out_.store_cpu_imm(15 * 4, stub.address);
+    out_.mov_imm(Rax, static_cast<Word>(stub.retired * 2 + 1));
+    exits_.push_back(out_.jmp());
+  }
+  for (const auto patch : exits_) {
+    out_.bind(patch);
+  }
+  for (auto guest = 0u; guest < hosts_.size(); ++guest) {
+    if (hosts_[guest] && (written_ >> guest & 1) != 0) {
+      out_.store_cpu(static_cast<int>(guest * 4), *hosts_[guest]);
+    }
+  }
+  out_.store_cpu(apsr_offset, apsr_register);
+  for (auto host = saved.rbegin(); host != saved.rend(); ++host) {
+    out_.pop(*host);
+  }
+  out_.ret();
+  return true;
+}
+
+} // namespace
+
+namespace {
+// the jit whose code this thread is running, for the fault handler
+thread_local const Jit *running{};
+} // namespace
+
+// Turns faults of compiled code on the guard pages of reserved memory into
+// bails, and passes on the rest to the handler that was there before.
+class aavm::vm::FaultHandler {
+public:
+  static void install() {
+    static const auto installed = [] {
+      auto action = sigaction_t{};
+      action.sa_sigaction = handle;
+      action.sa_flags = SA_SIGINFO;
+      sigemptyset(&action.sa_mask);
+      return ::sigaction(SIGSEGV, &action, &previous) == 0;
+    }();
+    static_cast<void>(installed);
+  }
+
+private:
+  using sigaction_t = struct sigaction;
+
+  static void handle(int signal, siginfo_t *info, void *context) {
+    auto &rip = static_cast<ucontext_t *>(context)->uc_mcontext.gregs[REG_RIP];
+    if (running != nullptr && resume(*running, rip)) {
+      return;
+    }
+    if ((previous.sa_flags & SA_SIGINFO) != 0) {
+      previous.sa_sigaction(signal, info, context);
+    } else if (previous.sa_handler != SIG_DFL &&
+               previous.sa_handler != SIG_IGN) {
+      previous.sa_handler(signal);
+    } else {
+      // the access faults again, and this time kills the process
+      ::sigaction(SIGSEGV, &previous, nullptr);
+    }
+  }
+
+  // points rip at the stub for the access there, returns false if it is not
+  // one of the jit's
+  static bool resume(const Jit &jit, greg_t &rip) {
+    const auto offset =
+        static_cast<std::uintptr_t>(rip) -
+        reinterpret_cast<std::uintptr_t>(jit.buffer_);
+    const auto *const first = jit.faults_.get();
+    const auto *const last = first + jit.fault_count_.load();
+    const auto *const site = std::lower_bound(
+        first, last, offset, [](const FaultSite &site, std::uintptr_t at) {
+          return site.access < at;
+        });
+    if (site == last || site->access != offset) {
+      return false;
+    }
+    rip = static_cast<greg_t>(reinterpret_cast<std::uintptr_t>(jit.buffer_) +
+                              site->stub);
+    return true;
+  }
+
+  static inline sigaction_t previous{};
+};
+
+Jit::Jit(Memory &memory, const CodeCache &code)
+    : memory_{memory}, code_{code} {
+  const auto fd = ::memfd_create("aavm-jit", MFD_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  if (::ftruncate(fd, buffer_size) == 0) {
+    const auto writable = ::mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+    const auto buffer =
+        ::mmap(nullptr, buffer_size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    if (writable != MAP_FAILED && buffer != MAP_FAILED) {
+      writable_ = static_cast<std::uint8_t *>(writable);
+      buffer_ = static_cast<std::uint8_t *>(buffer);
+    } else {
+      if (writable != MAP_FAILED) {
+        ::munmap(writable, buffer_size);
+      }
+      if (buffer != MAP_FAILED) {
+        ::munmap(buffer, buffer_size);
+      }
+    }
+  }
+  // the mappings keep their own reference to the file
+  ::close(fd);
+
+  if (memory_.layout() == Memory::Reserved) {
+    faults_ = std::make_unique<FaultSite[]>(max_fault_sites);
+    FaultHandler::install();
+  }
+}
+
+Jit::~Jit() {
+  if (buffer_ != nullptr) {
+    ::munmap(buffer_, buffer_size);
+    ::munmap(writable_, buffer_size);
+  }
+}
+
+CompiledBlock Jit::compile(const Block &block) {
+  // bounds checks need room for a word
+  if (buffer_ == nullptr || memory_.size() < 4) {
+    return nullptr;
+  }
+  auto compiler = BlockCompiler{block, memory_, code_.watched_pages()};
+  if (!compiler.compile()) {
+    return nullptr;
+  }
+  const auto function =
+      place(compiler.code().data(), compiler.code().size(), compiler.faults());
+  if (function != nullptr) {
+    ++compiled_blocks_;
+  }
+  return function;
+}
+
+std::uint32_t Jit::run(CompiledBlock block, Cpu &cpu) const {
+  running = this;
+  const auto result = block(&cpu);
+  running = nullptr;
+  return result;
+}
+
+HostCode Jit::host_code(CompiledBlock block) const {
+  auto *start = static_cast<const std::uint8_t *>(nullptr);
+  std::memcpy(&start, &block, sizeof(block));
+  const auto offset = static_cast<std::size_t>(start - buffer_);
+  const auto found = std::lower_bound(
+      blocks_.begin(), blocks_.end(), std::make_pair(offset, std::size_t{}));
+  if (block == nullptr || found == blocks_.end() || found->first != offset) {
+    return {};
+  }
+  auto code = HostCode{start, found->second, {}};
+  const auto *const first = faults_.get();
+  for (auto *site = first; site != first + fault_count_.load(); ++site) {
+    if (site->access >= offset && site->access < offset + code.size) {
+      code.faults.push_back({static_cast<std::uint32_t>(site->access - offset),
+                             static_cast<std::uint32_t>(site->stub - offset)});
+    }
+  }
+  return code;
+}
+
+CompiledBlock Jit::load(const HostCode &code) {
+  // the pointers are loaded with movabs into r8 and r10
+  static constexpr std::uint8_t loads[] = {0x49, 0xB8, 0x49, 0xBA};
+  if (buffer_ == nullptr || code.size < pointers_size ||
+      std::memcmp(code.code, loads, 2) != 0 ||
+      std::memcmp(code.code + pages_pointer_offset - 2, loads + 2, 2) != 0 ||
+      (memory_.layout() == Memory::Reserved) != !code.faults.empty()) {
+    return nullptr;
+  }
+  for (const auto &site : code.faults) {
+    if (site.access >= code.size || site.stub >= code.size) {
+      return nullptr;
+    }
+  }
+  auto relocated = std::vector<std::uint8_t>(code.code, code.code + code.size);
+  const auto *const memory = host_memory(memory_);
+  const auto *const pages = code_.watched_pages();
+  std::memcpy(&relocated[memory_pointer_offset], &memory, sizeof(memory));
+  std::memcpy(&relocated[pages_pointer_offset], &pages, sizeof(pages));
+  return place(relocated.data(), relocated.size(), code.faults);
+}
+
+CompiledBlock Jit::place(const std::uint8_t *code, std::size_t size,
+                         const std::vector<FaultSite> &faults) {
+  const auto count = fault_count_.load();
+  if (size > buffer_size - used_ ||
+      (!faults.empty() && faults.size() > max_fault_sites - count)) {
+    return nullptr;
+  }
+  std::memcpy(writable_ + used_, code, size);
+  auto *const start = buffer_ + used_;
+  for (auto i = std::size_t{0}; i < faults.size(); ++i) {
+    faults_[count + i] = {static_cast<std::uint32_t>(used_ + faults[i].access),
+                          static_cast<std::uint32_t>(used_ + faults[i].stub)};
+  }
+  // the fault handler only looks at sites it is told about
+  fault_count_.store(count + faults.size());
+  blocks_.emplace_back(used_, size);
+  // keep blocks 16 byte aligned
+  used_ = (used_ + size + 15) & ~std::size_t{15};
+
+  auto function = CompiledBlock{};
+  std::memcpy(&function, &start, sizeof(function));
+  return function;
+}
+
+#else
+
+Jit::Jit(Memory &memory, const CodeCache &code)
+    : memory_{memory}, code_{code} {}
+
+Jit::~Jit() = default;
+
+CompiledBlock Jit::compile(const Block &) { return nullptr; }
+
+std::uint32_t Jit::run(CompiledBlock block, Cpu &cpu) const {
+  return block(&cpu);
+}
+
+HostCode Jit::host_code(CompiledBlock) const { return {}; }
+
+CompiledBlock Jit::load(const HostCode &) { return nullptr; }
+
+CompiledBlock Jit::place(const std::uint8_t *, std::size_t,
+                         const std::vector<FaultSite> &) {
+  return nullptr;
+}
+
+#endif
+
+// Sleeps on wake until ready(). It waits in slices because the untimed
+// wait() of newer libstdc++ is missing from older ones the program may load.
+template <typename Predicate>
+static void wait_until(std::condition_variable &wake,
+                       std::unique_lock<std::mutex> &lock, Predicate ready) {
+  while (!ready()) {
+    wake.wait_for(lock, std::chrono::milliseconds{100});
+  }
+}
+
+JitWorker::~JitWorker() {
+  {
+    const auto lock = std::lock_guard{mutex_};
+    stop_ = true;
+    queue_.clear();
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void JitWorker::submit(const Block &block) {
+  {
+    const auto lock = std::lock_guard{mutex_};
+    if (!thread_.joinable()) {
+      thread_ = std::thread{[this] { work(); }};
+    }
+    auto copy = Block{};
+    copy.address = block.address;
+    copy.ops = block.ops;
+    queue_.emplace_back(generation_, std::move(copy));
+  }
+  wake_.notify_one();
+}
+
+void JitWorker::flush() {
+  const auto lock = std::lock_guard{mutex_};
+  ++generation_;
+  queue_.clear();
+  finished_.clear();
+  finished_count_ = 0;
+}
+
+std::vector<JitWorker::Compiled> JitWorker::finished() {
+  const auto lock = std::lock_guard{mutex_};
+  finished_count_ = 0;
+  return std::move(finished_);
+}
+
+void JitWorker::wait() {
+  auto lock = std::unique_lock{mutex_};
+  wait_until(idle_, lock, [this] { return queue_.empty() && !busy_; });
+}
+
+void JitWorker::work() {
+  // the generation the jit's code belongs to
+  auto compiled_generation = std::uint64_t{};
+  auto lock = std::unique_lock{mutex_};
+  for (;;) {
+    wait_until(wake_, lock, [this] { return stop_ || !queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    auto [generation, block] = std::move(queue_.front());
+    queue_.pop_front();
+    busy_ = true;
+    lock.unlock();
+
+    // nothing runs code from before a flush once its blocks are dropped
+    if (generation != compiled_generation) {
+      jit_.clear();
+      compiled_generation = generation;
+    }
+    const auto code = jit_.compile(block);
+
+    lock.lock();
+    busy_ = false;
+    if (code != nullptr && generation == generation_) {
+      finished_.push_back({block.address, code});
+      finished_count_ = finished_.size();
+    }
+    if (queue_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
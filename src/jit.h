@@ -0,0 +1,171 @@
+#ifndef AAVM_VM_JIT_H_
+#define AAVM_VM_JIT_H_
+
+#include "blockcache.h"
+#include "codecache.h"
+#include "memory.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if AAVM_LINUX && defined(__x86_64__)
+#define AAVM_JIT 1
+#else
+#define AAVM_JIT 0
+#endif
+
+namespace aavm::vm {
+
+// Where compiled code accesses reserved memory and the stub that leaves the
+// instruction to the interpreter if the access faults, as offsets into the
+// code of its block.
+struct FaultSite {
+  std::uint32_t access;
+  std::uint32_t stub;
+};
+
+class FaultHandler;
+
+// The host code of a compiled block, as Jit::host_code() hands it out.
+struct HostCode {
+  const std::uint8_t *code{};
+  std::size_t size{};
+  std::vector<FaultSite> faults{};
+};
+
+// Compiles basic blocks to x86-64 code, up to the first instruction it cannot
+// compile. Compiled code runs straight on the Cpu: the guest registers a
+// block uses most live in host registers while it runs and NZCV is kept in
+// APSR layout, or in the host flags until something else needs them.
+//
+// A compiled block never calls back into the machine. Branches leave their
+// target in pc; an instruction it does not compile, a load or store outside
+// memory, a store into decoded code and an access the code cache guards stop
+// it with pc at that instruction, which the caller then interprets. See
+// CompiledBlock for what it returns.
+// With reserved memory, code accesses memory without checking its bounds;
+// an access that faults on the inaccessible pages around it stops the code
+// the same way. A Jit is not thread safe, but compiling can go on while code
+// runs.
+class Jit {
+public:
+  // bytes of host code kept at once
+  static constexpr auto buffer_size = std::size_t{16} << 20;
+  // whether this host can run compiled code
+  static constexpr auto available = AAVM_JIT != 0;
+  // accesses to reserved memory in the code kept at once
+  static constexpr auto max_fault_sites = buffer_size / 16;
+
+  Jit() = delete;
+  Jit(Memory &memory, const CodeCache &code);
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+  ~Jit();
+
+  // compiles block, returns nullptr if its first instruction cannot be
+  // compiled or the buffer is full
+  CompiledBlock compile(const Block &block);
+  // runs code this jit compiled on cpu
+  std::uint32_t run(CompiledBlock block, Cpu &cpu) const;
+  // drops all compiled code, which must not be running
+  void clear() {
+    used_ = 0;
+    blocks_.clear();
+    fault_count_ = 0;
+  }
+
+  // the host code of a block this jit compiled or loaded, to save it for
+  // another process, or no code
+  HostCode host_code(CompiledBlock block) const;
+  // copies in the host code of a block that host_code() returned and points
+  // it at this jit's memory, returns nullptr if it is not compiled code or
+  // the buffer is full
+  CompiledBlock load(const HostCode &code);
+
+  // how many blocks were compiled so far
+  auto compiled_blocks() const { return compiled_blocks_.load(); }
+  constexpr auto code_size() const { return used_; }
+
+private:
+  friend class FaultHandler;
+
+  // copies code to the end of the buffer
+  CompiledBlock place(const std::uint8_t *code, std::size_t size,
+                      const std::vector<FaultSite> &faults);
+
+  Memory &memory_;
+  const CodeCache &code_;
+  // the buffer is mapped twice, so code can be written while other code in
+  // it runs without any page being writable and executable at once
+  std::uint8_t *buffer_{};
+  std::uint8_t *writable_{};
+  std::size_t used_{};
+  // where the code of each block starts in the buffer and its size, in order
+  std::vector<std::pair<std::size_t, std::size_t>> blocks_{};
+  // the fault sites of all blocks, as offsets into the buffer and in order,
+  // which the fault handler reads while code is being compiled
+  std::unique_ptr<FaultSite[]> faults_{};
+  std::atomic<std::size_t> fault_count_{};
+  std::atomic<std::uint64_t> compiled_blocks_{};
+};
+
+// Compiles blocks with a Jit on a background thread, which starts with the
+// first block submitted. Blocks are copied when submitted, so the machine
+// can drop them meanwhile; code compiled before a flush is never handed out.
+class JitWorker {
+public:
+  struct Compiled {
+    std::uint32_t address;
+    CompiledBlock code;
+  };
+
+  JitWorker() = delete;
+  explicit JitWorker(Jit &jit) : jit_{jit} {}
+  JitWorker(const JitWorker &) = delete;
+  JitWorker &operator=(const JitWorker &) = delete;
+  // drops the blocks still queued and waits for the one being compiled
+  ~JitWorker();
+
+  void submit(const Block &block);
+  // drops the queued and compiled blocks, and the jit's code before the
+  // next block is compiled
+  void flush();
+  // whether finished() has anything to hand out
+  bool has_finished() const { return finished_count_.load() != 0; }
+  // the blocks compiled since the last call, that compiled at all
+  std::vector<Compiled> finished();
+  // waits until every submitted block is compiled
+  void wait();
+
+private:
+  void work();
+
+  Jit &jit_;
+  std::mutex mutex_{};
+  std::condition_variable wake_{};
+  std::condition_variable idle_{};
+  // bumped by flush(), blocks carry the one they were submitted in
+  std::uint64_t generation_{};
+  std::deque<std::pair<std::uint64_t, Block>> queue_{};
+  std::vector<Compiled> finished_{};
+  std::atomic<std::size_t> finished_count_{};
+  bool busy_{};
+  bool stop_{};
+  std::thread thread_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using Jit = vm::Jit;
+using JitWorker = vm::JitWorker;
+}
+
+#endif
@@ -48,7 +48,7 @@ constexpr auto keyword_lookup_matrix_ =
          {"ldmib"sv, kw_ldmib}, {"ldmda"sv, kw_ldmda}, {"ldmdb"sv, kw_ldmdb},
          {"stm"sv, kw_stm},     {"stmia"sv, kw_stmia}, {"stmib"sv, kw_stmib},
          {"stmda"sv, kw_stmda}, {"stmdb"sv, kw_stmdb}, {"push"sv, kw_push},
-         {"pop"sv, kw_pop}});
+         {"pop"sv, kw_pop},     {"svc"sv, kw_svc}});
 
 } // namespace detail_
 
@@ -0,0 +1,274 @@
+#include "legalizer.h"
+#include "operand2.h"
+#include <optional>
+#include <utility>
+#include <variant>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::ir;
+
+static constexpr auto immediate_of(const Operand2 &src2)
+    -> std::optional<std::uint32_t> {
+  if (src2.immediate()) {
+    return src2.imm12();
+  }
+  return std::nullopt;
+}
+
+// the operation and immediate that compute the same result (and flags) as op
+// applied to imm
+static constexpr auto complement(Instruction::ArithmeticOperation op,
+                                 std::uint32_t imm)
+    -> std::optional<std::pair<Instruction::ArithmeticOperation,
+                               std::uint32_t>> {
+  switch (op) {
+  case Instruction::Add:
+    return std::pair{Instruction::Sub, 0u - imm};
+  case Instruction::Sub:
+    return std::pair{Instruction::Add, 0u - imm};
+  case Instruction::Adc:
+    return std::pair{Instruction::Sbc, ~imm};
+  case Instruction::Sbc:
+    return std::pair{Instruction::Adc, ~imm};
+  case Instruction::And:
+    return std::pair{Instruction::Bic, ~imm};
+  case Instruction::Bic:
+    return std::pair{Instruction::And, ~imm};
+  default:
+    return std::nullopt;
+  }
+}
+
+// the operation that folds the remaining chunks of a split immediate into the
+// partial result of op
+static constexpr auto accumulate_operation(Instruction::ArithmeticOperation op)
+    -> std::optional<Instruction::ArithmeticOperation> {
+  switch (op) {
+  case Instruction::Add:
+  case Instruction::Adc:
+  case Instruction::Rsb:
+  case Instruction::Rsc:
+    return Instruction::Add;
+  case Instruction::Sub:
+  case Instruction::Sbc:
+    return Instruction::Sub;
+  case Instruction::Orr:
+  case Instruction::Eor:
+  case Instruction::Bic:
+    return op;
+  default:
+    return std::nullopt;
+  }
+}
+
+bool Legalizer::needs_legalization(const Instruction &instr) const {
+  const auto illegal = [](const Operand2 &src2) {
+    const auto imm = immediate_of(src2);
+    return imm && !is_modified_immediate(*imm);
+  };
+
+  if (const auto arithmetic = cast<ArithmeticInstruction>(&instr)) {
+    return arithmetic->operation() != Instruction::Adr &&
+           illegal(arithmetic->src2());
+  }
+  if (const auto move = cast<MoveInstruction>(&instr)) {
+    return (move->operation() == Instruction::Mov ||
+            move->operation() == Instruction::Mvn) &&
+           illegal(move->src2());
+  }
+  if (const auto comparison = cast<ComparisonInstruction>(&instr)) {
+    return illegal(comparison->src2());
+  }
+  if (const auto memory = cast<SingleMemoryInstruction>(&instr)) {
+    // literal loads are legal but a single mov, mvn or movw is cheaper
+    const auto source = memory->source();
+    const auto literal = std::get_if<unsigned>(&source);
+    return literal && memory->operation() == Instruction::Ldr &&
+           materialize_cost(*literal) == 1 &&
+           can_materialize(memory->rd(), *literal);
+  }
+  return false;
+}
+
+bool Legalizer::legalize(const Instruction &instr, InstructionList &out) const {
+  if (const auto arithmetic = cast<ArithmeticInstruction>(&instr)) {
+    return legalize_arithmetic(*arithmetic, out);
+  }
+  if (const auto move = cast<MoveInstruction>(&instr)) {
+    return legalize_move(*move, out);
+  }
+  if (const auto comparison = cast<ComparisonInstruction>(&instr)) {
+    return legalize_comparison(*comparison, out);
+  }
+  if (const auto memory = cast<SingleMemoryInstruction>(&instr)) {
+    return legalize_literal(*memory, out);
+  }
+  return false;
+}
+
+bool Legalizer::legalize_arithmetic(const ArithmeticInstruction &instr,
+                                    InstructionList &out) const {
+  const auto imm = immediate_of(instr.src2());
+  if (!imm) {
+    return false;
+  }
+
+  const auto op =
+      static_cast<Instruction::ArithmeticOperation>(instr.operation());
+  if (const auto alternative = complement(op, *imm);
+      alternative && is_modified_immediate(alternative->second)) {
+    out.push_back(std::make_unique<ArithmeticInstruction>(
+        alternative->first, instr.condition(), instr.updatesflags(),
+        instr.rd(), instr.rn(), Operand2{alternative->second}));
+    return true;
+  }
+
+  // and with a mask is a chain of bics with the complemented mask
+  const auto split_op = op == Instruction::And ? Instruction::Bic : op;
+  const auto split_value = op == Instruction::And ? ~*imm : *imm;
+  const auto accumulate = accumulate_operation(split_op);
+  const auto [chunks, chunk_count] = split_modified_immediate(split_value);
+  // splitting changes the carry and overflow flags of the intermediate
+  // results, materializing the constant into rd first does not. Neither can
+  // build the result in pc, every partial write to it is a branch
+  const auto can_split = !instr.updatesflags() && accumulate.has_value() &&
+                         instr.rd() != Register::PC;
+  const auto into_rd =
+      instr.rd() != instr.rn() && instr.rd() != Register::PC;
+
+  if (into_rd &&
+      (!can_split || materialize_cost(*imm) + 1 < chunk_count)) {
+    materialize(instr.condition(), false, instr.rd(), *imm, out);
+    out.push_back(std::make_unique<ArithmeticInstruction>(
+        op, instr.condition(), instr.updatesflags(), instr.rd(), instr.rn(),
+        Operand2{ShiftedRegister{instr.rd(), Instruction::Lsl, 0u}}));
+    return true;
+  }
+
+  if (can_split) {
+    for (auto i = std::size_t{0}; i < chunk_count; ++i) {
+      const auto first = i == 0;
+      out.push_back(std::make_unique<ArithmeticInstruction>(
+          first ? split_op : *accumulate, instr.condition(), false, instr.rd(),
+          first ? instr.rn() : instr.rd(), Operand2{chunks[i]}));
+    }
+    return true;
+  }
+
+  return false;
+}
+
+bool Legalizer::legalize_move(const MoveInstruction &instr,
+                              InstructionList &out) const {
+  const auto imm = immediate_of(instr.src2());
+  if (!imm) {
+    return false;
+  }
+
+  const auto value = instr.operation() == Instruction::Mvn ? ~*imm : *imm;
+  return materialize(instr.condition(), instr.updatesflags(), instr.rd(), value,
+                     out);
+}
+
+bool Legalizer::legalize_comparison(const ComparisonInstruction &instr,
+                                    InstructionList &out) const {
+  const auto imm = immediate_of(instr.src2());
+  if (!imm) {
+    return false;
+  }
+
+  // cmp and cmn set identical flags for negated immediates
+  const auto negated = 0u - *imm;
+  switch (instr.operation()) {
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+    if (is_modified_immediate(negated)) {
+      out.push_back(std::make_unique<ComparisonInstruction>(
+          instr.operation() == Instruction::Cmp ? Instruction::Cmn
+                                                : Instruction::Cmp,
+          instr.condition(), instr.rn(), Operand2{negated}));
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  // anything else needs a scratch register
+  return false;
+}
+
+bool Legalizer::legalize_literal(const SingleMemoryInstruction &instr,
+                                 InstructionList &out) const {
+  const auto source = instr.source();
+  const auto literal = std::get_if<unsigned>(&source);
+  if (!literal || instr.operation() != Instruction::Ldr) {
+    return false;
+  }
+
+  if (materialize_cost(*literal) > 1 ||
+      !can_materialize(instr.rd(), *literal)) {
+    // keep the literal pool load
+    return false;
+  }
+
+  return materialize(instr.condition(), false, instr.rd(), *literal, out);
+}
+
+unsigned Legalizer::materialize_cost(std::uint32_t value) const {
+  if (is_modified_immediate(value) || is_modified_immediate(~value)) {
+    return 1;
+  }
+  if (has_movw_movt_) {
+    return value <= 0xFFFFu ? 1 : 2;
+  }
+  // a literal pool load is a single instruction but also costs a data word
+  // and a memory access
+  return 2;
+}
+
+bool Legalizer::can_materialize(Register::Kind rd, std::uint32_t value) const {
+  // movw and movt into pc are unpredictable, and a sequence building it would
+  // branch at its first write
+  return rd != Register::PC || is_modified_immediate(value) ||
+         is_modified_immediate(~value);
+}
+
+bool Legalizer::materialize(Condition::Kind cond, bool updates,
+                            Register::Kind rd, std::uint32_t value,
+                            InstructionList &out) const {
+  if (is_modified_immediate(value)) {
+    out.push_back(std::make_unique<MoveInstruction>(
+        Instruction::Mov, cond, updates, rd, Operand2{value}));
+    return true;
+  }
+  if (is_modified_immediate(~value)) {
+    out.push_back(std::make_unique<MoveInstruction>(
+        Instruction::Mvn, cond, updates, rd, Operand2{~value}));
+    return true;
+  }
+  if (!can_materialize(rd, value)) {
+    return false;
+  }
+
+  if (has_movw_movt_) {
+    out.push_back(std::make_unique<MoveInstruction>(Instruction::Movw, cond, rd,
+                                                    value & 0xFFFFu));
+    if (value > 0xFFFFu) {
+      out.push_back(std::make_unique<MoveInstruction>(Instruction::Movt, cond,
+                                                      rd, value >> 16));
+    }
+  } else {
+    out.push_back(std::make_unique<SingleMemoryInstruction>(
+        Instruction::Ldr, cond, rd, static_cast<unsigned>(value)));
+  }
+
+  if (updates) {
+    // neither movw/movt nor ldr set flags
+    out.push_back(std::make_unique<MoveInstruction>(
+        Instruction::Mov, cond, true, rd,
+        Operand2{ShiftedRegister{rd, Instruction::Lsl, 0u}}));
+  }
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef AAVM_ASSEMBLER_LEGALIZER_H_
+#define AAVM_ASSEMBLER_LEGALIZER_H_
+
+#include "instruction.h"
+#include "instructions.h"
+#include "register.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace aavm::assembler {
+
+// Rewrites instructions whose immediates have no A32 encoding into equivalent
+// sequences that do, picking the cheapest of the mvn, movw/movt and literal
+// pool forms.
+class Legalizer {
+public:
+  explicit Legalizer(bool has_movw_movt = true)
+      : has_movw_movt_{has_movw_movt} {}
+
+  bool needs_legalization(const ir::Instruction &instr) const;
+
+  // appends the rewritten sequence for instr to out, returns false if instr
+  // cannot be rewritten (e.g. a comparison would need a scratch register)
+  bool legalize(const ir::Instruction &instr,
+                std::vector<std::unique_ptr<ir::Instruction>> &out) const;
+
+private:
+  using InstructionList = std::vector<std::unique_ptr<ir::Instruction>>;
+
+  bool legalize_arithmetic(const ir::ArithmeticInstruction &instr,
+                           InstructionList &out) const;
+  bool legalize_move(const ir::MoveInstruction &instr,
+                     InstructionList &out) const;
+  bool legalize_comparison(const ir::ComparisonInstruction &instr,
+                           InstructionList &out) const;
+  bool legalize_literal(const ir::SingleMemoryInstruction &instr,
+                        InstructionList &out) const;
+
+  unsigned materialize_cost(std::uint32_t value) const;
+  // whether value can be built in rd, which pc only allows in one mov or mvn
+  bool can_materialize(ir::Register::Kind rd, std::uint32_t value) const;
+  // appends the cheapest sequence building value in rd, returns false if it
+  // cannot be built there
+  bool materialize(ir::Condition::Kind cond, bool updates,
+                   ir::Register::Kind rd, std::uint32_t value,
+                   InstructionList &out) const;
+
+  bool has_movw_movt_;
+};
+
+} // namespace aavm::assembler
+
+#endif
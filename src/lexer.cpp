@@ -71,7 +71,8 @@ token::Kind Lexer::lex_identifier() {
   auto condition = keyword::none;
   // all these mnemonics end with valid condition suffixes
   if (!(maybe_instruction == "mls"sv || maybe_instruction == "teq"sv ||
-        maybe_instruction == "umlal"sv || maybe_instruction == "smlal"sv) &&
+        maybe_instruction == "umlal"sv || maybe_instruction == "smlal"sv ||
+        maybe_instruction == "svc"sv) &&
       maybe_instruction.length() > 2) {
     const auto maybe_condition =
         maybe_instruction.substr(maybe_instruction.length() - 2);
@@ -168,6 +169,8 @@ token::Kind Lexer::lex_token() {
         return lex_identifier();
       }
 
+      // skip the offending character so lexing can resume after an error
+      get_char();
       return token::Error;
     }
 
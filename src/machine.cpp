@@ -0,0 +1,1058 @@
+#include "machine.h"
+#include "instruction.h"
+#include "translationcache.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <type_traits>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto pc_offset = Word{8};
+static constexpr auto lr = 14;
+static constexpr auto pc = 15;
+
+// loads a T from address through mmu into rd, extending it to a word
+template <typename T>
+static bool load_paged(Mmu &mmu, std::uint32_t address, Word &rd) {
+  auto value = T{};
+  if (!mmu.load(address, value)) {
+    return false;
+  }
+  if constexpr (std::is_signed_v<T>) {
+    rd = static_cast<Word>(std::int32_t{value});
+  } else {
+    rd = value;
+  }
+  return true;
+}
+
+Machine::Machine(Memory &memory) : memory_{memory}, code_{memory} {
+  reset(memory.base());
+}
+
+void Machine::reset(std::uint32_t entry) {
+  cpu_ = Cpu{};
+  cpu_.reg(Register::SP) = memory_.end();
+  cpu_.reg(Register::LR) = exit_address;
+  cpu_.reg(Register::PC) = entry;
+  retired_ = 0;
+  fault_address_ = 0;
+  page_ = nullptr;
+  stopped_ = false;
+}
+
+bool Machine::write(std::uint32_t address, const void *data,
+                    std::uint32_t size) {
+  if (!memory_.write(address, data, size)) {
+    return false;
+  }
+  stored(address, size);
+  return true;
+}
+
+bool Machine::load(const image::Image &image) {
+  for (auto i = std::size_t{0}; i < image.segment_count(); ++i) {
+    const auto &segment = image.segments()[i];
+    if (!memory_.contains(segment.address, segment.memory_size)) {
+      return false;
+    }
+    if (!memory_.map(segment.address, segment.memory_size, image.fd(),
+                     segment.file_offset, segment.file_size)) {
+      memory_.write(segment.address, image.contents(segment),
+                    segment.file_size);
+      memory_.clear(segment.address + segment.file_size,
+                    segment.memory_size - segment.file_size);
+    }
+    if (segment.memory_size != 0) {
+      stored(segment.address, segment.memory_size);
+    }
+  }
+  reset(image.header().entry);
+  return true;
+}
+
+void Machine::snapshot() {
+  snapshot_.cpu = cpu_;
+  snapshot_.retired = retired_;
+  snapshot_.memory.assign(memory_.data(), memory_.data() + memory_.size());
+  code_.watch_stores();
+}
+
+std::size_t Machine::restore() {
+  auto restored = std::size_t{};
+  code_.rewatch_dirty([&](std::uint32_t index) {
+    const auto offset = index * CodeCache::page_size;
+    const auto size = std::min(CodeCache::page_size, memory_.size() - offset);
+    memory_.write(memory_.base() + offset, snapshot_.memory.data() + offset,
+                  size);
+    // drops the page if it was decoded again since
+    stored(memory_.base() + offset, size);
+    ++restored;
+  });
+  cpu_ = snapshot_.cpu;
+  retired_ = snapshot_.retired;
+  fault_address_ = 0;
+  page_ = nullptr;
+  stopped_ = false;
+  return restored;
+}
+
+bool Machine::save_translations(const char *path, std::uint64_t key) {
+  if (worker_ != nullptr) {
+    worker_->wait();
+    install();
+  }
+  return translationcache::save(path, key, memory_, code_, blocks_, jit_);
+}
+
+bool Machine::load_translations(const char *path, std::uint64_t key) {
+  // the jit is about to be filled from here
+  worker_.reset();
+  flush_blocks();
+  page_ = nullptr;
+  const auto loaded =
+      translationcache::load(path, key, memory_, code_, blocks_, jit_);
+  // the code saved may run over our breakpoints
+  for (const auto address : code_.breakpoints()) {
+    blocks_.retranslate(address);
+  }
+  return loaded;
+}
+
+Status Machine::run() {
+  // write() may have changed code since the last run
+  if (code_written_) {
+    flush_blocks();
+  }
+  flags_ = LazyFlags{cpu_.apsr};
+  deadline_ = budget_ != 0 ? retired_ + budget_ : ~std::uint64_t{0};
+  auto status = stopped_ && cpu_.registers[pc] == stopped_address_
+                    ? resume()
+                    : Status::Running;
+  if (status == Status::Running) {
+    status = profiling_ || trace_ != nullptr ? run_blocks<true>()
+                                             : run_blocks<false>();
+  }
+  stopped(status);
+  cpu_.apsr = flags_.apsr();
+  return status;
+}
+
+Status Machine::resume() {
+  const auto address = cpu_.registers[pc];
+  // the instruction as it is in memory, without the watchpoints
+  resuming_ = true;
+  const auto status =
+      retire(predecode(memory_.load<Word>(address), address), address);
+  resuming_ = false;
+  if (status == Status::Running) {
+    ++retired_;
+  }
+  if (code_written_) {
+    flush_blocks();
+  }
+  return status;
+}
+
+void Machine::stopped(Status status) {
+  stopped_ = status == Status::Breakpoint || status == Status::Watchpoint;
+  stopped_address_ = cpu_.registers[pc];
+}
+
+bool Machine::add_breakpoint(std::uint32_t address) {
+  if (address % word_size != 0 || !memory_.contains(address, word_size)) {
+    return false;
+  }
+  code_.set_breakpoint(address);
+  retranslate(address);
+  return true;
+}
+
+void Machine::remove_breakpoint(std::uint32_t address) {
+  if (address % word_size != 0 || !memory_.contains(address, word_size)) {
+    return;
+  }
+  code_.clear_breakpoint(address);
+  retranslate(address);
+}
+
+void Machine::retranslate(std::uint32_t address) {
+  // code still being compiled from the old ops is installed first, so that
+  // it is dropped along with the rest
+  if (worker_ != nullptr) {
+    worker_->wait();
+    install();
+  }
+  page_ = nullptr;
+  blocks_.retranslate(address);
+}
+
+bool Machine::add_watchpoint(const Watchpoint &watchpoint) {
+  if (watchpoint.size == 0) {
+    return false;
+  }
+  watchpoints_.push_back(watchpoint);
+  const auto first = watchpoint.address / CodeCache::page_size;
+  const auto last =
+      (watchpoint.address + (watchpoint.size - 1)) / CodeCache::page_size;
+  // the pages wrap around the table, and the address space
+  for (auto page = first; page - first < protection_pages; ++page) {
+    protection_[page % protection_pages] |= watchpoint.accesses;
+    if (page == last) {
+      break;
+    }
+  }
+  // and in the code cache, for compiled code to leave their accesses to
+  // check_access()
+  const auto loads = (watchpoint.accesses & Watchpoint::Loads) != 0;
+  const auto stores = (watchpoint.accesses & Watchpoint::Stores) != 0;
+  code_.guard(watchpoint.address, watchpoint.size,
+              (loads ? CodeCache::GuardedLoads : 0) |
+                  (stores ? CodeCache::GuardedStores : 0));
+  check_memory();
+  return true;
+}
+
+void Machine::remove_watchpoint(std::uint32_t address, std::uint32_t size) {
+  const auto watched = watchpoints_;
+  watchpoints_.clear();
+  protection_.fill(0);
+  code_.unguard();
+  for (const auto &watchpoint : watched) {
+    if (watchpoint.address != address || watchpoint.size != size) {
+      add_watchpoint(watchpoint);
+    }
+  }
+  check_memory();
+}
+
+Status Machine::check_access(std::uint8_t accesses, std::uint32_t address,
+                             std::uint32_t size) {
+  const auto first = address / CodeCache::page_size;
+  const auto last = (address + (size - 1)) / CodeCache::page_size;
+  const auto protection = protection_[first % protection_pages] |
+                          protection_[last % protection_pages];
+  if ((protection & accesses) != 0 && !resuming_) {
+    for (const auto &watchpoint : watchpoints_) {
+      if ((watchpoint.accesses & accesses) != 0 &&
+          (address - watchpoint.address < watchpoint.size ||
+           watchpoint.address - address < size)) {
+        fault_address_ = address;
+        return Status::Watchpoint;
+      }
+    }
+  }
+  if (trace_accesses_) {
+    trace_->access(accesses == Watchpoint::Loads ? TraceRecord::Load
+                                                 : TraceRecord::Store,
+                   address, size);
+  }
+  return Status::Running;
+}
+
+template <bool Instrumented> Status Machine::run_blocks() {
+  auto &regs = cpu_.registers;
+  auto *block = static_cast<Block *>(nullptr);
+  // the link to point at the next block entered, which was not formed yet
+  // when its predecessor ended
+  auto **pending = static_cast<Block **>(nullptr);
+  for (;;) {
+    // every branch, backwards or not, comes through here
+    if (retired_ >= deadline_) {
+      return Status::Preempted;
+    }
+    if (block == nullptr) {
+      const auto address = regs[pc];
+      if (address == exit_address) {
+        return Status::Halted;
+      }
+      if (address % word_size != 0 || !memory_.contains(address, word_size)) {
+        return Status::BadBranch;
+      }
+      block = blocks_.lookup(address,
+                             Instrumented ? 1 : tiering_.block_threshold);
+      if (block == nullptr) {
+        // still cold
+        pending = nullptr;
+        const auto status = interpret(address);
+        if (status != Status::Running) {
+          return status;
+        }
+        continue;
+      }
+      if (pending != nullptr) {
+        *pending = block;
+        pending = nullptr;
+      }
+    }
+
+    if (worker_ != nullptr && worker_->has_finished()) {
+      install();
+    }
+    if (jit_enabled_ && ++block->executions == tiering_.jit_threshold) {
+      promote(*block);
+    }
+    [[maybe_unused]] const auto retired = retired_;
+    const auto status = execute_block(*block);
+    if constexpr (Instrumented) {
+      count(*block, retired_ - retired);
+    }
+    if (status != Status::Running) {
+      return status;
+    }
+    if (code_written_) {
+      flush_blocks();
+      block = nullptr;
+      continue;
+    }
+
+    // follow the link for the way the block ended, looking the successor up
+    // the first time
+    const auto next = regs[pc];
+    auto *link = &block->fallthrough;
+    if (next != block->end_address()) {
+      const auto last = block->ops.back().operation;
+      if (last == Instruction::B || last == Instruction::Bl) {
+        link = &block->taken;
+      } else {
+        if (next != block->indirect_address) {
+          block->indirect = nullptr;
+          block->indirect_address = next;
+        }
+        link = &block->indirect;
+      }
+    }
+    block = *link;
+    if (block == nullptr) {
+      pending = link;
+    }
+  }
+}
+
+void Machine::count(Block &block, std::uint64_t instructions) {
+  if (trace_ != nullptr) {
+    trace_->block(block.address, static_cast<std::uint32_t>(instructions));
+  }
+  if (!profiling_) {
+    return;
+  }
+  auto *profile = block.profile;
+  if (profile == nullptr) {
+    profile = &profile_.block(block.address);
+    profile->cost = 0;
+    for (const auto &op : block.ops) {
+      profile->cost += estimate_cycles(op);
+    }
+    block.profile = profile;
+  }
+  ++profile->entries;
+  profile->instructions += instructions;
+  profile->cycles += profile->cost;
+}
+
+Status Machine::interpret(std::uint32_t address) {
+  for (;;) {
+    const auto &op = fetch(address);
+    const auto ends = (op.flags & MicroOp::WritesPc) != 0;
+    const auto status = retire(op, address);
+    if (status != Status::Running) {
+      return status;
+    }
+    ++retired_;
+    if (code_written_) {
+      flush_blocks();
+      return status;
+    }
+    address += word_size;
+    if (ends || address % CodeCache::page_size == 0) {
+      return status;
+    }
+  }
+}
+
+void Machine::promote(Block &block) {
+  if (!tiering_.background) {
+    block.compiled = jit_.compile(block);
+    return;
+  }
+  if (worker_ == nullptr) {
+    worker_ = std::make_unique<JitWorker>(jit_);
+  }
+  worker_->submit(block);
+}
+
+void Machine::install() {
+  for (const auto &compiled : worker_->finished()) {
+    // blocks are only dropped by a flush, which drops their code as well
+    if (auto *const block = blocks_.find(compiled.address)) {
+      block->compiled = compiled.code;
+    }
+  }
+}
+
+Status Machine::step() {
+  const auto address = cpu_.registers[pc];
+  if (address == exit_address) {
+    return Status::Halted;
+  }
+  if (address % word_size != 0) {
+    return Status::BadBranch;
+  }
+  if (!memory_.contains(address, word_size)) {
+    return Status::BadBranch;
+  }
+
+  flags_ = LazyFlags{cpu_.apsr};
+  auto status = Status::Running;
+  if (stopped_ && address == stopped_address_) {
+    status = resume();
+  } else {
+    status = retire(fetch(address), address);
+    if (status == Status::Running) {
+      ++retired_;
+    }
+    if (code_written_) {
+      flush_blocks();
+    }
+  }
+  stopped(status);
+  cpu_.apsr = flags_.apsr();
+  return status;
+}
+
+Status Machine::execute_block(const Block &block) {
+  auto address = block.address;
+  auto first = block.ops.begin();
+  if (block.compiled != nullptr && jit_enabled_) {
+    cpu_.apsr = flags_.apsr();
+    const auto result = jit_.run(block.compiled, cpu_);
+    flags_ = LazyFlags{cpu_.apsr};
+    retired_ += result >> 1;
+    if ((result & 1) == 0) {
+      return Status::Running;
+    }
+    // interpret the rest, from the instruction the code stopped at
+    address = cpu_.registers[pc];
+    first += (address - block.address) / word_size;
+  }
+  // charged up front, with what is left of the block given back if it stops
+  // early
+  const auto end = block.ops.end();
+  retired_ += static_cast<std::uint64_t>(end - first);
+  for (auto op = first; op != end; ++op) {
+    const auto status = retire(*op, address);
+    if (status != Status::Running) {
+      retired_ -= static_cast<std::uint64_t>(end - op);
+      return status;
+    }
+    if (code_written_) {
+      retired_ -= static_cast<std::uint64_t>(end - op - 1);
+      return status;
+    }
+    address += word_size;
+  }
+  return Status::Running;
+}
+
+Status Machine::retire(const MicroOp &op, std::uint32_t address) {
+  auto &regs = cpu_.registers;
+  auto next = address + word_size;
+  // only conditional instructions compute the flags
+  if (op.condition == Condition::AL ||
+      condition_passed(op.condition, flags_.apsr())) {
+    regs[pc] = address + pc_offset;
+    auto status = execute(op, address);
+    if (status != Status::Running) {
+      regs[pc] = address;
+      // the last page can run past the end of memory
+      if (!memory_.contains(address, word_size)) {
+        status = Status::BadBranch;
+      }
+      return status;
+    }
+    if ((op.flags & MicroOp::WritesPc) != 0) {
+      // bit 0 selects thumb state on interworking branches, which we ignore
+      next = regs[pc] & ~Word{1};
+    }
+  }
+  regs[pc] = next;
+  return Status::Running;
+}
+
+std::pair<std::uint32_t, std::uint32_t>
+Machine::operand(const MicroOp &op, std::uint32_t carry) const {
+  const auto &regs = cpu_.registers;
+  switch (op.operand) {
+  case MicroOp::Immediate:
+    return {op.imm, carry};
+  case MicroOp::RotatedImmediate:
+    return {op.imm, op.imm >> 31};
+  case MicroOp::Register:
+    return {regs[op.rm], carry};
+  case MicroOp::ShiftImmediate:
+    return shift_c(regs[op.rm], op.shift, op.amount, carry);
+  case MicroOp::ShiftRegister:
+    return shift_c(regs[op.rm], op.shift, regs[op.rs] & 0xFFu, carry);
+  default:
+    return {0, carry};
+  }
+}
+
+std::uint32_t Machine::carry_in(const MicroOp &op) const {
+  switch (op.operation) {
+  case Instruction::Adc:
+  case Instruction::Sbc:
+  case Instruction::Rsc:
+    return flags_.carry();
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic:
+  case Instruction::Mov:
+  case Instruction::Mvn:
+  case Instruction::Tst:
+  case Instruction::Teq:
+    // flag setting logical operations without a shift leave C alone
+    if ((op.flags & MicroOp::UpdatesFlags) != 0) {
+      return flags_.carry();
+    }
+    break;
+  default:
+    break;
+  }
+  return op.operand == MicroOp::ShiftImmediate && op.shift == Instruction::Rrx
+             ? flags_.carry()
+             : 0;
+}
+
+Status Machine::execute(const MicroOp &op, std::uint32_t address) {
+  auto &regs = cpu_.registers;
+  const auto setflags = (op.flags & MicroOp::UpdatesFlags) != 0;
+
+  switch (op.operation) {
+  case Instruction::Add:
+  case Instruction::Adc:
+  case Instruction::Sub:
+  case Instruction::Sbc:
+  case Instruction::Rsb:
+  case Instruction::Rsc: {
+    const auto carry = carry_in(op);
+    const auto value = operand(op, carry).first;
+    const auto rn = regs[op.rn];
+    // every form is x + y + c, as AddWithCarry
+    auto x = rn;
+    auto y = value;
+    auto c = Word{0};
+    switch (op.operation) {
+    case Instruction::Adc:
+      c = carry;
+      break;
+    case Instruction::Sub:
+      y = ~value;
+      c = 1;
+      break;
+    case Instruction::Sbc:
+      y = ~value;
+      c = carry;
+      break;
+    case Instruction::Rsb:
+      x = value;
+      y = ~rn;
+      c = 1;
+      break;
+    case Instruction::Rsc:
+      x = value;
+      y = ~rn;
+      c = carry;
+      break;
+    default:
+      break;
+    }
+    regs[op.rd] = x + y + c;
+    // flag setting writes to pc return from exceptions, which we do not model
+    if (setflags && op.rd != pc) {
+      flags_.add(x, y, c);
+    }
+    return Status::Running;
+  }
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic:
+  case Instruction::Mov:
+  case Instruction::Mvn: {
+    const auto [value, shift_carry] = operand(op, carry_in(op));
+    const auto rn = regs[op.rn];
+    const auto result = op.operation == Instruction::And ? rn & value
+                        : op.operation == Instruction::Eor ? rn ^ value
+                        : op.operation == Instruction::Orr ? rn | value
+                        : op.operation == Instruction::Bic ? rn & ~value
+                        : op.operation == Instruction::Mov ? value
+                                                           : ~value;
+    regs[op.rd] = result;
+    if (setflags && op.rd != pc) {
+      flags_.logical(result, shift_carry);
+    }
+    return Status::Running;
+  }
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+  case Instruction::Tst:
+  case Instruction::Teq: {
+    const auto [value, shift_carry] = operand(op, carry_in(op));
+    const auto rn = regs[op.rn];
+    switch (op.operation) {
+    case Instruction::Cmp:
+      flags_.add(rn, ~value, 1);
+      break;
+    case Instruction::Cmn:
+      flags_.add(rn, value, 0);
+      break;
+    case Instruction::Tst:
+      flags_.logical(rn & value, shift_carry);
+      break;
+    default:
+      flags_.logical(rn ^ value, shift_carry);
+      break;
+    }
+    return Status::Running;
+  }
+  case Instruction::Movw:
+    regs[op.rd] = op.imm & 0xFFFFu;
+    return Status::Running;
+  case Instruction::Movt:
+    regs[op.rd] = (regs[op.rd] & 0xFFFFu) | op.imm << 16;
+    return Status::Running;
+  case Instruction::Mul:
+  case Instruction::Mla:
+  case Instruction::Mls: {
+    const auto product = regs[op.rm] * regs[op.rs];
+    const auto result = op.operation == Instruction::Mul ? product
+                        : op.operation == Instruction::Mla
+                            ? product + regs[op.rn]
+                            : regs[op.rn] - product;
+    regs[op.rd] = result;
+    if (setflags) {
+      flags_ = LazyFlags{nz(result) | (flags_.apsr() & (FlagC | FlagV))};
+    }
+    return Status::Running;
+  }
+  case Instruction::Umull:
+  case Instruction::Umlal:
+  case Instruction::Smull:
+  case Instruction::Smlal: {
+    const auto rm = regs[op.rm];
+    const auto rs = regs[op.rs];
+    const auto is_signed = op.operation >= Instruction::Smull;
+    auto result =
+        is_signed ? static_cast<std::uint64_t>(
+                        std::int64_t{static_cast<std::int32_t>(rm)} *
+                        static_cast<std::int32_t>(rs))
+                  : std::uint64_t{rm} * rs;
+    if (op.operation == Instruction::Umlal ||
+        op.operation == Instruction::Smlal) {
+      result += std::uint64_t{regs[op.rn]} << 32 | regs[op.rd];
+    }
+    regs[op.rd] = static_cast<Word>(result);
+    regs[op.rn] = static_cast<Word>(result >> 32);
+    if (setflags) {
+      const auto n = (result >> 63) != 0 ? Word{FlagN} : Word{0};
+      const auto z = result == 0 ? Word{FlagZ} : Word{0};
+      flags_ = LazyFlags{n | z | (flags_.apsr() & (FlagC | FlagV))};
+    }
+    return Status::Running;
+  }
+  case Instruction::Sdiv:
+  case Instruction::Udiv: {
+    const auto rn = regs[op.rn];
+    const auto rm = regs[op.rm];
+    // division by zero yields zero unless the divide trap is enabled
+    auto result = Word{0};
+    if (rm != 0) {
+      if (op.operation == Instruction::Udiv) {
+        result = rn / rm;
+      } else if (rn == 0x80000000u && rm == ~Word{0}) {
+        // the only overflow, which wraps around
+        result = rn;
+      } else {
+        result = static_cast<Word>(static_cast<std::int32_t>(rn) /
+                                   static_cast<std::int32_t>(rm));
+      }
+    }
+    regs[op.rd] = result;
+    return Status::Running;
+  }
+  case Instruction::Bfc:
+  case Instruction::Bfi:
+  case Instruction::Sbfx:
+  case Instruction::Ubfx: {
+    // the decoder rules out empty fields and fields past bit 31
+    const auto lsb = op.lsb;
+    const auto width = op.width;
+    const auto field = low_bits(width);
+    switch (op.operation) {
+    case Instruction::Bfc:
+      regs[op.rd] &= ~(field << lsb);
+      break;
+    case Instruction::Bfi:
+      regs[op.rd] =
+          (regs[op.rd] & ~(field << lsb)) | (regs[op.rn] & field) << lsb;
+      break;
+    case Instruction::Sbfx: {
+      // move the field to the top, then shift it back down sign extending
+      const auto top = regs[op.rn] << (32 - lsb - width);
+      regs[op.rd] =
+          static_cast<Word>(static_cast<std::int32_t>(top) >> (32 - width));
+      break;
+    }
+    default:
+      regs[op.rd] = (regs[op.rn] >> lsb) & field;
+      break;
+    }
+    return Status::Running;
+  }
+  case Instruction::Rbit: {
+    const auto rm = regs[op.rm];
+    auto result = Word{0};
+    for (auto i = 0; i < 32; ++i) {
+      result |= ((rm >> i) & 1u) << (31 - i);
+    }
+    regs[op.rd] = result;
+    return Status::Running;
+  }
+  case Instruction::Rev: {
+    const auto rm = regs[op.rm];
+    regs[op.rd] = rm >> 24 | (rm >> 8 & 0xFF00u) | (rm << 8 & 0xFF0000u) |
+                  rm << 24;
+    return Status::Running;
+  }
+  case Instruction::Rev16: {
+    const auto rm = regs[op.rm];
+    regs[op.rd] = (rm >> 8 & 0x00FF00FFu) | (rm << 8 & 0xFF00FF00u);
+    return Status::Running;
+  }
+  case Instruction::Revsh: {
+    const auto rm = regs[op.rm];
+    const auto swapped = static_cast<std::int16_t>((rm >> 8 & 0xFFu) |
+                                                   (rm << 8 & 0xFF00u));
+    regs[op.rd] = static_cast<Word>(std::int32_t{swapped});
+    return Status::Running;
+  }
+  case Instruction::B:
+    regs[pc] = op.imm;
+    return Status::Running;
+  case Instruction::Bl:
+    regs[lr] = address + word_size;
+    regs[pc] = op.imm;
+    return Status::Running;
+  case Instruction::Bx:
+    regs[pc] = regs[op.rm];
+    return Status::Running;
+  case Instruction::Ldr:
+  case Instruction::Ldrb:
+  case Instruction::Ldrsb:
+  case Instruction::Ldrh:
+  case Instruction::Ldrsh:
+  case Instruction::Str:
+  case Instruction::Strb:
+  case Instruction::Strh:
+    return execute_single_memory(op);
+  case Instruction::Ldmia:
+  case Instruction::Ldmib:
+  case Instruction::Ldmda:
+  case Instruction::Ldmdb:
+  case Instruction::Stmia:
+  case Instruction::Stmib:
+  case Instruction::Stmda:
+  case Instruction::Stmdb:
+    return execute_block_memory(op);
+  case Instruction::Svc:
+    return call_host(op.imm);
+  case MicroOp::breakpoint:
+    return Status::Breakpoint;
+  default:
+    return Status::Unsupported;
+  }
+}
+
+std::uint8_t *Machine::guest_buffer(std::uint32_t address,
+                                    std::uint32_t size) {
+  if (mmu_ != nullptr || !memory_.contains(address, size)) {
+    return nullptr;
+  }
+  return memory_.data() + (address - memory_.base());
+}
+
+Status Machine::call_host(std::uint32_t number) {
+  if (host_ == nullptr) {
+    return Status::Unsupported;
+  }
+  auto &regs = cpu_.registers;
+  auto result = std::int32_t{-1};
+  switch (number) {
+  case HostCalls::Exit:
+    host_->exit(regs[0]);
+    return Status::Exited;
+  case HostCalls::Write:
+    if (const auto *data = guest_buffer(regs[1], regs[2])) {
+      result = host_->write(regs[0], data, regs[2]);
+    }
+    break;
+  case HostCalls::Read:
+    if (auto *data = guest_buffer(regs[1], regs[2])) {
+      result = host_->read(regs[0], data, regs[2]);
+      if (result > 0) {
+        stored(regs[1], static_cast<Word>(result));
+      }
+    }
+    break;
+  case HostCalls::Open: {
+    // the path runs up to its nul, which must come before the end of memory
+    const auto *path = guest_buffer(regs[0], 0);
+    const auto size = memory_.end() - regs[0];
+    if (path != nullptr && std::memchr(path, 0, size) != nullptr) {
+      result = host_->open(reinterpret_cast<const char *>(path), regs[1]);
+    }
+    break;
+  }
+  case HostCalls::Close:
+    result = host_->close(regs[0]);
+    break;
+  case HostCalls::Clock:
+    result = static_cast<std::int32_t>(host_->clock());
+    break;
+  default:
+    return Status::Unsupported;
+  }
+  regs[0] = static_cast<Word>(result);
+  return Status::Running;
+}
+
+Status Machine::execute_single_memory(const MicroOp &op) {
+  auto &regs = cpu_.registers;
+  const auto offset = operand(op, carry_in(op)).first;
+  const auto base = regs[op.rn];
+  const auto offset_address =
+      (op.flags & MicroOp::Subtract) != 0 ? base - offset : base + offset;
+  const auto address =
+      (op.flags & MicroOp::PreIndex) != 0 ? offset_address : base;
+  const auto size = op.operation == Instruction::Ldr ||
+                            op.operation == Instruction::Str
+                        ? Word{4}
+                    : op.operation == Instruction::Ldrb ||
+                            op.operation == Instruction::Ldrsb ||
+                            op.operation == Instruction::Strb
+                        ? Word{1}
+                        : Word{2};
+  // before anything changes, so that a watchpoint stops the instruction
+  // short
+  if (checked_memory_) {
+    const auto status = check_access(op.operation < Instruction::Str
+                                         ? Watchpoint::Loads
+                                         : Watchpoint::Stores,
+                                     address, size);
+    if (status != Status::Running) {
+      return status;
+    }
+  }
+  // only once the access is done, so that a fault leaves the base alone,
+  // and a load into the base register wins over it
+  const auto writeback = (op.flags & MicroOp::Writeback) != 0 &&
+                         (op.operation >= Instruction::Str || op.rd != op.rn);
+
+  if (mmu_ != nullptr) {
+    const auto status = execute_paged_memory(op, address, size);
+    if (status == Status::Running && writeback) {
+      regs[op.rn] = offset_address;
+    }
+    return status;
+  }
+  if (!memory_.contains(address, size)) {
+    fault_address_ = address;
+    return Status::MemoryFault;
+  }
+
+  switch (op.operation) {
+  case Instruction::Ldr:
+    regs[op.rd] = memory_.load<std::uint32_t>(address);
+    break;
+  case Instruction::Ldrb:
+    regs[op.rd] = memory_.load<std::uint8_t>(address);
+    break;
+  case Instruction::Ldrsb:
+    regs[op.rd] =
+        static_cast<Word>(std::int32_t{memory_.load<std::int8_t>(address)});
+    break;
+  case Instruction::Ldrh:
+    regs[op.rd] = memory_.load<std::uint16_t>(address);
+    break;
+  case Instruction::Ldrsh:
+    regs[op.rd] =
+        static_cast<Word>(std::int32_t{memory_.load<std::int16_t>(address)});
+    break;
+  case Instruction::Str:
+    memory_.store<std::uint32_t>(address, regs[op.rd]);
+    stored(address, size);
+    break;
+  case Instruction::Strb:
+    memory_.store<std::uint8_t>(address,
+                                static_cast<std::uint8_t>(regs[op.rd]));
+    stored(address, size);
+    break;
+  default:
+    memory_.store<std::uint16_t>(address,
+                                 static_cast<std::uint16_t>(regs[op.rd]));
+    stored(address, size);
+    break;
+  }
+  if (writeback) {
+    regs[op.rn] = offset_address;
+  }
+  return Status::Running;
+}
+
+Status Machine::execute_block_memory(const MicroOp &op) {
+  auto &regs = cpu_.registers;
+  const auto load = op.operation <= Instruction::Ldmdb;
+  const auto base = regs[op.rn];
+  // the predecoder counts the registers into lsb
+  const auto size = Word{op.lsb} * word_size;
+
+  // registers are transferred in ascending order from the lowest address
+  auto start = base;
+  auto final_base = base + size;
+  switch (op.operation) {
+  case Instruction::Ldmib:
+  case Instruction::Stmib:
+    start = base + word_size;
+    break;
+  case Instruction::Ldmda:
+  case Instruction::Stmda:
+    start = base - size + word_size;
+    final_base = base - size;
+    break;
+  case Instruction::Ldmdb:
+  case Instruction::Stmdb:
+    start = base - size;
+    final_base = start;
+    break;
+  default:
+    break;
+  }
+
+  if (checked_memory_) {
+    const auto status = check_access(
+        load ? Watchpoint::Loads : Watchpoint::Stores, start, size);
+    if (status != Status::Running) {
+      return status;
+    }
+  }
+  if (mmu_ != nullptr) {
+    return execute_paged_block(op, start, final_base);
+  }
+  if (!memory_.contains(start, size)) {
+    fault_address_ = start;
+    return Status::MemoryFault;
+  }
+
+  if (!load) {
+    memory_.store_registers(start, op.imm, regs.data());
+    stored(start, size);
+  }
+  // a loaded base register wins over the writeback
+  if ((op.flags & MicroOp::Writeback) != 0) {
+    regs[op.rn] = final_base;
+  }
+  if (load) {
+    memory_.load_registers(start, op.imm, regs.data());
+  }
+  return Status::Running;
+}
+
+Status Machine::execute_paged_memory(const MicroOp &op, std::uint32_t address,
+                                     std::uint32_t size) {
+  auto &regs = cpu_.registers;
+  auto &mmu = *mmu_;
+  auto done = false;
+  switch (op.operation) {
+  case Instruction::Ldr:
+    done = load_paged<std::uint32_t>(mmu, address, regs[op.rd]);
+    break;
+  case Instruction::Ldrb:
+    done = load_paged<std::uint8_t>(mmu, address, regs[op.rd]);
+    break;
+  case Instruction::Ldrsb:
+    done = load_paged<std::int8_t>(mmu, address, regs[op.rd]);
+    break;
+  case Instruction::Ldrh:
+    done = load_paged<std::uint16_t>(mmu, address, regs[op.rd]);
+    break;
+  case Instruction::Ldrsh:
+    done = load_paged<std::int16_t>(mmu, address, regs[op.rd]);
+    break;
+  case Instruction::Str:
+    done = mmu.store<std::uint32_t>(address, regs[op.rd]);
+    break;
+  case Instruction::Strb:
+    done = mmu.store<std::uint8_t>(address,
+                                   static_cast<std::uint8_t>(regs[op.rd]));
+    break;
+  default:
+    done = mmu.store<std::uint16_t>(address,
+                                    static_cast<std::uint16_t>(regs[op.rd]));
+    break;
+  }
+  if (!done) {
+    fault_address_ = address;
+    return Status::MemoryFault;
+  }
+  if (op.operation >= Instruction::Str) {
+    stored(address, size);
+  }
+  return Status::Running;
+}
+
+Status Machine::execute_paged_block(const MicroOp &op, std::uint32_t start,
+                                    std::uint32_t final_base) {
+  auto &regs = cpu_.registers;
+  const auto load = op.operation <= Instruction::Ldmdb;
+  // loads land here first, so that a fault leaves the registers alone
+  auto loaded = std::array<Word, 16>{};
+  auto address = start;
+  auto status = Status::Running;
+  for (auto reg = 0u; reg < 16; ++reg) {
+    if ((op.imm >> reg & 1u) == 0) {
+      continue;
+    }
+    if (load ? !mmu_->load<std::uint32_t>(address, loaded[reg])
+             : !mmu_->store<std::uint32_t>(address, regs[reg])) {
+      fault_address_ = address;
+      status = Status::MemoryFault;
+      break;
+    }
+    address += word_size;
+  }
+  // a store that faults may already have written the words before it
+  if (!load && address != start) {
+    stored(start, address - start);
+  }
+  if (status != Status::Running) {
+    return status;
+  }
+  if ((op.flags & MicroOp::Writeback) != 0) {
+    regs[op.rn] = final_base;
+  }
+  if (load) {
+    for (auto reg = 0u; reg < 16; ++reg) {
+      if ((op.imm >> reg & 1u) != 0) {
+        regs[reg] = loaded[reg];
+      }
+    }
+  }
+  return Status::Running;
+}
@@ -0,0 +1,342 @@
+#ifndef AAVM_VM_MACHINE_H_
+#define AAVM_VM_MACHINE_H_
+
+#include "alu.h"
+#include "blockcache.h"
+#include "codecache.h"
+#include "cpu.h"
+#include "hostcalls.h"
+#include "image.h"
+#include "jit.h"
+#include "memory.h"
+#include "mmu.h"
+#include "profiler.h"
+#include "trace.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace aavm::vm {
+
+// When run() moves code up a tier. Code starts out interpreted one
+// instruction at a time, addresses branched to block_threshold times get a
+// basic block, and with the jit on blocks entered jit_threshold times are
+// compiled to host code. Code only changes tier between blocks.
+struct Tiering {
+  std::uint32_t block_threshold = 2;
+  std::uint32_t jit_threshold = 16;
+  // compile on a background thread while the blocks keep running as they
+  // are, rather than waiting for the code
+  bool background = true;
+};
+
+// Guest memory a Machine stops before accessing.
+struct Watchpoint {
+  enum Accesses : std::uint8_t { Loads = 1, Stores = 2 };
+
+  std::uint32_t address;
+  std::uint32_t size;
+  // the Accesses that stop the machine
+  std::uint8_t accesses;
+};
+
+// Executes A32 code from guest memory. Instructions only ever run from the
+// micro-ops of the code cache; stores into a decoded page drop it, so code
+// that writes code sees its own changes. run() goes from basic block to
+// basic block through the links between them and only looks a block up the
+// first time each exit is taken, see Tiering for how code gets there. The
+// flags are kept lazily while running and written back to the cpu when run()
+// or step() return.
+class Machine {
+public:
+  // lr on entry, the program halts when it branches here
+  static constexpr auto exit_address = std::uint32_t{0xFFFFFFFC};
+
+  Machine() = delete;
+  explicit Machine(Memory &memory);
+
+  // points pc at entry, sp at the top of memory and lr at exit_address,
+  // clears the other registers and the flags
+  void reset(std::uint32_t entry);
+
+  // executes instructions until the program halts or faults
+  Status run();
+  // executes a single instruction, without going through the blocks
+  Status step();
+  // Both carry on from a breakpoint or watchpoint that stopped them at pc by
+  // executing its instruction, rather than stopping there again.
+
+  // turns compiling hot blocks on or off, returns whether it is on, which it
+  // cannot be on hosts without a jit, with an mmu, or while tracing memory
+  // accesses. It comes back on by itself once those are gone.
+  bool set_jit(bool enabled) {
+    jit_wanted_ = enabled;
+    check_memory();
+    return jit_enabled_;
+  }
+  constexpr auto jit_enabled() const { return jit_enabled_; }
+  void set_tiering(const Tiering &tiering) {
+    tiering_ = tiering;
+    if (!tiering_.background) {
+      worker_.reset();
+    }
+  }
+  constexpr auto &tiering() const { return tiering_; }
+  // limits every call to run() to about instructions more, zero for no
+  // limit. Blocks are charged for all of their instructions as they are
+  // entered and the budget is only tested between blocks, so run() returns
+  // Preempted at the first block boundary once it has run out, which can be
+  // a block past it. Everything is up to date by then and calling run()
+  // again resumes the program.
+  void set_budget(std::uint64_t instructions) { budget_ = instructions; }
+  constexpr auto budget() const { return budget_; }
+  // counts every block run() enters into profile(), once per entry. Blocks
+  // are formed the first time they run while it is on, so that all code is
+  // counted. run() picks a dispatch loop without the counting while it is
+  // off, which then costs nothing.
+  void set_profiling(bool enabled) { profiling_ = enabled; }
+  constexpr auto profiling() const { return profiling_; }
+  constexpr auto &profile() const { return profile_; }
+  void clear_profile() { profile_.clear(); }
+  // records every block run() enters into trace along with the instructions
+  // it retired, and with accesses the address of every load and store, or
+  // stops tracing if trace is nullptr. Blocks are formed the first time they
+  // run while tracing, as while profiling, so a block's instructions are the
+  // words from its address on. Compiled code accesses memory directly, so
+  // the jit is off while accesses are traced.
+  void set_trace(TraceWriter *trace, bool accesses = false) {
+    trace_ = trace;
+    trace_accesses_ = trace_ != nullptr && accesses;
+    check_memory();
+  }
+  constexpr auto trace() const { return trace_; }
+  // answers svc with the calls of host, or leaves it unsupported if host is
+  // nullptr. Guest buffers are handed to host as pointers into memory, and
+  // calls passing one fail while loads and stores go through an mmu. Reads
+  // drop the code they overwrite like stores, but neither trace their
+  // accesses nor stop at watchpoints.
+  void set_host_calls(HostCalls *host) { host_ = host; }
+  constexpr auto host_calls() const { return host_; }
+
+  // Breakpoints stop run() and step() before the instruction at their
+  // address with Status::Breakpoint. Its op is decoded as a trap, and the
+  // blocks holding it are formed again from the trap with their compiled
+  // code dropped, so nothing else runs any slower. Returns false if address
+  // is not a word aligned address in memory.
+  bool add_breakpoint(std::uint32_t address);
+  void remove_breakpoint(std::uint32_t address);
+  const auto &breakpoints() const { return code_.breakpoints(); }
+  // Watchpoints stop run() and step() before an instruction that accesses
+  // their memory the way they watch, with Status::Watchpoint and the address
+  // of the access in fault_address(). Every page they cover is marked in a
+  // table of page protections that loads and stores look at, and only those
+  // to a marked page go on to compare their address with the watchpoints.
+  // The pages are marked in the code cache as well, and compiled code leaves
+  // the accesses it makes to them to the interpreter. Returns false if size
+  // is zero.
+  bool add_watchpoint(const Watchpoint &watchpoint);
+  // removes the watchpoints on [address, address + size)
+  void remove_watchpoint(std::uint32_t address, std::uint32_t size);
+  const auto &watchpoints() const { return watchpoints_; }
+  // sends loads and stores through mmu, or straight to memory again if it is
+  // nullptr. Code is still fetched from memory, which the mmu should map at
+  // its own addresses for stores to code to be seen. Compiled code accesses
+  // memory directly, so the jit is off while there is an mmu.
+  void set_mmu(Mmu *mmu) {
+    mmu_ = mmu;
+    check_memory();
+  }
+  constexpr auto mmu() const { return mmu_; }
+  // waits for the blocks being compiled in the background, which run() then
+  // picks up as it goes
+  void wait_for_jit() {
+    if (worker_ != nullptr) {
+      worker_->wait();
+    }
+  }
+
+  // saves the decoded code, the blocks and their compiled code to path under
+  // key, see translationcache.h
+  bool save_translations(const char *path, std::uint64_t key);
+  // starts from the translations saved to path under key, rather than
+  // decoding and compiling the code again. Call it once the program is in
+  // memory; returns false if path holds none for key and this memory.
+  bool load_translations(const char *path, std::uint64_t key);
+
+  // copies size bytes from data to address and drops the code it overwrites,
+  // returns false if they do not fit in memory
+  bool write(std::uint32_t address, const void *data, std::uint32_t size);
+  // puts the segments of image into memory, zero filled past their contents,
+  // and points pc at its entry. Reserved memory maps them from the file, so
+  // the pages a machine leaves clean are shared with every other machine
+  // loading the image; a buffer gets a copy. Returns false if a segment
+  // does not fit in memory.
+  bool load(const image::Image &image);
+
+  // keeps the registers and a copy of memory for restore(), which puts them
+  // back. From here on the pages stored to are noted as they are first
+  // stored to, so restore() only copies those back and costs what the guest
+  // dirtied rather than the size of memory. Stores that do not go through
+  // the machine, such as to memory directly, are not seen.
+  void snapshot();
+  // returns how many pages it copied back
+  std::size_t restore();
+
+  constexpr auto &cpu() { return cpu_; }
+  constexpr auto &cpu() const { return cpu_; }
+  constexpr auto &memory() const { return memory_; }
+  constexpr auto &code_cache() const { return code_; }
+  constexpr auto &block_cache() const { return blocks_; }
+  constexpr auto &jit() const { return jit_; }
+  // instructions stepped over so far, including those whose condition failed
+  constexpr auto retired() const { return retired_; }
+  // the address of the access that caused a MemoryFault or hit a watchpoint
+  constexpr auto fault_address() const { return fault_address_; }
+
+private:
+  // Instrumented runs count() every block entered
+  template <bool Instrumented> Status run_blocks();
+  // profiles and traces an entry into block, which retired instructions
+  void count(Block &block, std::uint64_t instructions);
+  // executes instructions from address until one writes pc, the page ends
+  // or code is written
+  Status interpret(std::uint32_t address);
+  // the micro-op at address, which must be word aligned and in memory
+  const MicroOp &fetch(std::uint32_t address) {
+    if (page_ == nullptr || address - page_address_ >= CodeCache::page_size) {
+      page_ = code_.page(address);
+      page_address_ = code_.page_address(address);
+    }
+    return page_[(address - page_address_) / word_size];
+  }
+  // executes the instruction at pc if a breakpoint or watchpoint stopped the
+  // machine there, and counts it as retired
+  Status resume();
+  // notes where the machine stopped if status is a breakpoint or watchpoint
+  void stopped(Status status);
+  // forms the blocks holding address again once its op has changed
+  void retranslate(std::uint32_t address);
+  // whether loads and stores go through check_access(), and whether the jit
+  // can be on with what they go through
+  void check_memory() {
+    checked_memory_ = trace_accesses_ || !watchpoints_.empty();
+    jit_enabled_ =
+        jit_wanted_ && Jit::available && mmu_ == nullptr && !trace_accesses_;
+  }
+  // traces an access of size bytes from address and stops it if it is
+  // watched, accesses holds one of the Watchpoint::Accesses
+  Status check_access(std::uint8_t accesses, std::uint32_t address,
+                      std::uint32_t size);
+  // compiles block, or hands it to the worker
+  void promote(Block &block);
+  // gives the blocks the worker compiled their code
+  void install();
+  // executes block, stopping early when it writes code
+  Status execute_block(const Block &block);
+  // executes op at address if its condition passes and moves pc on, which
+  // callers count as retired
+  Status retire(const MicroOp &op, std::uint32_t address);
+  // executes op, which sees r15 as its address plus 8
+  Status execute(const MicroOp &op, std::uint32_t address);
+  Status execute_single_memory(const MicroOp &op);
+  Status execute_block_memory(const MicroOp &op);
+  // the same through the mmu, once the address is known
+  Status execute_paged_memory(const MicroOp &op, std::uint32_t address,
+                              std::uint32_t size);
+  Status execute_paged_block(const MicroOp &op, std::uint32_t start,
+                             std::uint32_t final_base);
+  // makes host call number with the arguments in r0 to r2
+  Status call_host(std::uint32_t number);
+  // the host address of [address, address + size), nullptr if it is not all
+  // in memory or memory is behind an mmu
+  std::uint8_t *guest_buffer(std::uint32_t address, std::uint32_t size);
+
+  // the value of the operand of op and the carry out of its shift, given the
+  // carry flag if op reads it
+  std::pair<std::uint32_t, std::uint32_t> operand(const MicroOp &op,
+                                                  std::uint32_t carry) const;
+  // the carry flag if op reads it, otherwise zero
+  std::uint32_t carry_in(const MicroOp &op) const;
+  // notes a store to [address, address + size)
+  void stored(std::uint32_t address, std::uint32_t size) {
+    if (code_.invalidate(address, size)) {
+      page_ = nullptr;
+      code_written_ = true;
+    }
+  }
+  // drops the blocks and their host code once the code they came from has
+  // changed
+  void flush_blocks() {
+    blocks_.flush();
+    if (worker_ != nullptr) {
+      worker_->flush();
+    } else {
+      jit_.clear();
+    }
+    code_written_ = false;
+  }
+
+  static constexpr auto word_size = std::uint32_t{4};
+
+  Memory &memory_;
+  Mmu *mmu_{};
+  CodeCache code_;
+  BlockCache blocks_{code_};
+  Jit jit_{memory_, code_};
+  // started with the first block compiled in the background
+  std::unique_ptr<JitWorker> worker_{};
+  bool jit_enabled_{};
+  // what set_jit() was last given
+  bool jit_wanted_{};
+  Tiering tiering_{};
+  std::uint64_t budget_{};
+  bool profiling_{};
+  Profile profile_{};
+  TraceWriter *trace_{};
+  bool trace_accesses_{};
+  HostCalls *host_{};
+  // any of the tracing or watching check_access() does
+  bool checked_memory_{};
+
+  std::vector<Watchpoint> watchpoints_{};
+  // the Watchpoint::Accesses watched on every page whose number is the index
+  // modulo the table size, a page sharing its entry with a watched one only
+  // costs it the comparisons
+  static constexpr auto protection_pages = std::size_t{1024};
+  std::array<std::uint8_t, protection_pages> protection_{};
+  // where the last breakpoint or watchpoint stopped the machine
+  bool stopped_{};
+  std::uint32_t stopped_address_{};
+  // while resume() executes the instruction a watchpoint stopped
+  bool resuming_{};
+  // the retired count the current run() stops at
+  std::uint64_t deadline_{};
+
+  Cpu cpu_{};
+  LazyFlags flags_{};
+  std::uint64_t retired_{};
+  std::uint32_t fault_address_{};
+
+  struct Snapshot {
+    Cpu cpu;
+    std::uint64_t retired;
+    std::vector<std::uint8_t> memory;
+  };
+  Snapshot snapshot_{};
+
+  // the page pc was last fetched from
+  const MicroOp *page_{};
+  std::uint32_t page_address_{};
+  bool code_written_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using Machine = vm::Machine;
+}
+
+#endif
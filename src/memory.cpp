@@ -0,0 +1,109 @@
+#include "memory.h"
+
+// reserving the guest address space takes a 64-bit host
+#if !AAVM_WINDOWS && UINTPTR_MAX > 0xFFFFFFFF
+#define AAVM_RESERVE 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define AAVM_RESERVE 0
+#endif
+
+using namespace aavm;
+using namespace aavm::vm;
+
+#if AAVM_RESERVE
+// the guest address space, and a guard past its top for accesses that start
+// below 4 GiB and run over it
+static constexpr auto reservation_size = (std::size_t{1} << 32) + 0x10000;
+#endif
+
+Memory::Memory(std::uint32_t base, std::uint32_t size, Layout layout)
+    : base_{base}, size_{size} {
+  if (layout == Reserved && reserve()) {
+    return;
+  }
+  bytes_.resize(size);
+  data_ = bytes_.data();
+}
+
+Memory &Memory::operator=(Memory &&other) noexcept {
+  std::swap(base_, other.base_);
+  std::swap(size_, other.size_);
+  std::swap(data_, other.data_);
+  std::swap(bytes_, other.bytes_);
+  std::swap(reservation_, other.reservation_);
+  return *this;
+}
+
+Memory::~Memory() {
+#if AAVM_RESERVE
+  if (reservation_ != nullptr) {
+    ::munmap(reservation_, reservation_size);
+  }
+#endif
+}
+
+bool Memory::reserve() {
+#if !AAVM_RESERVE
+  return false;
+#else
+  // only whole host pages can be made accessible
+  const auto page = static_cast<std::uint32_t>(::sysconf(_SC_PAGESIZE));
+  if (base_ % page != 0 || size_ % page != 0) {
+    return false;
+  }
+  const auto reservation =
+      ::mmap(nullptr, reservation_size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reservation == MAP_FAILED) {
+    return false;
+  }
+  auto *const flat = static_cast<std::uint8_t *>(reservation);
+  if (size_ != 0 &&
+      ::mprotect(flat + base_, size_, PROT_READ | PROT_WRITE) != 0) {
+    ::munmap(reservation, reservation_size);
+    return false;
+  }
+  reservation_ = flat;
+  data_ = flat + base_;
+  return true;
+#endif
+}
+
+bool Memory::map(std::uint32_t address, std::uint32_t memory_size, int fd,
+                 std::uint64_t offset, std::uint32_t size) {
+#if !AAVM_RESERVE
+  static_cast<void>(address);
+  static_cast<void>(memory_size);
+  static_cast<void>(fd);
+  static_cast<void>(offset);
+  static_cast<void>(size);
+  return false;
+#else
+  const auto page = static_cast<std::uint32_t>(::sysconf(_SC_PAGESIZE));
+  if (reservation_ == nullptr || fd < 0 || address % page != 0 ||
+      offset % page != 0 || size > memory_size ||
+      !contains(address, memory_size)) {
+    return false;
+  }
+  // the pages come from the file, with whatever follows its last byte in
+  // the page it ends in cleared, which copies only that page
+  auto *const start = reservation_ + address;
+  const auto round = [&](std::size_t bytes) {
+    return bytes + (page - bytes % page) % page;
+  };
+  const auto mapped = round(size);
+  const auto end = round(memory_size);
+  if (mapped != 0 &&
+      ::mmap(start, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, static_cast<off_t>(offset)) == MAP_FAILED) {
+    return false;
+  }
+  std::memset(start + size, 0, mapped - size);
+  return end == mapped ||
+         ::mmap(start + mapped, end - mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1,
+                0) != MAP_FAILED;
+#endif
+}
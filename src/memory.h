@@ -0,0 +1,146 @@
+#ifndef AAVM_VM_MEMORY_H_
+#define AAVM_VM_MEMORY_H_
+
+#include "compiler.h"
+#include "stl_bit.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// guest words are accessed with host loads and stores, which assumes a
+// little-endian host
+#if AAVM_GCC || AAVM_CLANG
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+#endif
+
+namespace aavm::vm {
+
+// Flat little-endian guest memory covering [base, base + size). Accesses are
+// not checked, callers test contains() first.
+//
+// Reserved memory maps the whole 4 GiB guest address space and leaves all of
+// it outside [base, base + size) inaccessible, so the host address of a guest
+// address is flat_base() plus the address, and an access outside memory
+// faults rather than landing somewhere else. Compiled code relies on that
+// instead of checking bounds. The host commits its pages as they are first
+// touched. Hosts that cannot reserve it, and memory whose bounds are not
+// aligned to host pages, fall back to a buffer.
+class Memory {
+public:
+  enum Layout { Buffer, Reserved };
+
+  Memory() = delete;
+  Memory(std::uint32_t base, std::uint32_t size, Layout layout = Buffer);
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+  Memory(Memory &&other) noexcept { *this = std::move(other); }
+  Memory &operator=(Memory &&other) noexcept;
+  ~Memory();
+
+  constexpr auto base() const { return base_; }
+  constexpr auto size() const { return size_; }
+  // wraps to 0 when memory reaches the top of the address space
+  constexpr auto end() const { return base_ + size_; }
+  constexpr auto layout() const {
+    return reservation_ != nullptr ? Reserved : Buffer;
+  }
+
+  auto contains(std::uint32_t address, std::uint32_t size) const {
+    // addresses below base wrap around to offsets past the end
+    const auto offset = address - base_;
+    return offset <= size_ && size <= size_ - offset;
+  }
+
+  template <typename T> T load(std::uint32_t address) const {
+    auto value = T{};
+    std::memcpy(&value, data_ + (address - base_), sizeof(T));
+    return value;
+  }
+
+  template <typename T> void store(std::uint32_t address, T value) {
+    std::memcpy(data_ + (address - base_), &value, sizeof(T));
+  }
+
+  // load_registers() and store_registers() move the registers set in the 16
+  // bit mask between registers and the words from address, the lowest
+  // register at the lowest address, as block transfers do. Every run of
+  // consecutive registers is a single copy, so push {r4-r11, lr} takes two.
+  void load_registers(std::uint32_t address, std::uint32_t mask,
+                      std::uint32_t *registers) const {
+    const auto *words = data_ + (address - base_);
+    for_each_run(mask, [&](int first, std::size_t size) {
+      std::memcpy(registers + first, words, size);
+      words += size;
+    });
+  }
+  void store_registers(std::uint32_t address, std::uint32_t mask,
+                       const std::uint32_t *registers) {
+    auto *words = data_ + (address - base_);
+    for_each_run(mask, [&](int first, std::size_t size) {
+      std::memcpy(words, registers + first, size);
+      words += size;
+    });
+  }
+
+  // copies size bytes from data to address, returns false if they do not fit
+  bool write(std::uint32_t address, const void *data, std::uint32_t size) {
+    if (!contains(address, size)) {
+      return false;
+    }
+    std::memcpy(data_ + (address - base_), data, size);
+    return true;
+  }
+
+  // sets size bytes from address to zero, returns false if they do not fit
+  bool clear(std::uint32_t address, std::uint32_t size) {
+    if (!contains(address, size)) {
+      return false;
+    }
+    std::memset(data_ + (address - base_), 0, size);
+    return true;
+  }
+
+  // Maps size bytes of the open file fd from offset to address, privately
+  // and copy on write, and zero fills the rest of [address, address +
+  // memory_size). Pages left clean stay those of the page cache, shared by
+  // every memory mapping the file, all but the page the bytes end in.
+  // Returns false if the host cannot map it, and without changing anything
+  // if memory is a buffer or address and offset are not on host pages,
+  // where callers copy instead.
+  bool map(std::uint32_t address, std::uint32_t memory_size, int fd,
+           std::uint64_t offset, std::uint32_t size);
+
+  std::uint8_t *data() { return data_; }
+  const std::uint8_t *data() const { return data_; }
+  // the host address of guest address 0 in reserved memory, nullptr in a
+  // buffer
+  std::uint8_t *flat_base() const { return reservation_; }
+
+private:
+  // calls copy with the first register and the size in bytes of each run of
+  // set bits in mask, from the lowest
+  template <typename Copy>
+  static void for_each_run(std::uint32_t mask, Copy &&copy) {
+    while (mask != 0) {
+      const auto first = stl::countr_zero(mask);
+      const auto count = stl::countr_zero(~(mask >> first));
+      copy(first, static_cast<std::size_t>(count) * sizeof(std::uint32_t));
+      mask &= ~(((std::uint32_t{1} << count) - 1) << first);
+    }
+  }
+
+  // reserves the address space, returns false if the host cannot
+  bool reserve();
+
+  std::uint32_t base_{};
+  std::uint32_t size_{};
+  std::uint8_t *data_{};
+  std::vector<std::uint8_t> bytes_{};
+  std::uint8_t *reservation_{};
+};
+
+} // namespace aavm::vm
+
+#endif
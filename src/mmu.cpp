@@ -0,0 +1,120 @@
+#include "mmu.h"
+#include <algorithm>
+
+using namespace aavm;
+using namespace aavm::vm;
+
+static constexpr auto page_mask = Mmu::page_size - 1;
+
+bool Mmu::map(std::uint32_t address, std::uint32_t size, std::uint8_t *host,
+              std::uint8_t permissions) {
+  if ((address & page_mask) != 0 || (size & page_mask) != 0) {
+    return false;
+  }
+  for (auto i = std::uint32_t{0}; i < size / page_size; ++i) {
+    entry(address + i * page_size) = {host + std::size_t{i} * page_size,
+                                      nullptr, 0, permissions};
+  }
+  flush_tlb();
+  return true;
+}
+
+bool Mmu::map_device(std::uint32_t address, std::uint32_t size,
+                     Device &device) {
+  if ((address & page_mask) != 0 || (size & page_mask) != 0) {
+    return false;
+  }
+  for (auto i = std::uint32_t{0}; i < size / page_size; ++i) {
+    entry(address + i * page_size) = {nullptr, &device, i * page_size,
+                                      Read | Write};
+  }
+  flush_tlb();
+  return true;
+}
+
+void Mmu::unmap(std::uint32_t address, std::uint32_t size) {
+  for (auto i = std::uint32_t{0}; i < size / page_size; ++i) {
+    entry(address + i * page_size) = {};
+  }
+  flush_tlb();
+}
+
+void Mmu::flush_tlb() {
+  std::fill(tlb_.begin(), tlb_.end(), Entry{no_page, no_page, 0});
+}
+
+const Mmu::Page *Mmu::walk(std::uint32_t address) const {
+  const auto &table = directory_[address >> (page_bits + table_bits)];
+  if (table == nullptr) {
+    return nullptr;
+  }
+  const auto &page = (*table)[address >> page_bits & ((1u << table_bits) - 1)];
+  return page.permissions != 0 ? &page : nullptr;
+}
+
+Mmu::Page &Mmu::entry(std::uint32_t address) {
+  auto &table = directory_[address >> (page_bits + table_bits)];
+  if (table == nullptr) {
+    table = std::make_unique<Table>();
+  }
+  return (*table)[address >> page_bits & ((1u << table_bits) - 1)];
+}
+
+bool Mmu::access(std::uint32_t address, std::uint32_t size,
+                 Permissions permission, std::uint32_t &value) {
+  ++misses_;
+  const auto offset = address & page_mask;
+  if (offset <= page_size - size) {
+    return transfer(address, size, permission, value);
+  }
+
+  // split at the end of the page once both pages are known to allow it, so
+  // that a store that fails leaves memory alone
+  for (const auto at : {address, address + size - 1}) {
+    const auto *const page = walk(at);
+    if (page == nullptr || (page->permissions & permission) == 0) {
+      return false;
+    }
+  }
+  auto result = std::uint32_t{};
+  for (auto i = 0u; i < size; ++i) {
+    auto byte = value >> (i * 8) & 0xFFu;
+    transfer(address + i, 1, permission, byte);
+    result |= (byte & 0xFFu) << (i * 8);
+  }
+  if (permission == Read) {
+    value = result;
+  }
+  return true;
+}
+
+bool Mmu::transfer(std::uint32_t address, std::uint32_t size,
+                   Permissions permission, std::uint32_t &value) {
+  const auto *const page = walk(address);
+  if (page == nullptr || (page->permissions & permission) == 0) {
+    return false;
+  }
+  const auto offset = address & page_mask;
+  if (page->device != nullptr) {
+    if (permission == Read) {
+      value = page->device->read(page->device_offset + offset, size);
+    } else {
+      page->device->write(page->device_offset + offset, value, size);
+    }
+    return true;
+  }
+
+  const auto page_address = address - offset;
+  auto &cached = tlb_[address >> page_bits & (tlb_entries - 1)];
+  cached.read = (page->permissions & Read) != 0 ? page_address : no_page;
+  cached.write = (page->permissions & Write) != 0 ? page_address : no_page;
+  cached.host = reinterpret_cast<std::uintptr_t>(page->host) - page_address;
+  // the host is little-endian, like the guest
+  if (permission == Read) {
+    value = 0;
+    std::memcpy(&value, page->host + offset, size);
+  } else {
+    std::memcpy(page->host + offset, &value, size);
+  }
+  return true;
+}
@@ -0,0 +1,141 @@
+#ifndef AAVM_VM_MMU_H_
+#define AAVM_VM_MMU_H_
+
+#include "memory.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace aavm::vm {
+
+// A memory mapped device. Offsets are from the start of its mapping, sizes
+// are 1, 2 or 4 bytes.
+class Device {
+public:
+  virtual ~Device() = default;
+  virtual std::uint32_t read(std::uint32_t offset, std::uint32_t size) = 0;
+  virtual void write(std::uint32_t offset, std::uint32_t value,
+                     std::uint32_t size) = 0;
+};
+
+// Guest memory as a map of 4 KiB pages, each backed by host memory the guest
+// may read, write or both, or by a Device. Accesses to pages with nothing
+// mapped or without the permission fail.
+//
+// Accesses go through a direct-mapped software TLB first. Its entries hold
+// the host address of a memory page, tagged with the guest page for reads
+// and for writes separately, so a hit costs a compare and an add. A miss
+// walks the page table and refills the entry; device pages never enter the
+// TLB, and neither do accesses that cross into the next page.
+class Mmu {
+public:
+  static constexpr auto page_bits = 12u;
+  static constexpr auto page_size = std::uint32_t{1} << page_bits;
+  static constexpr auto tlb_entries = std::size_t{256};
+
+  enum Permissions : std::uint8_t { Read = 1, Write = 2 };
+
+  Mmu() { flush_tlb(); }
+  Mmu(const Mmu &) = delete;
+  Mmu &operator=(const Mmu &) = delete;
+
+  // maps the pages of [address, address + size) to host, which must stay
+  // valid while they are mapped. address and size must be page aligned,
+  // returns false if they are not.
+  bool map(std::uint32_t address, std::uint32_t size, std::uint8_t *host,
+           std::uint8_t permissions);
+  // maps memory at its own addresses
+  bool map(Memory &memory, std::uint8_t permissions) {
+    return map(memory.base(), memory.size(), memory.data(), permissions);
+  }
+  bool map_device(std::uint32_t address, std::uint32_t size, Device &device);
+  void unmap(std::uint32_t address, std::uint32_t size);
+
+  // reads a T from address, returns false if the access fails
+  template <typename T> bool load(std::uint32_t address, T &value) {
+    const auto &entry = tlb_[address >> page_bits & (tlb_entries - 1)];
+    if (entry.read == (address & ~(page_size - 1)) &&
+        (address & (page_size - 1)) <= page_size - sizeof(T)) {
+      ++hits_;
+      std::memcpy(&value, reinterpret_cast<const void *>(entry.host + address),
+                  sizeof(T));
+      return true;
+    }
+    auto word = std::uint32_t{};
+    if (!access(address, sizeof(T), Read, word)) {
+      return false;
+    }
+    value = static_cast<T>(word);
+    return true;
+  }
+
+  // writes a T to address, returns false if the access fails
+  template <typename T> bool store(std::uint32_t address, T value) {
+    const auto &entry = tlb_[address >> page_bits & (tlb_entries - 1)];
+    if (entry.write == (address & ~(page_size - 1)) &&
+        (address & (page_size - 1)) <= page_size - sizeof(T)) {
+      ++hits_;
+      std::memcpy(reinterpret_cast<void *>(entry.host + address), &value,
+                  sizeof(T));
+      return true;
+    }
+    auto word = static_cast<std::uint32_t>(value);
+    return access(address, sizeof(T), Write, word);
+  }
+
+  // drops every TLB entry, which nothing but remapping needs
+  void flush_tlb();
+
+  // accesses the TLB answered, and those that walked the page table
+  constexpr auto hits() const { return hits_; }
+  constexpr auto misses() const { return misses_; }
+
+private:
+  struct Page {
+    // the host address of the page, or nullptr
+    std::uint8_t *host;
+    Device *device;
+    // of the page from the start of the device's mapping
+    std::uint32_t device_offset;
+    std::uint8_t permissions;
+  };
+  static constexpr auto table_bits = 10u;
+  using Table = std::array<Page, std::size_t{1} << table_bits>;
+
+  // A TLB entry. The tags are guest page addresses, with a tag that is not
+  // page aligned matching nothing. host is the host address of the page less
+  // its guest address, so that adding a guest address to it gives the host
+  // address of that byte.
+  struct Entry {
+    std::uint32_t read;
+    std::uint32_t write;
+    std::uintptr_t host;
+  };
+  static constexpr auto no_page = std::uint32_t{1};
+
+  // the page holding address, or nullptr if nothing is mapped there
+  const Page *walk(std::uint32_t address) const;
+  Page &entry(std::uint32_t address);
+  // the slow path, which moves size bytes between value and address
+  bool access(std::uint32_t address, std::uint32_t size,
+              Permissions permission, std::uint32_t &value);
+  // the same within a page, refilling the TLB entry for it
+  bool transfer(std::uint32_t address, std::uint32_t size,
+                Permissions permission, std::uint32_t &value);
+
+  std::array<std::unique_ptr<Table>, std::size_t{1} << table_bits>
+      directory_{};
+  std::array<Entry, tlb_entries> tlb_{};
+  std::uint64_t hits_{};
+  std::uint64_t misses_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using Mmu = vm::Mmu;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef AAVM_IR_MODULE_H_
+#define AAVM_IR_MODULE_H_
+
+#include "instruction.h"
+#include "label.h"
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace aavm::ir {
+
+// A parsed program: its instructions in source order and the instruction each
+// label marks. The labels are owned by the parser, which must outlive it.
+class Module {
+public:
+  void append(std::unique_ptr<Instruction> instr) {
+    instructions_.push_back(std::move(instr));
+  }
+
+  // marks the next instruction appended, returns false if label is already
+  // defined
+  bool define_label(const Label &label) {
+    if (label.id() >= label_indices_.size()) {
+      label_indices_.resize(label.id() + 1, undefined_);
+    }
+    if (label_indices_[label.id()] != undefined_) {
+      return false;
+    }
+    label_indices_[label.id()] = instructions_.size();
+    return true;
+  }
+
+  constexpr auto &instructions() const { return instructions_; }
+  auto size() const { return instructions_.size(); }
+
+  // index of the instruction label marks, size() for a label at the end
+  std::optional<std::size_t> label_index(const Label &label) const {
+    if (label.id() < label_indices_.size() &&
+        label_indices_[label.id()] != undefined_) {
+      return label_indices_[label.id()];
+    }
+    return std::nullopt;
+  }
+
+private:
+  static constexpr auto undefined_ = ~std::size_t{0};
+
+  std::vector<std::unique_ptr<Instruction>> instructions_{};
+  // indexed by LabelID
+  std::vector<std::size_t> label_indices_{};
+};
+
+} // namespace aavm::ir
+
+#endif
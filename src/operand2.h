@@ -3,6 +3,12 @@
 
 #include "instruction.h"
 #include "register.h"
+#include "stl_bit.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
 #include <variant>
 
 namespace aavm::ir {
@@ -83,6 +89,61 @@ private:
   bool immediate_{};
 };
 
+// A32 data-processing immediates are an 8-bit value rotated right by twice
+// the 4-bit rotation field. Returns the 12-bit rotation:imm8 field for value or
+// std::nullopt if no such encoding exists.
+constexpr auto encode_modified_immediate(std::uint32_t value)
+    -> std::optional<std::uint32_t> {
+  if ((value & ~0xFFu) == 0) {
+    return value;
+  }
+
+  const auto encode = [](std::uint32_t imm, int shift) {
+    // imm == imm8 rotated left by shift, i.e. rotated right by 32 - shift
+    const auto rotation = static_cast<std::uint32_t>((32 - shift) & 31) / 2;
+    return rotation << 8 | stl::rotr(imm, shift);
+  };
+
+  // rotate the lowest set bit (rounded down to an even position) into bit 0
+  const auto shift = stl::countr_zero(value) & ~1;
+  if ((stl::rotr(value, shift) & ~0xFFu) == 0) {
+    return encode(value, shift);
+  }
+
+  // the 8-bit window can wrap around from bit 31 into bits 0-5, in which case
+  // the window starts at the lowest set bit above bit 5
+  if ((value & 0x3Fu) != 0) {
+    const auto wrapped_shift = stl::countr_zero(value & ~0x3Fu) & ~1;
+    if ((stl::rotr(value, wrapped_shift) & ~0xFFu) == 0) {
+      return encode(value, wrapped_shift);
+    }
+  }
+
+  return std::nullopt;
+}
+
+constexpr auto decode_modified_immediate(std::uint32_t imm12) {
+  return stl::rotr(imm12 & 0xFFu, static_cast<int>((imm12 >> 8) & 0xFu) * 2);
+}
+
+constexpr auto is_modified_immediate(std::uint32_t value) {
+  return encode_modified_immediate(value).has_value();
+}
+
+// splits value into disjoint modified immediates (at most four) whose sum is
+// value, returns the chunks and how many were used
+constexpr auto split_modified_immediate(std::uint32_t value) {
+  auto chunks = std::array<std::uint32_t, 4>{};
+  auto count = std::size_t{0};
+  while (value != 0) {
+    const auto shift = stl::countr_zero(value) & ~1;
+    const auto chunk = value & stl::rotl(0xFFu, shift);
+    chunks[count++] = chunk;
+    value &= ~chunk;
+  }
+  return std::pair{chunks, count};
+}
+
 } // namespace aavm::ir
 
 #endif
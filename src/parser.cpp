@@ -214,6 +214,8 @@ static constexpr auto map_token(token::Kind token) -> unsigned {
     return Instruction::Push;
   case kw_pop:
     return Instruction::Pop;
+  case kw_svc:
+    return Instruction::Svc;
 
   default:
     return 0;
@@ -222,6 +224,28 @@ static constexpr auto map_token(token::Kind token) -> unsigned {
   aavm_unreachable();
 }
 
+void Parser::report_error(std::size_t line, std::string_view message) {
+  fmt::print("line {}: {}\n", line, message);
+}
+
+std::optional<Module> Parser::parse_module() {
+  auto module = Module{};
+  const auto ok = parse_statements(
+      [&module](const Label &label, std::size_t line) {
+        if (!module.define_label(label)) {
+          report_error(line, fmt::format("redefinition of label '{}'",
+                                         label.name()));
+          return false;
+        }
+        return true;
+      },
+      [&module](std::unique_ptr<Instruction> instr, std::size_t /*line*/) {
+        module.append(std::move(instr));
+        return true;
+      });
+  return ok ? std::optional{std::move(module)} : std::nullopt;
+}
+
 std::unique_ptr<Instruction> Parser::parse_instruction() {
   const auto tok = lexer_.token_kind();
 
@@ -269,6 +293,9 @@ std::unique_ptr<Instruction> Parser::parse_instruction() {
         return parse_block_memory(
             static_cast<Instruction::BlockMemoryOperation>(op),
             lexer_.source_location());
+      } else if (Instruction::is_system_operation(op)) {
+        return parse_system(static_cast<Instruction::SystemOperation>(op),
+                            lexer_.source_location());
       } else {
         return {};
       }
@@ -276,19 +303,34 @@ std::unique_ptr<Instruction> Parser::parse_instruction() {
   }
 
   // return mov r0, r0
+  lexer_.get_token();
   return std::make_unique<MoveInstruction>(
       Instruction::Mov, Condition::AL, false, Register::Kind::R0,
       Operand2{ShiftedRegister{Register::Kind::R0, Instruction::Lsl, 0u}});
 }
 
+std::optional<const Label *> Parser::parse_label_definition() {
+  const auto label = parse_label(lexer_.source_location());
+  if (!label || !ensure(token::Colon, "expected colon"sv)) {
+    return std::nullopt;
+  }
+  return label;
+}
+
 const Label *Parser::find_label_or_insert(std::string_view name) {
-  for (const auto &l : labels_) {
-    if (name == l.name()) {
-      return &l;
-    }
+  const auto [it, inserted] = label_lookup_.try_emplace(name, nullptr);
+  if (inserted) {
+    it->second = &labels_.emplace_back(
+        Label{static_cast<LabelID>(labels_.size() + 1), name});
+  }
+  return it->second;
+}
+
+void Parser::skip_line() {
+  while (lexer_.token_kind() != token::Newline &&
+         lexer_.token_kind() != token::Eof) {
+    lexer_.get_token();
   }
-  return &labels_.emplace_back(
-      Label{static_cast<LabelID>(labels_.size() + 1), name});
 }
 
 bool Parser::parse_update_flag(const SourceLocation & /*srcloc*/) {
@@ -506,7 +548,7 @@ Parser::parse_multiply(Instruction::MultiplyOperation op,
       break;
     }
     const auto rn = parse_register(lexer_.source_location());
-    return rn ? std::make_unique<MultiplyInstruction>(op, cond, updates, *rs,
+    return rn ? std::make_unique<MultiplyInstruction>(op, cond, updates, *rd,
                                                       *rm, *rs, *rn)
               : nullptr;
   }
@@ -698,7 +740,7 @@ Parser::parse_branch(Instruction::BranchOperation op,
       break;
     }
     const auto label = parse_label(lexer_.source_location());
-    return label ? std::make_unique<BranchInstruction>(op, cond, *label)
+    return label ? std::make_unique<BranchInstruction>(op, cond, *rn, *label)
                  : nullptr;
   }
   default:
@@ -775,6 +817,9 @@ Parser::parse_single_memory(Instruction::SingleMemoryOperation op,
   const auto indexmode = lexer_.token_kind() == token::Exclaim
                              ? SingleMemoryInstruction::IndexMode::PreIndex
                              : SingleMemoryInstruction::IndexMode::Offset;
+  if (indexmode == SingleMemoryInstruction::IndexMode::PreIndex) {
+    lexer_.get_token();
+  }
   return std::make_unique<SingleMemoryInstruction>(op, cond, *rd, *rn, *src2,
                                                    indexmode, subtract);
 }
@@ -845,7 +890,20 @@ Parser::parse_block_memory(Instruction::BlockMemoryOperation op,
       return nullptr;
     }
   }
+  lexer_.get_token();
 
   return std::make_unique<BlockMemoryInstruction>(op, cond, *rn, writeback,
                                                   registers);
 }
+
+std::unique_ptr<SystemInstruction>
+Parser::parse_system(Instruction::SystemOperation op,
+                     const SourceLocation & /*srcloc*/) {
+  lexer_.get_token();
+
+  const auto cond = parse_condition(lexer_.source_location());
+
+  const auto imm =
+      parse_immediate(/*numbersym*/ true, lexer_.source_location());
+  return imm ? std::make_unique<SystemInstruction>(op, cond, *imm) : nullptr;
+}
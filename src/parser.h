@@ -6,12 +6,17 @@
 #include "instructions.h"
 #include "label.h"
 #include "lexer.h"
+#include "module.h"
 #include "operand2.h"
 #include "register.h"
 #include "textbuffer.h"
+#include "token.h"
+#include <cstddef>
+#include <deque>
 #include <memory>
 #include <optional>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace aavm::parser {
@@ -24,9 +29,67 @@ public:
     lexer_.get_token();
   }
 
-  // TODO: make this private and make the parser return a "module" instead with
-  // all parsed instructions and directives etc.
+  // parses the whole input, reports every error and returns std::nullopt if
+  // there were any
+  std::optional<ir::Module> parse_module();
+
+  // Parses statements up to the end of the input, handing each label to
+  // on_label(label, line) and each instruction to
+  // on_instruction(std::move(instr), line), which return false once they
+  // have reported an error of their own. Syntax errors are reported and the
+  // rest of their line skipped. Returns false if there were any errors.
+  template <typename OnLabel, typename OnInstruction>
+  bool parse_statements(OnLabel &&on_label, OnInstruction &&on_instruction) {
+    using namespace std::string_view_literals;
+    auto ok = true;
+    for (;;) {
+      const auto line = lexer_.source_location().line() + 1;
+      switch (lexer_.token_kind()) {
+      case token::Eof:
+        return ok;
+      case token::Newline:
+        lexer_.get_token();
+        continue;
+      case token::Label: {
+        // a label may be followed by an instruction on the same line
+        const auto label = parse_label_definition();
+        if (!label) {
+          ok = false;
+          skip_line();
+        } else {
+          ok = on_label(**label, line) && ok;
+        }
+        continue;
+      }
+      default:
+        break;
+      }
+
+      auto instr = parse_instruction();
+      if (!instr) {
+        report_error(line, "expected instruction"sv);
+        ok = false;
+        skip_line();
+        continue;
+      }
+
+      ok = on_instruction(std::move(instr), line) && ok;
+      if (lexer_.token_kind() != token::Newline &&
+          lexer_.token_kind() != token::Eof) {
+        report_error(line, "expected end of line"sv);
+        ok = false;
+        skip_line();
+      }
+    }
+  }
+
   std::unique_ptr<ir::Instruction> parse_instruction();
+  std::optional<const ir::Label *> parse_label_definition();
+
+  // prints message as an error on line, counting from 1
+  static void report_error(std::size_t line, std::string_view message);
+
+  constexpr auto &labels() const { return labels_; }
 
 private:
   template <typename Pred>
@@ -65,6 +128,7 @@ private:
   }
 
   const ir::Label *find_label_or_insert(std::string_view name);
+  void skip_line();
 
   bool parse_update_flag(const SourceLocation &srcloc);
   ir::Condition::Kind parse_condition(const SourceLocation &srcloc);
@@ -118,9 +182,15 @@ protected:
   parse_block_memory(ir::Instruction::BlockMemoryOperation op,
                      const SourceLocation &srcloc);
 
+  std::unique_ptr<ir::SystemInstruction>
+  parse_system(ir::Instruction::SystemOperation op,
+               const SourceLocation &srcloc);
+
 private:
   Lexer &lexer_;
-  std::vector<ir::Label> labels_{};
+  // instructions hold pointers to labels so they must never move
+  std::deque<ir::Label> labels_{};
+  std::unordered_map<std::string_view, const ir::Label *> label_lookup_{};
 };
 
 } // namespace aavm::parser
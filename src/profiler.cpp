@@ -0,0 +1,114 @@
+#include "profiler.h"
+#include "assembler.h"
+#include "fmt/format.h"
+#include "instruction.h"
+#include <algorithm>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+std::uint32_t aavm::vm::estimate_cycles(const MicroOp &op) {
+  const auto operation = op.operation;
+  if (Instruction::is_multiply_operation(operation)) {
+    return operation <= Instruction::Mls ? 2 : 3;
+  }
+  if (Instruction::is_divide_operation(operation)) {
+    return 8;
+  }
+  if (Instruction::is_single_memory_operation(operation)) {
+    // loads wait for the data, stores go to a write buffer
+    return operation < Instruction::Str ? 3 : 1;
+  }
+  if (Instruction::is_block_memory_operation(operation)) {
+    // the predecoder counts the registers into lsb
+    auto cycles = 1u + op.lsb;
+    if ((op.flags & MicroOp::WritesPc) != 0) {
+      cycles += 2;
+    }
+    return cycles;
+  }
+  // the pipeline refills after a branch
+  if (Instruction::is_branch_operation(operation) ||
+      (op.flags & MicroOp::WritesPc) != 0) {
+    return 3;
+  }
+  return 1;
+}
+
+std::vector<Region> aavm::vm::label_regions(const Assembler &assembler,
+                                            std::uint32_t base) {
+  auto regions = std::vector<Region>{};
+  for (const auto &label : assembler.labels()) {
+    if (const auto offset = assembler.label_address(label)) {
+      regions.push_back({label.name(), base + *offset});
+    }
+  }
+  return regions;
+}
+
+std::vector<Hotspot> aavm::vm::hotspots(const Profile &profile,
+                                        std::vector<Region> regions) {
+  std::stable_sort(regions.begin(), regions.end(),
+                   [](const Region &a, const Region &b) {
+                     return a.address < b.address;
+                   });
+  auto spots = std::vector<Hotspot>(regions.size() + 1);
+  spots[0].region = {};
+  for (auto i = std::size_t{0}; i < regions.size(); ++i) {
+    spots[i + 1].region = regions[i];
+  }
+
+  for (const auto &[address, block] : profile.blocks()) {
+    // the last region starting at or below the block, of the labels
+    // defined at one address the first
+    const auto after = std::upper_bound(
+        regions.begin(), regions.end(), address,
+        [](std::uint32_t at, const Region &region) {
+          return at < region.address;
+        });
+    auto index = static_cast<std::size_t>(after - regions.begin());
+    if (index != 0) {
+      const auto start = regions[index - 1].address;
+      while (index > 1 && regions[index - 2].address == start) {
+        --index;
+      }
+    }
+    auto &spot = spots[index];
+    spot.entries += block.entries;
+    spot.instructions += block.instructions;
+    spot.cycles += block.cycles;
+  }
+
+  spots.erase(std::remove_if(spots.begin(), spots.end(),
+                             [](const Hotspot &spot) {
+                               return spot.entries == 0;
+                             }),
+              spots.end());
+  std::stable_sort(spots.begin(), spots.end(),
+                   [](const Hotspot &a, const Hotspot &b) {
+                     return a.cycles > b.cycles;
+                   });
+  return spots;
+}
+
+void aavm::vm::print_hotspots(std::FILE *file,
+                              const std::vector<Hotspot> &hotspots) {
+  auto total = std::uint64_t{};
+  for (const auto &spot : hotspots) {
+    total += spot.cycles;
+  }
+  fmt::print(file, "{:>14} {:>6} {:>12} {:>14}  {}\n", "cycles", "share",
+             "entries", "instructions", "region");
+  for (const auto &spot : hotspots) {
+    const auto share =
+        total != 0 ? 100.0 * static_cast<double>(spot.cycles) /
+                         static_cast<double>(total)
+                   : 0.0;
+    const auto name =
+        spot.region.name.empty() ? std::string_view{"?"} : spot.region.name;
+    fmt::print(file, "{:>14} {:>5.1f}% {:>12} {:>14}  {} ({:08x})\n",
+               spot.cycles, share, spot.entries, spot.instructions, name,
+               spot.region.address);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef AAVM_VM_PROFILER_H_
+#define AAVM_VM_PROFILER_H_
+
+#include "codecache.h"
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace aavm::assembler {
+class Assembler;
+}
+
+namespace aavm::vm {
+
+// What a profiling run counted for the block at one address.
+struct BlockProfile {
+  std::uint64_t entries{};
+  std::uint64_t instructions{};
+  std::uint64_t cycles{};
+  // the estimated cycles of running the whole block once
+  std::uint32_t cost{};
+};
+
+// Per-block counts, which a profiling machine adds to once each time it
+// enters a block. Entries stay put as more are added and are never removed,
+// so blocks keep a pointer to theirs.
+class Profile {
+public:
+  BlockProfile &block(std::uint32_t address) { return blocks_[address]; }
+  const auto &blocks() const { return blocks_; }
+  // zeroes the counts, keeping the entries
+  void clear() {
+    for (auto &[address, block] : blocks_) {
+      block.entries = 0;
+      block.instructions = 0;
+      block.cycles = 0;
+    }
+  }
+
+private:
+  std::unordered_map<std::uint32_t, BlockProfile> blocks_{};
+};
+
+// The cycles op takes on a simple in-order core, good for telling hot code
+// from cold and not much else: one per instruction, with loads, multiplies,
+// block transfers and branches taking longer.
+std::uint32_t estimate_cycles(const MicroOp &op);
+
+// code from address up to the next region, usually what follows a label
+struct Region {
+  std::string_view name;
+  std::uint32_t address;
+};
+
+// the regions of the labels assembler defined, for code loaded at base
+std::vector<Region> label_regions(const assembler::Assembler &assembler,
+                                  std::uint32_t base);
+
+// the counts of the blocks starting in a region added up
+struct Hotspot {
+  Region region;
+  std::uint64_t entries;
+  std::uint64_t instructions;
+  std::uint64_t cycles;
+};
+
+// adds up profile per region, hottest first by estimated cycles. Blocks
+// below every region are added up under a region with no name.
+std::vector<Hotspot> hotspots(const Profile &profile,
+                              std::vector<Region> regions);
+// prints hotspots as a table, with each region's share of the cycles
+void print_hotspots(std::FILE *file, const std::vector<Hotspot> &hotspots);
+
+} // namespace aavm::vm
+
+#endif
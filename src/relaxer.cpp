@@ -0,0 +1,209 @@
+#include "relaxer.h"
+#include "operand2.h"
+#include <algorithm>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto word_size = static_cast<Word>(sizeof(Word));
+static constexpr auto nop = Word{0xE1A00000};
+
+static constexpr auto ip = Word{12};
+static constexpr auto lr = Word{14};
+static constexpr auto pc = Word{15};
+
+static constexpr auto destination(Word word) { return word >> 12 & 0xFu; }
+
+static constexpr auto magnitude(std::int32_t value) {
+  return value < 0 ? Word{0} - static_cast<Word>(value)
+                   : static_cast<Word>(value);
+}
+
+static auto chunk_count(std::int32_t value) {
+  return static_cast<Word>(split_modified_immediate(magnitude(value)).second);
+}
+
+static constexpr auto load_offset_mask(FixupKind kind) {
+  return kind == FixupKind::Load12 ? Word{0xFFF} : Word{0xFF};
+}
+
+std::optional<std::uint32_t>
+aavm::assembler::relaxed_size(std::uint32_t word, FixupKind kind,
+                              std::int32_t distance) {
+  const auto displacement = distance - static_cast<std::int32_t>(pc_offset);
+  if (apply_fixup(word, kind, displacement)) {
+    return 1;
+  }
+
+  switch (kind) {
+  case FixupKind::Branch:
+    if ((word >> 24 & 1u) != 0) {
+      // bl sets lr first, so the jump reads pc one word later
+      return 1 + chunk_count(displacement - static_cast<std::int32_t>(4));
+    }
+    // a plain branch may be within a function, where ip can be live, so it
+    // only relaxes to a single add to pc
+    if (chunk_count(displacement) > 1) {
+      return std::nullopt;
+    }
+    return 1;
+  case FixupKind::Adr:
+    if (destination(word) == pc) {
+      return std::nullopt;
+    }
+    return chunk_count(displacement);
+  case FixupKind::Load12:
+  case FixupKind::Load8: {
+    // only loads have a destination that is free to hold the address
+    if ((word >> 20 & 1u) == 0 || destination(word) == pc) {
+      return std::nullopt;
+    }
+    const auto high = magnitude(displacement) & ~load_offset_mask(kind);
+    return 1 + static_cast<Word>(split_modified_immediate(high).second);
+  }
+  }
+  return std::nullopt;
+}
+
+void aavm::assembler::emit_relaxed(std::uint32_t word, FixupKind kind,
+                                   std::int32_t distance, std::uint32_t size,
+                                   std::uint32_t *out) {
+  auto displacement = distance - static_cast<std::int32_t>(pc_offset);
+  if (const auto patched = apply_fixup(word, kind, displacement)) {
+    out[0] = *patched;
+    std::fill(out + 1, out + size, nop);
+    return;
+  }
+
+  const auto condition = word & 0xF0000000u;
+  auto emitted = Word{0};
+  const auto add = [&](Word rd, Word rn, std::int32_t value) {
+    const auto add_rd_rn = condition | 0x02800000u | rn << 16 | rd << 12;
+    out[emitted++] = *apply_fixup(add_rd_rn, FixupKind::Adr, value);
+  };
+  // adds (or subtracts) value to rn into rd, one modified immediate at a time
+  const auto add_chunks = [&](Word rd, Word rn, std::int32_t value,
+                              Word last_rd) {
+    const auto [chunks, count] = split_modified_immediate(magnitude(value));
+    for (auto i = std::size_t{0}; i < count; ++i) {
+      const auto chunk = static_cast<std::int32_t>(chunks[i]);
+      add(i + 1 == count ? last_rd : rd, i == 0 ? rn : rd,
+          value < 0 ? -chunk : chunk);
+    }
+  };
+
+  switch (kind) {
+  case FixupKind::Branch:
+    if ((word >> 24 & 1u) != 0) {
+      // return past the end of the sequence
+      add(lr, pc, static_cast<std::int32_t>(size * word_size - pc_offset));
+      displacement -= static_cast<std::int32_t>(word_size);
+    }
+    // only calls go through ip
+    add_chunks(ip, pc, displacement, pc);
+    break;
+  case FixupKind::Adr:
+    add_chunks(destination(word), pc, displacement, destination(word));
+    break;
+  case FixupKind::Load12:
+  case FixupKind::Load8: {
+    const auto rd = destination(word);
+    const auto mask = load_offset_mask(kind);
+    const auto negative = displacement < 0;
+    const auto distance_bits = magnitude(displacement);
+    const auto high = static_cast<std::int32_t>(distance_bits & ~mask);
+    const auto low = static_cast<std::int32_t>(distance_bits & mask);
+    add_chunks(rd, pc, negative ? -high : high, rd);
+    const auto load = (word & ~(Word{0xF} << 16)) | rd << 16;
+    out[emitted++] = *apply_fixup(load, kind, negative ? -low : low);
+    break;
+  }
+  }
+  std::fill(out + emitted, out + size, nop);
+}
+
+bool Relaxer::relax() {
+  const auto count = references_.size();
+  offsets_.resize(count);
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    offsets_[i] = references_[i].offset;
+  }
+  sizes_.assign(count, 1);
+  growth_.assign(count + 1, 0);
+
+  // a target moves by the growth of the references before it
+  auto target_growth = std::vector<std::uint32_t>(count);
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    if (references_[i].target != unresolved_target) {
+      target_growth[i] =
+          static_cast<std::uint32_t>(references_before(references_[i].target));
+    }
+  }
+
+  const auto address = [&](std::size_t i) {
+    return offsets_[i] + growth_[i] * word_size;
+  };
+  const auto target = [&](std::size_t i) {
+    return references_[i].target + growth_[target_growth[i]] * word_size;
+  };
+
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (auto i = std::size_t{0}; i < count; ++i) {
+      growth_[i + 1] = growth_[i] + sizes_[i] - 1;
+    }
+    for (auto i = std::size_t{0}; i < count; ++i) {
+      if (references_[i].target == unresolved_target) {
+        continue;
+      }
+      const auto distance = static_cast<std::int32_t>(target(i) - address(i));
+      const auto size = relaxed_size(code_[offsets_[i] / word_size],
+                                     references_[i].kind, distance);
+      if (!size) {
+        unreachable_ = i;
+        return false;
+      }
+      if (*size > sizes_[i]) {
+        sizes_[i] = *size;
+        changed = true;
+      }
+    }
+  }
+
+  auto relaxed = std::vector<std::uint32_t>{};
+  relaxed.reserve(code_.size() + growth_[count]);
+  auto next = std::size_t{0};
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    const auto index = offsets_[i] / word_size;
+    relaxed.insert(relaxed.end(), code_.begin() + next, code_.begin() + index);
+    next = index + 1;
+
+    auto &reference = references_[i];
+    if (reference.target == unresolved_target) {
+      relaxed.push_back(code_[index]);
+    } else {
+      const auto distance = static_cast<std::int32_t>(target(i) - address(i));
+      relaxed.resize(relaxed.size() + sizes_[i]);
+      emit_relaxed(code_[index], reference.kind, distance, sizes_[i],
+                   relaxed.data() + relaxed.size() - sizes_[i]);
+      reference.target = target(i);
+    }
+    reference.offset = address(i);
+  }
+  relaxed.insert(relaxed.end(), code_.begin() + next, code_.end());
+  code_.swap(relaxed);
+  return true;
+}
+
+std::uint32_t Relaxer::relocate(std::uint32_t offset) const {
+  return offset + growth_[references_before(offset)] * word_size;
+}
+
+std::size_t Relaxer::references_before(std::uint32_t offset) const {
+  return static_cast<std::size_t>(
+      std::lower_bound(offsets_.begin(), offsets_.end(), offset) -
+      offsets_.begin());
+}
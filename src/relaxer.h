@@ -0,0 +1,70 @@
+#ifndef AAVM_ASSEMBLER_RELAXER_H_
+#define AAVM_ASSEMBLER_RELAXER_H_
+
+#include "encoder.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace aavm::assembler {
+
+constexpr auto unresolved_target = ~std::uint32_t{0};
+
+// an instruction word that refers to another offset in the same code
+struct Reference {
+  // byte offset of the instruction word
+  std::uint32_t offset;
+  FixupKind kind;
+  // byte offset of the target, unresolved_target if it is not known
+  std::uint32_t target;
+};
+
+// the number of words needed to reach a target distance (target - address)
+// bytes away, returns std::nullopt if no sequence can reach it
+std::optional<std::uint32_t> relaxed_size(std::uint32_t word, FixupKind kind,
+                                          std::int32_t distance);
+
+// writes the size words reaching a target distance bytes away to out. Far
+// calls are built from add instructions through ip, which AAPCS allows
+// veneers to clobber. Other far branches keep every register and so only
+// reach what a single add to pc does. Far adr and ldr build the address in
+// their destination.
+void emit_relaxed(std::uint32_t word, FixupKind kind, std::int32_t distance,
+                  std::uint32_t size, std::uint32_t *out);
+
+// Grows references that cannot reach their targets into longer sequences.
+// Every reference starts at its shortest form and only grows, each pass is
+// linear in the number of references and the layout is final once a pass
+// grows nothing. references must be sorted by offset.
+class Relaxer {
+public:
+  Relaxer() = delete;
+  Relaxer(std::vector<std::uint32_t> &code, std::vector<Reference> &references)
+      : code_{code}, references_{references} {}
+
+  // rewrites code and the offsets and targets of references, returns false if
+  // a reference cannot reach its target
+  bool relax();
+  // the index of the reference relax() last failed to reach its target from
+  auto unreachable() const { return unreachable_; }
+
+  // maps an offset in the original layout to the relaxed layout
+  std::uint32_t relocate(std::uint32_t offset) const;
+
+private:
+  std::size_t references_before(std::uint32_t offset) const;
+
+  std::vector<std::uint32_t> &code_;
+  std::vector<Reference> &references_;
+
+  std::vector<std::uint32_t> offsets_{};
+  std::vector<std::uint32_t> sizes_{};
+  // extra words inserted before each reference
+  std::vector<std::uint32_t> growth_{};
+  std::size_t unreachable_{};
+};
+
+} // namespace aavm::assembler
+
+#endif
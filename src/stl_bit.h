@@ -0,0 +1,64 @@
+#ifndef AAVM_STL_BIT_H_
+#define AAVM_STL_BIT_H_
+
+#include <array>
+#include <cstdint>
+
+namespace aavm::stl {
+
+// C++17 stand-ins for the C++20 <bit> functions, limited to 32-bit values
+
+constexpr auto rotr(std::uint32_t x, int s) -> std::uint32_t {
+  const auto r = static_cast<unsigned>(s) & 31u;
+  // compilers recognise this pattern and emit a single rotate instruction
+  return r == 0 ? x : (x >> r) | (x << (32u - r));
+}
+
+constexpr auto rotl(std::uint32_t x, int s) -> std::uint32_t {
+  return rotr(x, -s);
+}
+
+namespace detail_ {
+
+constexpr auto debruijn_sequence_ = std::uint32_t{0x077CB531};
+
+constexpr auto debruijn_table_ = [] {
+  auto table = std::array<int, 32>();
+  for (auto i = 0; i < 32; ++i) {
+    table[static_cast<std::uint32_t>(debruijn_sequence_ << i) >> 27] = i;
+  }
+  return table;
+}();
+
+} // namespace detail_
+
+constexpr auto countr_zero(std::uint32_t x) -> int {
+  if (x == 0) {
+    return 32;
+  }
+#if AAVM_GCC || AAVM_CLANG
+  return __builtin_ctz(x);
+#else
+  // isolate the lowest set bit and look up its position
+  const auto lowest = x & (~x + 1);
+  return detail_::debruijn_table_[static_cast<std::uint32_t>(
+                                      lowest * detail_::debruijn_sequence_) >>
+                                  27];
+#endif
+}
+
+constexpr auto popcount(std::uint32_t x) -> int {
+#if AAVM_GCC || AAVM_CLANG
+  return __builtin_popcount(x);
+#else
+  // sum the bits in pairs, then nibbles, then add up the bytes
+  x = x - ((x >> 1) & 0x55555555u);
+  x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+  x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+  return static_cast<int>((x * 0x01010101u) >> 24);
+#endif
+}
+
+} // namespace aavm::stl
+
+#endif
@@ -0,0 +1,597 @@
+#include "interpreter.h"
+#include "alu.h"
+#include <variant>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::ir;
+
+using Word = std::uint32_t;
+
+static constexpr auto word_size = Word{4};
+
+// gcc and clang let every handler jump straight to the next through a table of
+// label addresses, elsewhere every handler goes back through one switch
+#if AAVM_GCC || AAVM_CLANG
+#define AAVM_COMPUTED_GOTO 1
+#else
+#define AAVM_COMPUTED_GOTO 0
+#endif
+
+namespace {
+
+// in the order of the label table in run_threaded
+enum class Handler : std::uint8_t {
+  Generic,
+  Halt,
+  UndefinedLabel,
+  Add,
+  Adc,
+  Sub,
+  Sbc,
+  Rsb,
+  Rsc,
+  And,
+  Eor,
+  Orr,
+  Bic,
+  Mov,
+  Mvn,
+  Movw,
+  Movt,
+  Cmp,
+  Cmn,
+  Tst,
+  Teq,
+  B,
+  Bl,
+  Bx,
+  Cbz,
+  Cbnz,
+  Ldr,
+  Ldrb,
+  Ldrsb,
+  Ldrh,
+  Ldrsh,
+  Str,
+  Strb,
+  Strh,
+  handler_count
+};
+
+enum Form : std::uint8_t { Immediate, ImmediateShift, RegisterShift };
+
+} // namespace
+
+static constexpr auto index(Register::Kind reg) {
+  return static_cast<std::uint8_t>(reg - 1);
+}
+
+// the handler count places after first, for operations numbered in the same
+// order as their handlers
+static constexpr auto offset(Handler first, unsigned count) {
+  return static_cast<Handler>(static_cast<unsigned>(first) + count);
+}
+
+// fills in the operand2 fields of op, returns false if src2 reads pc
+static auto translate_operand2(const Operand2 &src2, ThreadedOp &op) {
+  if (src2.immediate()) {
+    op.form = Immediate;
+    op.imm = src2.imm12();
+    return true;
+  }
+
+  const auto &rm = src2.rm();
+  op.rm = index(rm.rm());
+  op.shift = static_cast<std::uint8_t>(rm.sh());
+  if (rm.immediate()) {
+    op.form = ImmediateShift;
+    op.imm = rm.shamt5();
+    return rm.rm() != Register::PC;
+  }
+  op.form = RegisterShift;
+  op.rs = index(rm.rs());
+  return rm.rm() != Register::PC && rm.rs() != Register::PC;
+}
+
+// the handler for instr with its operands filled into op, Generic for
+// instructions that read or write pc or have no handler of their own
+static auto translate_instruction(const Instruction &instr,
+                                  const Module &module, ThreadedOp &op) {
+  const auto operation = instr.operation();
+  switch (operation) {
+  case Instruction::Add:
+  case Instruction::Adc:
+  case Instruction::Sub:
+  case Instruction::Sbc:
+  case Instruction::Rsb:
+  case Instruction::Rsc:
+  case Instruction::And:
+  case Instruction::Eor:
+  case Instruction::Orr:
+  case Instruction::Bic: {
+    const auto &arithmetic = static_cast<const ArithmeticInstruction &>(instr);
+    if (arithmetic.rd() == Register::PC || arithmetic.rn() == Register::PC ||
+        !translate_operand2(arithmetic.src2(), op)) {
+      return Handler::Generic;
+    }
+    op.rd = index(arithmetic.rd());
+    op.rn = index(arithmetic.rn());
+    return offset(Handler::Add, operation - Instruction::Add);
+  }
+  case Instruction::Mov:
+  case Instruction::Mvn:
+  case Instruction::Movw:
+  case Instruction::Movt: {
+    const auto &move = static_cast<const MoveInstruction &>(instr);
+    if (move.rd() == Register::PC) {
+      return Handler::Generic;
+    }
+    op.rd = index(move.rd());
+    if (operation == Instruction::Movw || operation == Instruction::Movt) {
+      op.imm = move.imm16();
+      return operation == Instruction::Movw ? Handler::Movw : Handler::Movt;
+    }
+    if (!translate_operand2(move.src2(), op)) {
+      return Handler::Generic;
+    }
+    return operation == Instruction::Mov ? Handler::Mov : Handler::Mvn;
+  }
+  case Instruction::Cmp:
+  case Instruction::Cmn:
+  case Instruction::Tst:
+  case Instruction::Teq: {
+    const auto &comparison = static_cast<const ComparisonInstruction &>(instr);
+    if (comparison.rn() == Register::PC ||
+        !translate_operand2(comparison.src2(), op)) {
+      return Handler::Generic;
+    }
+    op.rn = index(comparison.rn());
+    return offset(Handler::Cmp, operation - Instruction::Cmp);
+  }
+  case Instruction::B:
+  case Instruction::Bl:
+  case Instruction::Cbz:
+  case Instruction::Cbnz: {
+    const auto &branch = static_cast<const BranchInstruction &>(instr);
+    const auto target = module.label_index(*branch.label());
+    if (operation == Instruction::Cbz || operation == Instruction::Cbnz) {
+      // compare and branch only faults on an undefined label when taken
+      if (!target || branch.rn() == Register::PC) {
+        return Handler::Generic;
+      }
+      op.rn = index(branch.rn());
+    }
+    if (!target) {
+      return Handler::UndefinedLabel;
+    }
+    op.imm = static_cast<Word>(*target);
+    return offset(Handler::B, operation - Instruction::B);
+  }
+  case Instruction::Bx: {
+    const auto &branch = static_cast<const BranchInstruction &>(instr);
+    if (branch.rm() == Register::PC) {
+      return Handler::Generic;
+    }
+    op.rm = index(branch.rm());
+    return Handler::Bx;
+  }
+  case Instruction::Ldr:
+  case Instruction::Ldrb:
+  case Instruction::Ldrsb:
+  case Instruction::Ldrh:
+  case Instruction::Ldrsh:
+  case Instruction::Str:
+  case Instruction::Strb:
+  case Instruction::Strh: {
+    const auto &memory = static_cast<const SingleMemoryInstruction &>(instr);
+    if (memory.rd() == Register::PC) {
+      return Handler::Generic;
+    }
+    op.rd = index(memory.rd());
+
+    const auto source = memory.source();
+    // ldr rd, =imm32 only moves a constant into rd
+    if (const auto literal = std::get_if<unsigned>(&source)) {
+      if (operation != Instruction::Ldr) {
+        return Handler::Generic;
+      }
+      op.form = Immediate;
+      op.imm = *literal;
+      return Handler::Mov;
+    }
+    const auto src2 = std::get_if<Operand2>(&source);
+    if (src2 == nullptr || memory.rn() == Register::PC ||
+        !translate_operand2(*src2, op)) {
+      return Handler::Generic;
+    }
+    op.rn = index(memory.rn());
+    op.mode = static_cast<std::uint8_t>(memory.indexmode());
+    op.subtract = memory.subtract();
+    return offset(Handler::Ldr, operation - Instruction::Ldr);
+  }
+  default:
+    return Handler::Generic;
+  }
+}
+
+// the value of the operand2 of op and the carry out of its shift
+static auto operand(const Cpu &cpu, const ThreadedOp &op)
+    -> std::pair<Word, Word> {
+  const auto carry = (cpu.apsr >> carry_shift) & 1u;
+  switch (op.form) {
+  case Immediate:
+    return {op.imm, op.imm > 0xFFu ? op.imm >> 31 : carry};
+  case ImmediateShift:
+    return shift_c(cpu.registers[op.rm], op.shift, op.imm, carry);
+  default:
+    return shift_c(cpu.registers[op.rm], op.shift,
+                   cpu.registers[op.rs] & 0xFFu, carry);
+  }
+}
+
+static void arithmetic(Cpu &cpu, const ThreadedOp &op,
+                       std::pair<Word, Word> result) {
+  cpu.registers[op.rd] = result.first;
+  if (op.flags) {
+    cpu.apsr = result.second;
+  }
+}
+
+static void logical(Cpu &cpu, const ThreadedOp &op, Word result, Word carry) {
+  cpu.registers[op.rd] = result;
+  if (op.flags) {
+    cpu.apsr = logical_flags(result, carry, cpu.apsr);
+  }
+}
+
+// the address op accesses and what its base register holds once the access
+// is done, which is only written back then so that a fault leaves it alone
+struct Access {
+  Word address;
+  Word base;
+};
+
+static auto effective_address(const Cpu &cpu, const ThreadedOp &op) {
+  using IndexMode = SingleMemoryInstruction::IndexMode;
+  const auto offset = operand(cpu, op).first;
+  const auto base = cpu.registers[op.rn];
+  const auto offset_address = op.subtract ? base - offset : base + offset;
+  const auto mode = static_cast<IndexMode>(op.mode);
+  return Access{mode == IndexMode::PostIndex ? base : offset_address,
+                mode == IndexMode::Offset ? base : offset_address};
+}
+
+void Interpreter::translate() {
+  threaded_.reserve(module_.size() + 1);
+  for (const auto &instr : module_.instructions()) {
+    auto op = ThreadedOp{};
+    op.instr = instr.get();
+    op.cond = static_cast<std::uint8_t>(instr->condition());
+    op.flags = instr->updatesflags();
+    op.kind =
+        static_cast<std::uint8_t>(translate_instruction(*instr, module_, op));
+    threaded_.push_back(op);
+  }
+
+  // branching to the end of the module halts
+  auto halt = ThreadedOp{};
+  halt.kind = static_cast<std::uint8_t>(Handler::Halt);
+  halt.cond = Condition::AL;
+  threaded_.push_back(halt);
+}
+
+// taking the address of a label and jumping to it are gnu extensions
+#if AAVM_GCC || AAVM_CLANG
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+Status Interpreter::run_threaded() {
+  if (threaded_.empty()) {
+    translate();
+  }
+
+  auto &pc = cpu_.reg(Register::PC);
+  const auto start = pc - code_base_;
+  if (start % word_size != 0 || start / word_size > module_.size()) {
+    return Status::BadBranch;
+  }
+
+#if AAVM_COMPUTED_GOTO
+  static const void *const handlers[] = {
+      &&Generic_handler, &&Halt_handler,  &&UndefinedLabel_handler,
+      &&Add_handler,     &&Adc_handler,   &&Sub_handler,
+      &&Sbc_handler,     &&Rsb_handler,   &&Rsc_handler,
+      &&And_handler,     &&Eor_handler,   &&Orr_handler,
+      &&Bic_handler,     &&Mov_handler,   &&Mvn_handler,
+      &&Movw_handler,    &&Movt_handler,  &&Cmp_handler,
+      &&Cmn_handler,     &&Tst_handler,   &&Teq_handler,
+      &&B_handler,       &&Bl_handler,    &&Bx_handler,
+      &&Cbz_handler,     &&Cbnz_handler,  &&Ldr_handler,
+      &&Ldrb_handler,    &&Ldrsb_handler, &&Ldrh_handler,
+      &&Ldrsh_handler,   &&Str_handler,   &&Strb_handler,
+      &&Strh_handler};
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) ==
+                static_cast<std::size_t>(Handler::handler_count));
+  if (threaded_.front().handler == nullptr) {
+    for (auto &op : threaded_) {
+      op.handler = handlers[op.kind];
+    }
+  }
+#define DISPATCH() goto *op->handler
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+  auto *const ops = threaded_.data();
+  auto *op = ops + start / word_size;
+  auto &regs = cpu_.registers;
+  auto retired = retired_;
+  auto status = Status::Running;
+
+#if AAVM_COMPUTED_GOTO
+#define HANDLER(name)                                                          \
+  case Handler::name:                                                          \
+  name##_handler:
+#else
+#define HANDLER(name) case Handler::name:
+#endif
+// retires op and moves on to the next
+#define NEXT()                                                                 \
+  {                                                                            \
+    ++retired;                                                                 \
+    ++op;                                                                      \
+    DISPATCH();                                                                \
+  }
+#define CONDITION()                                                            \
+  if (!condition_passed(op->cond, cpu_.apsr)) {                                \
+    NEXT();                                                                    \
+  }
+// retires op and continues at the instruction index target
+#define JUMP(target)                                                           \
+  {                                                                            \
+    ++retired;                                                                 \
+    op = ops + (target);                                                       \
+    DISPATCH();                                                                \
+  }
+// continues at an address op has already retired into
+#define BRANCH(address)                                                        \
+  {                                                                            \
+    const auto offset = (address)-code_base_;                                  \
+    if (offset % word_size != 0 || offset / word_size > module_.size()) {      \
+      pc = address;                                                            \
+      retired_ = retired;                                                      \
+      return Status::BadBranch;                                                \
+    }                                                                          \
+    op = ops + offset / word_size;                                             \
+    DISPATCH();                                                                \
+  }
+// stops at op without retiring it
+#define EXIT(result)                                                           \
+  {                                                                            \
+    status = result;                                                           \
+    goto exit;                                                                 \
+  }
+#define LOAD(type)                                                             \
+  {                                                                            \
+    CONDITION();                                                               \
+    const auto access = effective_address(cpu_, *op);                          \
+    if (!memory_.contains(access.address, sizeof(type))) {                     \
+      fault_address_ = access.address;                                         \
+      EXIT(Status::MemoryFault);                                               \
+    }                                                                          \
+    /* a load into the base register wins over the writeback */                \
+    regs[op->rn] = access.base;                                                \
+    regs[op->rd] = static_cast<Word>(memory_.load<type>(access.address));      \
+    NEXT();                                                                    \
+  }
+#define STORE(type)                                                            \
+  {                                                                            \
+    CONDITION();                                                               \
+    const auto access = effective_address(cpu_, *op);                          \
+    if (!memory_.contains(access.address, sizeof(type))) {                     \
+      fault_address_ = access.address;                                         \
+      EXIT(Status::MemoryFault);                                               \
+    }                                                                          \
+    memory_.store<type>(access.address, static_cast<type>(regs[op->rd]));      \
+    regs[op->rn] = access.base;                                                \
+    NEXT();                                                                    \
+  }
+
+#if !AAVM_COMPUTED_GOTO
+dispatch:
+#endif
+  switch (static_cast<Handler>(op->kind)) {
+  HANDLER(Generic) {
+    CONDITION();
+    const auto address = code_base_ + static_cast<Word>(op - ops) * word_size;
+    pc = address;
+    next_pc_ = address + word_size;
+    const auto result = execute(*op->instr);
+    if (result != Status::Running) {
+      EXIT(result);
+    }
+    if (next_pc_ == address + word_size) {
+      NEXT();
+    }
+    ++retired;
+    BRANCH(next_pc_);
+  }
+  HANDLER(Halt) { EXIT(Status::Halted); }
+  HANDLER(UndefinedLabel) {
+    CONDITION();
+    EXIT(Status::UndefinedLabel);
+  }
+  HANDLER(Add) {
+    CONDITION();
+    arithmetic(cpu_, *op,
+               add_with_carry(regs[op->rn], operand(cpu_, *op).first, 0));
+    NEXT();
+  }
+  HANDLER(Adc) {
+    CONDITION();
+    const auto carry = (cpu_.apsr >> carry_shift) & 1u;
+    arithmetic(cpu_, *op,
+               add_with_carry(regs[op->rn], operand(cpu_, *op).first, carry));
+    NEXT();
+  }
+  HANDLER(Sub) {
+    CONDITION();
+    arithmetic(cpu_, *op,
+               add_with_carry(regs[op->rn], ~operand(cpu_, *op).first, 1));
+    NEXT();
+  }
+  HANDLER(Sbc) {
+    CONDITION();
+    const auto carry = (cpu_.apsr >> carry_shift) & 1u;
+    arithmetic(cpu_, *op,
+               add_with_carry(regs[op->rn], ~operand(cpu_, *op).first, carry));
+    NEXT();
+  }
+  HANDLER(Rsb) {
+    CONDITION();
+    arithmetic(cpu_, *op,
+               add_with_carry(operand(cpu_, *op).first, ~regs[op->rn], 1));
+    NEXT();
+  }
+  HANDLER(Rsc) {
+    CONDITION();
+    const auto carry = (cpu_.apsr >> carry_shift) & 1u;
+    arithmetic(cpu_, *op,
+               add_with_carry(operand(cpu_, *op).first, ~regs[op->rn], carry));
+    NEXT();
+  }
+  HANDLER(And) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, regs[op->rn] & value, carry);
+    NEXT();
+  }
+  HANDLER(Eor) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, regs[op->rn] ^ value, carry);
+    NEXT();
+  }
+  HANDLER(Orr) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, regs[op->rn] | value, carry);
+    NEXT();
+  }
+  HANDLER(Bic) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, regs[op->rn] & ~value, carry);
+    NEXT();
+  }
+  HANDLER(Mov) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, value, carry);
+    NEXT();
+  }
+  HANDLER(Mvn) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    logical(cpu_, *op, ~value, carry);
+    NEXT();
+  }
+  HANDLER(Movw) {
+    CONDITION();
+    regs[op->rd] = op->imm & 0xFFFFu;
+    NEXT();
+  }
+  HANDLER(Movt) {
+    CONDITION();
+    regs[op->rd] = (regs[op->rd] & 0xFFFFu) | op->imm << 16;
+    NEXT();
+  }
+  HANDLER(Cmp) {
+    CONDITION();
+    cpu_.apsr =
+        add_with_carry(regs[op->rn], ~operand(cpu_, *op).first, 1).second;
+    NEXT();
+  }
+  HANDLER(Cmn) {
+    CONDITION();
+    cpu_.apsr =
+        add_with_carry(regs[op->rn], operand(cpu_, *op).first, 0).second;
+    NEXT();
+  }
+  HANDLER(Tst) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    cpu_.apsr = logical_flags(regs[op->rn] & value, carry, cpu_.apsr);
+    NEXT();
+  }
+  HANDLER(Teq) {
+    CONDITION();
+    const auto [value, carry] = operand(cpu_, *op);
+    cpu_.apsr = logical_flags(regs[op->rn] ^ value, carry, cpu_.apsr);
+    NEXT();
+  }
+  HANDLER(B) {
+    CONDITION();
+    JUMP(op->imm);
+  }
+  HANDLER(Bl) {
+    CONDITION();
+    regs[index(Register::LR)] =
+        code_base_ + static_cast<Word>(op - ops + 1) * word_size;
+    JUMP(op->imm);
+  }
+  HANDLER(Bx) {
+    CONDITION();
+    // bit 0 selects thumb state, which we ignore
+    const auto target = regs[op->rm] & ~Word{1};
+    ++retired;
+    BRANCH(target);
+  }
+  HANDLER(Cbz) {
+    CONDITION();
+    if (regs[op->rn] == 0) {
+      JUMP(op->imm);
+    }
+    NEXT();
+  }
+  HANDLER(Cbnz) {
+    CONDITION();
+    if (regs[op->rn] != 0) {
+      JUMP(op->imm);
+    }
+    NEXT();
+  }
+  HANDLER(Ldr) LOAD(std::uint32_t)
+  HANDLER(Ldrb) LOAD(std::uint8_t)
+  HANDLER(Ldrsb) LOAD(std::int8_t)
+  HANDLER(Ldrh) LOAD(std::uint16_t)
+  HANDLER(Ldrsh) LOAD(std::int16_t)
+  HANDLER(Str) STORE(std::uint32_t)
+  HANDLER(Strb) STORE(std::uint8_t)
+  HANDLER(Strh) STORE(std::uint16_t)
+  case Handler::handler_count:
+    break;
+  }
+  aavm_unreachable();
+
+exit:
+  pc = code_base_ + static_cast<Word>(op - ops) * word_size;
+  retired_ = retired;
+  return status;
+
+#undef HANDLER
+#undef NEXT
+#undef CONDITION
+#undef JUMP
+#undef BRANCH
+#undef EXIT
+#undef LOAD
+#undef STORE
+#undef DISPATCH
+}
+
+#if AAVM_GCC || AAVM_CLANG
+#pragma GCC diagnostic pop
+#endif
@@ -146,7 +146,8 @@ enum Kind {
   kw_stmdb,
   kw_push,
   kw_pop,
-  instructions_end_ = kw_pop
+  kw_svc,
+  instructions_end_ = kw_svc
 };
 
 constexpr auto is_condition(token::Kind token) {
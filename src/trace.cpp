@@ -0,0 +1,218 @@
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+
+using namespace aavm;
+using namespace aavm::vm;
+
+namespace {
+
+struct Header {
+  std::uint32_t magic;
+  std::uint16_t version;
+  std::uint16_t reserved;
+};
+
+static_assert(sizeof(Header) == 8);
+
+} // namespace
+
+// small signed distances become small unsigned ones, -1 to 1 and 1 to 2
+static constexpr std::uint32_t zigzag(std::uint32_t delta) {
+  return (delta << 1) ^ (0u - (delta >> 31));
+}
+
+static constexpr std::uint32_t unzigzag(std::uint32_t value) {
+  return (value >> 1) ^ (0u - (value & 1));
+}
+
+// writes value to out seven bits at a time, low bits first, returns the
+// bytes written
+static std::size_t put_varint(std::uint8_t *out, std::uint32_t value) {
+  auto size = std::size_t{};
+  while (value >= 0x80) {
+    out[size++] = static_cast<std::uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[size++] = static_cast<std::uint8_t>(value);
+  return size;
+}
+
+std::unique_ptr<TraceWriter> TraceWriter::open(const char *path,
+                                               std::size_t capacity) {
+  const auto fd = fileio::open_for_writing(path);
+  if (fd < 0) {
+    return nullptr;
+  }
+  const auto header = Header{magic, version, 0};
+  const auto buffer = fileio::Buffer{&header, sizeof(header)};
+  if (!fileio::write_buffers(fd, &buffer, 1)) {
+    fileio::close_file(fd);
+    return nullptr;
+  }
+  auto size = std::size_t{64};
+  while (size < capacity) {
+    size *= 2;
+  }
+  return std::unique_ptr<TraceWriter>{new TraceWriter{fd, size}};
+}
+
+TraceWriter::TraceWriter(int fd, std::size_t capacity)
+    : fd_{fd}, ring_(capacity), mask_{capacity - 1} {
+  thread_ = std::thread{[this] { drain(); }};
+}
+
+TraceWriter::~TraceWriter() {
+  stop_.store(true, std::memory_order_release);
+  wake_.notify_one();
+  thread_.join();
+  fileio::close_file(fd_);
+}
+
+void TraceWriter::block(std::uint32_t address, std::uint32_t instructions) {
+  auto record = std::array<std::uint8_t, max_record>{};
+  record[0] = TraceRecord::Block;
+  // in words, which blocks are aligned to
+  const auto delta = (address >> 2) - (block_end_ >> 2);
+  auto size = std::size_t{1};
+  size += put_varint(record.data() + size, zigzag(delta));
+  size += put_varint(record.data() + size, instructions);
+  block_end_ = address + instructions * 4;
+  push(record.data(), size);
+}
+
+void TraceWriter::access(TraceRecord::Kind kind, std::uint32_t address,
+                         std::uint32_t size) {
+  auto record = std::array<std::uint8_t, max_record>{};
+  record[0] = kind;
+  auto length = std::size_t{1};
+  length += put_varint(record.data() + length,
+                       zigzag(address - access_address_));
+  length += put_varint(record.data() + length, size);
+  access_address_ = address;
+  push(record.data(), length);
+}
+
+void TraceWriter::push(const std::uint8_t *record, std::size_t size) {
+  const auto head = head_.load(std::memory_order_relaxed);
+  while (head + size - cached_tail_ > ring_.size()) {
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    if (head + size - cached_tail_ <= ring_.size()) {
+      break;
+    }
+    wake_.notify_one();
+    std::this_thread::yield();
+  }
+  const auto at = static_cast<std::size_t>(head & mask_);
+  const auto first = std::min(size, ring_.size() - at);
+  std::memcpy(ring_.data() + at, record, first);
+  std::memcpy(ring_.data(), record + first, size - first);
+  head_.store(head + size, std::memory_order_release);
+  // wakes the writer each time another half of the ring fills, it looks in
+  // now and then otherwise
+  if (((head ^ (head + size)) & (ring_.size() / 2)) != 0) {
+    wake_.notify_one();
+  }
+}
+
+bool TraceWriter::flush() {
+  while (tail_.load(std::memory_order_acquire) !=
+         head_.load(std::memory_order_relaxed)) {
+    wake_.notify_one();
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+  }
+  return !failed_.load(std::memory_order_relaxed);
+}
+
+void TraceWriter::drain() {
+  for (;;) {
+    // read before head_, so that everything pushed before stopping is seen
+    const auto stopping = stop_.load(std::memory_order_acquire);
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (head != tail) {
+      // the stretch from tail to head, which may wrap around the ring
+      const auto at = static_cast<std::size_t>(tail & mask_);
+      const auto size = static_cast<std::size_t>(head - tail);
+      const auto first = std::min(size, ring_.size() - at);
+      const auto buffers = std::array<fileio::Buffer, 2>{
+          {{ring_.data() + at, first}, {ring_.data(), size - first}}};
+      // once a write fails the rest is dropped rather than holding up the
+      // machine
+      if (!failed_.load(std::memory_order_relaxed) &&
+          !fileio::write_buffers(fd_, buffers.data(), size == first ? 1 : 2)) {
+        failed_.store(true, std::memory_order_relaxed);
+      }
+      tail_.store(head, std::memory_order_release);
+      continue;
+    }
+    if (stopping) {
+      return;
+    }
+    auto lock = std::unique_lock{mutex_};
+    wake_.wait_for(lock, std::chrono::milliseconds{10});
+  }
+}
+
+std::optional<TraceReader> TraceReader::open(const char *path) {
+  auto file = fileio::MappedFile::open(path);
+  if (!file) {
+    return std::nullopt;
+  }
+  auto header = Header{};
+  if (file->size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (header.magic != TraceWriter::magic ||
+      header.version != TraceWriter::version) {
+    return std::nullopt;
+  }
+  auto reader = TraceReader{std::move(*file)};
+  reader.offset_ = sizeof(header);
+  return reader;
+}
+
+bool TraceReader::varint(std::uint32_t &value) {
+  value = 0;
+  for (auto shift = 0u; shift < 35; shift += 7) {
+    if (offset_ == file_.size()) {
+      return false;
+    }
+    const auto byte = file_.data()[offset_++];
+    value |= std::uint32_t{byte & 0x7Fu} << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+  if (offset_ == file_.size()) {
+    return false;
+  }
+  const auto tag = file_.data()[offset_++];
+  auto delta = std::uint32_t{};
+  auto size = std::uint32_t{};
+  if (tag > TraceRecord::Store || !varint(delta) || !varint(size)) {
+    truncated_ = true;
+    offset_ = file_.size();
+    return false;
+  }
+  record.kind = static_cast<TraceRecord::Kind>(tag);
+  record.size = size;
+  if (record.kind == TraceRecord::Block) {
+    record.address = ((block_end_ >> 2) + unzigzag(delta)) << 2;
+    record.branched = !entered_ || record.address != block_end_;
+    block_end_ = record.address + size * 4;
+    entered_ = true;
+  } else {
+    record.address = access_address_ + unzigzag(delta);
+    record.branched = false;
+    access_address_ = record.address;
+  }
+  return true;
+}
@@ -0,0 +1,141 @@
+#ifndef AAVM_VM_TRACE_H_
+#define AAVM_VM_TRACE_H_
+
+#include "fileio.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace aavm::vm {
+
+// One record of an execution trace.
+struct TraceRecord {
+  enum Kind : std::uint8_t { Block, Load, Store };
+
+  Kind kind;
+  std::uint32_t address;
+  // the instructions a block retired, or the bytes an access covered
+  std::uint32_t size;
+  // whether a block was branched to rather than fallen into from the one
+  // before, the first block counts as branched to
+  bool branched;
+};
+
+// Writes a binary trace of a running program to a file: the blocks it
+// enters with the instructions each retired, and optionally the address of
+// every load and store. Records are a tag followed by LEB128 varints, a
+// block's address as the zigzag distance in words from where the previous
+// block ended and an access's from the previous access, so falling through
+// to the next block takes three bytes. A block is recorded once it is done,
+// after the accesses it made.
+//
+// Records go into a ring buffer that a thread of its own drains to the file
+// with one writev per stretch, so the machine never waits on the disk until
+// the buffer fills, and then only long enough for there to be room. Nothing
+// is dropped. The ring has a single producer and no locks: only one thread
+// may record into a writer at a time, give every machine running on its own
+// thread a writer of its own.
+class TraceWriter {
+public:
+  // "AATR" read as a little-endian word
+  static constexpr auto magic = std::uint32_t{0x52544141};
+  static constexpr auto version = std::uint16_t{1};
+  static constexpr auto default_capacity = std::size_t{1} << 20;
+
+  TraceWriter() = delete;
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+  // writes out the records still buffered and closes the file
+  ~TraceWriter();
+
+  // starts a trace at path, truncating it, with a buffer of capacity bytes
+  // rounded up to a power of two. Returns nullptr if path cannot be written.
+  static std::unique_ptr<TraceWriter>
+  open(const char *path, std::size_t capacity = default_capacity);
+
+  // records a block entered at address that retired instructions
+  void block(std::uint32_t address, std::uint32_t instructions);
+  // records an access of size bytes from address
+  void access(TraceRecord::Kind kind, std::uint32_t address,
+              std::uint32_t size);
+  // waits until everything recorded so far is in the file, returns false if
+  // a write to it failed
+  bool flush();
+  // the bytes recorded so far, not counting the header
+  std::uint64_t recorded() const {
+    return head_.load(std::memory_order_relaxed);
+  }
+
+private:
+  // a tag and two five byte varints
+  static constexpr auto max_record = std::size_t{11};
+
+  TraceWriter(int fd, std::size_t capacity);
+  // copies a record into the ring, waiting for room if it is full
+  void push(const std::uint8_t *record, std::size_t size);
+  // the writing thread
+  void drain();
+
+  int fd_;
+  std::vector<std::uint8_t> ring_;
+  std::size_t mask_;
+  // where the previous block ended and the previous access started
+  std::uint32_t block_end_{};
+  std::uint32_t access_address_{};
+  // what the producer last saw of tail_, refreshed when the ring looks full
+  std::uint64_t cached_tail_{};
+
+  // bytes ever pushed and ever written, kept apart so they do not share a
+  // cache line
+  alignas(64) std::atomic<std::uint64_t> head_{};
+  alignas(64) std::atomic<std::uint64_t> tail_{};
+  std::atomic<bool> stop_{};
+  std::atomic<bool> failed_{};
+  std::mutex mutex_{};
+  std::condition_variable wake_{};
+  std::thread thread_{};
+};
+
+// Reads back the records of a trace TraceWriter wrote.
+class TraceReader {
+public:
+  TraceReader() = delete;
+
+  // returns nullopt if path is not a trace this version wrote
+  static std::optional<TraceReader> open(const char *path);
+
+  // reads the next record, returns false at the end of the trace
+  bool next(TraceRecord &record);
+  // whether the trace stopped in the middle of a record, as when the
+  // program writing it died
+  constexpr auto truncated() const { return truncated_; }
+
+private:
+  explicit TraceReader(fileio::MappedFile file) : file_{std::move(file)} {}
+  // reads a varint into value, returns false past the end of the file
+  bool varint(std::uint32_t &value);
+
+  fileio::MappedFile file_;
+  std::size_t offset_{};
+  std::uint32_t block_end_{};
+  std::uint32_t access_address_{};
+  bool entered_{};
+  bool truncated_{};
+};
+
+} // namespace aavm::vm
+
+namespace aavm {
+using TraceReader = vm::TraceReader;
+using TraceRecord = vm::TraceRecord;
+using TraceWriter = vm::TraceWriter;
+}
+
+#endif
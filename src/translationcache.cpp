@@ -0,0 +1,223 @@
+#include "translationcache.h"
+#include "fileio.h"
+#include "image.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::vm;
+using namespace aavm::vm::translationcache;
+
+namespace {
+
+struct Header {
+  std::uint32_t magic;
+  std::uint16_t version;
+  // a Memory::Layout, compiled code depends on it
+  std::uint16_t layout;
+  std::uint64_t key;
+  std::uint32_t memory_base;
+  std::uint32_t memory_size;
+  std::uint32_t page_count;
+  std::uint32_t block_count;
+  std::uint64_t code_size;
+  // image::fnv1a() of everything that follows
+  std::uint64_t checksum;
+};
+
+// Followed by the index of each of the page_count pages, then the guest words
+// and the ops of each page, then block_count blocks and code_size bytes of
+// host code.
+struct CachedBlock {
+  std::uint32_t address;
+  std::uint32_t executions;
+  // into the host code, code_size is 0 for blocks that were not compiled
+  std::uint32_t code_offset;
+  std::uint32_t code_size;
+  // the block's fault sites follow its code
+  std::uint32_t fault_count;
+};
+
+static_assert(sizeof(Header) == 48);
+static_assert(sizeof(CachedBlock) == 20);
+
+} // namespace
+
+static constexpr auto page_bytes = std::size_t{CodeCache::page_size};
+static constexpr auto ops_bytes = CodeCache::page_ops * sizeof(MicroOp);
+
+// how many bytes of page index are in memory
+static std::size_t page_length(const Memory &memory, std::size_t index) {
+  return std::min(page_bytes, memory.size() - index * page_bytes);
+}
+
+static auto page_index(const Memory &memory, std::uint32_t address) {
+  return std::size_t{(address - memory.base()) / CodeCache::page_size};
+}
+
+bool translationcache::save(const char *path, std::uint64_t key,
+                            const Memory &memory, const CodeCache &code,
+                            const BlockCache &blocks, const Jit &jit) {
+  auto pages = std::vector<std::uint32_t>{};
+  for (auto i = std::size_t{0}; i < code.page_count(); ++i) {
+    if (code.decoded_page(i) != nullptr) {
+      pages.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+
+  // blocks of pages dropped since they were formed are stale
+  auto cached = std::vector<CachedBlock>{};
+  auto host_code = std::vector<std::uint8_t>{};
+  blocks.for_each([&](const Block &block) {
+    if (code.decoded_page(page_index(memory, block.address)) == nullptr) {
+      return;
+    }
+    auto entry = CachedBlock{};
+    entry.address = block.address;
+    entry.executions = block.executions;
+    const auto compiled = jit.host_code(block.compiled);
+    if (compiled.size != 0) {
+      entry.code_offset = static_cast<std::uint32_t>(host_code.size());
+      entry.code_size = static_cast<std::uint32_t>(compiled.size);
+      entry.fault_count = static_cast<std::uint32_t>(compiled.faults.size());
+      host_code.insert(host_code.end(), compiled.code,
+                       compiled.code + compiled.size);
+      const auto *const faults =
+          reinterpret_cast<const std::uint8_t *>(compiled.faults.data());
+      host_code.insert(host_code.end(), faults,
+                       faults + compiled.faults.size() * sizeof(FaultSite));
+    }
+    cached.push_back(entry);
+  });
+
+  auto header = Header{};
+  header.magic = magic;
+  header.version = version;
+  header.layout = memory.layout();
+  header.key = key;
+  header.memory_base = memory.base();
+  header.memory_size = memory.size();
+  header.page_count = static_cast<std::uint32_t>(pages.size());
+  header.block_count = static_cast<std::uint32_t>(cached.size());
+  header.code_size = host_code.size();
+
+  // the last page can be cut short by the end of memory
+  auto padded = std::vector<std::uint8_t>(page_bytes);
+  auto buffers = std::vector<fileio::Buffer>{
+      {&header, sizeof(header)},
+      {pages.data(), pages.size() * sizeof(std::uint32_t)}};
+  for (const auto index : pages) {
+    const auto *const words = memory.data() + index * page_bytes;
+    const auto length = page_length(memory, index);
+    if (length < page_bytes) {
+      std::copy(words, words + length, padded.begin());
+      buffers.push_back({padded.data(), page_bytes});
+    } else {
+      buffers.push_back({words, page_bytes});
+    }
+    buffers.push_back({code.decoded_page(index), ops_bytes});
+  }
+  buffers.push_back({cached.data(), cached.size() * sizeof(CachedBlock)});
+  buffers.push_back({host_code.data(), host_code.size()});
+  header.checksum = image::fnv1a_basis;
+  for (auto i = std::size_t{1}; i < buffers.size(); ++i) {
+    header.checksum =
+        image::fnv1a(buffers[i].data, buffers[i].size, header.checksum);
+  }
+
+  const auto fd = fileio::open_for_writing(path);
+  if (fd < 0) {
+    return false;
+  }
+  const auto written =
+      fileio::write_buffers(fd, buffers.data(), buffers.size());
+  fileio::close_file(fd);
+  return written;
+}
+
+bool translationcache::load(const char *path, std::uint64_t key,
+                            const Memory &memory, CodeCache &code,
+                            BlockCache &blocks, Jit &jit) {
+  const auto file = fileio::MappedFile::open(path);
+  if (!file) {
+    return false;
+  }
+  const auto *const data = file->data();
+  auto header = Header{};
+  if (file->size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != magic || header.version != version ||
+      header.layout != memory.layout() || header.key != key ||
+      header.memory_base != memory.base() ||
+      header.memory_size != memory.size() ||
+      header.page_count > code.page_count()) {
+    return false;
+  }
+  // bounded by the page count of memory and 32 bit counts, none of these
+  // can wrap, while code_size is only compared with what is left
+  const auto pages_offset = sizeof(Header) + std::uint64_t{header.page_count} *
+                                                 sizeof(std::uint32_t);
+  const auto blocks_offset = pages_offset + std::uint64_t{header.page_count} *
+                                                 (page_bytes + ops_bytes);
+  const auto code_offset =
+      blocks_offset + std::uint64_t{header.block_count} * sizeof(CachedBlock);
+  if (code_offset > file->size() ||
+      header.code_size != file->size() - code_offset ||
+      image::fnv1a(data + sizeof(Header), file->size() - sizeof(Header)) !=
+          header.checksum) {
+    return false;
+  }
+
+  // take the pages whose code is still what they were decoded from
+  auto matches = std::vector<bool>(code.page_count());
+  for (auto i = std::size_t{0}; i < header.page_count; ++i) {
+    auto index = std::uint32_t{};
+    std::memcpy(&index, data + sizeof(Header) + i * sizeof(index),
+                sizeof(index));
+    const auto *const words =
+        data + pages_offset + i * (page_bytes + ops_bytes);
+    if (index >= code.page_count() ||
+        std::memcmp(words, memory.data() + index * page_bytes,
+                    page_length(memory, index)) != 0) {
+      continue;
+    }
+    code.install(index,
+                 reinterpret_cast<const MicroOp *>(words + page_bytes));
+    matches[index] = true;
+  }
+
+  for (auto i = std::size_t{0}; i < header.block_count; ++i) {
+    auto entry = CachedBlock{};
+    std::memcpy(&entry, data + blocks_offset + i * sizeof(entry),
+                sizeof(entry));
+    if (entry.address % 4 != 0 || !memory.contains(entry.address, 4) ||
+        !matches[page_index(memory, entry.address)] ||
+        blocks.find(entry.address) != nullptr) {
+      continue;
+    }
+    auto *const block = blocks.form(entry.address);
+    const auto faults_size =
+        std::uint64_t{entry.fault_count} * sizeof(FaultSite);
+    if (entry.code_size == 0 || std::uint64_t{entry.code_offset} +
+                                        entry.code_size + faults_size >
+                                    header.code_size) {
+      continue;
+    }
+    const auto *const start = data + code_offset + entry.code_offset;
+    auto compiled = HostCode{start, entry.code_size, {}};
+    compiled.faults.resize(entry.fault_count);
+    if (faults_size != 0) {
+      std::memcpy(compiled.faults.data(), start + entry.code_size,
+                  faults_size);
+    }
+    // blocks whose code does not fit get compiled again once they are hot
+    block->compiled = jit.load(compiled);
+    if (block->compiled != nullptr) {
+      block->executions = entry.executions;
+    }
+  }
+  return true;
+}
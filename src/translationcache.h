@@ -0,0 +1,35 @@
+#ifndef AAVM_VM_TRANSLATIONCACHE_H_
+#define AAVM_VM_TRANSLATIONCACHE_H_
+
+#include "blockcache.h"
+#include "codecache.h"
+#include "jit.h"
+#include "memory.h"
+#include <cstdint>
+
+namespace aavm::vm::translationcache {
+
+// "AAVT" read as a little-endian word
+constexpr auto magic = std::uint32_t{0x54564141};
+// bumped whenever micro-ops or compiled code change shape
+constexpr auto version = std::uint16_t{4};
+
+// What a machine translated, as saved on disk: its decoded pages along with
+// the guest words they came from, its blocks and their host code. A cache is
+// keyed by whatever identifies the program, usually Image::hash(), and only
+// fits memory of the same base, size and layout.
+//
+// save() writes the translations of memory to path. load() maps path and
+// takes the pages whose words still match memory, the blocks in them and
+// their host code, which is copied into jit; it returns false if path holds
+// no translations for key and memory. The host code is run as it is, so only
+// load caches this program wrote; a checksum over everything past the header
+// turns away files that were cut short or changed since.
+bool save(const char *path, std::uint64_t key, const Memory &memory,
+          const CodeCache &code, const BlockCache &blocks, const Jit &jit);
+bool load(const char *path, std::uint64_t key, const Memory &memory,
+          CodeCache &code, BlockCache &blocks, Jit &jit);
+
+} // namespace aavm::vm::translationcache
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef AAVM_TEST_MACHINETEST_H_
+#define AAVM_TEST_MACHINETEST_H_
+
+#include "assembler.h"
+#include "lexer.h"
+#include "machine.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// What the tests that run guest programs on a Machine share: where their
+// memory lives, and how a program gets from source into it.
+namespace aavm::test {
+
+inline constexpr auto memory_base = std::uint32_t{0x10000};
+inline constexpr auto memory_size = std::uint32_t{0x4000};
+
+// assembles source into code, returns false and fails the test if it does
+// not assemble
+inline bool assemble(std::string_view source,
+                     std::vector<std::uint32_t> &code) {
+  auto buffer = Charbuffer{source};
+  auto lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{lexer};
+  if (!assembler.assemble()) {
+    ADD_FAILURE() << "cannot assemble '" << source << "'";
+    return false;
+  }
+  code = assembler.code();
+  return true;
+}
+
+// writes code to the bottom of memory and points pc at it
+inline void load_code(vm::Machine &machine,
+                      const std::vector<std::uint32_t> &code) {
+  machine.write(memory_base, code.data(),
+                static_cast<std::uint32_t>(code.size() * 4));
+  machine.reset(memory_base);
+}
+
+// assembles source to the bottom of memory and points pc at it, returns
+// false and fails the test if it does not assemble
+inline bool assemble_into(vm::Machine &machine, std::string_view source) {
+  auto code = std::vector<std::uint32_t>{};
+  if (!assemble(source, code)) {
+    return false;
+  }
+  load_code(machine, code);
+  return true;
+}
+
+} // namespace aavm::test
+
+#endif
@@ -0,0 +1,183 @@
+#include "assembler.h"
+#include "lexer.h"
+#include "textbuffer.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::textbuffer_literals;
+using ::testing::ElementsAre;
+
+static auto assemble(const Charbuffer &text)
+    -> std::optional<std::vector<std::uint32_t>> {
+  auto lexer = parser::Lexer{text};
+  auto assembler = Assembler{lexer};
+  if (!assembler.assemble()) {
+    return std::nullopt;
+  }
+  return assembler.code();
+}
+
+static auto assemble_one(const Charbuffer &text) -> std::uint32_t {
+  const auto code = assemble(text);
+  if (!code || code->size() != 1) {
+    ADD_FAILURE() << "expected a single instruction word";
+    return 0;
+  }
+  return code->front();
+}
+
+TEST(AssemblerTest, EncodesDataProcessing) {
+  EXPECT_EQ(assemble_one("add r0, r1, #1"_tb), 0xE2810001u);
+  EXPECT_EQ(assemble_one("mov r0, #0xFF00"_tb), 0xE3A00CFFu);
+  EXPECT_EQ(assemble_one("sub r2, r3, r4, lsl #2"_tb), 0xE0432104u);
+  EXPECT_EQ(assemble_one("orrs r0, r1, r2, ror r3"_tb), 0xE1910372u);
+  EXPECT_EQ(assemble_one("cmp r0, #1"_tb), 0xE3500001u);
+  EXPECT_EQ(assemble_one("lsr r0, r1, #32"_tb), 0xE1A00021u);
+  EXPECT_EQ(assemble_one("rrx r0, r1"_tb), 0xE1A00061u);
+  EXPECT_EQ(assemble_one("moveq r0, r1"_tb), 0x01A00001u);
+  EXPECT_EQ(assemble_one("nop"_tb), 0xE1A00000u);
+}
+
+TEST(AssemblerTest, EncodesMultiplyAndDivide) {
+  EXPECT_EQ(assemble_one("mul r0, r1, r2"_tb), 0xE0000291u);
+  EXPECT_EQ(assemble_one("mla r0, r1, r2, r3"_tb), 0xE0203291u);
+  EXPECT_EQ(assemble_one("mls r0, r1, r2, r3"_tb), 0xE0603291u);
+  EXPECT_EQ(assemble_one("umull r0, r1, r2, r3"_tb), 0xE0810392u);
+  EXPECT_EQ(assemble_one("sdiv r0, r1, r2"_tb), 0xE710F211u);
+  EXPECT_EQ(assemble_one("udiv r0, r1, r2"_tb), 0xE730F211u);
+}
+
+TEST(AssemblerTest, EncodesMovesBitfieldsAndReverses) {
+  EXPECT_EQ(assemble_one("movw r0, #0x1234"_tb), 0xE3010234u);
+  EXPECT_EQ(assemble_one("movt r0, #0x1234"_tb), 0xE3410234u);
+  EXPECT_EQ(assemble_one("ubfx r0, r1, #4, #8"_tb), 0xE7E70251u);
+  EXPECT_EQ(assemble_one("bfc r0, #4, #8"_tb), 0xE7CB021Fu);
+  EXPECT_EQ(assemble_one("rev r0, r1"_tb), 0xE6BF0F31u);
+  EXPECT_EQ(assemble_one("rbit r0, r1"_tb), 0xE6FF0F31u);
+}
+
+TEST(AssemblerTest, EncodesMemoryAccesses) {
+  EXPECT_EQ(assemble_one("ldr r0, [r1, #4]"_tb), 0xE5910004u);
+  EXPECT_EQ(assemble_one("ldr r0, [r1, #-4]"_tb), 0xE5110004u);
+  EXPECT_EQ(assemble_one("str r0, [r1], #4"_tb), 0xE4810004u);
+  EXPECT_EQ(assemble_one("ldrb r0, [r1, r2, lsl #2]!"_tb), 0xE7F10102u);
+  EXPECT_EQ(assemble_one("ldr r0, [r1]"_tb), 0xE5910000u);
+  EXPECT_EQ(assemble_one("ldrh r0, [r1, #2]"_tb), 0xE1D100B2u);
+  EXPECT_EQ(assemble_one("ldrsb r0, [r1, r2]"_tb), 0xE19100D2u);
+  EXPECT_EQ(assemble_one("push {r4, lr}"_tb), 0xE92D4010u);
+  EXPECT_EQ(assemble_one("pop {r4-r6, pc}"_tb), 0xE8BD8070u);
+  EXPECT_EQ(assemble_one("ldmib r0!, {r1, r2}"_tb), 0xE9B00006u);
+  EXPECT_EQ(assemble_one("bx lr"_tb), 0xE12FFF1Eu);
+  EXPECT_EQ(assemble_one("svc #0x123456"_tb), 0xEF123456u);
+}
+
+TEST(AssemblerTest, ResolvesBackwardReferences) {
+  EXPECT_THAT(*assemble("loop: b loop"_tb), ElementsAre(0xEAFFFFFEu));
+  EXPECT_THAT(*assemble("start:\nnop\nadr r0, start"_tb),
+              ElementsAre(0xE1A00000u, 0xE24F000Cu));
+}
+
+TEST(AssemblerTest, ResolvesForwardReferences) {
+  const auto code = assemble(R"(
+    b end
+    bleq end
+    ldr r0, end
+    nop
+end:
+    bx lr
+)"_tb);
+  ASSERT_TRUE(code.has_value());
+  EXPECT_THAT(*code, ElementsAre(0xEA000002u, 0x0B000001u, 0xE59F0000u,
+                                 0xE1A00000u, 0xE12FFF1Eu));
+}
+
+TEST(AssemblerTest, PlacesLiteralsInPool) {
+  const auto code = assemble(R"(
+    ldr r0, =0x12345678
+    ldr r1, =0x12345678
+    ldr r2, =0xFF
+)"_tb);
+  ASSERT_TRUE(code.has_value());
+  EXPECT_THAT(*code, ElementsAre(0xE59F0004u, 0xE59F1000u, 0xE3A020FFu,
+                                 0x12345678u));
+}
+
+TEST(AssemblerTest, RejectsCompareAndBranch) {
+  EXPECT_FALSE(assemble("cbz r1, end\nend:"_tb).has_value());
+  EXPECT_FALSE(assemble("cbnz r1, end\nend:"_tb).has_value());
+}
+
+TEST(AssemblerTest, LegalizesImmediates) {
+  EXPECT_THAT(*assemble("mov r0, #0x12345678"_tb),
+              ElementsAre(0xE3050678u, 0xE3410234u));
+  EXPECT_THAT(*assemble("add r0, r1, #-1"_tb), ElementsAre(0xE2410001u));
+}
+
+static auto nops(std::size_t count) -> std::string {
+  auto text = std::string{};
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    text += "nop\n";
+  }
+  return text;
+}
+
+TEST(AssemblerTest, RelaxesFarReferences) {
+  const auto text = "ldr r0, far\nadr r1, far\n" + nops(1100) + "far: nop\n";
+  const auto code = assemble(Charbuffer{std::string_view{text}});
+  ASSERT_TRUE(code.has_value());
+  ASSERT_EQ(code->size(), 1105u);
+  EXPECT_THAT(std::vector<std::uint32_t>(code->begin(), code->begin() + 4),
+              ElementsAre(0xE28F0A01u, 0xE5900138u, 0xE28F1E13u, 0xE2811A01u));
+}
+
+TEST(AssemblerTest, RelaxesFarLiterals) {
+  const auto text = "ldr r0, =0x12345678\n" + nops(1100);
+  auto buffer = Charbuffer{std::string_view{text}};
+  auto lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+  EXPECT_EQ(assembler.literal_pool_offset(), 4408u);
+  EXPECT_THAT(std::vector<std::uint32_t>(assembler.code().begin(),
+                                         assembler.code().begin() + 2),
+              ElementsAre(0xE28F0A01u, 0xE5900130u));
+  EXPECT_EQ(assembler.code().back(), 0x12345678u);
+}
+
+TEST(AssemblerTest, ReportsReferencesRelaxedOutOfRange) {
+  // ldr pc reaches target until the ldr r0 behind it grows by a word
+  const auto text = "ldr pc, target\nldr r0, far\n" + nops(1023) +
+                    "target: nop\n" + nops(1100) + "far: nop\n";
+  ::testing::internal::CaptureStdout();
+  EXPECT_FALSE(assemble(Charbuffer{std::string_view{text}}).has_value());
+  EXPECT_EQ(::testing::internal::GetCapturedStdout(),
+            "line 1: label 'target' is out of range after relaxation\n");
+}
+
+TEST(AssemblerTest, KeepsUnresolvedFixups) {
+  const auto text = "bl external\nb external"_tb;
+  auto lexer = parser::Lexer{text};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+  const auto unresolved = assembler.unresolved_fixups();
+  ASSERT_EQ(unresolved.size(), 2u);
+  EXPECT_EQ(unresolved[0].offset, 4u);
+  EXPECT_EQ(unresolved[1].offset, 0u);
+  EXPECT_EQ(unresolved[0].kind, assembler::FixupKind::Branch);
+}
+
+TEST(AssemblerTest, ReportsErrors) {
+  EXPECT_FALSE(assemble("label:\nlabel:"_tb).has_value());
+  EXPECT_FALSE(assemble("add r0, r1"_tb).has_value());
+  EXPECT_FALSE(assemble("@"_tb).has_value());
+  EXPECT_FALSE(assemble("tst r0, #0x10001"_tb).has_value());
+  // splitting would write pc twice
+  EXPECT_FALSE(assemble("add pc, r0, #0x10100"_tb).has_value());
+  // and movw with movt would
+  EXPECT_FALSE(assemble("mov pc, #0x12345"_tb).has_value());
+  EXPECT_FALSE(assemble("svc #0x1000000"_tb).has_value());
+}
@@ -0,0 +1,122 @@
+#include "assembler.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "lexer.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+
+static auto assemble_one(std::string_view text) -> std::uint32_t {
+  auto buffer = Charbuffer{text};
+  auto lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{lexer};
+  if (!assembler.assemble() || assembler.code().size() != 1) {
+    ADD_FAILURE() << "cannot assemble '" << text << "'";
+    return 0;
+  }
+  return assembler.code().front();
+}
+
+TEST(DecoderTest, RoundTripsThroughInstructions) {
+  constexpr std::string_view sources[] = {
+      "add r0, r1, #1",         "adds r2, r3, r4, lsl #3",
+      "sub r0, r1, r2, asr r3", "rsbne r0, r1, #0",
+      "ands r0, r1, #0xFF00",   "eor r0, r0, r1, ror #8",
+      "rrx r0, r1",    "bic r0, r1, #3",
+      "mov r0, #0xFF000000",    "mvns r0, r1",
+      "lsr r0, r1, #32",        "asr r0, r1, r2",
+      "movw r0, #0x1234",       "movt r0, #0xABCD",
+      "cmp r0, #1",             "cmn r0, r1",
+      "tst r0, #0x80000000",    "teq r0, r1, lsl r2",
+      "mul r0, r1, r2",         "mlas r0, r1, r2, r3",
+      "mls r0, r1, r2, r3",     "umull r0, r1, r2, r3",
+      "smlal r0, r1, r2, r3",   "sdiv r0, r1, r2",
+      "udiv r0, r1, r2",        "bfc r0, #4, #8",
+      "bfi r0, r1, #4, #8",     "sbfx r0, r1, #4, #8",
+      "ubfx r0, r1, #0, #32",   "rev r0, r1",
+      "rev16 r0, r1",           "revsh r0, r1",
+      "rbit r0, r1",            "bx lr",
+      "ldr r0, [r1, #4]",       "ldr r0, [r1, #-4]",
+      "str r0, [r1], #4",       "ldrb r0, [r1, r2, lsl #2]!",
+      "strb r0, [r1, -r2]",     "ldr r0, [r1]",
+      "ldrh r0, [r1, #2]",      "strh r0, [r1, #-2]!",
+      "ldrsb r0, [r1, r2]",     "ldrsh r0, [r1], #6",
+      "push {r4, lr}",          "pop {r4-r6, pc}",
+      "ldmib r0!, {r1, r2}",    "stmda r0, {r1, r2}",
+      "ldr r0, [pc, #-8]",      "svc #0x123456",
+      "svcvc #1"};
+
+  auto labels = LabelTable{};
+  for (const auto source : sources) {
+    const auto word = assemble_one(source);
+    const auto decoded = decode(word);
+    ASSERT_TRUE(decoded.valid()) << source;
+    const auto instr = to_instruction(decoded, 0, labels);
+    ASSERT_NE(instr, nullptr) << source;
+    EXPECT_EQ(assembler::encode(*instr), word) << source;
+  }
+}
+
+TEST(DecoderTest, DecodesFields) {
+  const auto add = decode(0x12810C01u); // addne r0, r1, #0x100
+  EXPECT_EQ(add.operation, Instruction::Add);
+  EXPECT_EQ(add.condition, Condition::NE);
+  EXPECT_EQ(add.operand, DecodedInstruction::Immediate);
+  EXPECT_EQ(add.rd, 0u);
+  EXPECT_EQ(add.rn, 1u);
+  EXPECT_EQ(add.imm, 0x100u);
+  EXPECT_EQ(add.shift_amount, 24u);
+
+  const auto lsr = decode(0xE1B00021u); // lsrs r0, r1, #32
+  EXPECT_EQ(lsr.operation, Instruction::Mov);
+  EXPECT_TRUE(lsr.updatesflags());
+  EXPECT_EQ(lsr.shift, Instruction::Lsr);
+  EXPECT_EQ(lsr.shift_amount, 32u);
+
+  const auto pop = decode(0xE8BD8010u); // pop {r4, pc}
+  EXPECT_EQ(pop.operation, Instruction::Ldmia);
+  EXPECT_EQ(pop.rn, 13u);
+  EXPECT_EQ(pop.imm, 0x8010u);
+  EXPECT_NE(pop.flags & DecodedInstruction::Writeback, 0);
+
+  const auto post = decode(0xE4910004u); // ldr r0, [r1], #4
+  EXPECT_EQ(post.flags & DecodedInstruction::PreIndex, 0);
+  EXPECT_NE(post.flags & DecodedInstruction::Writeback, 0);
+
+  const auto svc = decode(0x1F000005u); // svcne #5
+  EXPECT_EQ(svc.operation, Instruction::Svc);
+  EXPECT_EQ(svc.condition, Condition::NE);
+  EXPECT_EQ(svc.imm, 5u);
+}
+
+TEST(DecoderTest, DecodesBranchesToLabels) {
+  const auto back = decode(0xEAFFFFFEu); // b .
+  EXPECT_EQ(back.operation, Instruction::B);
+  EXPECT_EQ(static_cast<std::int32_t>(back.imm), -8);
+
+  auto labels = LabelTable{};
+  const auto call = to_instruction(decode(0xEB000002u), 0x100, labels);
+  const auto branch = cast<BranchInstruction>(call.get());
+  ASSERT_NE(branch, nullptr);
+  EXPECT_EQ(branch->operation(), Instruction::Bl);
+  EXPECT_EQ(branch->label()->name(), "L00000110");
+  EXPECT_EQ(labels.label_at(0x110), branch->label());
+}
+
+TEST(DecoderTest, RejectsUnsupportedWords) {
+  EXPECT_FALSE(decode(0xF57FF01Fu).valid()); // clrex
+  EXPECT_FALSE(decode(0xEE000000u).valid()); // cdp p0, #0, c0, c0, c0
+  EXPECT_FALSE(decode(0xE10F0000u).valid()); // mrs r0, apsr
+  EXPECT_FALSE(decode(0xE1C000D0u).valid()); // ldrd r0, r1, [r0]
+  EXPECT_FALSE(decode(0xE8900000u).valid()); // ldm r0, {}
+  EXPECT_FALSE(decode(0xE7C00210u).valid()); // bfi with msb < lsb
+  // sbfx and ubfx past bit 31
+  EXPECT_FALSE(decode(0xE7A10FDBu).valid());
+  EXPECT_FALSE(decode(0xE7E10FDBu).valid());
+  EXPECT_TRUE(decode(0xE7A00FDBu).valid()); // sbfx r0, r11, #31, #1
+}
@@ -0,0 +1,143 @@
+#include "elfwriter.h"
+#include "lexer.h"
+#include "textbuffer.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using namespace aavm::textbuffer_literals;
+
+template <typename T>
+static auto read_at(const std::vector<char> &file, std::size_t offset) -> T {
+  auto value = T{};
+  std::memcpy(&value, file.data() + offset, sizeof(T));
+  return value;
+}
+
+static auto read_file(const std::string &path) -> std::vector<char> {
+  auto stream = std::ifstream{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{stream},
+          std::istreambuf_iterator<char>{}};
+}
+
+class ElfWriterTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    ASSERT_TRUE(assembler_.assemble());
+    const auto path = ::testing::TempDir() + "testelfwriter.o";
+    ASSERT_TRUE(ElfWriter{assembler_}.write(path.c_str()));
+    file_ = read_file(path);
+    ASSERT_GE(file_.size(), sizeof(elf::FileHeader));
+    header_ = read_at<elf::FileHeader>(file_, 0);
+  }
+
+  auto section(std::size_t index) const {
+    return read_at<elf::SectionHeader>(
+        file_, header_.section_header_offset +
+                   index * sizeof(elf::SectionHeader));
+  }
+
+  auto string_at(std::size_t section_index, std::uint32_t offset) const {
+    return std::string_view{file_.data() + section(section_index).offset +
+                            offset};
+  }
+
+  Charbuffer text_{R"(
+_start:
+start:
+    bl external
+    ldr r0, =0x12345678
+    beq external
+    b start
+)"_tb};
+  parser::Lexer lexer_{text_};
+  Assembler assembler_{lexer_};
+  std::vector<char> file_{};
+  elf::FileHeader header_{};
+};
+
+TEST_F(ElfWriterTest, WritesHeader) {
+  EXPECT_EQ(std::string_view(file_.data(), 4), "\x7F"
+                                               "ELF");
+  EXPECT_EQ(header_.type, 1u);
+  EXPECT_EQ(header_.machine, 40u);
+  EXPECT_EQ(header_.flags, 0x05000000u);
+  EXPECT_EQ(header_.section_header_count, elf::SectionCount);
+  EXPECT_EQ(header_.section_header_offset % 4, 0u);
+  EXPECT_EQ(file_.size(), header_.section_header_offset +
+                              elf::SectionCount * sizeof(elf::SectionHeader));
+  EXPECT_EQ(string_at(elf::Shstrtab, section(elf::Text).name), ".text");
+  EXPECT_EQ(string_at(elf::Shstrtab, section(elf::RelText).name),
+            ".rel.text");
+}
+
+TEST_F(ElfWriterTest, WritesCode) {
+  const auto text = section(elf::Text);
+  ASSERT_EQ(text.size, assembler_.code().size() * sizeof(std::uint32_t));
+  EXPECT_EQ(std::memcmp(file_.data() + text.offset, assembler_.code().data(),
+                        text.size),
+            0);
+  // unresolved branches hold the addend -8
+  EXPECT_EQ(read_at<std::uint32_t>(file_, text.offset), 0xEBFFFFFEu);
+}
+
+TEST_F(ElfWriterTest, WritesSymbols) {
+  const auto symtab = section(elf::Symtab);
+  const auto count = symtab.size / sizeof(elf::Symbol);
+  auto names = std::vector<std::string_view>{};
+  for (auto i = std::size_t{0}; i < count; ++i) {
+    const auto symbol =
+        read_at<elf::Symbol>(file_, symtab.offset + i * sizeof(elf::Symbol));
+    names.push_back(string_at(elf::Strtab, symbol.name));
+  }
+  EXPECT_THAT(names, ::testing::ElementsAre("", "", "$a", "$d", "start",
+                                            "_start", "external"));
+  EXPECT_EQ(symtab.info, 5u);
+
+  const auto external = read_at<elf::Symbol>(
+      file_, symtab.offset + 6 * sizeof(elf::Symbol));
+  EXPECT_EQ(external.section, 0u);
+  EXPECT_EQ(external.info, 0x10u);
+}
+
+TEST_F(ElfWriterTest, KeepsDefinedLabelsLocal) {
+  const auto symtab = section(elf::Symtab);
+  const auto binding = [&](std::size_t index) {
+    return read_at<elf::Symbol>(file_,
+                                symtab.offset + index * sizeof(elf::Symbol))
+               .info >>
+           4;
+  };
+  // start is local, _start exported and external undefined
+  EXPECT_EQ(binding(4), 0u);
+  EXPECT_EQ(binding(5), 1u);
+  EXPECT_EQ(binding(6), 1u);
+  for (auto i = std::size_t{0}; i < symtab.info; ++i) {
+    EXPECT_EQ(binding(i), 0u);
+  }
+  EXPECT_EQ(read_at<elf::Symbol>(file_, symtab.offset + 5 * sizeof(elf::Symbol))
+                .section,
+            elf::Text);
+}
+
+TEST_F(ElfWriterTest, WritesRelocations) {
+  const auto rel = section(elf::RelText);
+  EXPECT_EQ(rel.link, elf::Symtab);
+  EXPECT_EQ(rel.info, elf::Text);
+  ASSERT_EQ(rel.size, 2 * sizeof(elf::Relocation));
+  const auto call = read_at<elf::Relocation>(file_, rel.offset);
+  const auto jump =
+      read_at<elf::Relocation>(file_, rel.offset + sizeof(elf::Relocation));
+  EXPECT_EQ(call.offset, 0u);
+  EXPECT_EQ(call.info, 6u << 8 | elf::R_ARM_CALL);
+  EXPECT_EQ(jump.offset, 8u);
+  EXPECT_EQ(jump.info, 6u << 8 | elf::R_ARM_JUMP24);
+}
@@ -0,0 +1,117 @@
+#include "farm.h"
+#include "machinetest.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class FarmTest : public ::testing::Test {
+protected:
+  // sums 1 to r0 into r0, and counts its runs at 0x18000 into r3
+  void SetUp() override {
+    static constexpr auto program = "push {r4, lr}\n"
+                                    "mov r4, r0\n"
+                                    "mov r0, #0\n"
+                                    "loop: add r0, r0, r4\n"
+                                    "subs r4, r4, #1\n"
+                                    "bne loop\n"
+                                    "ldr r1, =0x18000\n"
+                                    "ldr r3, [r1]\n"
+                                    "add r3, r3, #1\n"
+                                    "str r3, [r1]\n"
+                                    "pop {r4, pc}\n";
+    ASSERT_TRUE(assemble(program, code_));
+  }
+
+  Farm farm(unsigned workers, std::uint64_t budget = 0) {
+    auto options = FarmOptions{};
+    options.memory_base = memory_base;
+    options.workers = workers;
+    options.budget = budget;
+    return Farm{code_.data(), static_cast<std::uint32_t>(code_.size() * 4),
+                options};
+  }
+
+  std::vector<std::uint32_t> code_{};
+};
+
+TEST_F(FarmTest, RunsEveryJobFromTheImage) {
+  static constexpr auto jobs = 1000u;
+  auto farm = this->farm(4);
+  ASSERT_EQ(farm.workers(), 4u);
+  auto sums = std::vector<std::uint32_t>(jobs);
+  auto runs = std::vector<std::uint32_t>(jobs);
+  auto statuses = std::vector<Status>(jobs);
+  farm.run(
+      jobs, memory_base,
+      [](Machine &machine, std::uint64_t job) {
+        machine.cpu().reg(Register::R0) = static_cast<std::uint32_t>(job + 1);
+      },
+      [&](const Machine &machine, std::uint64_t job, Status status) {
+        sums[job] = machine.cpu().reg(Register::R0);
+        runs[job] = machine.cpu().reg(Register::R3);
+        statuses[job] = status;
+      });
+
+  auto total = std::uint64_t{};
+  for (auto job = 0u; job < jobs; ++job) {
+    EXPECT_EQ(statuses[job], Status::Halted);
+    EXPECT_EQ(sums[job], (job + 1) * (job + 2) / 2);
+    // every job starts from memory as the image left it
+    EXPECT_EQ(runs[job], 1u);
+  }
+  for (auto worker = std::size_t{0}; worker < farm.workers(); ++worker) {
+    total += farm.jobs_run(worker);
+  }
+  EXPECT_EQ(total, jobs);
+}
+
+TEST_F(FarmTest, BalancesUnevenJobs) {
+  // the first half of the jobs is slow, the second quick
+  static constexpr auto jobs = 64u;
+  auto farm = this->farm(2);
+  auto sums = std::vector<std::uint32_t>(jobs);
+  const auto count = [](std::uint64_t job) {
+    return job < jobs / 2 ? std::uint32_t{50000} : std::uint32_t{1};
+  };
+  farm.run(
+      jobs, memory_base,
+      [&](Machine &machine, std::uint64_t job) {
+        machine.cpu().reg(Register::R0) = count(job);
+      },
+      [&](const Machine &machine, std::uint64_t job, Status) {
+        sums[job] = machine.cpu().reg(Register::R0);
+      });
+
+  for (auto job = 0u; job < jobs; ++job) {
+    const auto n = count(job);
+    EXPECT_EQ(sums[job], n * (n + 1) / 2);
+  }
+  EXPECT_EQ(farm.jobs_run(0) + farm.jobs_run(1), jobs);
+  // whichever worker is free takes the next job, so both of them take some
+  // of the slow ones rather than one worker running them all
+  EXPECT_GT(farm.jobs_run(0), 0u);
+  EXPECT_GT(farm.jobs_run(1), 0u);
+}
+
+TEST_F(FarmTest, GivesUpOnRunawayJobs) {
+  // counting down from 0 takes 2^32 iterations
+  auto farm = this->farm(2, 100000);
+  auto statuses = std::vector<Status>(8);
+  farm.run(
+      statuses.size(), memory_base,
+      [](Machine &machine, std::uint64_t job) {
+        machine.cpu().reg(Register::R0) = job % 4 == 0 ? 0u : 10u;
+      },
+      [&](const Machine &, std::uint64_t job, Status status) {
+        statuses[job] = status;
+      });
+  for (auto job = 0u; job < statuses.size(); ++job) {
+    EXPECT_EQ(statuses[job],
+              job % 4 == 0 ? Status::Preempted : Status::Halted);
+  }
+}
@@ -0,0 +1,206 @@
+#include "fileio.h"
+#include "hostcalls.h"
+#include "machinetest.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class HostCallsTest : public ::testing::Test {
+protected:
+  // where the tests put the data the programs work on
+  static constexpr auto data_address = memory_base + 0x2000;
+
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "testhostcalls.out";
+  }
+
+  // assembles source to the bottom of memory and points pc at it
+  void load(std::string_view source) {
+    ASSERT_TRUE(assemble_into(machine_, source));
+  }
+
+  static std::string contents(const std::string &path) {
+    auto *const file = std::fopen(path.c_str(), "rb");
+    EXPECT_NE(file, nullptr);
+    if (file == nullptr) {
+      return {};
+    }
+    auto text = std::string(1 << 20, '\0');
+    text.resize(std::fread(text.data(), 1, text.size(), file));
+    std::fclose(file);
+    return text;
+  }
+
+  Memory memory_{memory_base, memory_size};
+  Machine machine_{memory_};
+  std::string path_{};
+};
+
+TEST_F(HostCallsTest, GathersSmallWrites) {
+  static constexpr auto message = std::string_view{"hello, world\n"};
+  ASSERT_TRUE(machine_.write(data_address, message.data(),
+                             static_cast<std::uint32_t>(message.size())));
+  // prints the message 10000 times, a character at a time
+  load("ldr r4, =0x12000\n"
+       "ldr r6, =10000\n"
+       "line: mov r5, #0\n"
+       "char: mov r0, #1\n"
+       "add r1, r4, r5\n"
+       "mov r2, #1\n"
+       "svc #1\n"
+       "add r5, r5, #1\n"
+       "cmp r5, #13\n"
+       "bne char\n"
+       "subs r6, r6, #1\n"
+       "bne line\n"
+       "mov r0, #7\n"
+       "svc #0\n");
+  auto tiering = Tiering{};
+  tiering.jit_threshold = 2;
+  tiering.background = false;
+  machine_.set_tiering(tiering);
+  machine_.set_jit(true);
+
+  const auto output = fileio::open_for_writing(path_.c_str());
+  ASSERT_GE(output, 0);
+  {
+    auto host = HostCalls{0, output, 2};
+    machine_.set_host_calls(&host);
+    EXPECT_EQ(machine_.host_calls(), &host);
+    ASSERT_EQ(machine_.run(), Status::Exited);
+    EXPECT_TRUE(host.exited());
+    EXPECT_EQ(host.exit_code(), 7u);
+    // every write returned its size
+    EXPECT_EQ(machine_.cpu().reg(Register::R0), 7u);
+    // 130000 bytes in two writes rather than one per character
+    EXPECT_EQ(host.host_writes(), 2u);
+  }
+  fileio::close_file(output);
+
+  auto expected = std::string{};
+  for (auto i = 0; i < 10000; ++i) {
+    expected += message;
+  }
+  EXPECT_EQ(contents(path_), expected);
+}
+
+TEST_F(HostCallsTest, WritesLargeBuffersStraightThrough) {
+  const auto output = fileio::open_for_writing(path_.c_str());
+  ASSERT_GE(output, 0);
+  auto data = std::string(HostCalls::buffer_size * 2, 'x');
+  {
+    auto host = HostCalls{0, output, 2};
+    const auto *bytes = reinterpret_cast<const std::uint8_t *>(data.data());
+    EXPECT_EQ(host.write(1, bytes, 3), 3);
+    EXPECT_EQ(host.host_writes(), 0u);
+    // goes out along with what was gathered
+    EXPECT_EQ(host.write(1, bytes, static_cast<std::uint32_t>(data.size())),
+              static_cast<std::int32_t>(data.size()));
+    EXPECT_EQ(host.host_writes(), 1u);
+    EXPECT_EQ(host.write(1, bytes, 5), 5);
+    EXPECT_EQ(host.write(4, bytes, 5), -1);
+  }
+  fileio::close_file(output);
+  EXPECT_EQ(contents(path_).size(), data.size() + 8);
+}
+
+TEST_F(HostCallsTest, ReadsFilesIntoMemory) {
+  static constexpr auto text = std::string_view{"abcdefgh"};
+  auto *const file = std::fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(text.data(), 1, text.size(), file);
+  std::fclose(file);
+  ASSERT_TRUE(machine_.write(data_address, path_.c_str(),
+                             static_cast<std::uint32_t>(path_.size() + 1)));
+
+  load("ldr r0, =0x12000\n"
+       "mov r1, #0\n"
+       "svc #3\n"
+       "mov r4, r0\n"
+       "ldr r1, =0x13000\n"
+       "mov r2, #16\n"
+       "svc #2\n"
+       "mov r5, r0\n"
+       "mov r0, r4\n"
+       "ldr r1, =0x13100\n"
+       "mov r2, #16\n"
+       "svc #2\n"
+       "mov r6, r0\n"
+       "mov r0, r4\n"
+       "svc #4\n"
+       "mov r7, r0\n"
+       "mov r0, r4\n"
+       "svc #4\n"
+       "mov r8, r0\n"
+       "svc #5\n"
+       "bx lr\n");
+  auto host = HostCalls{};
+  machine_.set_host_calls(&host);
+  ASSERT_EQ(machine_.run(), Status::Halted);
+  EXPECT_EQ(machine_.cpu().reg(Register::R4), 3u);
+  EXPECT_EQ(machine_.cpu().reg(Register::R5), text.size());
+  // then the end of the file
+  EXPECT_EQ(machine_.cpu().reg(Register::R6), 0u);
+  EXPECT_EQ(machine_.cpu().reg(Register::R7), 0u);
+  // closed already
+  EXPECT_EQ(machine_.cpu().reg(Register::R8), ~0u);
+  EXPECT_LT(machine_.cpu().reg(Register::R0), 60000u);
+  EXPECT_EQ(std::memcmp(memory_.data() + 0x3000, text.data(), text.size()),
+            0);
+}
+
+TEST_F(HostCallsTest, ReadsOverCode) {
+  // mov r0, #42
+  static constexpr auto word = std::uint32_t{0xE3A0002A};
+  auto *const file = std::fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(&word, sizeof(word), 1, file);
+  std::fclose(file);
+  ASSERT_TRUE(machine_.write(data_address, path_.c_str(),
+                             static_cast<std::uint32_t>(path_.size() + 1)));
+
+  load("ldr r0, =0x12000\n"
+       "mov r1, #0\n"
+       "svc #3\n"
+       "adr r1, patched\n"
+       "mov r2, #4\n"
+       "svc #2\n"
+       "patched: mov r0, #1\n"
+       "bx lr\n");
+  auto host = HostCalls{};
+  machine_.set_host_calls(&host);
+  ASSERT_EQ(machine_.run(), Status::Halted);
+  EXPECT_EQ(machine_.cpu().reg(Register::R0), 42u);
+}
+
+TEST_F(HostCallsTest, FailsBadCalls) {
+  load("ldr r1, =0x20000\n"
+       "mov r0, #1\n"
+       "mov r2, #4\n"
+       "svc #1\n"
+       "mov r4, r0\n"
+       "mov r0, #9\n"
+       "ldr r1, =0x12000\n"
+       "svc #1\n"
+       "mov r5, r0\n"
+       "svc #99\n");
+  ASSERT_EQ(machine_.run(), Status::Unsupported);
+  EXPECT_EQ(machine_.cpu().reg(Register::PC), memory_base + 12);
+
+  machine_.reset(memory_base);
+  auto host = HostCalls{};
+  machine_.set_host_calls(&host);
+  ASSERT_EQ(machine_.run(), Status::Unsupported);
+  // outside memory, then a file that is not open
+  EXPECT_EQ(machine_.cpu().reg(Register::R4), ~0u);
+  EXPECT_EQ(machine_.cpu().reg(Register::R5), ~0u);
+  EXPECT_EQ(machine_.cpu().reg(Register::PC), memory_base + 36);
+}
@@ -0,0 +1,151 @@
+#include "image.h"
+#include "imagewriter.h"
+#include "lexer.h"
+#include "machine.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::image;
+using namespace aavm::textbuffer_literals;
+
+static auto temp_path(const char *name) {
+  return ::testing::TempDir() + name;
+}
+
+TEST(ImageTest, WritesAndMapsSegments) {
+  auto text = R"(
+    nop
+_start:
+    mov r0, #1
+    bx lr
+)"_tb;
+  auto lexer = parser::Lexer{text};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+
+  const auto data = std::uint32_t{0xCAFEF00D};
+  auto writer = ImageWriter{assembler};
+  writer.add_segment(0x20000, &data, sizeof(data), 0x1000, Read | Write);
+  writer.add_segment(0x30000, nullptr, 0, 0x2000, Read | Write);
+  const auto path = temp_path("testimage.img");
+  ASSERT_TRUE(writer.write(path.c_str()));
+
+  const auto image = Image::open(path.c_str());
+  ASSERT_TRUE(image.has_value());
+  EXPECT_EQ(image->header().entry, ImageWriter::default_base + 4);
+  ASSERT_EQ(image->segment_count(), 3u);
+
+  const auto &code = image->segments()[0];
+  EXPECT_EQ(code.address, ImageWriter::default_base);
+  EXPECT_EQ(code.flags, Read | Execute);
+  EXPECT_EQ(code.file_offset % alignment, 0u);
+  ASSERT_EQ(code.file_size, assembler.code().size() * sizeof(std::uint32_t));
+  EXPECT_EQ(std::memcmp(image->contents(code), assembler.code().data(),
+                        code.file_size),
+            0);
+
+  const auto &initialized = image->segments()[1];
+  EXPECT_EQ(initialized.memory_size, 0x1000u);
+  EXPECT_EQ(initialized.file_offset % alignment, 0u);
+  EXPECT_EQ(std::memcmp(image->contents(initialized), &data, sizeof(data)), 0);
+
+  const auto &zeroed = image->segments()[2];
+  EXPECT_EQ(zeroed.file_size, 0u);
+  EXPECT_EQ(zeroed.memory_size, 0x2000u);
+
+  // the hash covers the contents without reading them as the image opens
+  auto hash = fnv1a(image->segments(), 3 * sizeof(Segment));
+  for (auto i = std::size_t{0}; i < 3; ++i) {
+    const auto &segment = image->segments()[i];
+    hash = fnv1a(image->contents(segment), segment.file_size, hash);
+  }
+  EXPECT_EQ(image->hash(), hash);
+}
+
+TEST(ImageTest, LoadsIntoMemory) {
+  auto text = R"(
+_start:
+    ldr r1, =0x20000
+    ldr r0, [r1]
+    ldr r2, [r1, #0x800]
+    ldr r2, [r1, r2]
+    bx lr
+)"_tb;
+  auto lexer = parser::Lexer{text};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+  // two pages of data, then zeros
+  auto data = std::vector<std::uint32_t>(0x800, 0xCAFEF00D);
+  data[0x200] = 0x2000;
+  auto writer = ImageWriter{assembler};
+  writer.add_segment(0x20000, data.data(),
+                     static_cast<std::uint32_t>(data.size() * 4), 0x3000,
+                     Read | Write);
+  const auto path = temp_path("testimage-load.img");
+  ASSERT_TRUE(writer.write(path.c_str()));
+  const auto image = Image::open(path.c_str());
+  ASSERT_TRUE(image.has_value());
+
+  for (const auto layout : {vm::Memory::Buffer, vm::Memory::Reserved}) {
+    auto memory = vm::Memory{0x10000, 0x20000, layout};
+    // left over from an earlier program, past the contents of the segment
+    memory.store<std::uint32_t>(0x22000, 7);
+    auto machine = vm::Machine{memory};
+    ASSERT_TRUE(machine.load(*image));
+    EXPECT_EQ(machine.cpu().reg(ir::Register::PC), image->header().entry);
+    ASSERT_EQ(machine.run(), vm::Status::Halted);
+    EXPECT_EQ(machine.cpu().reg(ir::Register::R0), data[0]);
+    EXPECT_EQ(machine.cpu().reg(ir::Register::R2), 0u);
+  }
+
+#if AAVM_LINUX
+  // reserved memory maps the data from the image instead of copying it
+  auto memory = vm::Memory{0x10000, 0x20000, vm::Memory::Reserved};
+  auto machine = vm::Machine{memory};
+  ASSERT_TRUE(machine.load(*image));
+  auto stream = std::ifstream{"/proc/self/maps"};
+  const auto maps = std::string{std::istreambuf_iterator<char>{stream},
+                                std::istreambuf_iterator<char>{}};
+  auto mapped = std::size_t{0};
+  for (auto at = maps.find(path); at != std::string::npos;
+       at = maps.find(path, at + 1)) {
+    ++mapped;
+  }
+  // Image::open() maps the whole file once, the data segment is the other
+  EXPECT_GE(mapped, 2u);
+#endif
+
+  auto small = vm::Memory{0x10000, 0x1000};
+  auto machine_too_small = vm::Machine{small};
+  EXPECT_FALSE(machine_too_small.load(*image));
+}
+
+TEST(ImageTest, RejectsUnresolvedReferences) {
+  auto text = "b external"_tb;
+  auto lexer = parser::Lexer{text};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+  const auto path = temp_path("testimage-unresolved.img");
+  EXPECT_FALSE(ImageWriter{assembler}.write(path.c_str()));
+}
+
+TEST(ImageTest, RejectsInvalidImages) {
+  const auto path = temp_path("testimage-invalid.img");
+  {
+    auto stream = std::ofstream{path, std::ios::binary};
+    const auto header = Header{magic, version, 1, 0, alignment, 0};
+    const auto segment = Segment{0x10000, 0x10, alignment, 0x10, Read};
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char *>(&segment), sizeof(segment));
+  }
+  // the segment lies past the end of the file
+  EXPECT_FALSE(Image::open(path.c_str()).has_value());
+  EXPECT_FALSE(Image::open(temp_path("testimage-missing.img").c_str()));
+}
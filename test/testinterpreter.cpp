@@ -0,0 +1,379 @@
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+
+class InterpreterTest : public ::testing::Test {
+protected:
+  static constexpr auto memory_base = std::uint32_t{0x100000};
+
+  Status run(std::string_view source, bool threaded = false) {
+    buffer_ = std::make_unique<Charbuffer>(source);
+    lexer_ = std::make_unique<parser::Lexer>(*buffer_);
+    parser_ = std::make_unique<Parser>(*lexer_);
+    module_ = parser_->parse_module();
+    if (!module_) {
+      ADD_FAILURE() << "cannot parse '" << source << "'";
+      return Status::Unsupported;
+    }
+    interpreter_ = std::make_unique<Interpreter>(*module_, memory_);
+    return threaded ? interpreter_->run_threaded() : interpreter_->run();
+  }
+
+  auto reg(Register::Kind reg) const { return interpreter_->cpu().reg(reg); }
+  auto apsr() const { return interpreter_->cpu().apsr; }
+
+  Memory memory_{memory_base, 0x1000};
+  std::unique_ptr<Charbuffer> buffer_{};
+  std::unique_ptr<parser::Lexer> lexer_{};
+  std::unique_ptr<Parser> parser_{};
+  std::optional<Module> module_{};
+  std::unique_ptr<Interpreter> interpreter_{};
+};
+
+TEST_F(InterpreterTest, ExecutesArithmetic) {
+  ASSERT_EQ(run("mov r0, #5\n"
+                "add r1, r0, #3\n"
+                "sub r2, r1, r0, lsl #1\n"
+                "rsb r3, r0, #0\n"
+                "eor r4, r0, #0xFF\n"
+                "bic r5, r4, #0xF0\n"
+                "mvn r6, #0\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 8u);
+  EXPECT_EQ(reg(Register::R2), ~std::uint32_t{1});
+  EXPECT_EQ(reg(Register::R3), ~std::uint32_t{4});
+  EXPECT_EQ(reg(Register::R4), 0xFAu);
+  EXPECT_EQ(reg(Register::R5), 0x0Au);
+  EXPECT_EQ(reg(Register::R6), 0xFFFFFFFFu);
+  EXPECT_EQ(interpreter_->retired(), 7u);
+  // nothing set the flags
+  EXPECT_EQ(apsr(), 0u);
+}
+
+TEST_F(InterpreterTest, SetsFlags) {
+  ASSERT_EQ(run("mvn r0, #0x80000000\n"
+                "adds r1, r0, #1\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 0x80000000u);
+  EXPECT_EQ(apsr(), FlagN | FlagV);
+
+  ASSERT_EQ(run("mov r0, #1\n"
+                "subs r1, r0, #1\n"),
+            Status::Halted);
+  EXPECT_EQ(apsr(), FlagZ | FlagC);
+
+  // a borrow clears the carry, which sbc then subtracts
+  ASSERT_EQ(run("mov r0, #0\n"
+                "subs r1, r0, #1\n"
+                "sbc r2, r0, #0\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 0xFFFFFFFFu);
+  EXPECT_EQ(reg(Register::R2), 0xFFFFFFFFu);
+  EXPECT_EQ(apsr(), std::uint32_t{FlagN});
+
+  // logical operations take the carry from the shifter and keep V
+  ASSERT_EQ(run("mvn r0, #0x80000000\n"
+                "adds r0, r0, #1\n"
+                "mov r1, #3\n"
+                "lsrs r2, r1, #1\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R2), 1u);
+  EXPECT_EQ(apsr(), FlagC | FlagV);
+
+  ASSERT_EQ(run("mov r0, #1\n"
+                "cmp r0, #2\n"
+                "tst r0, #0x80000000\n"),
+            Status::Halted);
+  EXPECT_EQ(apsr(), FlagZ | FlagC);
+}
+
+TEST_F(InterpreterTest, ShiftsThroughCarry) {
+  ASSERT_EQ(run("mov r0, #1\n"
+                "cmp r0, #0\n"
+                "rrx r1, r0\n"
+                "lsr r2, r0, #32\n"
+                "mov r3, #33\n"
+                "lsl r4, r0, r3\n"
+                "mov r5, #0x80000000\n"
+                "asr r6, r5, #31\n"
+                "ror r7, r0, #1\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 0x80000000u);
+  EXPECT_EQ(reg(Register::R2), 0u);
+  EXPECT_EQ(reg(Register::R4), 0u);
+  EXPECT_EQ(reg(Register::R6), 0xFFFFFFFFu);
+  EXPECT_EQ(reg(Register::R7), 0x80000000u);
+}
+
+TEST_F(InterpreterTest, HonoursConditions) {
+  ASSERT_EQ(run("mov r0, #0\n"
+                "mov r1, #10\n"
+                "loop:\n"
+                "add r0, r0, r1\n"
+                "subs r1, r1, #1\n"
+                "bne loop\n"
+                "cmp r0, #55\n"
+                "moveq r2, #1\n"
+                "movne r2, #2\n"
+                "movgt r3, #1\n"
+                "movle r3, #2\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 55u);
+  EXPECT_EQ(reg(Register::R2), 1u);
+  EXPECT_EQ(reg(Register::R3), 2u);
+  // instructions whose condition fails still retire
+  EXPECT_EQ(interpreter_->retired(), 2u + 10u * 3u + 5u);
+}
+
+TEST(ConditionTest, MatchesTheFlags) {
+  for (auto nzcv = 0u; nzcv < 16; ++nzcv) {
+    const auto apsr = std::uint32_t{nzcv << 28};
+    const auto n = (apsr & FlagN) != 0;
+    const auto z = (apsr & FlagZ) != 0;
+    const auto c = (apsr & FlagC) != 0;
+    const auto v = (apsr & FlagV) != 0;
+    // in the order of Condition::Kind, after the placeholder at 0
+    const bool expected[] = {true,    z,           !z,         c,
+                             !c,      n,           !n,         v,
+                             !v,      c && !z,     !c || z,    n == v,
+                             n != v,  !z && n == v, z || n != v, true};
+    for (auto cond = 0u; cond < 16; ++cond) {
+      EXPECT_EQ(condition_passed(cond, apsr), expected[cond])
+          << "condition " << cond << " flags " << nzcv;
+    }
+    // the unconditional space decodes past AL
+    EXPECT_TRUE(condition_passed(Condition::AL + 1, apsr));
+  }
+}
+
+TEST_F(InterpreterTest, MultipliesAndDivides) {
+  ASSERT_EQ(run("mvn r0, #0\n"
+                "mov r1, #2\n"
+                "umull r2, r3, r0, r1\n"
+                "smull r4, r5, r0, r1\n"
+                "mov r6, #7\n"
+                "mla r7, r6, r1, r1\n"
+                "mls r8, r6, r1, r6\n"
+                "rsb r9, r6, #0\n"
+                "sdiv r10, r9, r1\n"
+                "mov r11, #0\n"
+                "udiv r12, r6, r11\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R2), 0xFFFFFFFEu);
+  EXPECT_EQ(reg(Register::R3), 1u);
+  EXPECT_EQ(reg(Register::R4), 0xFFFFFFFEu);
+  EXPECT_EQ(reg(Register::R5), 0xFFFFFFFFu);
+  EXPECT_EQ(reg(Register::R7), 16u);
+  EXPECT_EQ(reg(Register::R8), ~std::uint32_t{6});
+  EXPECT_EQ(reg(Register::R10), ~std::uint32_t{2});
+  EXPECT_EQ(reg(Register::R12), 0u);
+}
+
+TEST_F(InterpreterTest, ManipulatesBits) {
+  ASSERT_EQ(run("ldr r0, =0x12345678\n"
+                "ubfx r1, r0, #4, #8\n"
+                "sbfx r2, r0, #28, #4\n"
+                "mov r3, #0\n"
+                "bfi r3, r0, #8, #8\n"
+                "mvn r4, #0\n"
+                "bfc r4, #0, #16\n"
+                "rev r5, r0\n"
+                "rev16 r6, r0\n"
+                "revsh r7, r0\n"
+                "rbit r8, r0\n"
+                "movw r9, #0xBEEF\n"
+                "movt r9, #0xDEAD\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 0x67u);
+  EXPECT_EQ(reg(Register::R2), 1u);
+  EXPECT_EQ(reg(Register::R3), 0x7800u);
+  EXPECT_EQ(reg(Register::R4), 0xFFFF0000u);
+  EXPECT_EQ(reg(Register::R5), 0x78563412u);
+  EXPECT_EQ(reg(Register::R6), 0x34127856u);
+  EXPECT_EQ(reg(Register::R7), 0x7856u);
+  EXPECT_EQ(reg(Register::R8), 0x1E6A2C48u);
+  EXPECT_EQ(reg(Register::R9), 0xDEADBEEFu);
+}
+
+TEST_F(InterpreterTest, LoadsAndStores) {
+  ASSERT_EQ(run("movw r1, #0\n"
+                "movt r1, #0x10\n"
+                "ldr r0, =0x8765FEDC\n"
+                "str r0, [r1, #4]\n"
+                "ldrb r2, [r1, #4]\n"
+                "ldrsh r3, [r1, #6]\n"
+                "ldrsb r4, [r1, #5]\n"
+                "add r5, r1, #8\n"
+                "strh r0, [r5], #2\n"
+                "mov r6, #1\n"
+                "ldr r7, [r1, r6, lsl #2]!\n"
+                "ldrh r8, [r5, #-2]\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R2), 0xDCu);
+  EXPECT_EQ(reg(Register::R3), 0xFFFF8765u);
+  EXPECT_EQ(reg(Register::R4), 0xFFFFFFFEu);
+  EXPECT_EQ(reg(Register::R5), memory_base + 10);
+  EXPECT_EQ(reg(Register::R7), 0x8765FEDCu);
+  EXPECT_EQ(reg(Register::R1), memory_base + 4);
+  EXPECT_EQ(reg(Register::R8), 0xFEDCu);
+  EXPECT_EQ(memory_.load<std::uint16_t>(memory_base + 8), 0xFEDCu);
+}
+
+TEST_F(InterpreterTest, TransfersBlocks) {
+  ASSERT_EQ(run("mov r0, #1\n"
+                "mov r1, #2\n"
+                "mov r2, #3\n"
+                "push {r0-r2}\n"
+                "ldmia sp, {r3, r4}\n"
+                "mov r5, sp\n"
+                "stmib r5!, {r0, r1}\n"
+                "pop {r6-r8}\n"
+                "stmdb sp, {r0, pc}\n"
+                "ldr r9, [sp, #-4]\n"),
+            Status::Halted);
+  const auto top = memory_base + 0x1000;
+  // pc is stored 8 bytes on
+  EXPECT_EQ(reg(Register::R9), Interpreter::default_code_base + 40);
+  EXPECT_EQ(reg(Register::R3), 1u);
+  EXPECT_EQ(reg(Register::R4), 2u);
+  EXPECT_EQ(reg(Register::R5), top - 4);
+  EXPECT_EQ(reg(Register::R6), 1u);
+  EXPECT_EQ(reg(Register::R7), 1u);
+  EXPECT_EQ(reg(Register::R8), 2u);
+  EXPECT_EQ(reg(Register::SP), top);
+}
+
+TEST_F(InterpreterTest, CallsAndReturns) {
+  ASSERT_EQ(run("mov r0, #6\n"
+                "bl factorial\n"
+                "b end\n"
+                "factorial:\n"
+                "push {r4, lr}\n"
+                "mov r4, r0\n"
+                "mov r0, #1\n"
+                "again: mul r0, r0, r4\n"
+                "subs r4, r4, #1\n"
+                "bne again\n"
+                "pop {r4, pc}\n"
+                "end:\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 720u);
+  EXPECT_EQ(reg(Register::R4), 0u);
+  EXPECT_EQ(reg(Register::SP), memory_base + 0x1000);
+  EXPECT_EQ(reg(Register::PC), interpreter_->end_address());
+}
+
+TEST_F(InterpreterTest, ReadsPcAhead) {
+  ASSERT_EQ(run("mov r0, pc\n"
+                "adr r1, here\n"
+                "here: bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), Interpreter::default_code_base + 8);
+  EXPECT_EQ(reg(Register::R1), Interpreter::default_code_base + 8);
+}
+
+TEST_F(InterpreterTest, StopsOnFaults) {
+  EXPECT_EQ(run("mov r1, #0\n"
+                "ldr r0, [r1, #4]\n"),
+            Status::MemoryFault);
+  EXPECT_EQ(interpreter_->fault_address(), 4u);
+  EXPECT_EQ(interpreter_->retired(), 1u);
+
+  // the base is only written back once the access is done, with either
+  // dispatch
+  for (const auto threaded : {false, true}) {
+    EXPECT_EQ(run("ldr r0, =0x20000\n"
+                  "ldr r1, [r0], #16\n",
+                  threaded),
+              Status::MemoryFault);
+    EXPECT_EQ(reg(Register::R0), 0x20000u);
+    EXPECT_EQ(run("ldr r0, =0x20000\n"
+                  "str r1, [r0, #16]!\n",
+                  threaded),
+              Status::MemoryFault);
+    EXPECT_EQ(reg(Register::R0), 0x20000u);
+  }
+
+  EXPECT_EQ(run("b nowhere\n"), Status::UndefinedLabel);
+  EXPECT_EQ(run("mov r0, #2\n"
+                "bx r0\n"),
+            Status::BadBranch);
+  EXPECT_EQ(run("ubfx r0, r1, #16, #20\n"), Status::Unsupported);
+}
+
+TEST_F(InterpreterTest, ThreadedDispatchMatchesSwitch) {
+  static constexpr std::string_view programs[] = {
+      // flags, conditions and a loop
+      "mov r0, #0\n"
+      "mov r1, #10\n"
+      "loop: adds r0, r0, r1, lsl #28\n"
+      "adc r2, r2, #1\n"
+      "subs r1, r1, #1\n"
+      "bne loop\n"
+      "cmp r0, #55\n"
+      "rsbhi r3, r0, #0\n"
+      "mvnls r4, r0, ror #4\n"
+      "teq r0, r2, asr r1\n"
+      "cmn r0, #1\n"
+      "bicmi r5, r0, #0xF0\n",
+      // calls through push and pop, which have no handler of their own
+      "mov r0, #6\n"
+      "bl factorial\n"
+      "b end\n"
+      "factorial: push {r4, lr}\n"
+      "mov r4, r0\n"
+      "mov r0, #1\n"
+      "again: mul r0, r0, r4\n"
+      "subs r4, r4, #1\n"
+      "bne again\n"
+      "pop {r4, pc}\n"
+      "end:\n",
+      // memory with every index mode
+      "movw r1, #0\n"
+      "movt r1, #0x10\n"
+      "ldr r0, =0x8765FEDC\n"
+      "str r0, [r1, #4]!\n"
+      "strb r0, [r1], #1\n"
+      "strh r0, [r1, #-1]\n"
+      "ldrsb r2, [r1, #-1]\n"
+      "ldrsh r3, [r1, #3]\n"
+      "mov r6, #1\n"
+      "ldr r7, [r1, -r6]\n"
+      "ldrh r8, [r1, r6, lsl #1]\n"
+      "cbz r8, skip\n"
+      "ldrb r9, [r1]\n"
+      "skip: cbnz r9, done\n"
+      "mov r10, pc\n"
+      "done: bx lr\n",
+      // faults stop on the faulting instruction
+      "mov r0, #1\n"
+      "ldr r0, [r0]\n",
+      "mov r0, #2\n"
+      "bx r0\n",
+      "cmp r0, r0\n"
+      "bne nowhere\n"
+      "b nowhere\n"};
+
+  for (const auto program : programs) {
+    const auto status = run(program);
+    const auto cpu = interpreter_->cpu();
+    const auto retired = interpreter_->retired();
+    const auto fault_address = interpreter_->fault_address();
+    memory_ = Memory{memory_base, 0x1000};
+    EXPECT_EQ(run(program, true), status) << program;
+    EXPECT_EQ(interpreter_->cpu().registers, cpu.registers) << program;
+    EXPECT_EQ(apsr(), cpu.apsr) << program;
+    EXPECT_EQ(interpreter_->retired(), retired) << program;
+    EXPECT_EQ(interpreter_->fault_address(), fault_address) << program;
+  }
+}
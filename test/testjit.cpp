@@ -0,0 +1,226 @@
+#include "machinetest.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+// Runs each program with the jit off and on, and expects the same results.
+// The compiled runs use memory of each layout.
+class JitTest : public ::testing::TestWithParam<Memory::Layout> {
+protected:
+
+  void SetUp() override {
+    if (!Jit::available) {
+      GTEST_SKIP() << "no jit on this host";
+    }
+    // compile as soon as blocks get hot, so every run compiles the same
+    auto tiering = Tiering{};
+    tiering.background = false;
+    compiled_.set_tiering(tiering);
+    ASSERT_EQ(compiled_memory_.layout(), GetParam());
+  }
+
+  static Status run(Machine &machine, std::string_view source) {
+    if (!assemble_into(machine, source)) {
+      return Status::Unsupported;
+    }
+    return machine.run();
+  }
+
+  // runs source on both machines, returns the status of the compiled run
+  Status compare(std::string_view source) {
+    const auto expected = run(interpreted_, source);
+    EXPECT_TRUE(compiled_.set_jit(true));
+    const auto status = run(compiled_, source);
+    EXPECT_EQ(status, expected);
+    EXPECT_EQ(compiled_.cpu().registers, interpreted_.cpu().registers);
+    EXPECT_EQ(compiled_.cpu().apsr, interpreted_.cpu().apsr);
+    EXPECT_EQ(compiled_.retired(), interpreted_.retired());
+    EXPECT_EQ(compiled_.fault_address(), interpreted_.fault_address());
+    EXPECT_EQ(std::memcmp(compiled_memory_.data(), interpreted_memory_.data(),
+                          memory_size),
+              0);
+    EXPECT_GT(compiled_.jit().compiled_blocks(), 0u);
+    return status;
+  }
+
+  auto reg(Register::Kind reg) const { return compiled_.cpu().reg(reg); }
+
+  Memory interpreted_memory_{memory_base, memory_size};
+  Memory compiled_memory_{memory_base, memory_size, GetParam()};
+  Machine interpreted_{interpreted_memory_};
+  Machine compiled_{compiled_memory_};
+};
+
+TEST_P(JitTest, ComputesLikeTheInterpreter) {
+  ASSERT_EQ(compare("push {r4-r11, lr}\n"
+                    "ldr r0, =0x89ABCDEF\n"
+                    "mov r1, #0\n"
+                    "mov r2, #0\n"
+                    "mov r12, #100\n"
+                    "loop: adds r1, r1, r0\n"
+                    "adc r2, r2, r1, lsr #3\n"
+                    "subs r3, r2, r1, asr #5\n"
+                    "sbc r4, r3, r0, ror #7\n"
+                    "rsbs r5, r4, #0xFF000000\n"
+                    "rsc r6, r5, r1\n"
+                    "ands r7, r6, #0x80000001\n"
+                    "orr r8, r7, r2, lsl #4\n"
+                    "eor r9, r8, r0, lsr #32\n"
+                    "bic r10, r9, #0xF0\n"
+                    "mvn r11, r10, asr #32\n"
+                    "teq r11, r1\n"
+                    "movwmi r3, #0x1234\n"
+                    "movtpl r3, #0x5678\n"
+                    "mla r4, r3, r12, r4\n"
+                    "mls r5, r4, r4, r5\n"
+                    "mul r6, r5, r3\n"
+                    "cmn r1, r0\n"
+                    "addhi r0, r0, #1\n"
+                    "subls r0, r0, #3\n"
+                    "cmp r2, r1\n"
+                    "movge r7, #1\n"
+                    "movlt r7, #2\n"
+                    "mvngt r8, r7\n"
+                    "addsle r9, r9, r0\n"
+                    "orrvs r10, r10, #1\n"
+                    "eorvc r10, r10, #2\n"
+                    "addcs r11, r11, #3\n"
+                    "subcc r11, r11, #4\n"
+                    "tst r0, #1\n"
+                    "addeq r0, r0, r1\n"
+                    "addne r0, r0, r2\n"
+                    "subs r12, r12, #1\n"
+                    "bne loop\n"
+                    "pop {r4-r11, pc}\n"),
+            Status::Halted);
+}
+
+TEST_P(JitTest, LoadsAndStores) {
+  ASSERT_EQ(compare("push {r4, lr}\n"
+                    "ldr r0, =0x12000\n"
+                    "mov r1, #0\n"
+                    "mov r4, #200\n"
+                    "loop: and r2, r4, #31\n"
+                    "ldr r3, [r0, r2, lsl #2]\n"
+                    "add r3, r3, r4\n"
+                    "str r3, [r0, r2, lsl #2]\n"
+                    "strb r4, [r0, #-1]!\n"
+                    "ldrb r3, [r0], #1\n"
+                    "add r1, r1, r3\n"
+                    "ldr r3, [pc, #-12]\n"
+                    "str r1, [r0, #128]!\n"
+                    "sub r0, r0, #128\n"
+                    "ldr r3, [r0, -r2]\n"
+                    "subs r4, r4, #1\n"
+                    "strne r3, [r0, #256]\n"
+                    "bne loop\n"
+                    "pop {r4, pc}\n"),
+            Status::Halted);
+}
+
+TEST_P(JitTest, CallsAndReturns) {
+  ASSERT_EQ(compare("push {r4, lr}\n"
+                    "mov r0, #0\n"
+                    "mov r4, #100\n"
+                    "loop: tst r4, #1\n"
+                    "bleq even\n"
+                    "blne odd\n"
+                    "subs r4, r4, #1\n"
+                    "bgt loop\n"
+                    "pop {r4, pc}\n"
+                    "even: add r0, r0, #2\n"
+                    "bx lr\n"
+                    "odd: push {lr}\n"
+                    "sub r0, r0, #1\n"
+                    "pop {pc}\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 50u);
+}
+
+TEST_P(JitTest, LeavesCodeWritesToTheInterpreter) {
+  // the loop patches its first instruction once it has been compiled
+  ASSERT_EQ(compare("mov r3, #0\n"
+                    "ldr r1, =0xE2833002\n"
+                    "adr r2, loop\n"
+                    "mov r4, #40\n"
+                    "loop: add r3, r3, #1\n"
+                    "cmp r4, #10\n"
+                    "streq r1, [r2]\n"
+                    "subs r4, r4, #1\n"
+                    "bne loop\n"
+                    "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R3), 31u + 2u * 9u);
+}
+
+TEST_P(JitTest, StopsOnFaults) {
+  ASSERT_EQ(compare("ldr r0, =0x13E00\n"
+                    "loop: ldr r1, [r0], #16\n"
+                    "add r2, r2, r1\n"
+                    "b loop\n"),
+            Status::MemoryFault);
+  EXPECT_EQ(compiled_.fault_address(), memory_base + memory_size);
+}
+
+TEST_P(JitTest, LeavesWatchedAccessesToTheInterpreter) {
+  for (auto *const machine : {&interpreted_, &compiled_}) {
+    ASSERT_TRUE(machine->add_watchpoint({0x13000, 4, Watchpoint::Stores}));
+    ASSERT_TRUE(machine->add_watchpoint({0x12800, 4, Watchpoint::Loads}));
+  }
+  // stopped before the store, from the loop compiled well before it
+  ASSERT_EQ(compare("ldr r0, =0x12E00\n"
+                    "loop: str r0, [r0], #4\n"
+                    "b loop\n"),
+            Status::Watchpoint);
+  EXPECT_EQ(compiled_.fault_address(), 0x13000u);
+  ASSERT_EQ(compare("ldr r0, =0x12400\n"
+                    "loop: ldr r1, [r0], #4\n"
+                    "add r2, r2, r1\n"
+                    "b loop\n"),
+            Status::Watchpoint);
+  EXPECT_EQ(compiled_.fault_address(), 0x12800u);
+  EXPECT_EQ(reg(Register::R0), 0x12800u);
+}
+
+TEST_P(JitTest, CanBeTurnedOff) {
+  EXPECT_TRUE(compiled_.set_jit(true));
+  EXPECT_FALSE(compiled_.set_jit(false));
+  EXPECT_FALSE(compiled_.jit_enabled());
+  ASSERT_EQ(run(compiled_, "mov r0, #100\n"
+                           "loop: subs r0, r0, #1\n"
+                           "bne loop\n"
+                           "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(compiled_.jit().compiled_blocks(), 0u);
+}
+
+TEST_P(JitTest, CompilesInTheBackground) {
+  static constexpr auto program = "mov r0, #0\n"
+                                  "ldr r1, =1000\n"
+                                  "loop: add r0, r0, r1\n"
+                                  "subs r1, r1, #1\n"
+                                  "bne loop\n"
+                                  "bx lr\n";
+  compiled_.set_tiering(Tiering{});
+  ASSERT_TRUE(compiled_.set_jit(true));
+  ASSERT_EQ(run(compiled_, program), Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 500500u);
+  compiled_.wait_for_jit();
+  EXPECT_EQ(compiled_.jit().compiled_blocks(), 1u);
+
+  // the second run starts with the code compiled in the first
+  compiled_.reset(memory_base);
+  ASSERT_EQ(compiled_.run(), Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 500500u);
+  EXPECT_EQ(compiled_.jit().compiled_blocks(), 1u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, JitTest,
+                         ::testing::Values(Memory::Buffer, Memory::Reserved));
@@ -0,0 +1,170 @@
+#include "instruction.h"
+#include "instructions.h"
+#include "legalizer.h"
+#include "operand2.h"
+#include "parser.h"
+#include "register.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::textbuffer_literals;
+
+static auto brute_force_encode(std::uint32_t value)
+    -> std::optional<std::uint32_t> {
+  for (auto rotation = 0u; rotation < 16; ++rotation) {
+    const auto imm8 = stl::rotl(value, static_cast<int>(rotation * 2));
+    if (imm8 <= 0xFFu) {
+      return rotation << 8 | imm8;
+    }
+  }
+  return std::nullopt;
+}
+
+static auto legalize(const Charbuffer &text, bool has_movw_movt = true) {
+  auto lexer = parser::Lexer{text};
+  const auto parsed = Parser{lexer}.parse_instruction();
+  const auto legalizer = assembler::Legalizer{has_movw_movt};
+  auto out = std::vector<std::unique_ptr<ir::Instruction>>{};
+  if (parsed && legalizer.needs_legalization(*parsed)) {
+    EXPECT_TRUE(legalizer.legalize(*parsed, out));
+  }
+  return out;
+}
+
+TEST(LegalizerTest, EncodesEveryModifiedImmediate) {
+  for (auto imm12 = 0u; imm12 < 0x1000u; ++imm12) {
+    const auto value = ir::decode_modified_immediate(imm12);
+    const auto encoded = ir::encode_modified_immediate(value);
+    ASSERT_TRUE(encoded.has_value());
+    EXPECT_EQ(ir::decode_modified_immediate(*encoded), value);
+    EXPECT_EQ(encoded, brute_force_encode(value));
+  }
+}
+
+TEST(LegalizerTest, RejectsUnencodableImmediates) {
+  auto value = std::uint32_t{0x12345678u};
+  for (auto i = 0; i < 100000; ++i) {
+    value = value * 1664525u + 1013904223u;
+    const auto sample = value >> (i % 32);
+    EXPECT_EQ(ir::encode_modified_immediate(sample).has_value(),
+              brute_force_encode(sample).has_value());
+  }
+  EXPECT_FALSE(ir::is_modified_immediate(0x101u));
+  EXPECT_FALSE(ir::is_modified_immediate(0xFF1u));
+  EXPECT_TRUE(ir::is_modified_immediate(0xF000000Fu));
+  EXPECT_TRUE(ir::is_modified_immediate(0xC000003Fu));
+  EXPECT_TRUE(ir::is_modified_immediate(0xFF000000u));
+}
+
+TEST(LegalizerTest, LeavesEncodableImmediatesAlone) {
+  EXPECT_TRUE(legalize("mov r0, #0xFF00"_tb).empty());
+  EXPECT_TRUE(legalize("add r0, r1, #4"_tb).empty());
+}
+
+TEST(LegalizerTest, RewritesMoveAsMvn) {
+  const auto out = legalize("mov r0, #-2"_tb);
+  ASSERT_EQ(out.size(), 1u);
+  const auto &instr = *ir::cast<ir::MoveInstruction>(out[0].get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Mvn);
+  EXPECT_EQ(instr.src2().imm12(), 1u);
+}
+
+TEST(LegalizerTest, RewritesMoveAsMovwMovt) {
+  const auto out = legalize("mov r0, #0x12345678"_tb);
+  ASSERT_EQ(out.size(), 2u);
+  const auto &low = *ir::cast<ir::MoveInstruction>(out[0].get());
+  const auto &high = *ir::cast<ir::MoveInstruction>(out[1].get());
+  EXPECT_EQ(low.operation(), ir::Instruction::Movw);
+  EXPECT_EQ(low.imm16(), 0x5678u);
+  EXPECT_EQ(high.operation(), ir::Instruction::Movt);
+  EXPECT_EQ(high.imm16(), 0x1234u);
+}
+
+TEST(LegalizerTest, RewritesMoveAsLiteralLoad) {
+  const auto out = legalize("mov r0, #0x12345678"_tb, false);
+  ASSERT_EQ(out.size(), 1u);
+  const auto &instr = *ir::cast<ir::SingleMemoryInstruction>(out[0].get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Ldr);
+  EXPECT_EQ(std::get<unsigned>(instr.source()), 0x12345678u);
+}
+
+TEST(LegalizerTest, RewritesLiteralLoadAsMove) {
+  const auto out = legalize("ldr r0, =0x1234"_tb);
+  ASSERT_EQ(out.size(), 1u);
+  const auto &instr = *ir::cast<ir::MoveInstruction>(out[0].get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Movw);
+  EXPECT_EQ(instr.imm16(), 0x1234u);
+}
+
+TEST(LegalizerTest, KeepsLiteralLoadsIntoPc) {
+  const auto text = "ldr pc, =0x1234"_tb;
+  auto lexer = parser::Lexer{text};
+  const auto parsed = Parser{lexer}.parse_instruction();
+  ASSERT_NE(parsed.get(), nullptr);
+  EXPECT_FALSE(assembler::Legalizer{}.needs_legalization(*parsed));
+  // a single mov is still fine
+  const auto out = legalize("ldr pc, =0x1000"_tb);
+  ASSERT_EQ(out.size(), 1u);
+  EXPECT_EQ(out[0]->operation(), ir::Instruction::Mov);
+}
+
+TEST(LegalizerTest, RewritesArithmeticWithComplement) {
+  const auto out = legalize("adds r0, r1, #-8"_tb);
+  ASSERT_EQ(out.size(), 1u);
+  const auto &instr = *ir::cast<ir::ArithmeticInstruction>(out[0].get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Sub);
+  EXPECT_TRUE(instr.updatesflags());
+  EXPECT_EQ(instr.src2().imm12(), 8u);
+
+  const auto masked = legalize("and r0, r1, #0xFFFFFF00"_tb);
+  ASSERT_EQ(masked.size(), 1u);
+  EXPECT_EQ(masked[0]->operation(), ir::Instruction::Bic);
+}
+
+TEST(LegalizerTest, SplitsArithmeticInPlace) {
+  const auto out = legalize("add r0, r0, #0x10001"_tb);
+  ASSERT_EQ(out.size(), 2u);
+  const auto &first = *ir::cast<ir::ArithmeticInstruction>(out[0].get());
+  const auto &second = *ir::cast<ir::ArithmeticInstruction>(out[1].get());
+  EXPECT_EQ(first.src2().imm12() + second.src2().imm12(), 0x10001u);
+  EXPECT_EQ(second.rn(), ir::Register::R0);
+}
+
+TEST(LegalizerTest, MaterializesIntoDestination) {
+  const auto out = legalize("adds r0, r1, #0x10001"_tb);
+  ASSERT_EQ(out.size(), 3u);
+  EXPECT_EQ(out[0]->operation(), ir::Instruction::Movw);
+  EXPECT_EQ(out[1]->operation(), ir::Instruction::Movt);
+  const auto &instr = *ir::cast<ir::ArithmeticInstruction>(out[2].get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Add);
+  EXPECT_TRUE(instr.updatesflags());
+  EXPECT_FALSE(instr.src2().immediate());
+  EXPECT_EQ(instr.src2().rm().rm(), ir::Register::R0);
+}
+
+TEST(LegalizerTest, RewritesComparisonWithNegation) {
+  const auto out = legalize("cmp r0, #-1"_tb);
+  ASSERT_EQ(out.size(), 1u);
+  EXPECT_EQ(out[0]->operation(), ir::Instruction::Cmn);
+}
+
+TEST(LegalizerTest, CannotLegalizeWithoutScratchRegister) {
+  // a result in pc can be neither split nor built up in place, nor moved
+  // in with movw and movt
+  for (const auto &text : {"tst r0, #0x10001"_tb, "add pc, r0, #0x10100"_tb,
+                           "add pc, pc, #0x10001"_tb, "mov pc, #0x12345"_tb,
+                           "mvn pc, #0x1234"_tb}) {
+    auto lexer = parser::Lexer{text};
+    const auto parsed = Parser{lexer}.parse_instruction();
+    ASSERT_NE(parsed.get(), nullptr);
+    const auto legalizer = assembler::Legalizer{};
+    auto out = std::vector<std::unique_ptr<ir::Instruction>>{};
+    EXPECT_TRUE(legalizer.needs_legalization(*parsed));
+    EXPECT_FALSE(legalizer.legalize(*parsed, out));
+  }
+}
@@ -0,0 +1,599 @@
+#include "machinetest.h"
+#include "gtest/gtest.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class MachineTest : public ::testing::Test {
+protected:
+
+  // assembles source to the bottom of memory for a new machine with
+  // tiering_ and points pc at it, returns false if it does not assemble
+  bool load(std::string_view source) {
+    if (!assemble(source, code_)) {
+      return false;
+    }
+    machine_ = std::make_unique<Machine>(memory_);
+    machine_->set_tiering(tiering_);
+    load(*machine_);
+    return true;
+  }
+
+  // writes the code load() assembled to machine and points pc at it
+  void load(Machine &machine) const { load_code(machine, code_); }
+
+  // loads source and runs it from the bottom of memory
+  Status run(std::string_view source, bool step = false) {
+    if (!load(source)) {
+      return Status::Unsupported;
+    }
+    if (!step) {
+      return machine_->run();
+    }
+    auto status = Status::Running;
+    while (status == Status::Running) {
+      status = machine_->step();
+    }
+    return status;
+  }
+
+  auto reg(Register::Kind reg) const { return machine_->cpu().reg(reg); }
+
+  Memory memory_{memory_base, memory_size};
+  Tiering tiering_{};
+  std::vector<std::uint32_t> code_{};
+  std::unique_ptr<Machine> machine_{};
+};
+
+TEST_F(MachineTest, RunsAssembledCode) {
+  ASSERT_EQ(run("push {r4, lr}\n"
+                "mov r0, #6\n"
+                "bl factorial\n"
+                "ldr r1, =0x12345678\n"
+                "ror r1, r1, #8\n"
+                "cmp r0, #720\n"
+                "moveq r2, #1\n"
+                "movne r2, #2\n"
+                "pop {r4, pc}\n"
+                "factorial: mov r4, r0\n"
+                "mov r0, #1\n"
+                "again: mul r0, r0, r4\n"
+                "subs r4, r4, #1\n"
+                "bne again\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 720u);
+  EXPECT_EQ(reg(Register::R1), 0x78123456u);
+  EXPECT_EQ(reg(Register::R2), 1u);
+  EXPECT_EQ(reg(Register::SP), memory_base + memory_size);
+  EXPECT_EQ(reg(Register::PC), Machine::exit_address);
+  EXPECT_EQ(machine_->retired(), 9u + 2u + 6u * 3u + 1u);
+}
+
+TEST_F(MachineTest, ReadsPcAhead) {
+  ASSERT_EQ(run("mov r0, pc\n"
+                "adr r1, here\n"
+                "here: ldr r2, [pc, #-8]\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), memory_base + 8);
+  EXPECT_EQ(reg(Register::R1), memory_base + 8);
+  // the word of the ldr itself
+  EXPECT_EQ(reg(Register::R2), memory_.load<std::uint32_t>(memory_base + 8));
+}
+
+TEST_F(MachineTest, PredecodesEachPageOnce) {
+  ASSERT_EQ(run("push {lr}\n"
+                "mov r0, #0\n"
+                "ldr r1, =1000\n"
+                "loop: add r0, r0, r1\n"
+                "subs r1, r1, #1\n"
+                "bne loop\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 500500u);
+  EXPECT_EQ(machine_->code_cache().decoded_pages(), 1u);
+}
+
+TEST_F(MachineTest, InvalidatesWrittenCode) {
+  // overwrites the mov r0, #1 at patch with mov r0, #2 before running it
+  ASSERT_EQ(run("ldr r1, =0xE3A00002\n"
+                "adr r2, patch\n"
+                "str r1, [r2]\n"
+                "patch: mov r0, #1\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 2u);
+  EXPECT_EQ(machine_->code_cache().decoded_pages(), 2u);
+
+  // data stores leave the page alone
+  ASSERT_EQ(run("mov r0, #0x11000\n"
+                "str r0, [r0]\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(machine_->code_cache().decoded_pages(), 1u);
+}
+
+TEST_F(MachineTest, ChainsBlocks) {
+  tiering_.block_threshold = 1;
+  ASSERT_EQ(run("push {lr}\n"
+                "mov r0, #0\n"
+                "ldr r1, =1000\n"
+                "loop: tst r1, #1\n"
+                "bleq even\n"
+                "subs r1, r1, #1\n"
+                "bne loop\n"
+                "pop {pc}\n"
+                "even: add r0, r0, #1\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 500u);
+  // the entry, the loop head, the call, the loop tail and the return, each
+  // looked up once per link that leads to it
+  EXPECT_EQ(machine_->block_cache().size(), 5u);
+  EXPECT_EQ(machine_->block_cache().lookups(), 7u);
+}
+
+TEST_F(MachineTest, InterpretsColdCode) {
+  static constexpr auto program = "mov r0, #0\n"
+                                  "mov r1, #10\n"
+                                  "loop: add r0, r0, r1\n"
+                                  "subs r1, r1, #1\n"
+                                  "bne loop\n"
+                                  "bx lr\n";
+  // only the loop is branched to twice
+  ASSERT_EQ(run(program), Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 55u);
+  EXPECT_EQ(machine_->block_cache().size(), 1u);
+  const auto retired = machine_->retired();
+
+  tiering_.block_threshold = ~std::uint32_t{};
+  ASSERT_EQ(run(program), Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 55u);
+  EXPECT_EQ(machine_->block_cache().size(), 0u);
+  EXPECT_EQ(machine_->retired(), retired);
+}
+
+TEST_F(MachineTest, StepsLikeItRuns) {
+  static constexpr auto program = "push {r4, lr}\n"
+                                  "mov r4, #10\n"
+                                  "loop: adds r0, r0, r4, lsl #28\n"
+                                  "adc r1, r1, #1\n"
+                                  "str r0, [sp, #-4]!\n"
+                                  "ldr r2, [sp], #4\n"
+                                  "subs r4, r4, #1\n"
+                                  "bne loop\n"
+                                  "pop {r4, pc}\n";
+  ASSERT_EQ(run(program), Status::Halted);
+  const auto cpu = machine_->cpu();
+  const auto retired = machine_->retired();
+  ASSERT_EQ(run(program, true), Status::Halted);
+  EXPECT_EQ(machine_->cpu().registers, cpu.registers);
+  EXPECT_EQ(machine_->cpu().apsr, cpu.apsr);
+  EXPECT_EQ(machine_->retired(), retired);
+}
+
+TEST_F(MachineTest, DropsBlocksOfWrittenCode) {
+  // the loop patches its first instruction once it has linked to itself
+  ASSERT_EQ(run("mov r3, #0\n"
+                "ldr r1, =0xE2833002\n"
+                "adr r2, loop\n"
+                "mov r4, #3\n"
+                "loop: add r3, r3, #1\n"
+                "str r1, [r2]\n"
+                "subs r4, r4, #1\n"
+                "bne loop\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R3), 5u);
+}
+
+TEST_F(MachineTest, ComputesFlagsWhenRead) {
+  ASSERT_EQ(run("mvn r0, #0\n"
+                "adds r1, r0, #2\n"
+                "adc r2, r1, #0\n"
+                "adds r3, r0, r0\n"
+                "lsrs r4, r1, #1\n"
+                "rrx r5, r4\n"
+                "cmp r1, #2\n"
+                "movlt r6, #1\n"
+                "cmp r2, #1\n"
+                "mlas r7, r0, r0, r0\n"
+                "bx lr\n"),
+            Status::Halted);
+  EXPECT_EQ(reg(Register::R2), 2u);
+  // the rotate reads the carry out of the shift before it
+  EXPECT_EQ(reg(Register::R5), 0x80000000u);
+  EXPECT_EQ(reg(Register::R6), 1u);
+  // the multiply sets N and Z and keeps C and V from cmp
+  EXPECT_EQ(machine_->cpu().apsr, std::uint32_t{FlagZ | FlagC});
+}
+
+TEST(LazyFlagsTest, MatchesEagerFlags) {
+  static constexpr std::uint32_t values[] = {0,          1,          0x7FFFFFFF,
+                                             0x80000000, 0xFFFFFFFF, 0x1234};
+  for (const auto x : values) {
+    for (const auto y : values) {
+      for (auto carry = 0u; carry < 2; ++carry) {
+        auto flags = LazyFlags{FlagV};
+        flags.add(x, y, carry);
+        const auto expected = add_with_carry(x, y, carry).second;
+        EXPECT_EQ(flags.apsr(), expected);
+        EXPECT_EQ(flags.carry(), (expected >> carry_shift) & 1u);
+        // a logical operation keeps V from the addition
+        flags.logical(x & y, carry);
+        EXPECT_EQ(flags.apsr(), logical_flags(x & y, carry, expected));
+      }
+    }
+  }
+}
+
+TEST_F(MachineTest, TransfersBlocksInEveryMode) {
+  static constexpr auto source = "mov r0, #1\n"
+                                 "mov r1, #2\n"
+                                 "mov r2, #3\n"
+                                 "mov r3, #4\n"
+                                 "ldr r4, =0x12000\n"
+                                 "stmia r4, {r0-r1, r3}\n"
+                                 "add r5, r4, #16\n"
+                                 "stmib r5!, {r0, r2-r3}\n"
+                                 "add r6, r4, #48\n"
+                                 "stmda r6, {r1-r3}\n"
+                                 "stmdb r6!, {r0, r3}\n"
+                                 "ldmia r4, {r7-r9}\n"
+                                 "ldmdb r5, {r10-r11}\n"
+                                 "ldmib r6, {r12}\n"
+                                 "ldmda r5!, {r0-r2}\n"
+                                 "bx lr\n";
+  for (const auto step : {false, true}) {
+    ASSERT_EQ(run(source, step), Status::Halted);
+    EXPECT_EQ(memory_.load<std::uint32_t>(0x12008), 4u);
+    EXPECT_EQ(memory_.load<std::uint32_t>(0x12018), 3u);
+    EXPECT_EQ(memory_.load<std::uint32_t>(0x12030), 4u);
+    EXPECT_EQ(reg(Register::R7), 1u);
+    EXPECT_EQ(reg(Register::R8), 2u);
+    EXPECT_EQ(reg(Register::R9), 4u);
+    EXPECT_EQ(reg(Register::R10), 1u);
+    EXPECT_EQ(reg(Register::R11), 3u);
+    EXPECT_EQ(reg(Register::R12), 4u);
+    EXPECT_EQ(reg(Register::R0), 1u);
+    EXPECT_EQ(reg(Register::R1), 3u);
+    EXPECT_EQ(reg(Register::R2), 4u);
+    EXPECT_EQ(reg(Register::R5), 0x12010u);
+    EXPECT_EQ(reg(Register::R6), 0x12028u);
+  }
+}
+
+TEST_F(MachineTest, RestoresSnapshots) {
+  static constexpr auto source = "push {r4, lr}\n"
+                                 "ldr r1, =0x12000\n"
+                                 "mov r4, #100\n"
+                                 "loop: ldr r2, [r1]\n"
+                                 "add r2, r2, #1\n"
+                                 "str r2, [r1]\n"
+                                 "subs r4, r4, #1\n"
+                                 "bne loop\n"
+                                 "mov r0, r2\n"
+                                 "pop {r4, pc}\n";
+  tiering_.background = false;
+  ASSERT_TRUE(load(source));
+  // compiled code marks the pages it stores to as well
+  machine_->set_jit(true);
+  machine_->snapshot();
+
+  for (auto i = 0; i < 3; ++i) {
+    ASSERT_EQ(machine_->run(), Status::Halted);
+    EXPECT_EQ(reg(Register::R0), 100u);
+    // the counter and the stack
+    EXPECT_EQ(machine_->restore(), 2u);
+    EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 0u);
+    EXPECT_EQ(memory_.load<std::uint32_t>(memory_base + memory_size - 4), 0u);
+    EXPECT_EQ(reg(Register::PC), memory_base);
+    EXPECT_EQ(reg(Register::R4), 0u);
+    EXPECT_EQ(machine_->retired(), 0u);
+  }
+  // restoring again has nothing to copy
+  EXPECT_EQ(machine_->restore(), 0u);
+  EXPECT_EQ(machine_->code_cache().decoded_pages(), 1u);
+  if (Jit::available) {
+    EXPECT_GT(machine_->jit().compiled_blocks(), 0u);
+  }
+}
+
+TEST_F(MachineTest, PreemptsOnItsBudget) {
+  static constexpr auto source = "push {lr}\n"
+                                 "mov r0, #0\n"
+                                 "ldr r1, =10000\n"
+                                 "loop: add r0, r0, r1\n"
+                                 "subs r1, r1, #1\n"
+                                 "bne loop\n"
+                                 "pop {pc}\n";
+  static constexpr auto budget = std::uint64_t{1000};
+  tiering_.background = false;
+  ASSERT_TRUE(load(source));
+
+  // two guests time-sliced on this thread, one of them compiled
+  auto other_memory = Memory{memory_base, memory_size};
+  auto other = Machine{other_memory};
+  const auto machines = std::array<Machine *, 2>{machine_.get(), &other};
+  auto statuses = std::array<Status, 2>{};
+  other.set_jit(true);
+  for (auto *const machine : machines) {
+    machine->set_tiering(tiering_);
+    machine->set_budget(budget);
+    load(*machine);
+  }
+  auto slices = std::uint64_t{};
+  while (statuses[0] != Status::Halted || statuses[1] != Status::Halted) {
+    for (auto i = 0; i < 2; ++i) {
+      if (statuses[i] == Status::Halted) {
+        continue;
+      }
+      const auto before = machines[i]->retired();
+      statuses[i] = machines[i]->run();
+      ASSERT_TRUE(statuses[i] == Status::Preempted ||
+                  statuses[i] == Status::Halted);
+      if (statuses[i] == Status::Preempted) {
+        // stopped at the first block boundary past the budget
+        EXPECT_GE(machines[i]->retired() - before, budget);
+        EXPECT_LT(machines[i]->retired() - before, budget + 3);
+        ++slices;
+      }
+    }
+  }
+  auto retired = std::uint64_t{};
+  for (const auto *const machine : machines) {
+    EXPECT_EQ(machine->cpu().reg(Register::R0), 50005000u);
+    EXPECT_EQ(machine->retired(), 30004u);
+    retired += machine->retired();
+  }
+  // every slice but the last of each machine retired its budget and at most
+  // a block past it
+  EXPECT_LE(slices * budget, retired);
+  EXPECT_GE((slices + machines.size()) * (budget + 2), retired);
+  if (Jit::available) {
+    EXPECT_GT(other.jit().compiled_blocks(), 0u);
+  }
+
+  // bounds code that never ends
+  machine_->write(memory_base, "\xFE\xFF\xFF\xEA", 4); // b .
+  machine_->reset(memory_base);
+  EXPECT_EQ(machine_->run(), Status::Preempted);
+  EXPECT_EQ(reg(Register::PC), memory_base);
+}
+
+TEST_F(MachineTest, StopsAtBreakpoints) {
+  static constexpr auto source = "push {r4, lr}\n"
+                                 "mov r0, #0\n"
+                                 "mov r4, #10\n"
+                                 "loop: add r0, r0, r4\n"
+                                 "subs r4, r4, #1\n"
+                                 "bne loop\n"
+                                 "pop {r4, pc}\n";
+  tiering_.block_threshold = 1;
+  tiering_.jit_threshold = 2;
+  tiering_.background = false;
+  ASSERT_TRUE(load(source));
+  machine_->set_jit(true);
+  // run once first, so that the loop is compiled
+  ASSERT_EQ(machine_->run(), Status::Halted);
+  const auto decoded = machine_->code_cache().decoded_pages();
+
+  EXPECT_FALSE(machine_->add_breakpoint(memory_base + 2));
+  EXPECT_FALSE(machine_->add_breakpoint(memory_base + memory_size));
+  const auto subs = memory_base + 16;
+  ASSERT_TRUE(machine_->add_breakpoint(subs));
+  EXPECT_EQ(machine_->code_cache().decoded_pages(), decoded + 1);
+  machine_->reset(memory_base);
+  ASSERT_EQ(machine_->run(), Status::Breakpoint);
+  EXPECT_EQ(reg(Register::PC), subs);
+  EXPECT_EQ(reg(Register::R0), 10u);
+  EXPECT_EQ(reg(Register::R4), 10u);
+  EXPECT_EQ(machine_->retired(), 4u);
+
+  // every run carries on over the breakpoint it stopped at
+  auto stops = 1;
+  auto status = Status::Running;
+  while ((status = machine_->run()) == Status::Breakpoint) {
+    EXPECT_EQ(reg(Register::PC), subs);
+    ++stops;
+  }
+  EXPECT_EQ(status, Status::Halted);
+  EXPECT_EQ(stops, 10);
+  EXPECT_EQ(reg(Register::R0), 55u);
+
+  // and so does stepping
+  machine_->reset(memory_base + 12);
+  EXPECT_EQ(machine_->step(), Status::Running);
+  EXPECT_EQ(machine_->step(), Status::Breakpoint);
+  EXPECT_EQ(reg(Register::PC), subs);
+  EXPECT_EQ(machine_->step(), Status::Running);
+  EXPECT_EQ(reg(Register::PC), subs + 4);
+
+  machine_->remove_breakpoint(subs);
+  EXPECT_TRUE(machine_->breakpoints().empty());
+  machine_->reset(memory_base);
+  EXPECT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(reg(Register::R0), 55u);
+}
+
+TEST_F(MachineTest, StopsAtWatchpoints) {
+  static constexpr auto source = "ldr r1, =0x12000\n"
+                                 "mov r2, #5\n"
+                                 "str r2, [r1, #4]!\n"
+                                 "ldr r3, [r1]\n"
+                                 "add r3, r3, #1\n"
+                                 "str r3, [r1, #8]\n"
+                                 "push {r3}\n"
+                                 "pop {r3}\n"
+                                 "bx lr\n";
+  ASSERT_EQ(run(source), Status::Halted);
+  EXPECT_TRUE(machine_->set_jit(true) || !Jit::available);
+
+  EXPECT_FALSE(machine_->add_watchpoint({0x12004, 0, Watchpoint::Stores}));
+  ASSERT_TRUE(machine_->add_watchpoint({0x12004, 4, Watchpoint::Stores}));
+  // compiled code leaves the watched pages to the interpreter
+  EXPECT_TRUE(machine_->jit_enabled() || !Jit::available);
+  memory_.store<std::uint32_t>(0x12004, 0);
+  machine_->reset(memory_base);
+  ASSERT_EQ(machine_->run(), Status::Watchpoint);
+  // stopped before the store and its writeback
+  EXPECT_EQ(reg(Register::PC), memory_base + 8);
+  EXPECT_EQ(machine_->fault_address(), 0x12004u);
+  EXPECT_EQ(reg(Register::R1), 0x12000u);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12004), 0u);
+  // the load and the store to 0x1200C share its page
+  ASSERT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(reg(Register::R1), 0x12004u);
+  EXPECT_EQ(reg(Register::R3), 6u);
+
+  ASSERT_TRUE(machine_->add_watchpoint({0x12000, 8, Watchpoint::Loads}));
+  // push {r3} watched as a block transfer
+  ASSERT_TRUE(machine_->add_watchpoint(
+      {memory_base + memory_size - 8, 6, Watchpoint::Stores}));
+  machine_->reset(memory_base);
+  EXPECT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(reg(Register::PC), memory_base + 8);
+  EXPECT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(reg(Register::PC), memory_base + 12);
+  EXPECT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(reg(Register::PC), memory_base + 24);
+  EXPECT_EQ(machine_->fault_address(), memory_base + memory_size - 4);
+  EXPECT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(reg(Register::R3), 6u);
+
+  machine_->remove_watchpoint(0x12004, 4);
+  machine_->remove_watchpoint(0x12000, 8);
+  machine_->remove_watchpoint(memory_base + memory_size - 8, 6);
+  EXPECT_TRUE(machine_->watchpoints().empty());
+  EXPECT_TRUE(machine_->set_jit(true) || !Jit::available);
+  machine_->reset(memory_base);
+  EXPECT_EQ(machine_->run(), Status::Halted);
+}
+
+TEST_F(MachineTest, StopsAtWatchpointsInCompiledCode) {
+  static constexpr auto source = "ldr r1, =0x12000\n"
+                                 "mov r4, #100\n"
+                                 "loop: ldr r0, [r1]\n"
+                                 "add r0, r0, #1\n"
+                                 "str r0, [r1]\n"
+                                 "subs r4, r4, #1\n"
+                                 "bne loop\n"
+                                 "bx lr\n";
+  tiering_.block_threshold = 1;
+  tiering_.jit_threshold = 2;
+  tiering_.background = false;
+  ASSERT_TRUE(load(source));
+  machine_->set_jit(true);
+  ASSERT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 100u);
+  if (Jit::available) {
+    EXPECT_GT(machine_->jit().compiled_blocks(), 0u);
+  }
+
+  // the jit stays on, and only accesses to the watched page stop
+  ASSERT_TRUE(machine_->add_watchpoint({0x13000, 4, Watchpoint::Stores}));
+  EXPECT_TRUE(machine_->jit_enabled() || !Jit::available);
+  machine_->reset(memory_base);
+  ASSERT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 200u);
+
+  ASSERT_TRUE(machine_->add_watchpoint({0x12000, 4, Watchpoint::Stores}));
+  machine_->reset(memory_base);
+  ASSERT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(reg(Register::PC), memory_base + 16);
+  EXPECT_EQ(reg(Register::R0), 201u);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 200u);
+  ASSERT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 201u);
+  EXPECT_EQ(reg(Register::R4), 99u);
+
+  machine_->remove_watchpoint(0x12000, 4);
+  ASSERT_TRUE(machine_->add_watchpoint({0x12000, 4, Watchpoint::Loads}));
+  ASSERT_EQ(machine_->run(), Status::Watchpoint);
+  EXPECT_EQ(reg(Register::PC), memory_base + 8);
+  EXPECT_EQ(reg(Register::R4), 98u);
+
+  // and it is back on once nothing is checked
+  machine_->remove_watchpoint(0x12000, 4);
+  machine_->remove_watchpoint(0x13000, 4);
+  EXPECT_TRUE(machine_->watchpoints().empty());
+  EXPECT_TRUE(machine_->jit_enabled() || !Jit::available);
+  ASSERT_EQ(machine_->run(), Status::Halted);
+  EXPECT_EQ(memory_.load<std::uint32_t>(0x12000), 300u);
+}
+
+TEST_F(MachineTest, StopsOnFaults) {
+  EXPECT_EQ(run("mov r1, #0\n"
+                "ldr r0, [r1, #4]\n"),
+            Status::MemoryFault);
+  EXPECT_EQ(machine_->fault_address(), 4u);
+  EXPECT_EQ(reg(Register::PC), memory_base + 4);
+  EXPECT_EQ(machine_->retired(), 1u);
+
+  // the base is only written back once the access is done
+  EXPECT_EQ(run("ldr r0, =0x20000\n"
+                "ldr r1, [r0], #16\n"),
+            Status::MemoryFault);
+  EXPECT_EQ(reg(Register::R0), 0x20000u);
+  EXPECT_EQ(run("ldr r0, =0x20000\n"
+                "str r1, [r0, #16]!\n"),
+            Status::MemoryFault);
+  EXPECT_EQ(reg(Register::R0), 0x20000u);
+  // and compiled code stopping at a fault hands the access back whole
+  tiering_.block_threshold = 1;
+  tiering_.jit_threshold = 2;
+  tiering_.background = false;
+  ASSERT_TRUE(load("ldr r0, =0x13F00\n"
+                   "loop: ldr r1, [r0], #4\n"
+                   "b loop\n"));
+  machine_->set_jit(true);
+  EXPECT_EQ(machine_->run(), Status::MemoryFault);
+  EXPECT_EQ(machine_->fault_address(), memory_base + memory_size);
+  EXPECT_EQ(reg(Register::R0), memory_base + memory_size);
+  if (Jit::available) {
+    EXPECT_GT(machine_->jit().compiled_blocks(), 0u);
+  }
+
+  EXPECT_EQ(run("mov r0, #2\n"
+                "bx r0\n"),
+            Status::BadBranch);
+  EXPECT_EQ(run("ldr r0, =0x20000\n"
+                "bx r0\n"),
+            Status::BadBranch);
+  // udf
+  EXPECT_EQ(run("ldr r0, =0xE7F000F0\n"
+                "adr r1, undefined\n"
+                "str r0, [r1]\n"
+                "undefined: bx lr\n"),
+            Status::Unsupported);
+  EXPECT_EQ(reg(Register::PC), memory_base + 12);
+}
+
+TEST(CodeCacheTest, ResolvesOperands) {
+  // mov r0, r1
+  const auto move = predecode(0xE1A00001, 0x1000);
+  EXPECT_EQ(move.operand, MicroOp::Register);
+  EXPECT_EQ(move.rm, 1u);
+  // mov r0, #0xFF000000
+  const auto rotated = predecode(0xE3A004FF, 0x1000);
+  EXPECT_EQ(rotated.operand, MicroOp::RotatedImmediate);
+  EXPECT_EQ(rotated.imm, 0xFF000000u);
+  // b . branches to itself
+  const auto branch = predecode(0xEAFFFFFE, 0x1000);
+  EXPECT_EQ(branch.imm, 0x1000u);
+  EXPECT_NE(branch.flags & MicroOp::WritesPc, 0);
+  // pop {r4, pc}
+  const auto pop = predecode(0xE8BD8010, 0x1000);
+  EXPECT_EQ(pop.lsb, 2u);
+  EXPECT_NE(pop.flags & MicroOp::WritesPc, 0);
+  // pop {r4}
+  EXPECT_EQ(predecode(0xE8BD0010, 0x1000).flags & MicroOp::WritesPc, 0);
+}
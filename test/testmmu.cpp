@@ -0,0 +1,175 @@
+#include "assembler.h"
+#include "lexer.h"
+#include "machine.h"
+#include "mmu.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+
+// records what is written to it and reads back offset plus size
+class TestDevice : public Device {
+public:
+  std::uint32_t read(std::uint32_t offset, std::uint32_t size) override {
+    ++reads;
+    return offset + size;
+  }
+  void write(std::uint32_t offset, std::uint32_t value,
+             std::uint32_t size) override {
+    writes.push_back({offset, value, size});
+  }
+
+  struct Write {
+    std::uint32_t offset;
+    std::uint32_t value;
+    std::uint32_t size;
+  };
+  std::vector<Write> writes{};
+  int reads{};
+};
+
+class MmuTest : public ::testing::Test {
+protected:
+  static constexpr auto page = Mmu::page_size;
+
+  std::vector<std::uint8_t> host_ = std::vector<std::uint8_t>(page * 4);
+  Mmu mmu_{};
+};
+
+TEST_F(MmuTest, HitsOnceThePageIsCached) {
+  ASSERT_TRUE(
+      mmu_.map(0x10000, page * 2, host_.data(), Mmu::Read | Mmu::Write));
+  ASSERT_TRUE(mmu_.store<std::uint32_t>(0x10004, 0x12345678));
+  EXPECT_EQ(mmu_.misses(), 1u);
+  EXPECT_EQ(host_[4], 0x78);
+  EXPECT_EQ(host_[7], 0x12);
+
+  auto word = std::uint32_t{};
+  ASSERT_TRUE(mmu_.load(0x10004, word));
+  EXPECT_EQ(word, 0x12345678u);
+  auto half = std::int16_t{};
+  ASSERT_TRUE(mmu_.load(0x10006, half));
+  EXPECT_EQ(half, 0x1234);
+  EXPECT_EQ(mmu_.hits(), 2u);
+  EXPECT_EQ(mmu_.misses(), 1u);
+
+  // the next page has an entry of its own
+  ASSERT_TRUE(mmu_.store<std::uint8_t>(0x11000, 0xAB));
+  EXPECT_EQ(host_[page], 0xAB);
+  EXPECT_EQ(mmu_.misses(), 2u);
+}
+
+TEST_F(MmuTest, EvictsPagesThatShareAnEntry) {
+  const auto apart = static_cast<std::uint32_t>(page * Mmu::tlb_entries);
+  ASSERT_TRUE(mmu_.map(0, page, host_.data(), Mmu::Read));
+  ASSERT_TRUE(mmu_.map(apart, page, host_.data() + page, Mmu::Read));
+  host_[0] = 1;
+  host_[page] = 2;
+
+  auto byte = std::uint8_t{};
+  for (auto i = 0; i < 2; ++i) {
+    ASSERT_TRUE(mmu_.load(0, byte));
+    EXPECT_EQ(byte, 1);
+    ASSERT_TRUE(mmu_.load(apart, byte));
+    EXPECT_EQ(byte, 2);
+  }
+  EXPECT_EQ(mmu_.hits(), 0u);
+  EXPECT_EQ(mmu_.misses(), 4u);
+}
+
+TEST_F(MmuTest, KeepsToPermissions) {
+  ASSERT_TRUE(mmu_.map(0x20000, page, host_.data(), Mmu::Read));
+  ASSERT_TRUE(mmu_.map(0x21000, page, host_.data() + page, Mmu::Write));
+  auto word = std::uint32_t{};
+  EXPECT_TRUE(mmu_.load(0x20000, word));
+  EXPECT_FALSE(mmu_.store<std::uint32_t>(0x20000, 1));
+  EXPECT_TRUE(mmu_.store<std::uint32_t>(0x21000, 1));
+  EXPECT_FALSE(mmu_.load(0x21000, word));
+  EXPECT_FALSE(mmu_.load(0x22000, word));
+
+  // a cached page is dropped along with its mapping
+  EXPECT_FALSE(mmu_.map(0x20800, page, host_.data(), Mmu::Read));
+  mmu_.unmap(0x20000, page);
+  EXPECT_FALSE(mmu_.load(0x20000, word));
+}
+
+TEST_F(MmuTest, SplitsAccessesAcrossPages) {
+  ASSERT_TRUE(mmu_.map(0x30000, page, host_.data(), Mmu::Read | Mmu::Write));
+  ASSERT_TRUE(mmu_.map(0x31000, page, host_.data() + page * 3,
+                       Mmu::Read | Mmu::Write));
+  ASSERT_TRUE(mmu_.store<std::uint32_t>(0x30FFE, 0x12345678));
+  EXPECT_EQ(host_[page - 1], 0x56);
+  EXPECT_EQ(host_[page * 3], 0x34);
+  auto word = std::uint32_t{};
+  ASSERT_TRUE(mmu_.load(0x30FFE, word));
+  EXPECT_EQ(word, 0x12345678u);
+
+  // nothing is written unless both pages take it
+  EXPECT_FALSE(mmu_.store<std::uint32_t>(0x31FFE, 0xFFFFFFFF));
+  EXPECT_EQ(host_[page * 4 - 1], 0);
+}
+
+TEST_F(MmuTest, PassesDeviceAccessesThrough) {
+  auto device = TestDevice{};
+  ASSERT_TRUE(mmu_.map_device(0x40000000, page * 2, device));
+  ASSERT_TRUE(mmu_.store<std::uint16_t>(0x40001010, 0xBEEF));
+  ASSERT_EQ(device.writes.size(), 1u);
+  EXPECT_EQ(device.writes[0].offset, page + 0x10);
+  EXPECT_EQ(device.writes[0].value, 0xBEEFu);
+  EXPECT_EQ(device.writes[0].size, 2u);
+
+  // every access reaches the device
+  auto word = std::uint32_t{};
+  for (auto i = 0; i < 3; ++i) {
+    ASSERT_TRUE(mmu_.load(0x40000008, word));
+    EXPECT_EQ(word, 12u);
+  }
+  EXPECT_EQ(device.reads, 3);
+  EXPECT_EQ(mmu_.hits(), 0u);
+}
+
+TEST_F(MmuTest, RunsMachinesThroughIt) {
+  static constexpr auto program = "ldr r1, =0x40000000\n"
+                                  "mov r2, #65\n"
+                                  "strb r2, [r1, #4]\n"
+                                  "ldr r0, [r1, #8]\n"
+                                  "ldr r1, =0x20000\n"
+                                  "ldr r3, [r1]\n"
+                                  "str r0, [r1], #4\n"
+                                  "bx lr\n";
+  auto buffer = Charbuffer{std::string_view{program}};
+  auto lexer = parser::Lexer{buffer};
+  auto assembler = Assembler{lexer};
+  ASSERT_TRUE(assembler.assemble());
+  const auto &code = assembler.code();
+
+  auto memory = Memory{0x10000, page * 4};
+  auto device = TestDevice{};
+  ASSERT_TRUE(mmu_.map(memory, Mmu::Read | Mmu::Write));
+  ASSERT_TRUE(mmu_.map_device(0x40000000, page, device));
+  ASSERT_TRUE(mmu_.map(0x20000, page, host_.data(), Mmu::Read));
+  host_[0] = 7;
+
+  auto machine = Machine{memory};
+  machine.set_jit(true);
+  machine.set_mmu(&mmu_);
+  EXPECT_FALSE(machine.jit_enabled());
+  machine.write(memory.base(), code.data(),
+                static_cast<std::uint32_t>(code.size() * 4));
+  machine.reset(memory.base());
+  EXPECT_EQ(machine.run(), Status::MemoryFault);
+  EXPECT_EQ(machine.fault_address(), 0x20000u);
+  // the store is read-only, and leaves the base alone
+  EXPECT_EQ(machine.cpu().reg(Register::R1), 0x20000u);
+  EXPECT_EQ(machine.cpu().reg(Register::R0), 12u);
+  EXPECT_EQ(machine.cpu().reg(Register::R3), 7u);
+  ASSERT_EQ(device.writes.size(), 1u);
+  EXPECT_EQ(device.writes[0].offset, 4u);
+  EXPECT_EQ(device.writes[0].value, 65u);
+  EXPECT_EQ(host_[0], 7);
+}
@@ -170,6 +170,7 @@ TEST(ParserTest, CanParseBlockMemoryInstruction) {
   EXPECT_EQ(instr.register_list().size(), 2);
   EXPECT_EQ(instr.register_list()[0], ir::Register::R1);
   EXPECT_EQ(instr.register_list()[1], ir::Register::R2);
+  EXPECT_EQ(instr.register_mask(), 0b110u);
 }
 
 TEST(ParserTest, CanParseConditionSuffix) {
@@ -342,3 +343,52 @@ TEST(ParserTest, CanParseMultiplyAccumulateWithConditionInstruction) {
   EXPECT_FALSE(instr.updatesflags());
   EXPECT_EQ(instr.condition(), ir::Condition::AL);
 }
+
+TEST(ParserTest, CanParseCompareAndBranchInstruction) {
+  const auto text = "cbnz r3, loop"_tb;
+  auto lexer = parser::Lexer{text};
+  // labels are owned by the parser
+  auto parser = Parser{lexer};
+  const auto parsed = parser.parse_instruction();
+  ASSERT_NE(parsed.get(), nullptr);
+  const auto &instr = *ir::cast<ir::BranchInstruction>(parsed.get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Cbnz);
+  EXPECT_EQ(instr.rn(), ir::Register::R3);
+  ASSERT_NE(instr.label(), nullptr);
+  EXPECT_EQ(instr.label()->name(), "loop"sv);
+}
+
+TEST(ParserTest, CanParseSystemInstruction) {
+  // vc is also a condition suffix
+  const auto text = "svcvc #0x80"_tb;
+  auto lexer = parser::Lexer{text};
+  const auto parsed = Parser{lexer}.parse_instruction();
+  ASSERT_NE(parsed.get(), nullptr);
+  const auto &instr = *ir::cast<ir::SystemInstruction>(parsed.get());
+  EXPECT_EQ(instr.operation(), ir::Instruction::Svc);
+  EXPECT_EQ(instr.condition(), ir::Condition::VC);
+  EXPECT_EQ(instr.imm24(), 0x80u);
+}
+
+TEST(ParserTest, CanParseModule) {
+  const auto text = "start: mov r0, #1\n"
+                    "\n"
+                    "b start\n"
+                    "end:\n"_tb;
+  auto lexer = parser::Lexer{text};
+  auto parser = Parser{lexer};
+  const auto module = parser.parse_module();
+  ASSERT_TRUE(module.has_value());
+  EXPECT_EQ(module->size(), 2u);
+  ASSERT_EQ(parser.labels().size(), 2u);
+  EXPECT_EQ(module->label_index(parser.labels()[0]), 0u);
+  // labels at the end of the input refer to the end of the module
+  EXPECT_EQ(module->label_index(parser.labels()[1]), 2u);
+}
+
+TEST(ParserTest, CannotParseModuleWithRedefinedLabel) {
+  const auto text = "loop: mov r0, #1\n"
+                    "loop: b loop\n"_tb;
+  auto lexer = parser::Lexer{text};
+  EXPECT_FALSE(Parser{lexer}.parse_module().has_value());
+}
@@ -0,0 +1,86 @@
+#include "assembler.h"
+#include "lexer.h"
+#include "machinetest.h"
+#include "profiler.h"
+#include "textbuffer.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class ProfilerTest : public ::testing::Test {
+protected:
+  // the label names point into buffer_, which outlives the report
+  static constexpr auto program = "main: push {r4, lr}\n"
+                                  "mov r0, #0\n"
+                                  "mov r4, #100\n"
+                                  "loop: bl mix\n"
+                                  "subs r4, r4, #1\n"
+                                  "bne loop\n"
+                                  "pop {r4, pc}\n"
+                                  "mix: add r0, r0, r4\n"
+                                  "eor r0, r0, r0, lsl #1\n"
+                                  "ldr r1, [sp]\n"
+                                  "add r0, r0, r1\n"
+                                  "bx lr\n";
+
+  void SetUp() override {
+    ASSERT_TRUE(assembler_.assemble());
+    load_code(machine_, assembler_.code());
+  }
+
+  Charbuffer buffer_{std::string_view{program}};
+  parser::Lexer lexer_{buffer_};
+  Assembler assembler_{lexer_};
+  Memory memory_{memory_base, memory_size};
+  Machine machine_{memory_};
+};
+
+TEST_F(ProfilerTest, CountsBlocksPerLabel) {
+  machine_.set_profiling(true);
+  ASSERT_EQ(machine_.run(), Status::Halted);
+
+  const auto spots = hotspots(machine_.profile(),
+                              label_regions(assembler_, memory_base));
+  ASSERT_EQ(spots.size(), 3u);
+  EXPECT_EQ(spots[0].region.name, "mix");
+  EXPECT_EQ(spots[0].region.address, memory_base + 28);
+  EXPECT_EQ(spots[0].entries, 100u);
+  EXPECT_EQ(spots[0].instructions, 500u);
+  // add, eor, ldr, add and bx
+  EXPECT_EQ(spots[0].cycles, 100u * (1 + 1 + 3 + 1 + 3));
+  EXPECT_EQ(spots[1].region.name, "loop");
+  EXPECT_EQ(spots[1].entries, 200u);
+  EXPECT_EQ(spots[1].instructions, 300u);
+  EXPECT_EQ(spots[2].region.name, "main");
+  EXPECT_EQ(spots[2].instructions, 4u);
+  auto total = std::uint64_t{};
+  for (const auto &spot : spots) {
+    total += spot.instructions;
+  }
+  EXPECT_EQ(total, machine_.retired());
+
+  auto *const file = std::tmpfile();
+  ASSERT_NE(file, nullptr);
+  print_hotspots(file, spots);
+  std::rewind(file);
+  auto report = std::string(4096, '\0');
+  report.resize(std::fread(report.data(), 1, report.size(), file));
+  std::fclose(file);
+  EXPECT_NE(report.find("mix (0001001c)"), std::string::npos);
+  EXPECT_LT(report.find("mix"), report.find("loop"));
+
+  machine_.clear_profile();
+  EXPECT_TRUE(hotspots(machine_.profile(), {}).empty());
+}
+
+TEST_F(ProfilerTest, CountsNothingWhenOff) {
+  ASSERT_EQ(machine_.run(), Status::Halted);
+  EXPECT_TRUE(machine_.profile().blocks().empty());
+}
@@ -0,0 +1,90 @@
+#include "relaxer.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::assembler;
+using ::testing::ElementsAre;
+
+static auto relaxed(std::uint32_t word, FixupKind kind, std::int32_t distance)
+    -> std::vector<std::uint32_t> {
+  const auto size = relaxed_size(word, kind, distance);
+  if (!size) {
+    ADD_FAILURE() << "expected a relaxed sequence";
+    return {};
+  }
+  auto words = std::vector<std::uint32_t>(*size);
+  emit_relaxed(word, kind, distance, *size, words.data());
+  return words;
+}
+
+TEST(RelaxerTest, KeepsShortForms) {
+  EXPECT_EQ(relaxed_size(0xEA000000u, FixupKind::Branch, 0x100), 1u);
+  EXPECT_EQ(relaxed_size(0xE28F0000u, FixupKind::Adr, -0x100), 1u);
+  EXPECT_EQ(relaxed_size(0xE59F0000u, FixupKind::Load12, 0x1000), 1u);
+  EXPECT_THAT(relaxed(0xEA000000u, FixupKind::Branch, 0),
+              ElementsAre(0xEAFFFFFEu));
+}
+
+TEST(RelaxerTest, RelaxesFarBranches) {
+  EXPECT_THAT(relaxed(0xEA000000u, FixupKind::Branch, 0x04000008),
+              ElementsAre(0xE28FF301u));
+  EXPECT_THAT(relaxed(0x0B000000u, FixupKind::Branch, 0x0400000C),
+              ElementsAre(0x028FE000u, 0x028FF301u));
+  EXPECT_THAT(relaxed(0xEB000000u, FixupKind::Branch, 0x02345684),
+              ElementsAre(0xE28FE008u, 0xE28FCF9Eu, 0xE28CCB15u, 0xE28CF78Du));
+  EXPECT_THAT(relaxed(0xEA000000u, FixupKind::Branch, -0x03FFFFF8),
+              ElementsAre(0xE24FF301u));
+}
+
+TEST(RelaxerTest, RelaxesFarAddressesAndLoads) {
+  EXPECT_THAT(relaxed(0xE28F0000u, FixupKind::Adr, 0x4B4),
+              ElementsAre(0xE28F00ACu, 0xE2800B01u));
+  EXPECT_THAT(relaxed(0xE59F0000u, FixupKind::Load12, 0x1138),
+              ElementsAre(0xE28F0A01u, 0xE5900130u));
+  EXPECT_THAT(relaxed(0xE59F0000u, FixupKind::Load12, -0x1128),
+              ElementsAre(0xE24F0A01u, 0xE5100130u));
+  EXPECT_THAT(relaxed(0xE1DF00B0u, FixupKind::Load8, 0x108),
+              ElementsAre(0xE28F0C01u, 0xE1D000B0u));
+}
+
+TEST(RelaxerTest, RejectsUnrelaxableReferences) {
+  EXPECT_FALSE(relaxed_size(0xE58F0000u, FixupKind::Load12, 0x2000));
+  EXPECT_FALSE(relaxed_size(0xE59FF000u, FixupKind::Load12, 0x2000));
+  EXPECT_FALSE(relaxed_size(0xE28FF000u, FixupKind::Adr, 0x109));
+  // would need ip, which may be live across a plain branch
+  EXPECT_FALSE(relaxed_size(0xEA000000u, FixupKind::Branch, 0x02345680));
+}
+
+TEST(RelaxerTest, GrowsUntilStable) {
+  // the adr only goes out of range once the load behind it grows
+  auto code = std::vector<std::uint32_t>(0x503, 0xE1A00000u);
+  code[0] = 0xE28F1000u;
+  code[1] = 0xE59F0000u;
+  auto references = std::vector<Reference>{{0, FixupKind::Adr, 0x1408},
+                                           {4, FixupKind::Load12, 0x1408}};
+  auto relaxer = Relaxer{code, references};
+  ASSERT_TRUE(relaxer.relax());
+  EXPECT_EQ(code.size(), 0x505u);
+  EXPECT_EQ(relaxer.relocate(0), 0u);
+  EXPECT_EQ(relaxer.relocate(4), 8u);
+  EXPECT_EQ(relaxer.relocate(0x1408), 0x1410u);
+  EXPECT_EQ(references[1].offset, 8u);
+  EXPECT_EQ(references[1].target, 0x1410u);
+  EXPECT_THAT(std::vector<std::uint32_t>(code.begin(), code.begin() + 4),
+              ElementsAre(0xE28F1008u, 0xE2811B05u, 0xE28F0A01u, 0xE5900400u));
+}
+
+TEST(RelaxerTest, ReportsTheUnreachableReference) {
+  // the ldr pc only goes out of range once the load behind it grows
+  auto code = std::vector<std::uint32_t>(0x802, 0xE1A00000u);
+  code[0] = 0xE59FF000u;
+  code[1] = 0xE59F0000u;
+  auto references = std::vector<Reference>{{0, FixupKind::Load12, 0x1004},
+                                           {4, FixupKind::Load12, 0x2000}};
+  auto relaxer = Relaxer{code, references};
+  EXPECT_FALSE(relaxer.relax());
+  EXPECT_EQ(relaxer.unreachable(), 0u);
+}
@@ -0,0 +1,183 @@
+#include "machinetest.h"
+#include "trace.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class TraceTest : public ::testing::Test {
+protected:
+
+  void SetUp() override {
+    static constexpr auto program = "push {r4, lr}\n"
+                                    "mov r0, #0\n"
+                                    "mov r4, #100\n"
+                                    "loop: tst r4, #1\n"
+                                    "bleq even\n"
+                                    "add r0, r0, r4\n"
+                                    "subs r4, r4, #1\n"
+                                    "bne loop\n"
+                                    "pop {r4, pc}\n"
+                                    "even: ldr r1, [sp]\n"
+                                    "strb r0, [sp, #-4]\n"
+                                    "bx lr\n";
+    ASSERT_TRUE(assemble(program, code_));
+    path_ = ::testing::TempDir() + "testtrace.trace";
+  }
+
+  void load(Machine &machine) const { load_code(machine, code_); }
+
+  // what a trace holds, with its blocks spelled out an instruction at a time
+  struct Replay {
+    std::vector<std::uint32_t> instructions;
+    std::vector<TraceRecord> accesses;
+    std::size_t branches;
+    bool truncated;
+  };
+
+  static Replay replay(const std::string &path) {
+    auto replay = Replay{};
+    auto reader = TraceReader::open(path.c_str());
+    EXPECT_TRUE(reader.has_value());
+    if (!reader) {
+      return replay;
+    }
+    auto record = TraceRecord{};
+    while (reader->next(record)) {
+      if (record.kind != TraceRecord::Block) {
+        replay.accesses.push_back(record);
+        continue;
+      }
+      for (auto i = 0u; i < record.size; ++i) {
+        replay.instructions.push_back(record.address + i * 4);
+      }
+      replay.branches += record.branched ? 1 : 0;
+    }
+    replay.truncated = reader->truncated();
+    return replay;
+  }
+
+  // the same program stepped one instruction at a time, with its accesses
+  // traced to path
+  Replay step(const std::string &path) {
+    auto memory = Memory{memory_base, memory_size};
+    auto machine = Machine{memory};
+    load(machine);
+    auto stepped = Replay{};
+    {
+      auto trace = TraceWriter::open(path.c_str());
+      machine.set_trace(trace.get(), true);
+      for (;;) {
+        const auto pc = machine.cpu().reg(Register::PC);
+        if (machine.step() != Status::Running) {
+          break;
+        }
+        stepped.instructions.push_back(pc);
+      }
+    }
+    stepped.accesses = replay(path).accesses;
+    return stepped;
+  }
+
+  std::vector<std::uint32_t> code_{};
+  std::string path_{};
+};
+
+TEST_F(TraceTest, RebuildsTheInstructionStream) {
+  const auto stepped = step(path_ + ".step");
+  ASSERT_EQ(stepped.accesses.size(), 102u);
+
+  auto memory = Memory{memory_base, memory_size};
+  auto machine = Machine{memory};
+  load(machine);
+  auto trace = TraceWriter::open(path_.c_str());
+  ASSERT_NE(trace, nullptr);
+  machine.set_trace(trace.get(), true);
+  EXPECT_EQ(machine.trace(), trace.get());
+  EXPECT_FALSE(machine.set_jit(true));
+  ASSERT_EQ(machine.run(), Status::Halted);
+  EXPECT_EQ(machine.cpu().reg(Register::R0), 5050u);
+  ASSERT_TRUE(trace->flush());
+
+  const auto traced = replay(path_);
+  EXPECT_FALSE(traced.truncated);
+  EXPECT_EQ(traced.instructions.size(), machine.retired());
+  EXPECT_EQ(traced.instructions, stepped.instructions);
+  // into the program and the even calls, their returns and the loop
+  EXPECT_EQ(traced.branches, 1u + 50u + 50u + 99u);
+  ASSERT_EQ(traced.accesses.size(), stepped.accesses.size());
+  for (auto i = std::size_t{0}; i < traced.accesses.size(); ++i) {
+    EXPECT_EQ(traced.accesses[i].kind, stepped.accesses[i].kind);
+    EXPECT_EQ(traced.accesses[i].address, stepped.accesses[i].address);
+    EXPECT_EQ(traced.accesses[i].size, stepped.accesses[i].size);
+  }
+  // push, then a load and a byte store per even call, then pop
+  EXPECT_EQ(traced.accesses.front().kind, TraceRecord::Store);
+  EXPECT_EQ(traced.accesses.front().address, memory_base + memory_size - 8);
+  EXPECT_EQ(traced.accesses.front().size, 8u);
+  EXPECT_EQ(traced.accesses[2].kind, TraceRecord::Store);
+  EXPECT_EQ(traced.accesses[2].size, 1u);
+  EXPECT_EQ(traced.accesses.back().kind, TraceRecord::Load);
+}
+
+TEST_F(TraceTest, TracesCompiledBlocks) {
+  const auto stepped = step(path_ + ".step");
+
+  auto memory = Memory{memory_base, memory_size};
+  auto machine = Machine{memory};
+  auto tiering = Tiering{};
+  tiering.jit_threshold = 2;
+  tiering.background = false;
+  machine.set_tiering(tiering);
+  machine.set_jit(true);
+  load(machine);
+  {
+    // small enough to wrap around many times and fill up
+    auto trace = TraceWriter::open(path_.c_str(), 64);
+    machine.set_trace(trace.get());
+    ASSERT_EQ(machine.run(), Status::Halted);
+  }
+
+  const auto traced = replay(path_);
+  EXPECT_EQ(traced.instructions, stepped.instructions);
+  EXPECT_TRUE(traced.accesses.empty());
+}
+
+TEST_F(TraceTest, StopsAtACutShortRecord) {
+  auto memory = Memory{memory_base, memory_size};
+  auto machine = Machine{memory};
+  load(machine);
+  {
+    auto trace = TraceWriter::open(path_.c_str());
+    machine.set_trace(trace.get());
+    ASSERT_EQ(machine.run(), Status::Halted);
+  }
+
+  auto *file = std::fopen(path_.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  auto contents = std::string(1 << 16, '\0');
+  contents.resize(std::fread(contents.data(), 1, contents.size(), file));
+  std::fclose(file);
+  file = std::fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(contents.data(), 1, contents.size() - 1, file);
+  std::fclose(file);
+
+  const auto traced = replay(path_);
+  EXPECT_TRUE(traced.truncated);
+  EXPECT_LT(traced.instructions.size(), machine.retired());
+
+  // and is no trace at all without its header
+  file = std::fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(contents.data(), 1, 4, file);
+  std::fclose(file);
+  EXPECT_FALSE(TraceReader::open(path_.c_str()).has_value());
+}
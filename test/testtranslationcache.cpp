@@ -0,0 +1,128 @@
+#include "machinetest.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace aavm;
+using namespace aavm::ir;
+using namespace aavm::vm;
+using namespace aavm::test;
+
+class TranslationCacheTest : public ::testing::Test {
+protected:
+  static constexpr auto key = std::uint64_t{0x1234};
+
+  void SetUp() override {
+    static constexpr auto program = "push {r4, lr}\n"
+                                    "mov r0, #0\n"
+                                    "mov r4, #100\n"
+                                    "loop: tst r4, #1\n"
+                                    "bleq even\n"
+                                    "add r0, r0, r4\n"
+                                    "subs r4, r4, #1\n"
+                                    "bne loop\n"
+                                    "pop {r4, pc}\n"
+                                    "even: add r0, r0, #1\n"
+                                    "bx lr\n";
+    ASSERT_TRUE(assemble(program, code_));
+    path_ = ::testing::TempDir() + "testtranslationcache.cache";
+  }
+
+  // runs the program on a new machine, from the cache if there is one
+  std::unique_ptr<Machine> run(Memory &memory, bool cached,
+                               std::uint64_t cache_key = key) {
+    auto machine = std::make_unique<Machine>(memory);
+    auto tiering = Tiering{};
+    tiering.background = false;
+    machine->set_tiering(tiering);
+    machine->set_jit(true);
+    load_code(*machine, code_);
+    if (cached) {
+      loaded_ = machine->load_translations(path_.c_str(), cache_key);
+    }
+    EXPECT_EQ(machine->run(), Status::Halted);
+    EXPECT_EQ(machine->cpu().reg(Register::R0), 5050u + 50u);
+    return machine;
+  }
+
+  std::vector<std::uint32_t> code_{};
+  std::string path_{};
+  bool loaded_{};
+};
+
+TEST_F(TranslationCacheTest, StartsHot) {
+  auto memory = Memory{memory_base, memory_size};
+  const auto first = run(memory, false);
+  ASSERT_TRUE(first->save_translations(path_.c_str(), key));
+
+  auto again = Memory{memory_base, memory_size};
+  const auto second = run(again, true);
+  ASSERT_TRUE(loaded_);
+  EXPECT_EQ(second->code_cache().decoded_pages(), 0u);
+  EXPECT_EQ(second->block_cache().size(), first->block_cache().size());
+  EXPECT_EQ(second->retired(), first->retired());
+  if (Jit::available) {
+    EXPECT_GT(first->jit().compiled_blocks(), 0u);
+    EXPECT_EQ(second->jit().compiled_blocks(), 0u);
+    EXPECT_GT(second->jit().code_size(), 0u);
+  }
+}
+
+TEST_F(TranslationCacheTest, DecodesChangedCodeAgain) {
+  auto memory = Memory{memory_base, memory_size};
+  run(memory, false)->save_translations(path_.c_str(), key);
+
+  // the same program, moved up by a word
+  code_.insert(code_.begin(), 0xE1A00000);
+  auto again = Memory{memory_base, memory_size};
+  const auto second = run(again, true);
+  EXPECT_TRUE(loaded_);
+  EXPECT_EQ(second->code_cache().decoded_pages(), 1u);
+}
+
+TEST_F(TranslationCacheTest, KeepsToItsKeyAndMemory) {
+  auto memory = Memory{memory_base, memory_size};
+  run(memory, false)->save_translations(path_.c_str(), key);
+
+  auto other = Memory{memory_base, memory_size};
+  EXPECT_EQ(run(other, true, key + 1)->code_cache().decoded_pages(), 1u);
+  EXPECT_FALSE(loaded_);
+
+  auto larger = Memory{memory_base, memory_size * 2};
+  run(larger, true);
+  EXPECT_FALSE(loaded_);
+}
+
+TEST_F(TranslationCacheTest, RejectsDamagedFiles) {
+  auto memory = Memory{memory_base, memory_size};
+  run(memory, false)->save_translations(path_.c_str(), key);
+  const auto patch = [&](std::streamoff offset, auto update) {
+    auto file = std::fstream{path_, std::ios::binary | std::ios::in |
+                                        std::ios::out};
+    auto value = decltype(update(0)){};
+    file.seekg(offset);
+    file.read(reinterpret_cast<char *>(&value), sizeof(value));
+    value = update(value);
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+
+  // more blocks than the file holds, with a code size that wraps the end of
+  // the file back around to its size
+  static constexpr auto extra = std::uint32_t{0x10000};
+  patch(28, [](std::uint32_t count) { return count + extra; });
+  patch(32, [](std::uint64_t size) { return size - extra * 20; });
+  auto wrapped = Memory{memory_base, memory_size};
+  run(wrapped, true);
+  EXPECT_FALSE(loaded_);
+
+  // and contents that no longer match the checksum
+  run(memory, false)->save_translations(path_.c_str(), key);
+  patch(48, [](std::uint64_t word) { return ~word; });
+  auto changed = Memory{memory_base, memory_size};
+  run(changed, true);
+  EXPECT_FALSE(loaded_);
+}
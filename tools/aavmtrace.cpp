@@ -0,0 +1,94 @@
+#include "fmt/format.h"
+#include "image.h"
+#include "trace.h"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+using namespace aavm;
+
+// Prints the instructions a trace retired, rebuilt from the image of the
+// program it traced, with a mark on the first instruction of every block
+// branched to. The loads and stores a block made, if the trace has them,
+// follow its instructions.
+//
+// usage: aavmtrace <trace> <image>
+
+// the word at address in the segments of image, which code that wrote code
+// may have run something else from
+static std::optional<std::uint32_t> word_at(const image::Image &image,
+                                            std::uint32_t address) {
+  for (auto i = std::size_t{0}; i < image.segment_count(); ++i) {
+    const auto &segment = image.segments()[i];
+    const auto offset = address - segment.address;
+    if (address < segment.address || offset >= segment.memory_size ||
+        segment.memory_size - offset < 4) {
+      continue;
+    }
+    auto word = std::uint32_t{};
+    if (offset < segment.file_size) {
+      std::memcpy(&word, image.contents(segment) + offset, sizeof(word));
+    }
+    return word;
+  }
+  return std::nullopt;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fmt::print(stderr, "usage: {} <trace> <image>\n", argv[0]);
+    return 2;
+  }
+  auto trace = vm::TraceReader::open(argv[1]);
+  if (!trace) {
+    fmt::print(stderr, "{} is not a trace\n", argv[1]);
+    return 1;
+  }
+  const auto image = image::Image::open(argv[2]);
+  if (!image) {
+    fmt::print(stderr, "{} is not an image\n", argv[2]);
+    return 1;
+  }
+
+  auto blocks = std::uint64_t{};
+  auto instructions = std::uint64_t{};
+  auto branches = std::uint64_t{};
+  auto accesses = std::uint64_t{};
+  // recorded as they were made, before the block that made them
+  auto pending = std::vector<vm::TraceRecord>{};
+  auto record = vm::TraceRecord{};
+  while (trace->next(record)) {
+    if (record.kind != vm::TraceRecord::Block) {
+      pending.push_back(record);
+      continue;
+    }
+    ++blocks;
+    branches += record.branched ? 1 : 0;
+    for (auto i = 0u; i < record.size; ++i) {
+      const auto address = record.address + i * 4;
+      const auto mark = i == 0 && record.branched ? "->" : "  ";
+      if (const auto word = word_at(*image, address)) {
+        fmt::print("{} {:08x}  {:08x}\n", mark, address, *word);
+      } else {
+        fmt::print("{} {:08x}  ????????\n", mark, address);
+      }
+    }
+    instructions += record.size;
+    for (const auto &access : pending) {
+      fmt::print("             {} {:08x} {}\n",
+                 access.kind == vm::TraceRecord::Load ? "load " : "store",
+                 access.address, access.size);
+    }
+    accesses += pending.size();
+    pending.clear();
+  }
+
+  fmt::print("{} blocks, {} instructions, {} branches, {} accesses\n", blocks,
+             instructions, branches, accesses);
+  if (trace->truncated()) {
+    fmt::print(stderr, "{} stops in the middle of a record\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}